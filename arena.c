@@ -0,0 +1,95 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "libxsvf.h"
+
+/*
+ * Arena for the realloc() callback (see README). The library has at most
+ * one buffer per memory id at a time, so the arena has one slot per id,
+ * sized at the largest allocation recorded for that id in previous runs.
+ * Allocations that fit their slot are served without touching the heap.
+ * Larger ones (and ids without a slot) use the host's heap realloc().
+ */
+
+#define ARENA_ALIGN 16
+
+long libxsvf_arena_size(const struct libxsvf_arena *a)
+{
+	long size = 0;
+	int i;
+
+	for (i = 0; i < LIBXSVF_MEM_NUM; i++)
+		size += (a->maxsize[i] + ARENA_ALIGN-1) & ~(ARENA_ALIGN-1);
+	return size;
+}
+
+void libxsvf_arena_init(struct libxsvf_arena *a, void *base, long size)
+{
+	long used = 0;
+	int i;
+
+	a->base = base;
+	a->size = size;
+
+	for (i = 0; i < LIBXSVF_MEM_NUM; i++) {
+		long slot_size = (a->maxsize[i] + ARENA_ALIGN-1) & ~(ARENA_ALIGN-1);
+		if (!base || a->maxsize[i] == 0 || used + slot_size > size) {
+			a->slot[i] = -1;
+			a->slot_size[i] = 0;
+			continue;
+		}
+		a->slot[i] = used;
+		a->slot_size[i] = a->maxsize[i];
+		used += slot_size;
+	}
+}
+
+void *libxsvf_arena_realloc(struct libxsvf_arena *a, void *ptr, int size, enum libxsvf_mem which,
+		void *(*heap_realloc)(void *ptr, int size))
+{
+	unsigned char *slot = (void*)0;
+	int i;
+
+	if (size > a->maxsize[which])
+		a->maxsize[which] = size;
+
+	if (!ptr && size == 0)
+		return (void*)0;
+
+	if (a->base && a->slot[which] >= 0)
+		slot = (unsigned char*)a->base + a->slot[which];
+
+	if (slot && ptr == slot) {
+		if (size <= a->slot_size[which])
+			return size > 0 ? ptr : (void*)0;
+		unsigned char *p = heap_realloc((void*)0, size);
+		if (p) {
+			for (i = 0; i < a->slot_size[which]; i++)
+				p[i] = slot[i];
+		}
+		return p;
+	}
+
+	if (slot && !ptr && size > 0 && size <= a->slot_size[which])
+		return slot;
+
+	return heap_realloc(ptr, size);
+}
+
@@ -0,0 +1,102 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "libxsvf.h"
+
+/*
+ * Checkpoints for resuming interrupted runs (see README). The players count
+ * their commands and report a checkpoint at safe points (before an SIR) once
+ * 'interval' commands have been played since the last one. To resume, the
+ * players parse the file again from the start without touching the hardware
+ * until the command of the checkpoint is reached. So all parser state (END*
+ * states, HDR/HIR/TDR/TIR, XSDRSIZE, masks, ..) is restored as a side effect.
+ */
+
+void libxsvf_checkpoint_reset(struct libxsvf_host *h)
+{
+	struct libxsvf_checkpoint *cp = h->checkpoint;
+
+	if (!cp)
+		return;
+
+	cp->current = 0;
+	cp->last = 0;
+	cp->skipping = cp->resume && cp->command > 0;
+}
+
+int libxsvf_checkpoint_skip(struct libxsvf_host *h)
+{
+	return h->checkpoint && h->checkpoint->skipping;
+}
+
+int libxsvf_checkpoint_next(struct libxsvf_host *h)
+{
+	struct libxsvf_checkpoint *cp = h->checkpoint;
+
+	if (!cp)
+		return 0;
+
+	cp->current++;
+
+	if (!cp->skipping || cp->current < cp->command)
+		return 0;
+
+	cp->skipping = 0;
+	cp->last = cp->current;
+
+	LIBXSVF_HOST_REPORT_STATUS("Resuming at checkpoint.");
+
+	/* the TAP state is unknown after the interruption */
+	h->tap_state = LIBXSVF_TAP_INIT;
+	if (libxsvf_tap_walk(h, cp->tap_state) < 0)
+		return -1;
+
+	return 1;
+}
+
+int libxsvf_checkpoint_due(struct libxsvf_host *h)
+{
+	struct libxsvf_checkpoint *cp = h->checkpoint;
+
+	return cp && !cp->skipping && cp->interval > 0 && cp->current - cp->last >= cp->interval;
+}
+
+int libxsvf_checkpoint_boundary(struct libxsvf_host *h)
+{
+	struct libxsvf_checkpoint *cp = h->checkpoint;
+
+	if (!libxsvf_checkpoint_due(h))
+		return 0;
+
+	/* everything up to here must have been checked */
+	if (LIBXSVF_HOST_SYNC() != 0) {
+		libxsvf_report_mismatch(h);
+		return -1;
+	}
+	libxsvf_sync_reset(h);
+
+	cp->last = cp->current;
+	cp->command = cp->current;
+	cp->tap_state = h->tap_state;
+	LIBXSVF_HOST_REPORT_CHECKPOINT(cp);
+
+	return 0;
+}
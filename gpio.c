@@ -0,0 +1,190 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+/*
+ * Low-level GPIO I/O for the JTAG signals, shared by xsvftool-gpio and
+ * xsvftool-xvcd. Without a board define the functions do nothing and
+ * there is no TDO line (gpio_tdo() returns -1).
+ */
+
+#include "gpio.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+/** BEGIN: Low-Level I/O Implementation **/
+
+#ifdef XSVFTOOL_RLMS_VLINE
+
+// Simple example with MPC8349E GPIO pins
+// (RIEGL LMS V-Line motherboard)
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#define IO_PORT_ADDR 0xE0000C00
+
+struct io_layout {
+	unsigned long tdi:1;
+	unsigned long tdo:1;
+	unsigned long tms:1;
+	unsigned long tck:1;
+	unsigned long reserved:28;
+};
+
+static volatile struct io_layout *io_direction;
+static volatile struct io_layout *io_opendrain;
+static volatile struct io_layout *io_data;
+
+void gpio_setup(void)
+{
+	/* open /dev/mem device file */
+	int fd = open("/dev/mem", O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open /dev/mem: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	/* calculate offsets to page and within page */
+	unsigned long psize = getpagesize();
+	unsigned long off_inpage = IO_PORT_ADDR % psize;
+	unsigned long off_topage = IO_PORT_ADDR - off_inpage;
+	unsigned long mapsize = off_inpage + sizeof(struct io_layout) * 3;
+
+	/* map it into logical memory */
+	void *io_addr_map = mmap(0, mapsize, PROT_WRITE, MAP_SHARED, fd, off_topage);
+	if (io_addr_map == MAP_FAILED) {
+		fprintf(stderr, "Can't map physical memory: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	/* calculate register addresses */
+	io_direction = io_addr_map + off_inpage;
+	io_opendrain = io_addr_map + off_inpage + 4;
+	io_data = io_addr_map + off_inpage + 8;
+
+	/* set direction reg */
+	io_direction->tms = 1;
+	io_direction->tck = 1;
+	io_direction->tdo = 0;
+	io_direction->tdi = 1;
+
+	/* set open drain reg */
+	io_opendrain->tms = 0;
+	io_opendrain->tck = 0;
+	io_opendrain->tdo = 0;
+	io_opendrain->tdi = 0;
+
+#ifdef HAVE_TRST
+	/* for boards with TRST, must be driven high */
+	io_data->trst = 1;
+	io_direction->trst = 1;
+	io_opendrain->trst = 0;
+#endif
+}
+
+void gpio_shutdown(void)
+{
+	/* set all to z-state */
+	io_direction->tms = 0;
+	io_direction->tck = 0;
+	io_direction->tdo = 0;
+	io_direction->tdi = 0;
+
+#ifdef HAVE_TRST
+	/* for boards with TRST, assuming there is a pull-down resistor */
+	io_direction->trst = 0;
+#endif
+}
+
+void gpio_tms(int val)
+{
+	io_data->tms = val;
+}
+
+void gpio_tdi(int val)
+{
+	io_data->tdi = val;
+}
+
+void gpio_tck(int val)
+{
+	io_data->tck = val;
+	// usleep(1);
+}
+
+void gpio_sck(int val)
+{
+	/* not available */
+}
+
+void gpio_trst(int val)
+{
+	/* not available */
+}
+
+int gpio_tdo(void)
+{
+	return io_data->tdo ? 1 : 0;
+}
+
+#else
+
+void gpio_setup(void)
+{
+}
+
+void gpio_shutdown(void)
+{
+}
+
+void gpio_tms(int val)
+{
+}
+
+void gpio_tdi(int val)
+{
+}
+
+void gpio_tck(int val)
+{
+}
+
+void gpio_sck(int val)
+{
+}
+
+void gpio_trst(int val)
+{
+}
+
+int gpio_tdo(void)
+{
+	return -1;
+}
+
+#endif
+
+/** END: Low-Level I/O Implementation **/
@@ -87,7 +87,62 @@ enum libxsvf_mem {
 	LIBXSVF_MEM_SVF_TIR_TDO_DATA = 33,
 	LIBXSVF_MEM_SVF_TIR_TDO_MASK = 34,
 	LIBXSVF_MEM_SVF_TIR_RET_MASK = 35,
-	LIBXSVF_MEM_NUM = 36
+	LIBXSVF_MEM_XSVF_REPLAY = 36,
+	LIBXSVF_MEM_SVF_BLOCK_LOG = 37,
+	LIBXSVF_MEM_SCAN_DATA = 38,
+	LIBXSVF_MEM_SVF_HEX_WINDOW = 39,
+	LIBXSVF_MEM_SVF_BATCH = 40,
+	LIBXSVF_MEM_XSVF_IR_DATA = 41,
+	LIBXSVF_MEM_NUM = 42
+};
+
+struct libxsvf_sync_policy {
+	/* configuration (set by the host, 0 = no limit) */
+	long max_cycles;
+	long max_usecs;
+	int block_sync;
+	/* SVF block retries: max. replays of a failed block, lowest TCK
+	 * frequency for replays and clean blocks before raising it again */
+	int block_retries;
+	int min_frequency;
+	int clean_blocks;
+	/* set by the host: TCK frequency in Hz and cost of a sync point */
+	int frequency;
+	long sync_usecs;
+	/* state */
+	int pending;
+	long cycles;
+	long usecs;
+};
+
+struct libxsvf_srcpos {
+	/* command number (from 1), SVF source line (0 for XSVF) and bit offset
+	 * in the current scan (from the first shifted bit, incl. HDR/HIR) */
+	long command;
+	long line;
+	long bit;
+	/* state */
+	long next_line;
+};
+
+struct libxsvf_mismatch {
+	int valid;
+	struct libxsvf_srcpos pos;
+	int expected, actual;
+};
+
+struct libxsvf_checkpoint {
+	/* set by the host: min. number of commands between checkpoints (0 = none) */
+	long interval;
+	/* set by the host: non-zero to resume at the checkpoint below */
+	int resume;
+	/* the last checkpoint (set by the library, or by the host to resume) */
+	long command;
+	enum libxsvf_tap_state tap_state;
+	/* state */
+	long current;
+	long last;
+	int skipping;
 };
 
 struct libxsvf_host {
@@ -105,26 +160,68 @@ struct libxsvf_host {
 	void (*report_status)(struct libxsvf_host *h, const char *message);
 	void (*report_error)(struct libxsvf_host *h, const char *file, int line, const char *message);
 	void *(*realloc)(struct libxsvf_host *h, void *ptr, int size, enum libxsvf_mem which);
+	int (*shift_bits)(struct libxsvf_host *h, int len, const unsigned char *tdi, unsigned char *tdo, int tms_last);
+	void (*sync_tag)(struct libxsvf_host *h);
+	struct libxsvf_sync_policy *sync_policy;
+	void (*report_checkpoint)(struct libxsvf_host *h, const struct libxsvf_checkpoint *cp);
+	struct libxsvf_checkpoint *checkpoint;
+	int (*parallel)(struct libxsvf_host *h, int num, void (*func)(void *arg, int i), void *arg);
+	const char *input_data;
+	long input_size, input_pos;
 	enum libxsvf_tap_state tap_state;
+	struct libxsvf_srcpos srcpos;
+	struct libxsvf_mismatch mismatch;
 	void *user_data;
 };
 
+struct libxsvf_arena {
+	/* largest allocation per memory id, recorded by libxsvf_arena_realloc() */
+	int maxsize[LIBXSVF_MEM_NUM];
+	/* state */
+	void *base;
+	long size;
+	long slot[LIBXSVF_MEM_NUM];
+	int slot_size[LIBXSVF_MEM_NUM];
+};
+
 int libxsvf_play(struct libxsvf_host *, enum libxsvf_mode mode);
+int libxsvf_session_open(struct libxsvf_host *h);
+int libxsvf_session_play(struct libxsvf_host *h, enum libxsvf_mode mode);
+int libxsvf_session_close(struct libxsvf_host *h);
+int libxsvf_xvc_shift(struct libxsvf_host *h, int len, const unsigned char *tms, const unsigned char *tdi, unsigned char *tdo);
 const char *libxsvf_state2str(enum libxsvf_tap_state tap_state);
 const char *libxsvf_mem2str(enum libxsvf_mem which);
+void libxsvf_sync_cost(struct libxsvf_host *h, long usecs);
+void libxsvf_tdo_mismatch(struct libxsvf_host *h, const struct libxsvf_srcpos *pos, int expected, int actual);
+long libxsvf_arena_size(const struct libxsvf_arena *a);
+void libxsvf_arena_init(struct libxsvf_arena *a, void *base, long size);
+void *libxsvf_arena_realloc(struct libxsvf_arena *a, void *ptr, int size, enum libxsvf_mem which,
+		void *(*heap_realloc)(void *ptr, int size));
 
 /* Internal API */ 
 int libxsvf_svf(struct libxsvf_host *h);
 int libxsvf_xsvf(struct libxsvf_host *h);
 int libxsvf_scan(struct libxsvf_host *h);
 int libxsvf_tap_walk(struct libxsvf_host *, enum libxsvf_tap_state);
+void libxsvf_sync_reset(struct libxsvf_host *h);
+int libxsvf_sync_point(struct libxsvf_host *h, long cycles, long usecs, int checked);
+int libxsvf_sync_block(struct libxsvf_host *h);
+void libxsvf_checkpoint_reset(struct libxsvf_host *h);
+int libxsvf_checkpoint_skip(struct libxsvf_host *h);
+int libxsvf_checkpoint_next(struct libxsvf_host *h);
+int libxsvf_checkpoint_due(struct libxsvf_host *h);
+int libxsvf_checkpoint_boundary(struct libxsvf_host *h);
+void libxsvf_srcpos_reset(struct libxsvf_host *h);
+void libxsvf_report_mismatch(struct libxsvf_host *h);
 
 /* Host accessor macros (see README) */
 #define LIBXSVF_HOST_SETUP() h->setup(h)
 #define LIBXSVF_HOST_SHUTDOWN() h->shutdown(h)
 #define LIBXSVF_HOST_UDELAY(_usecs, _tms, _num_tck) h->udelay(h, _usecs, _tms, _num_tck)
-#define LIBXSVF_HOST_GETBYTE() h->getbyte(h)
+#define LIBXSVF_HOST_GETBYTE() (h->input_data ? (h->input_pos < h->input_size ? \
+		(unsigned char)h->input_data[h->input_pos++] : -1) : h->getbyte(h))
 #define LIBXSVF_HOST_SYNC() (h->sync ? h->sync(h) : 0)
+#define LIBXSVF_HOST_HAS_SYNC() (h->sync != (void*)0)
 #define LIBXSVF_HOST_PULSE_TCK(_tms, _tdi, _tdo, _rmask, _sync) h->pulse_tck(h, _tms, _tdi, _tdo, _rmask, _sync)
 #define LIBXSVF_HOST_PULSE_SCK() do { if (h->pulse_sck) h->pulse_sck(h); } while (0)
 #define LIBXSVF_HOST_SET_TRST(_v) do { if (h->set_trst) h->set_trst(h, _v); } while (0)
@@ -134,6 +231,13 @@ int libxsvf_tap_walk(struct libxsvf_host *, enum libxsvf_tap_state);
 #define LIBXSVF_HOST_REPORT_STATUS(_msg) do { if (h->report_status) h->report_status(h, _msg); } while (0)
 #define LIBXSVF_HOST_REPORT_ERROR(_msg) h->report_error(h, __FILE__, __LINE__, _msg)
 #define LIBXSVF_HOST_REALLOC(_ptr, _size, _which) h->realloc(h, _ptr, _size, _which)
+#define LIBXSVF_HOST_HAS_SHIFT_BITS() (h->shift_bits != (void*)0)
+#define LIBXSVF_HOST_SHIFT_BITS(_len, _tdi, _tdo, _tms_last) h->shift_bits(h, _len, _tdi, _tdo, _tms_last)
+#define LIBXSVF_HOST_HAS_SYNC_TAG() (h->sync_tag != (void*)0)
+#define LIBXSVF_HOST_SYNC_TAG() h->sync_tag(h)
+#define LIBXSVF_HOST_REPORT_CHECKPOINT(_cp) do { if (h->report_checkpoint) h->report_checkpoint(h, _cp); } while (0)
+#define LIBXSVF_HOST_HAS_PARALLEL() (h->parallel != (void*)0)
+#define LIBXSVF_HOST_PARALLEL(_num, _func, _arg) h->parallel(h, _num, _func, _arg)
 
 #endif
 
@@ -28,7 +28,12 @@ const char *libxsvf_mem2str(enum libxsvf_mem which)
 	X(XSVF_TDO_MASK, xsvf_tdo_mask)
 	X(XSVF_ADDR_MASK, xsvf_addr_mask)
 	X(XSVF_DATA_MASK, xsvf_data_mask)
+	X(XSVF_IR_DATA, xsvf_ir_data)
+	X(XSVF_REPLAY, xsvf_replay)
 	X(SVF_COMMANDBUF, svf_commandbuf)
+	X(SVF_HEX_WINDOW, svf_hex_window)
+	X(SVF_BATCH, svf_batch)
+	X(SVF_BLOCK_LOG, svf_block_log)
 	X(SVF_HDR_TDI_DATA, svf_hdr_tdi_data)
 	X(SVF_HDR_TDI_MASK, svf_hdr_tdi_mask)
 	X(SVF_HDR_TDO_DATA, svf_hdr_tdo_data)
@@ -59,6 +64,7 @@ const char *libxsvf_mem2str(enum libxsvf_mem which)
 	X(SVF_SIR_TDO_DATA, svf_sir_tdo_data)
 	X(SVF_SIR_TDO_MASK, svf_sir_tdo_mask)
 	X(SVF_SIR_RET_MASK, svf_sir_ret_mask)
+	X(SCAN_DATA, scan_data)
 #undef X
 	return (void*)0;
 }
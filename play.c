@@ -20,16 +20,26 @@
 
 #include "libxsvf.h"
 
-int libxsvf_play(struct libxsvf_host *h, enum libxsvf_mode mode)
+int libxsvf_session_open(struct libxsvf_host *h)
 {
-	int rc = -1;
-
 	h->tap_state = LIBXSVF_TAP_INIT;
 	if (LIBXSVF_HOST_SETUP() < 0) {
 		LIBXSVF_HOST_REPORT_ERROR("Setup of JTAG interface failed.");
 		return -1;
 	}
 
+	return 0;
+}
+
+int libxsvf_session_play(struct libxsvf_host *h, enum libxsvf_mode mode)
+{
+	int rc = -1;
+
+	libxsvf_sync_reset(h);
+	libxsvf_checkpoint_reset(h);
+	libxsvf_srcpos_reset(h);
+	h->input_pos = 0;
+
 	if (mode == LIBXSVF_MODE_SVF) {
 #ifdef LIBXSVF_WITHOUT_SVF
 		LIBXSVF_HOST_REPORT_ERROR("SVF support in libxsvf is disabled.");
@@ -54,18 +64,43 @@ int libxsvf_play(struct libxsvf_host *h, enum libxsvf_mode mode)
 #endif
 	}
 
+	if (rc >= 0 && libxsvf_checkpoint_skip(h)) {
+		LIBXSVF_HOST_REPORT_ERROR("Checkpoint for resume not found.");
+		rc = -1;
+	}
+
 	libxsvf_tap_walk(h, LIBXSVF_TAP_RESET);
 	if (LIBXSVF_HOST_SYNC() != 0 && rc >= 0 ) {
 		LIBXSVF_HOST_REPORT_ERROR("TDO mismatch in TAP reset. (this is not possible!)");
 		rc = -1;
 	}
 
-	int shutdown_rc = LIBXSVF_HOST_SHUTDOWN();
+	return rc;
+}
+
+int libxsvf_session_close(struct libxsvf_host *h)
+{
+	int rc = LIBXSVF_HOST_SHUTDOWN();
 
-	if (shutdown_rc < 0) {
+	if (rc < 0)
 		LIBXSVF_HOST_REPORT_ERROR("Shutdown of JTAG interface failed.");
+
+	return rc;
+}
+
+int libxsvf_play(struct libxsvf_host *h, enum libxsvf_mode mode)
+{
+	int rc;
+
+	if (libxsvf_session_open(h) < 0)
+		return -1;
+
+	rc = libxsvf_session_play(h, mode);
+
+	int shutdown_rc = libxsvf_session_close(h);
+
+	if (shutdown_rc < 0)
 		rc = rc < 0 ? rc : shutdown_rc;
-	}
 
 	return rc;
 }
@@ -20,6 +20,90 @@
 
 #include "libxsvf.h"
 
+/* Max. number of devices in the chain and bits shifted by the batched scan.
+ * The first shift covers the usual short chains, the rest of the bits are
+ * only shifted when no end of the chain was found in the first block.
+ */
+#define SCAN_MAX_DEVICES 256
+#define SCAN_MAX_BITS (SCAN_MAX_DEVICES*32)
+#define SCAN_FIRST_BITS 1024
+
+static inline int scan_bit(const unsigned char *tdo, int k)
+{
+	return (tdo[SCAN_MAX_BITS/8-1-k/8] >> (k%8)) & 1;
+}
+
+/* Decode the IDCODE (LSB set) and BYPASS (single 0 bit) registers from the
+ * first 'bits' captured TDO bits. Returns 1 when the end of the chain has been
+ * found (or the max. number of devices), 0 when more bits are needed.
+ */
+static int scan_decode(struct libxsvf_host *h, const unsigned char *tdo, int bits, int report)
+{
+	int i, j, k;
+
+	for (i=0, k=0; i<SCAN_MAX_DEVICES; i++)
+	{
+		if (k >= bits)
+			return 0;
+		if (scan_bit(tdo, k) == 0) {
+			if (report)
+				LIBXSVF_HOST_REPORT_DEVICE(0);
+			k++;
+		} else {
+			unsigned long idcode = 0;
+			if (k+32 > bits)
+				return 0;
+			for (j=0; j<32; j++, k++)
+				idcode |= ((unsigned long)scan_bit(tdo, k)) << j;
+			if (idcode == 0xffffffff)
+				break;
+			if (report)
+				LIBXSVF_HOST_REPORT_DEVICE(idcode);
+		}
+	}
+
+	return 1;
+}
+
+/* Shift ones through the chain with shift_bits() and decode the captured TDO
+ * vector, so the whole scan is one round trip for most chains.
+ */
+static int scan_batched(struct libxsvf_host *h)
+{
+	int nbytes = SCAN_MAX_BITS / 8;
+	int i, rc = 0;
+
+	unsigned char *buf = LIBXSVF_HOST_REALLOC((void*)0, 2*nbytes, LIBXSVF_MEM_SCAN_DATA);
+	unsigned char *tdi = buf, *tdo = buf + nbytes;
+
+	if (!buf) {
+		LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
+		return -1;
+	}
+
+	for (i=0; i<nbytes; i++)
+		tdi[i] = 0xff;
+
+	// bit k is in byte nbytes-1-k/8, so the first bits are at the end
+	if (LIBXSVF_HOST_SHIFT_BITS(SCAN_FIRST_BITS, tdi, tdo + nbytes - SCAN_FIRST_BITS/8, 0) < 0) {
+		rc = -1;
+		goto error;
+	}
+
+	if (!scan_decode(h, tdo, SCAN_FIRST_BITS, 0)) {
+		if (LIBXSVF_HOST_SHIFT_BITS(SCAN_MAX_BITS - SCAN_FIRST_BITS, tdi, tdo, 0) < 0) {
+			rc = -1;
+			goto error;
+		}
+	}
+
+	scan_decode(h, tdo, SCAN_MAX_BITS, 1);
+
+error:
+	LIBXSVF_HOST_REALLOC(buf, 0, LIBXSVF_MEM_SCAN_DATA);
+	return rc;
+}
+
 int libxsvf_scan(struct libxsvf_host *h)
 {
 	int i, j;
@@ -30,7 +114,10 @@ int libxsvf_scan(struct libxsvf_host *h)
 	if (libxsvf_tap_walk(h, LIBXSVF_TAP_DRSHIFT) < 0)
 		return -1;
 
-	for (i=0; i<256; i++)
+	if (LIBXSVF_HOST_HAS_SHIFT_BITS())
+		return scan_batched(h);
+
+	for (i=0; i<SCAN_MAX_DEVICES; i++)
 	{
 		int bit = LIBXSVF_HOST_PULSE_TCK(0, 1, -1, 0, 1);
 
@@ -0,0 +1,73 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "libxsvf.h"
+#include <stdio.h>
+
+/*
+ * Locating TDO mismatches. The players keep h->srcpos up to date (command
+ * number, SVF source line and bit offset in the current scan). Hosts that
+ * check TDO values later (asynchronous interfaces) remember the position
+ * with each queued bit and pass the first mismatch to libxsvf_tdo_mismatch().
+ * The library then reports it together with the "TDO mismatch" error.
+ */
+
+void libxsvf_srcpos_reset(struct libxsvf_host *h)
+{
+	h->srcpos.command = 0;
+	h->srcpos.line = 0;
+	h->srcpos.bit = 0;
+	h->srcpos.next_line = 1;
+	h->mismatch.valid = 0;
+}
+
+void libxsvf_tdo_mismatch(struct libxsvf_host *h, const struct libxsvf_srcpos *pos, int expected, int actual)
+{
+	/* keep the first mismatch until it is reported or cleared */
+	if (h->mismatch.valid)
+		return;
+
+	h->mismatch.valid = 1;
+	h->mismatch.pos = *pos;
+	h->mismatch.expected = expected;
+	h->mismatch.actual = actual;
+}
+
+void libxsvf_report_mismatch(struct libxsvf_host *h)
+{
+	char message[128];
+	struct libxsvf_mismatch *m = &h->mismatch;
+
+	if (!m->valid) {
+		LIBXSVF_HOST_REPORT_ERROR("TDO mismatch.");
+		return;
+	}
+
+	if (m->pos.line > 0)
+		sprintf(message, "TDO mismatch in command %ld (line %ld), bit %ld: expected %d, got %d.",
+				m->pos.command, m->pos.line, m->pos.bit, m->expected, m->actual);
+	else
+		sprintf(message, "TDO mismatch in command %ld, bit %ld: expected %d, got %d.",
+				m->pos.command, m->pos.bit, m->expected, m->actual);
+	LIBXSVF_HOST_REPORT_ERROR(message);
+
+	m->valid = 0;
+}
@@ -20,6 +20,7 @@
 
 #include "libxsvf.h"
 #include <stdio.h>
+#include <string.h>
 
 /*
 return:
@@ -27,9 +28,74 @@ return:
 -1 error or unexpected eof
  1 normal, proceed with processing
  2 null recevied, try again later. no data received due to buffer empty
+ 3 SDR with at least 'stream_bits' bits: the buffer holds the command up to
+   the first '(' and the rest must be read using bitdata_stream()
 */
 
-static int read_command(struct libxsvf_host *h, char **buffer_p, int *len_p)
+#ifndef LIBXSVF_SVF_STREAM_BITS
+#  define LIBXSVF_SVF_STREAM_BITS 65536
+#endif
+
+static int stream_command(const char *buffer, int stream_bits)
+{
+	long len = 0;
+	int i;
+
+	if (buffer[0] != 'S' || buffer[1] != 'D' || buffer[2] != 'R' || buffer[3] != ' ')
+		return 0;
+	for (i = 4; buffer[i] >= '0' && buffer[i] <= '9'; i++)
+		len = len * 10 + (buffer[i] - '0');
+	return len >= stream_bits;
+}
+
+/* an SVF command in memory, read by a worker of the batch parser */
+struct svf_source {
+	const char *p, *end;
+};
+
+static inline int svf_getbyte(struct libxsvf_host *h, struct svf_source *src)
+{
+	if (src)
+		return src->p < src->end ? (unsigned char)*src->p++ : -1;
+	return LIBXSVF_HOST_GETBYTE();
+}
+
+/*
+ * The SVF lexer classifies bytes with a table: white space (including all
+ * control characters), the characters with a special meaning in
+ * read_command(), lower case letters and hex digits, which also have their
+ * value in the low nibble. Bytes >= 0x80 are ordinary characters.
+ */
+
+#define SVF_C_SPACE   0x10
+#define SVF_C_SPECIAL 0x20
+#define SVF_C_LOWER   0x40
+#define SVF_C_HEX     0x80
+
+#define SP SVF_C_SPACE
+#define SC SVF_C_SPECIAL
+#define LC SVF_C_LOWER
+#define H(_v) (SVF_C_HEX | (_v))
+static const unsigned char svf_ctype[256] = {
+	SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP, /* 0x00 */
+	SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP,    SP, /* 0x10 */
+	SP,    SC,    0,     0,     0,     0,     0,     0,     SC,    SC,    0,     0,     0,     0,     0,     SC, /* 0x20 */
+	H(0),  H(1),  H(2),  H(3),  H(4),  H(5),  H(6),  H(7),  H(8),  H(9),  0,     SC,    0,     0,     0,     0, /* 0x30 */
+	0,     H(10), H(11), H(12), H(13), H(14), H(15), 0,     0,     0,     0,     0,     0,     0,     0,     0, /* 0x40 */
+	0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0, /* 0x50 */
+	0,     LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC, /* 0x60 */
+	LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    LC,    0,     0,     0,     0,     0, /* 0x70 */
+	/* 0x80 .. 0xff: ordinary characters */
+};
+#undef SP
+#undef SC
+#undef LC
+#undef H
+
+#define svf_ishex(_ch) (svf_ctype[(unsigned char)(_ch)] & SVF_C_HEX)
+
+static int read_command(struct libxsvf_host *h, struct svf_source *src, struct libxsvf_srcpos *pos,
+		char **buffer_p, int *len_p, int stream_bits)
 {
 	char *buffer = *buffer_p;
 	int braket_mode = 0;
@@ -50,7 +116,7 @@ static int read_command(struct libxsvf_host *h, char **buffer_p, int *len_p)
 		}
 		buffer[p] = 0;
 
-		int ch = LIBXSVF_HOST_GETBYTE();
+		int ch = svf_getbyte(h, src);
 		if (ch < 0) {
 handle_eof:
 			if (ch == -2) /* temporary buffer empty */
@@ -60,7 +126,16 @@ handle_eof:
 			LIBXSVF_HOST_REPORT_ERROR("Unexpected EOF.");
 			return -1;
 		}
-		if (ch <= ' ') {
+		int ctype = svf_ctype[ch];
+		if (!(ctype & (SVF_C_SPACE | SVF_C_SPECIAL))) {
+			if (p == 0)
+				pos->line = pos->next_line;
+			buffer[p++] = (ctype & SVF_C_LOWER) ? ch - ('a' - 'A') : ch;
+			continue;
+		}
+		if (ctype & SVF_C_SPACE) {
+			if (ch == '\n')
+				pos->next_line++;
 insert_eol:
 			if (!braket_mode && p > 0 && buffer[p-1] != ' ')
 				buffer[p++] = ' ';
@@ -69,28 +144,35 @@ insert_eol:
 		if (ch == '!') {
 skip_to_eol:
 			while (1) {
-				ch = LIBXSVF_HOST_GETBYTE();
+				ch = svf_getbyte(h, src);
 				if (ch < 0)
 					goto handle_eof;
-				if (ch < ' ' && ch != '\t')
+				if (ch < ' ' && ch != '\t') {
+					if (ch == '\n')
+						pos->next_line++;
 					goto insert_eol;
+				}
 			}
 		}
 		if (ch == '/' && p > 0 && buffer[p-1] == '/') {
 			p--;
 			goto skip_to_eol;
 		}
+		if (p == 0)
+			pos->line = pos->next_line;
 		if (ch == ';')
 			break;
 		if (ch == '(') {
 			if (!braket_mode && p > 0 && buffer[p-1] != ' ')
 				buffer[p++] = ' ';
+			if (!braket_mode && stream_bits > 0) {
+				buffer[p] = 0;
+				if (stream_command(buffer, stream_bits))
+					return 3;
+			}
 			braket_mode++;
 		}
-		if (ch >= 'a' && ch <= 'z')
-			buffer[p++] = ch - ('a' - 'A');
-		else
-			buffer[p++] = ch;
+		buffer[p++] = ch;
 		if (ch == ')') {
 			braket_mode--;
 			if (!braket_mode)
@@ -100,18 +182,117 @@ skip_to_eol:
 	return 1;
 }
 
-static int strtokencmp(const char *str1, const char *str2)
+/* Keywords, the TAP states use the values of enum libxsvf_tap_state and
+ * TDI .. RMASK are in the order of the bitdata_buffer() fields. */
+enum svf_keyword {
+	SVF_KW_NONE = 0,
+	SVF_KW_RESET = LIBXSVF_TAP_RESET,
+	SVF_KW_IDLE,
+	SVF_KW_DRSELECT,
+	SVF_KW_DRCAPTURE,
+	SVF_KW_DRSHIFT,
+	SVF_KW_DREXIT1,
+	SVF_KW_DRPAUSE,
+	SVF_KW_DREXIT2,
+	SVF_KW_DRUPDATE,
+	SVF_KW_IRSELECT,
+	SVF_KW_IRCAPTURE,
+	SVF_KW_IRSHIFT,
+	SVF_KW_IREXIT1,
+	SVF_KW_IRPAUSE,
+	SVF_KW_IREXIT2,
+	SVF_KW_IRUPDATE,
+	SVF_KW_ENDDR,
+	SVF_KW_ENDIR,
+	SVF_KW_FREQUENCY,
+	SVF_KW_HDR,
+	SVF_KW_HIR,
+	SVF_KW_PIO,
+	SVF_KW_PIOMAP,
+	SVF_KW_RUNTEST,
+	SVF_KW_SDR,
+	SVF_KW_SIR,
+	SVF_KW_STATE,
+	SVF_KW_TDR,
+	SVF_KW_TIR,
+	SVF_KW_TRST,
+	SVF_KW_TDI,
+	SVF_KW_TDO,
+	SVF_KW_SMASK,
+	SVF_KW_MASK,
+	SVF_KW_RMASK,
+	SVF_KW_MAXIMUM,
+	SVF_KW_ENDSTATE,
+	SVF_KW_SEC,
+	SVF_KW_TCK,
+	SVF_KW_SCK,
+	SVF_KW_ON,
+	SVF_KW_OFF,
+	SVF_KW_Z,
+	SVF_KW_ABSENT
+};
+
+/* Recognize the keyword at *pp (in a normalized command buffer), using a
+ * switch on the first character and the token length. On success *pp is
+ * moved to the next token, otherwise SVF_KW_NONE is returned. */
+static int svf_keyword(const char **pp)
 {
-	int i = 0;
-	while (1) {
-		if ((str1[i] == ' ' || str1[i] == 0) && (str2[i] == ' ' || str2[i] == 0))
-			return 0;
-		if (str1[i] < str2[i])
-			return -1;
-		if (str1[i] > str2[i])
-			return +1;
-		i++;
+	const char *p = *pp;
+	int kw = SVF_KW_NONE, n = 0;
+
+	while (p[n] != ' ' && p[n] != 0)
+		n++;
+
+#define K(_kw) if (n == sizeof(#_kw)-1 && !memcmp(p, #_kw, n)) { kw = SVF_KW_ ## _kw; break; }
+	switch (p[0]) {
+	case 'A':
+		K(ABSENT)
+		break;
+	case 'D':
+		K(DRSELECT) K(DRCAPTURE) K(DRSHIFT) K(DREXIT1) K(DRPAUSE) K(DREXIT2) K(DRUPDATE)
+		break;
+	case 'E':
+		K(ENDDR) K(ENDIR) K(ENDSTATE)
+		break;
+	case 'F':
+		K(FREQUENCY)
+		break;
+	case 'H':
+		K(HDR) K(HIR)
+		break;
+	case 'I':
+		K(IDLE) K(IRSELECT) K(IRCAPTURE) K(IRSHIFT) K(IREXIT1) K(IRPAUSE) K(IREXIT2) K(IRUPDATE)
+		break;
+	case 'M':
+		K(MASK) K(MAXIMUM)
+		break;
+	case 'O':
+		K(ON) K(OFF)
+		break;
+	case 'P':
+		K(PIO) K(PIOMAP)
+		break;
+	case 'R':
+		K(RESET) K(RUNTEST) K(RMASK)
+		break;
+	case 'S':
+		K(SDR) K(SIR) K(STATE) K(SMASK) K(SEC) K(SCK)
+		break;
+	case 'T':
+		K(TDR) K(TIR) K(TRST) K(TDI) K(TDO) K(TCK)
+		break;
+	case 'Z':
+		K(Z)
+		break;
 	}
+#undef K
+
+	if (kw != SVF_KW_NONE) {
+		while (p[n] == ' ')
+			n++;
+		*pp = p + n;
+	}
+	return kw;
 }
 
 static int strtokenskip(const char *str1)
@@ -122,26 +303,10 @@ static int strtokenskip(const char *str1)
 	return i;
 }
 
-static int token2tapstate(const char *str1)
+static int keyword2tapstate(int kw)
 {
-#define X(_t) if (!strtokencmp(str1, #_t)) return LIBXSVF_TAP_ ## _t;
-	X(RESET)
-	X(IDLE)
-	X(DRSELECT)
-	X(DRCAPTURE)
-	X(DRSHIFT)
-	X(DREXIT1)
-	X(DRPAUSE)
-	X(DREXIT2)
-	X(DRUPDATE)
-	X(IRSELECT)
-	X(IRCAPTURE)
-	X(IRSHIFT)
-	X(IREXIT1)
-	X(IRPAUSE)
-	X(IREXIT2)
-	X(IRUPDATE)
-#undef X
+	if (kw >= SVF_KW_RESET && kw <= SVF_KW_IRUPDATE)
+		return kw;
 	return -1;
 }
 
@@ -154,10 +319,15 @@ struct bitdata_s {
 	unsigned char *tdo_mask;
 	unsigned char *ret_mask;
 	int has_tdo_data;
+	/* the allocated buffers (by bitdata_buffer() index) and their sizes:
+	 * they only grow and are kept when the register length changes */
+	unsigned char *buf[5];
+	int buf_bytes[5];
 };
 
 static void bitdata_zero(struct bitdata_s *bd)
 {
+	int i;
 	bd->len = 0;
 	bd->alloced_len = 0;
 	bd->alloced_bytes = 0;
@@ -167,186 +337,1158 @@ static void bitdata_zero(struct bitdata_s *bd)
 	bd->tdo_mask = (void*)0;
 	bd->ret_mask = (void*)0;
 	bd->has_tdo_data = 0;
+	for (i=0; i<5; i++) {
+		bd->buf[i] = (void*)0;
+		bd->buf_bytes[i] = 0;
+	}
+}
+
+/* memory id offsets of the bitdata_buffer() fields TDI, TDO, SMASK, MASK, RMASK */
+static const int bitdata_memid[5] = { 0, 2, 1, 3, 4 };
+
+static void bitdata_free(struct libxsvf_host *h, struct bitdata_s *bd, int offset)
+{
+	int i;
+	for (i=0; i<5; i++) {
+		LIBXSVF_HOST_REALLOC(bd->buf[i], 0, offset+bitdata_memid[i]);
+		bd->buf[i] = (void*)0;
+		bd->buf_bytes[i] = 0;
+	}
+
+	bd->tdi_data = (void*)0;
+	bd->tdi_mask = (void*)0;
+	bd->tdo_data = (void*)0;
+	bd->tdo_mask = (void*)0;
+	bd->ret_mask = (void*)0;
+}
+
+static int hex(char ch)
+{
+	return svf_ctype[(unsigned char)ch] & 15;
+}
+
+/*
+ * Hex data is decoded into the (cleared) bitdata buffers. Long strings are
+ * split into segments that start on a byte boundary in the output and are
+ * decoded by the host's parallel() callback, e.g. on a thread pool.
+ */
+
+#ifndef LIBXSVF_PARALLEL_HEX_DIGITS
+#  define LIBXSVF_PARALLEL_HEX_DIGITS (1 << 18)
+#endif
+
+#ifndef LIBXSVF_PARALLEL_HEX_SEGMENTS
+#  define LIBXSVF_PARALLEL_HEX_SEGMENTS 16
+#endif
+
+/* decode n hex digits to the nibbles pos .. pos+n-1 of d */
+static void hex_decode_range(unsigned char *d, int pos, const char *text, int n)
+{
+	int i = 0;
+	if (pos%2 == 1 && n > 0) {
+		d[pos/2] |= hex(text[0]);
+		i = 1;
+	}
+	for (; i+1 < n; i += 2)
+		d[(pos+i)/2] |= (hex(text[i]) << 4) | hex(text[i+1]);
+	if (i < n)
+		d[(pos+i)/2] |= hex(text[i]) << 4;
+}
+
+struct hex_job {
+	unsigned char *d;
+	const char *text;
+	int pos, len, seglen;
+};
+
+static void hex_job_segment(void *arg, int i)
+{
+	struct hex_job *job = arg;
+	int odd = job->pos % 2;
+	int begin = i == 0 ? 0 : i*job->seglen + odd;
+	int end = (i+1)*job->seglen + odd;
+	if (end > job->len)
+		end = job->len;
+	hex_decode_range(job->d, job->pos + begin, job->text + begin, end - begin);
+}
+
+static void hex_decode(struct libxsvf_host *h, unsigned char *d, int pos, const char *text, int n)
+{
+	if (n >= LIBXSVF_PARALLEL_HEX_DIGITS && LIBXSVF_HOST_HAS_PARALLEL()) {
+		struct hex_job job;
+		job.d = d;
+		job.text = text;
+		job.pos = pos;
+		job.len = n;
+		job.seglen = (n / LIBXSVF_PARALLEL_HEX_SEGMENTS + 1) & ~1;
+		if (LIBXSVF_HOST_PARALLEL((n - pos%2 + job.seglen - 1) / job.seglen, hex_job_segment, &job) == 0)
+			return;
+	}
+	hex_decode_range(d, pos, text, n);
+}
+
+static void bitdata_setlen(struct libxsvf_host *h, struct bitdata_s *bd, int len, int offset)
+{
+	bd->len = len;
+	bd->has_tdo_data = 0;
+	if (bd->len != bd->alloced_len) {
+		bd->tdi_data = (void*)0;
+		bd->tdi_mask = (void*)0;
+		bd->tdo_data = (void*)0;
+		bd->tdo_mask = (void*)0;
+		bd->ret_mask = (void*)0;
+		bd->alloced_len = bd->len;
+		bd->alloced_bytes = (bd->len+7) / 8;
+	}
+}
+
+static const char *bitdata_parse_len(struct libxsvf_host *h, const char *p, struct bitdata_s *bd, int offset)
+{
+	int len = 0;
+	while (*p >= '0' && *p <= '9') {
+		len = len * 10 + (*p - '0');
+		p++;
+	}
+	while (*p == ' ') {
+		p++;
+	}
+	bitdata_setlen(h, bd, len, offset);
+	return p;
+}
+
+/* Parse the TDI/TDO/SMASK/MASK/RMASK keyword at *pp, returns the index
+ * of the buffer (0..4, as in the memory ids) or -1. */
+static int bitdata_keyword(const char **pp)
+{
+	int kw = svf_keyword(pp);
+	if (kw >= SVF_KW_TDI && kw <= SVF_KW_RMASK)
+		return kw - SVF_KW_TDI;
+	return -1;
+}
+
+static unsigned char **bitdata_buffer(struct bitdata_s *bd, int memnum)
+{
+	switch (memnum) {
+	case 0: return &bd->tdi_data;
+	case 1: return &bd->tdo_data;
+	case 2: return &bd->tdi_mask;
+	case 3: return &bd->tdo_mask;
+	}
+	return &bd->ret_mask;
+}
+
+/* Set field 'memnum' for the current length, reusing its buffer if it is
+ * large enough. Returns NULL if allocating memory failed. */
+static unsigned char *bitdata_alloc(struct libxsvf_host *h, struct bitdata_s *bd, int memnum, int offset)
+{
+	int nbytes = bd->alloced_bytes > 0 ? bd->alloced_bytes : 1;
+	if (bd->buf_bytes[memnum] < nbytes) {
+		unsigned char *buf = LIBXSVF_HOST_REALLOC(bd->buf[memnum], nbytes, offset+bitdata_memid[memnum]);
+		if (buf == (void*)0) {
+			LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
+			return (void*)0;
+		}
+		bd->buf[memnum] = buf;
+		bd->buf_bytes[memnum] = nbytes;
+	}
+	*bitdata_buffer(bd, memnum) = bd->buf[memnum];
+	return bd->buf[memnum];
+}
+
+/* Parse the keyword at *pp and return the cleared buffer for its data,
+ * or NULL on error. */
+static unsigned char *bitdata_field(struct libxsvf_host *h, const char **pp, struct bitdata_s *bd, int offset)
+{
+	int i, memnum = bitdata_keyword(pp);
+	if (memnum < 0)
+		return (void*)0;
+	if (memnum == 1)
+		bd->has_tdo_data = 1;
+
+	unsigned char *d = bitdata_alloc(h, bd, memnum, offset);
+	if (!d)
+		return (void*)0;
+	for (i=0; i<bd->alloced_bytes; i++)
+		d[i] = 0;
+	return d;
+}
+
+static const char *bitdata_parse(struct libxsvf_host *h, const char *p, struct bitdata_s *bd, int offset)
+{
+	int i;
+	p = bitdata_parse_len(h, p, bd, offset);
+	while (*p)
+	{
+		unsigned char *d = bitdata_field(h, &p, bd, offset);
+		if (!d)
+			return (void*)0;
+
+		if (*p != '(')
+			return (void*)0;
+		p++;
+
+		int hexdigits = 0;
+		for (i=0; svf_ishex(p[i]); i++)
+			hexdigits++;
+		/* excess leading zeros are valid (e.g. "HIR 0 TDI (0)") */
+		for (; hexdigits > bd->alloced_bytes*2 && *p == '0'; hexdigits--)
+			p++;
+		if (hexdigits > bd->alloced_bytes*2)
+			return (void*)0;
+
+		hex_decode(h, d, bd->alloced_bytes*2 - hexdigits, p, hexdigits);
+		p += hexdigits;
+
+		if (*p != ')')
+			return (void*)0;
+		p++;
+		while (*p == ' ') {
+			p++;
+		}
+	}
+#if 0
+	/* Debugging Output, needs <stdio.h> */
+	printf("--- Parsed bitdata [%d] ---\n", bd->len);
+	if (bd->tdi_data) {
+		printf("TDI DATA:");
+		for (i=0; i<bd->alloced_bytes; i++)
+			printf(" %02x", bd->tdi_data[i]);
+		printf("\n");
+	}
+	if (bd->tdo_data && has_tdo_data) {
+		printf("TDO DATA:");
+		for (i=0; i<bd->alloced_bytes; i++)
+			printf(" %02x", bd->tdo_data[i]);
+		printf("\n");
+	}
+	if (bd->tdi_mask) {
+		printf("TDI MASK:");
+		for (i=0; i<bd->alloced_bytes; i++)
+			printf(" %02x", bd->tdi_mask[i]);
+		printf("\n");
+	}
+	if (bd->tdo_mask) {
+		printf("TDO MASK:");
+		for (i=0; i<bd->alloced_bytes; i++)
+			printf(" %02x", bd->tdo_mask[i]);
+		printf("\n");
+	}
+#endif
+	return p;
+}
+
+/*
+ * Large SDR commands are not collected in the command buffer: the hex data
+ * is read in windows of LIBXSVF_SVF_HEX_WINDOW digits and each window is
+ * decoded into the bitdata buffers. The first bit to shift is the last hex
+ * digit of TDI, so the shift itself still starts after the command has been
+ * read, but the memory needed is the packed data and one window only.
+ */
+
+#ifndef LIBXSVF_SVF_HEX_WINDOW
+#  define LIBXSVF_SVF_HEX_WINDOW (1 << 20)
+#endif
+
+/* the window is sized for the register (up to LIBXSVF_SVF_HEX_WINDOW) and
+ * only grows, so it is allocated once for a run of similar SDRs */
+struct svf_window {
+	char *buf;
+	int size;
+};
+
+static char *svf_window_alloc(struct libxsvf_host *h, struct svf_window *w, int len)
+{
+	int size = (len+3)/4 + 16;
+	if (size > LIBXSVF_SVF_HEX_WINDOW)
+		size = LIBXSVF_SVF_HEX_WINDOW;
+	if (w->size < size) {
+		char *buf = LIBXSVF_HOST_REALLOC(w->buf, size, LIBXSVF_MEM_SVF_HEX_WINDOW);
+		if (!buf) {
+			LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
+			return (void*)0;
+		}
+		w->buf = buf;
+		w->size = size;
+	}
+	return w->buf;
+}
+
+static int stream_getbyte(struct libxsvf_host *h)
+{
+	int ch = LIBXSVF_HOST_GETBYTE();
+	if (ch == '\n')
+		h->srcpos.next_line++;
+	if (ch >= 'a' && ch <= 'z')
+		ch -= 'a' - 'A';
+	return ch;
+}
+
+/* skip white space and comments, starting with 'ch', returns the next character */
+static int stream_skip(struct libxsvf_host *h, int ch)
+{
+	while (1) {
+		if (ch >= 0 && ch <= ' ') {
+			ch = stream_getbyte(h);
+			continue;
+		}
+		if (ch == '!' || ch == '/') {
+			if (ch == '/' && (ch = stream_getbyte(h)) != '/')
+				return '/';
+			while (ch >= 0 && (ch >= ' ' || ch == '\t'))
+				ch = stream_getbyte(h);
+			continue;
+		}
+		return ch;
+	}
+}
+
+static int stream_getnibble(const unsigned char *d, int i)
+{
+	return i%2 == 0 ? d[i/2] >> 4 : d[i/2] & 15;
+}
+
+static void stream_setnibble(unsigned char *d, int i, int v)
+{
+	if (i%2 == 0)
+		d[i/2] = (d[i/2] & 15) | (v << 4);
+	else
+		d[i/2] = (d[i/2] & 0xf0) | v;
+}
+
+static const char *bitdata_stream(struct libxsvf_host *h, const char *p, struct bitdata_s *bd, int offset, struct svf_window *w)
+{
+	char keyword[8];
+	int i, j, ch = 0;
+
+	p = bitdata_parse_len(h, p, bd, offset);
+	char *window = svf_window_alloc(h, w, bd->len);
+	if (!window)
+		return (void*)0;
+
+	while (1)
+	{
+		unsigned char *d = bitdata_field(h, &p, bd, offset);
+		if (!d || *p)
+			goto error;
+
+		/* decode the digits left-aligned, then move them to the end */
+		int hexdigits = 0, n = 0;
+		while (1) {
+			ch = stream_getbyte(h);
+			if (ch < 0 || !svf_ishex(ch)) {
+				ch = stream_skip(h, ch);
+				if (ch == ')')
+					break;
+				if (ch < 0 || !svf_ishex(ch))
+					goto error;
+			}
+			/* leading zeros don't count against the register length */
+			if (ch == '0' && hexdigits + n == 0)
+				continue;
+			if (hexdigits + n == bd->alloced_bytes*2)
+				goto error;
+			window[n++] = ch;
+			if (n == w->size) {
+				hex_decode(h, d, hexdigits, window, n);
+				hexdigits += n;
+				n = 0;
+			}
+		}
+		hex_decode(h, d, hexdigits, window, n);
+		hexdigits += n;
+
+		j = bd->alloced_bytes*2 - hexdigits;
+		if (j > 0) {
+			for (i=hexdigits-1; i >= 0; i--)
+				stream_setnibble(d, i+j, stream_getnibble(d, i));
+			for (i=0; i<j; i++)
+				stream_setnibble(d, i, 0);
+		}
+
+		ch = stream_skip(h, stream_getbyte(h));
+		if (ch == ';')
+			break;
+		for (i=0; ch >= 'A' && ch <= 'Z'; i++) {
+			if (i == (int)sizeof(keyword)-1)
+				goto error;
+			keyword[i] = ch;
+			ch = stream_getbyte(h);
+		}
+		keyword[i] = 0;
+		ch = stream_skip(h, ch);
+		if (ch != '(')
+			goto error;
+		p = keyword;
+	}
+
+	return p;
+
+error:
+	if (ch < 0)
+		LIBXSVF_HOST_REPORT_ERROR("Unexpected EOF.");
+	return (void*)0;
+}
+
+static int allbits(const unsigned char *data, int len, int v)
+{
+	int left_padding = (8 - len % 8) % 8;
+	int i, mask = 0xff >> left_padding;
+	for (i=0; i<(len+7)/8; i++, mask = 0xff) {
+		if ((data[i] & mask) != (v ? mask : 0))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Bit-by-bit playback reads the registers in blocks of one word: each
+ * block holds the same bits of all planes, with bit 0 being the first bit
+ * to shift, so the planes are read once per word instead of once per bit.
+ * LIBXSVF_BITDATA_WORD may be set to a smaller unsigned type on targets
+ * without fast 64 bit arithmetic.
+ */
+
+#ifndef LIBXSVF_BITDATA_WORD
+#  define LIBXSVF_BITDATA_WORD unsigned long long
+#endif
+
+#define BITDATA_WORD_BITS ((int)sizeof(LIBXSVF_BITDATA_WORD) * 8)
+
+struct bitdata_word {
+	LIBXSVF_BITDATA_WORD tdi, tdi_mask, tdo, tdo_mask, ret_mask;
+};
+
+/* read bits k .. k+BITDATA_WORD_BITS-1 of a plane, k is a multiple of the word size */
+static LIBXSVF_BITDATA_WORD bitdata_getword(const unsigned char *data, int nbytes, int k)
+{
+	LIBXSVF_BITDATA_WORD w = 0;
+	int i, n = nbytes - k/8;
+	if (n > BITDATA_WORD_BITS/8)
+		n = BITDATA_WORD_BITS/8;
+	data += nbytes - 1 - k/8;
+	for (i=0; i<n; i++)
+		w |= (LIBXSVF_BITDATA_WORD)data[-i] << (8*i);
+	return w;
+}
+
+/* load one block of all planes, with the defaults for missing planes
+ * and the bits at and above 'len' cleared in the masks */
+static void bitdata_getblock(struct bitdata_s *bd, int k, struct bitdata_word *w)
+{
+	LIBXSVF_BITDATA_WORD valid = ~(LIBXSVF_BITDATA_WORD)0;
+	int nbytes = (bd->len+7) / 8;
+
+	if (bd->len - k < BITDATA_WORD_BITS)
+		valid = ((LIBXSVF_BITDATA_WORD)1 << (bd->len - k)) - 1;
+
+	w->tdi = bd->tdi_data ? bitdata_getword(bd->tdi_data, nbytes, k) : 0;
+	w->tdi_mask = !bd->tdi_data ? 0 : bd->tdi_mask ? bitdata_getword(bd->tdi_mask, nbytes, k) & valid : valid;
+	w->tdo = bd->tdo_data ? bitdata_getword(bd->tdo_data, nbytes, k) : 0;
+	w->tdo_mask = !bd->tdo_data || !bd->has_tdo_data ? 0 : bd->tdo_mask ? bitdata_getword(bd->tdo_mask, nbytes, k) & valid : valid;
+	w->ret_mask = bd->ret_mask ? bitdata_getword(bd->ret_mask, nbytes, k) & valid : 0;
+}
+
+/*
+ * The bit-by-bit player is generated in one variant for each register
+ * shape: TDI none (0), masked by SMASK (1) or complete (2), with or
+ * without TDO checks and with or without RMASK. The variant is selected
+ * once per command, so the loop over the bits has no branches on the
+ * data; the exit bit with TMS set is shifted after the loop.
+ */
+
+#define BITDATA_BIT(_word, _i) ((int)((_word) >> (_i)) & 1)
+
+/* the bit if the mask bit is set, -1 otherwise */
+#define BITDATA_SELECT(_mask, _bit) (((_bit) & -(_mask)) | ((_mask) - 1))
+
+#define BITDATA_TDI(_tdi, _w, _i) ((_tdi) == 0 ? -1 : (_tdi) == 2 ? BITDATA_BIT((_w).tdi, _i) : \
+		BITDATA_SELECT(BITDATA_BIT((_w).tdi_mask, _i), BITDATA_BIT((_w).tdi, _i)))
+#define BITDATA_TDO(_tdo, _w, _i) ((_tdo) ? BITDATA_SELECT(BITDATA_BIT((_w).tdo_mask, _i), BITDATA_BIT((_w).tdo, _i)) : -1)
+#define BITDATA_RMASK(_rmask, _w, _i) ((_rmask) ? BITDATA_BIT((_w).ret_mask, _i) : 0)
+
+#define BITDATA_PLAY_KERNEL(_tdi, _tdo, _rmask)                             \
+static int bitdata_play_ ## _tdi ## _tdo ## _rmask(struct libxsvf_host *h,  \
+		struct bitdata_s *bd, enum libxsvf_tap_state estate, int *tms, int *checked) \
+{                                                                           \
+	struct bitdata_word w = { 0, 0, 0, 0, 0 };                          \
+	int tdo_error = 0;                                                  \
+	int i, k, n;                                                        \
+	for (k=0; k < bd->len; k += BITDATA_WORD_BITS) {                    \
+		bitdata_getblock(bd, k, &w);                                \
+		if (_tdo)                                                   \
+			*checked |= w.tdo_mask != 0;                        \
+		n = bd->len - k < BITDATA_WORD_BITS ? bd->len - k : BITDATA_WORD_BITS; \
+		if (k + n == bd->len)                                       \
+			n--;                                                \
+		for (i=0; i<n; i++) {                                       \
+			tdo_error |= LIBXSVF_HOST_PULSE_TCK(0, BITDATA_TDI(_tdi, w, i), \
+					BITDATA_TDO(_tdo, w, i), BITDATA_RMASK(_rmask, w, i), 0) < 0; \
+			h->srcpos.bit++;                                    \
+		}                                                           \
+	}                                                                   \
+	i = (bd->len-1) % BITDATA_WORD_BITS;                                \
+	if (h->tap_state != estate) {                                       \
+		h->tap_state++;                                             \
+		*tms = 1;                                                   \
+	}                                                                   \
+	tdo_error |= LIBXSVF_HOST_PULSE_TCK(*tms, BITDATA_TDI(_tdi, w, i),  \
+			BITDATA_TDO(_tdo, w, i), BITDATA_RMASK(_rmask, w, i), 0) < 0; \
+	h->srcpos.bit++;                                                    \
+	return tdo_error;                                                   \
+}
+
+BITDATA_PLAY_KERNEL(0, 0, 0)
+BITDATA_PLAY_KERNEL(0, 0, 1)
+BITDATA_PLAY_KERNEL(0, 1, 0)
+BITDATA_PLAY_KERNEL(0, 1, 1)
+BITDATA_PLAY_KERNEL(1, 0, 0)
+BITDATA_PLAY_KERNEL(1, 0, 1)
+BITDATA_PLAY_KERNEL(1, 1, 0)
+BITDATA_PLAY_KERNEL(1, 1, 1)
+BITDATA_PLAY_KERNEL(2, 0, 0)
+BITDATA_PLAY_KERNEL(2, 0, 1)
+BITDATA_PLAY_KERNEL(2, 1, 0)
+BITDATA_PLAY_KERNEL(2, 1, 1)
+
+static int (* const bitdata_play_kernels[3][2][2])(struct libxsvf_host *h,
+		struct bitdata_s *bd, enum libxsvf_tap_state estate, int *tms, int *checked) = {
+	{ { bitdata_play_000, bitdata_play_001 }, { bitdata_play_010, bitdata_play_011 } },
+	{ { bitdata_play_100, bitdata_play_101 }, { bitdata_play_110, bitdata_play_111 } },
+	{ { bitdata_play_200, bitdata_play_201 }, { bitdata_play_210, bitdata_play_211 } }
+};
+
+static int bitdata_play(struct libxsvf_host *h, struct bitdata_s *bd, enum libxsvf_tap_state estate)
+{
+	int tdo_error = 0;
+	int checked = 0;
+	int tms = 0;
+
+	/* a new instruction starts a new block */
+	if (estate >= LIBXSVF_TAP_IRSELECT && libxsvf_sync_block(h) < 0)
+		tdo_error = 1;
+
+	int tdi_shape = !bd->tdi_data ? 0 : !bd->tdi_mask || allbits(bd->tdi_mask, bd->len, 1) ? 2 : 1;
+	int tdo_shape = bd->tdo_data && bd->has_tdo_data && !(bd->tdo_mask && allbits(bd->tdo_mask, bd->len, 0));
+	int rmask_shape = bd->ret_mask && !allbits(bd->ret_mask, bd->len, 0);
+
+	/* plain data shift without tdo checks: pass the whole register to the host */
+	if (LIBXSVF_HOST_HAS_SHIFT_BITS() && bd->len > 0 && tdi_shape == 2 && !tdo_shape && !rmask_shape) {
+		if (h->tap_state != estate) {
+			h->tap_state++;
+			tms = 1;
+		}
+		if (LIBXSVF_HOST_SHIFT_BITS(bd->len, bd->tdi_data, (void*)0, tms) < 0)
+			tdo_error = 1;
+		h->srcpos.bit += bd->len;
+	}
+	else if (bd->len > 0) {
+		if (bitdata_play_kernels[tdi_shape][tdo_shape][rmask_shape](h, bd, estate, &tms, &checked))
+			tdo_error = 1;
+	}
+
+	if (tms)
+		LIBXSVF_HOST_REPORT_TAPSTATE();
+
+	if (libxsvf_sync_point(h, bd->len, 0, checked) < 0)
+		tdo_error = 1;
+
+	return tdo_error ? -1 : 0;
+}
+
+/*
+ * Block retries for asynchronous interfaces (see 'block_retries' in the
+ * sync policy): The JTAG operations since the last SIR are recorded in a
+ * block log. A TDO mismatch in this block is handled by playing the block
+ * again, optionally at a lower TCK frequency, instead of aborting the SVF.
+ */
+
+#ifndef LIBXSVF_BLOCK_LOG_SIZE
+#  define LIBXSVF_BLOCK_LOG_SIZE 64
+#endif
+
+#ifndef LIBXSVF_BLOCK_LOG_BYTES
+#  define LIBXSVF_BLOCK_LOG_BYTES 16384
+#endif
+
+enum svf_op_type {
+	SVF_OP_TAP,
+	SVF_OP_SHIFT,
+	SVF_OP_RUNTEST
+};
+
+struct svf_op {
+	enum svf_op_type type;
+	enum libxsvf_tap_state state;
+	int len, has_tdo_data;
+	int tdi_data, tdi_mask, tdo_data, tdo_mask;
+	int min_time, tck_count, sck_count;
+	struct libxsvf_srcpos pos;
+};
+
+struct svf_block {
+	struct svf_op ops[LIBXSVF_BLOCK_LOG_SIZE];
+	int num, checked, broken, replaying;
+	unsigned char *data;
+	int data_size, data_used;
+	int frequency, nominal_frequency, clean_count;
+	/* settings skipped while resuming at a checkpoint */
+	int skipped_frequency, skipped_trst, has_skipped_trst;
+};
+
+static void block_init(struct libxsvf_host *h, struct svf_block *blk)
+{
+	blk->num = 0;
+	blk->checked = 0;
+	blk->broken = 0;
+	blk->replaying = 0;
+	blk->data = (void*)0;
+	blk->data_size = 0;
+	blk->data_used = 0;
+	blk->frequency = h->sync_policy ? h->sync_policy->frequency : 0;
+	blk->nominal_frequency = blk->frequency;
+	blk->clean_count = 0;
+	blk->skipped_frequency = 0;
+	blk->skipped_trst = 0;
+	blk->has_skipped_trst = 0;
+}
+
+static void block_free(struct libxsvf_host *h, struct svf_block *blk)
+{
+	LIBXSVF_HOST_REALLOC(blk->data, 0, LIBXSVF_MEM_SVF_BLOCK_LOG);
+	blk->data = (void*)0;
+	blk->data_size = 0;
+}
+
+static int block_enabled(struct libxsvf_host *h, struct svf_block *blk)
+{
+	return h->sync_policy && h->sync_policy->block_retries > 0 && !blk->replaying;
+}
+
+static struct svf_op *block_add(struct libxsvf_host *h, struct svf_block *blk, enum svf_op_type type, int nbytes)
+{
+	struct svf_op *op;
+
+	if (blk->broken)
+		return (void*)0;
+
+	if (blk->num == LIBXSVF_BLOCK_LOG_SIZE || blk->data_used + nbytes > LIBXSVF_BLOCK_LOG_BYTES) {
+		blk->broken = 1;
+		return (void*)0;
+	}
+
+	if (blk->data_used + nbytes > blk->data_size) {
+		unsigned char *data = LIBXSVF_HOST_REALLOC(blk->data, blk->data_used + nbytes, LIBXSVF_MEM_SVF_BLOCK_LOG);
+		if (!data) {
+			blk->broken = 1;
+			return (void*)0;
+		}
+		blk->data = data;
+		blk->data_size = blk->data_used + nbytes;
+	}
+
+	op = &blk->ops[blk->num++];
+	op->type = type;
+	op->pos = h->srcpos;
+	return op;
+}
+
+static int block_copy(struct svf_block *blk, const unsigned char *data, int nbytes)
+{
+	int offset = blk->data_used;
+	int i;
+
+	if (!data)
+		return -1;
+
+	for (i = 0; i < nbytes; i++)
+		blk->data[offset + i] = data[i];
+	blk->data_used += nbytes;
+
+	return offset;
+}
+
+static void block_set_frequency(struct libxsvf_host *h, struct svf_block *blk, int frequency, const char *message)
+{
+	if (frequency == blk->frequency || LIBXSVF_HOST_SET_FREQUENCY(frequency) < 0)
+		return;
+	blk->frequency = frequency;
+	LIBXSVF_HOST_REPORT_STATUS(message);
+}
+
+static int runtest(struct libxsvf_host *h, int min_time, int tck_count, int sck_count)
+{
+	int i;
+
+	if (sck_count >= 0) {
+		for (i=0; i < sck_count; i++) {
+			LIBXSVF_HOST_PULSE_SCK();
+		}
+	}
+	if (min_time >= 0 || tck_count >= 0) {
+		LIBXSVF_HOST_UDELAY(min_time >= 0 ? min_time : 0, 0, tck_count >= 0 ? tck_count : 0);
+	}
+	return libxsvf_sync_point(h, tck_count >= 0 ? tck_count : 0, min_time >= 0 ? min_time : 0, 0);
+}
+
+static int block_exec(struct libxsvf_host *h, struct svf_block *blk, struct svf_op *op)
+{
+	struct bitdata_s bd;
+
+	h->srcpos = op->pos;
+
+	switch (op->type)
+	{
+	case SVF_OP_TAP:
+		return libxsvf_tap_walk(h, op->state);
+	case SVF_OP_SHIFT:
+		bitdata_zero(&bd);
+		bd.len = op->len;
+		bd.has_tdo_data = op->has_tdo_data;
+		bd.tdi_data = op->tdi_data < 0 ? (void*)0 : blk->data + op->tdi_data;
+		bd.tdi_mask = op->tdi_mask < 0 ? (void*)0 : blk->data + op->tdi_mask;
+		bd.tdo_data = op->tdo_data < 0 ? (void*)0 : blk->data + op->tdo_data;
+		bd.tdo_mask = op->tdo_mask < 0 ? (void*)0 : blk->data + op->tdo_mask;
+		return bitdata_play(h, &bd, op->state);
+	case SVF_OP_RUNTEST:
+		return runtest(h, op->min_time, op->tck_count, op->sck_count);
+	}
+	return -1;
+}
+
+static int block_recover(struct libxsvf_host *h, struct svf_block *blk)
+{
+	struct libxsvf_sync_policy *p = h->sync_policy;
+	int attempt, i, rc = -1;
+
+	if (!block_enabled(h, blk) || blk->broken) {
+		libxsvf_report_mismatch(h);
+		return -1;
+	}
+
+	struct libxsvf_srcpos pos = h->srcpos;
+
+	blk->replaying = 1;
+	for (attempt = 0; attempt < p->block_retries; attempt++)
+	{
+		/* drain the interface and clear its error state */
+		LIBXSVF_HOST_SYNC();
+		h->mismatch.valid = 0;
+
+		if (p->min_frequency > 0 && blk->frequency > p->min_frequency)
+			block_set_frequency(h, blk, blk->frequency / 2 > p->min_frequency ? blk->frequency / 2 : p->min_frequency,
+					"Lowering TCK frequency for SVF block retry.");
+
+		LIBXSVF_HOST_REPORT_STATUS("Replaying SVF block.");
+
+		rc = 0;
+		for (i = 0; i < blk->num && rc == 0; i++)
+			rc = block_exec(h, blk, &blk->ops[i]);
+
+		if (rc == 0 && LIBXSVF_HOST_SYNC() == 0)
+			break;
+		rc = -1;
+	}
+	blk->replaying = 0;
+	h->srcpos = pos;
+
+	if (rc < 0) {
+		libxsvf_report_mismatch(h);
+		return -1;
+	}
+
+	libxsvf_sync_reset(h);
+	blk->clean_count = 0;
+	return 0;
+}
+
+static int block_commit(struct libxsvf_host *h, struct svf_block *blk)
+{
+	struct libxsvf_sync_policy *p = h->sync_policy;
+
+	if (!block_enabled(h, blk))
+		return 0;
+
+	if (blk->checked) {
+		if (LIBXSVF_HOST_SYNC() != 0) {
+			if (block_recover(h, blk) < 0)
+				return -1;
+		} else {
+			libxsvf_sync_reset(h);
+			if (blk->frequency < blk->nominal_frequency && ++blk->clean_count >= p->clean_blocks && p->clean_blocks > 0) {
+				block_set_frequency(h, blk, blk->frequency * 2 < blk->nominal_frequency ? blk->frequency * 2 : blk->nominal_frequency,
+						"Raising TCK frequency after clean SVF blocks.");
+				blk->clean_count = 0;
+			}
+		}
+	}
+
+	blk->num = 0;
+	blk->checked = 0;
+	blk->broken = 0;
+	blk->data_used = 0;
+	return 0;
+}
+
+static int svf_frequency(struct libxsvf_host *h, struct svf_block *blk, int frequency)
+{
+	if (libxsvf_checkpoint_skip(h))
+		blk->skipped_frequency = frequency;
+	else if (LIBXSVF_HOST_SET_FREQUENCY(frequency) < 0)
+		return -1;
+	blk->frequency = frequency;
+	blk->nominal_frequency = frequency;
+	return 0;
+}
+
+static void svf_trst(struct libxsvf_host *h, struct svf_block *blk, int v)
+{
+	if (libxsvf_checkpoint_skip(h)) {
+		blk->skipped_trst = v;
+		blk->has_skipped_trst = 1;
+		return;
+	}
+	LIBXSVF_HOST_SET_TRST(v);
+}
+
+static int svf_resume(struct libxsvf_host *h, struct svf_block *blk)
+{
+	if (blk->has_skipped_trst)
+		LIBXSVF_HOST_SET_TRST(blk->skipped_trst);
+	if (blk->skipped_frequency > 0 && LIBXSVF_HOST_SET_FREQUENCY(blk->skipped_frequency) < 0) {
+		LIBXSVF_HOST_REPORT_ERROR("FREQUENCY command failed!");
+		return -1;
+	}
+	return 0;
+}
+
+static int svf_tap(struct libxsvf_host *h, struct svf_block *blk, enum libxsvf_tap_state state)
+{
+	struct svf_op *op;
+
+	if (libxsvf_checkpoint_skip(h))
+		return 0;
+
+	if (block_enabled(h, blk) && (op = block_add(h, blk, SVF_OP_TAP, 0)) != (void*)0)
+		op->state = state;
+
+	return libxsvf_tap_walk(h, state);
+}
+
+static int svf_shift(struct libxsvf_host *h, struct svf_block *blk, struct bitdata_s *bd, enum libxsvf_tap_state estate)
+{
+	int nbytes = (bd->len+7)/8;
+	struct svf_op *op;
+
+	if (libxsvf_checkpoint_skip(h))
+		return 0;
+
+	if (block_enabled(h, blk)) {
+		if (bd->ret_mask && !allbits(bd->ret_mask, bd->len, 0)) {
+			/* captured tdo data can't be captured again */
+			blk->broken = 1;
+		} else if ((op = block_add(h, blk, SVF_OP_SHIFT, 4*nbytes)) != (void*)0) {
+			op->state = estate;
+			op->len = bd->len;
+			op->has_tdo_data = bd->has_tdo_data;
+			op->tdi_data = block_copy(blk, bd->tdi_data, nbytes);
+			op->tdi_mask = block_copy(blk, bd->tdi_mask, nbytes);
+			op->tdo_data = block_copy(blk, bd->has_tdo_data ? bd->tdo_data : (void*)0, nbytes);
+			op->tdo_mask = block_copy(blk, bd->tdo_mask, nbytes);
+		}
+		if (bd->tdo_data && bd->has_tdo_data)
+			blk->checked = 1;
+	}
+
+	if (bitdata_play(h, bd, estate) < 0)
+		return block_recover(h, blk);
+
+	return 0;
+}
+
+static int svf_runtest(struct libxsvf_host *h, struct svf_block *blk, int min_time, int tck_count, int sck_count)
+{
+	struct svf_op *op;
+
+	if (libxsvf_checkpoint_skip(h))
+		return 0;
+
+	if (block_enabled(h, blk) && (op = block_add(h, blk, SVF_OP_RUNTEST, 0)) != (void*)0) {
+		op->min_time = min_time;
+		op->tck_count = tck_count;
+		op->sck_count = sck_count;
+	}
+
+	if (runtest(h, min_time, tck_count, sck_count) < 0)
+		return block_recover(h, blk);
+
+	return 0;
 }
 
-static void bitdata_free(struct libxsvf_host *h, struct bitdata_s *bd, int offset)
-{
-	LIBXSVF_HOST_REALLOC(bd->tdi_data, 0, offset+0);
-	LIBXSVF_HOST_REALLOC(bd->tdi_mask, 0, offset+1);
-	LIBXSVF_HOST_REALLOC(bd->tdo_data, 0, offset+2);
-	LIBXSVF_HOST_REALLOC(bd->tdo_mask, 0, offset+3);
-	LIBXSVF_HOST_REALLOC(bd->ret_mask, 0, offset+4);
+/*
+ * Batch parser for SVF files in memory (see 'input_data' in the host struct):
+ * A prescan finds the boundaries of the next commands using memchr(). Then
+ * the commands are normalized and their bit data is decoded in parallel by
+ * the host's parallel() callback (or one after the other) and the player
+ * consumes them in order. Commands larger than LIBXSVF_SVF_BATCH_BYTES are
+ * read by the normal parser, using the streaming mode for large SDRs.
+ */
 
-	bd->tdi_data = (void*)0;
-	bd->tdi_mask = (void*)0;
-	bd->tdo_data = (void*)0;
-	bd->tdo_mask = (void*)0;
-	bd->ret_mask = (void*)0;
-}
+#ifndef LIBXSVF_SVF_BATCH_SIZE
+#  define LIBXSVF_SVF_BATCH_SIZE 256
+#endif
 
-static int hex(char ch)
+#ifndef LIBXSVF_SVF_BATCH_BYTES
+#  define LIBXSVF_SVF_BATCH_BYTES (1 << 20)
+#endif
+
+/* bit data of a command, decoded by a batch worker */
+struct svf_bits {
+	int len;
+	unsigned char *data[5];
+};
+
+struct svf_cmd {
+	struct svf_source src;
+	char *text;
+	int text_size;
+	unsigned char *data;
+	int data_size;
+	long line, newlines;
+	int rc;
+	int has_bits;
+	struct svf_bits bits;
+};
+
+struct svf_batch {
+	struct libxsvf_host *h;
+	struct svf_cmd *cmds;
+	int num, index;
+	char *buf;
+	long buf_size;
+};
+
+/* returns the length of the command at 'p' including the ';', or -1 */
+static long svf_prescan(const char *p, long len)
 {
-	if (ch >= 'A' && ch <= 'Z')
-		return (ch - 'A') + 10;
-	if (ch >= '0' && ch <= '9')
-		return ch - '0';
-	return 0;
+	const char *start = p, *end = p + len;
+
+	while (p < end) {
+		const char *semi = memchr(p, ';', end - p);
+		const char *excl = memchr(p, '!', (semi ? semi : end) - p);
+		const char *slash = memchr(p, '/', (excl ? excl : semi ? semi : end) - p);
+		const char *comment = slash && slash+1 < end && slash[1] == '/' ? slash : excl;
+		if (slash && !comment) {
+			p = slash + 1;
+			continue;
+		}
+		if (!comment)
+			return semi ? semi + 1 - start : -1;
+		/* like read_command(), any control character but tab ends a comment */
+		for (p = comment + 1; p < end && ((unsigned char)*p >= ' ' || *p == '\t'); p++) { }
+		if (p == end)
+			return -1;
+		p++;
+	}
+	return -1;
 }
 
-static const char *bitdata_parse(struct libxsvf_host *h, const char *p, struct bitdata_s *bd, int offset)
+static int bitdata_compile(struct libxsvf_host *h, struct svf_cmd *c, int parallel)
 {
-	int i, j;
-	bd->len = 0;
-	bd->has_tdo_data = 0;
+	const char *p = c->text;
+	int i, used = 0;
+
+	switch (svf_keyword(&p)) {
+	case SVF_KW_SDR:
+	case SVF_KW_SIR:
+	case SVF_KW_HDR:
+	case SVF_KW_HIR:
+	case SVF_KW_TDR:
+	case SVF_KW_TIR:
+		break;
+	default:
+		return 0;
+	}
+
+	c->bits.len = 0;
+	for (i=0; i<5; i++)
+		c->bits.data[i] = (void*)0;
 	while (*p >= '0' && *p <= '9') {
-		bd->len = bd->len * 10 + (*p - '0');
+		c->bits.len = c->bits.len * 10 + (*p - '0');
 		p++;
 	}
-	while (*p == ' ') {
+	while (*p == ' ')
 		p++;
-	}
-	if (bd->len != bd->alloced_len) {
-		bitdata_free(h, bd, offset);
-		bd->alloced_len = bd->len;
-		bd->alloced_bytes = (bd->len+7) / 8;
-	}
+
+	int nbytes = (c->bits.len+7) / 8;
 	while (*p)
 	{
-		int memnum = 0;
-		unsigned char **dp = (void*)0;
-		if (!strtokencmp(p, "TDI")) {
-			p += strtokenskip(p);
-			dp = &bd->tdi_data;
-			memnum = 0;
-		}
-		if (!strtokencmp(p, "TDO")) {
-			p += strtokenskip(p);
-			dp = &bd->tdo_data;
-			bd->has_tdo_data = 1;
-			memnum = 1;
-		}
-		if (!strtokencmp(p, "SMASK")) {
-			p += strtokenskip(p);
-			dp = &bd->tdi_mask;
-			memnum = 2;
-		}
-		if (!strtokencmp(p, "MASK")) {
-			p += strtokenskip(p);
-			dp = &bd->tdo_mask;
-			memnum = 3;
-		}
-		if (!strtokencmp(p, "RMASK")) {
-			p += strtokenskip(p);
-			dp = &bd->ret_mask;
-			memnum = 4;
-		}
-		if (!dp)
-			return (void*)0;
-		if (*dp == (void*)0) {
-			*dp = LIBXSVF_HOST_REALLOC(*dp, bd->alloced_bytes, offset+memnum);
-		}
-		if (*dp == (void*)0) {
-			LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
-			return (void*)0;
-		}
+		int memnum = bitdata_keyword(&p);
+		if (memnum < 0 || *p != '(' || used + nbytes > c->data_size)
+			return 0;
+		p++;
 
-		unsigned char *d = *dp;
-		for (i=0; i<bd->alloced_bytes; i++)
+		unsigned char *d = c->bits.data[memnum] = c->data + used;
+		used += nbytes;
+		for (i=0; i<nbytes; i++)
 			d[i] = 0;
 
-		if (*p != '(')
-			return (void*)0;
-		p++;
-
 		int hexdigits = 0;
-		for (i=0; (p[i] >= 'A' && p[i] <= 'F') || (p[i] >= '0' && p[i] <= '9'); i++)
+		for (i=0; svf_ishex(p[i]); i++)
 			hexdigits++;
+		for (; hexdigits > nbytes*2 && *p == '0'; hexdigits--)
+			p++;
+		if (hexdigits > nbytes*2 || p[hexdigits] != ')')
+			return 0;
 
-		i = bd->alloced_bytes*2 - hexdigits;
-		for (j=0; j<hexdigits; j++, i++, p++) {
-			if (i%2 == 0) {
-				d[i/2] |= hex(*p) << 4;
-			} else {
-				d[i/2] |= hex(*p);
-			}
-		}
-
-		if (*p != ')')
-			return (void*)0;
-		p++;
-		while (*p == ' ') {
+		if (parallel)
+			hex_decode(h, d, nbytes*2 - hexdigits, p, hexdigits);
+		else
+			hex_decode_range(d, nbytes*2 - hexdigits, p, hexdigits);
+		p += hexdigits + 1;
+		while (*p == ' ')
 			p++;
-		}
-	}
-#if 0
-	/* Debugging Output, needs <stdio.h> */
-	printf("--- Parsed bitdata [%d] ---\n", bd->len);
-	if (bd->tdi_data) {
-		printf("TDI DATA:");
-		for (i=0; i<bd->alloced_bytes; i++)
-			printf(" %02x", bd->tdi_data[i]);
-		printf("\n");
-	}
-	if (bd->tdo_data && has_tdo_data) {
-		printf("TDO DATA:");
-		for (i=0; i<bd->alloced_bytes; i++)
-			printf(" %02x", bd->tdo_data[i]);
-		printf("\n");
 	}
-	if (bd->tdi_mask) {
-		printf("TDI MASK:");
+	return 1;
+}
+
+/* copy the bit data decoded by bitdata_compile() to the player's buffers */
+static const char *bitdata_load(struct libxsvf_host *h, const char *p, struct svf_bits *bits, struct bitdata_s *bd, int offset)
+{
+	int i, memnum;
+
+	bitdata_setlen(h, bd, bits->len, offset);
+	for (memnum=0; memnum<5; memnum++)
+	{
+		if (!bits->data[memnum])
+			continue;
+		if (memnum == 1)
+			bd->has_tdo_data = 1;
+		unsigned char *d = bitdata_alloc(h, bd, memnum, offset);
+		if (!d)
+			return (void*)0;
 		for (i=0; i<bd->alloced_bytes; i++)
-			printf(" %02x", bd->tdi_mask[i]);
-		printf("\n");
+			d[i] = bits->data[memnum][i];
 	}
-	if (bd->tdo_mask) {
-		printf("TDO MASK:");
-		for (i=0; i<bd->alloced_bytes; i++)
-			printf(" %02x", bd->tdo_mask[i]);
-		printf("\n");
+	return p + strlen(p);
+}
+
+static void svf_batch_compile(void *arg, int i)
+{
+	struct svf_batch *b = arg;
+	struct svf_cmd *c = &b->cmds[i];
+	struct libxsvf_srcpos pos = { 0, 0, 0, 0 };
+
+	c->rc = read_command(b->h, &c->src, &pos, &c->text, &c->text_size, 0);
+	c->line = pos.line;
+	c->newlines = pos.next_line;
+	c->has_bits = 0;
+
+	/* the prescan must have found exactly one command */
+	while (c->rc == 1 && c->src.p < c->src.end) {
+		if ((unsigned char)*c->src.p++ > ' ')
+			c->rc = -2;
 	}
-#endif
-	return p;
+	if (c->rc == 1)
+		c->has_bits = bitdata_compile(b->h, c, b->num == 1);
 }
 
-static int getbit(unsigned char *data, int n)
+static int svf_batch_alloc(struct libxsvf_host *h, struct svf_batch *b, long size)
 {
-	return (data[n/8] & (1 << (7 - n%8))) ? 1 : 0;
+	if (size > b->buf_size) {
+		char *buf = LIBXSVF_HOST_REALLOC(b->buf, size, LIBXSVF_MEM_SVF_BATCH);
+		if (!buf) {
+			LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
+			return -1;
+		}
+		b->buf = buf;
+		b->buf_size = size;
+	}
+	b->cmds = (struct svf_cmd*)b->buf;
+	return 0;
 }
 
-static int bitdata_play(struct libxsvf_host *h, struct bitdata_s *bd, enum libxsvf_tap_state estate)
+/* prescan and parse the next batch of commands, returns -1 on error */
+static int svf_batch_fill(struct libxsvf_host *h, struct svf_batch *b)
 {
-	int left_padding = (8 - bd->len % 8) % 8;
-	int tdo_error = 0;
-	int tms = 0;
+	long header = sizeof(struct svf_cmd) * LIBXSVF_SVF_BATCH_SIZE;
+	long pos = h->input_pos, size = 0;
 	int i;
 
-	for (i=bd->len+left_padding-1; i >= left_padding; i--) {
-		if (i == left_padding && h->tap_state != estate) {
-			h->tap_state++;
-			tms = 1;
-		}
-		int tdi = -1;
-		if (bd->tdi_data) {
-			if (!bd->tdi_mask || getbit(bd->tdi_mask, i))
-				tdi = getbit(bd->tdi_data, i);
-		}
-		int tdo = -1;
-		if (bd->tdo_data && bd->has_tdo_data && (!bd->tdo_mask || getbit(bd->tdo_mask, i)))
-			tdo = getbit(bd->tdo_data, i);
-		int rmask = bd->ret_mask && getbit(bd->ret_mask, i);
-		if (LIBXSVF_HOST_PULSE_TCK(tms, tdi, tdo, rmask, 0) < 0)
-			tdo_error = 1;
+	b->num = 0;
+	b->index = 0;
+
+	if (svf_batch_alloc(h, b, header) < 0)
+		return -1;
+
+	while (b->num < LIBXSVF_SVF_BATCH_SIZE) {
+		long len = svf_prescan(h->input_data + pos, h->input_size - pos);
+		if (len < 0 || len > LIBXSVF_SVF_BATCH_BYTES || size + 3*len+32 > 3*(long)LIBXSVF_SVF_BATCH_BYTES+32)
+			break;
+		b->cmds[b->num].src.p = h->input_data + pos;
+		b->cmds[b->num].src.end = h->input_data + pos + len;
+		b->num++;
+		pos += len;
+		size += 3*len+32;
 	}
 
-	if (tms)
-		LIBXSVF_HOST_REPORT_TAPSTATE();
+	if (b->num == 0)
+		return 0;
+
+	if (svf_batch_alloc(h, b, header + size) < 0) {
+		b->num = 0;
+		return -1;
+	}
+
+	/* normalized text (<= 2*len+16) and decoded data (<= len+16) */
+	char *buf = b->buf + header;
+	for (i=0; i<b->num; i++) {
+		struct svf_cmd *c = &b->cmds[i];
+		long len = c->src.end - c->src.p;
+		c->text = buf;
+		c->text_size = 2*len+16;
+		c->data = (unsigned char*)buf + c->text_size;
+		c->data_size = len+16;
+		buf += 3*len+32;
+	}
 
-	if (!tdo_error)
+	if (b->num > 1 && LIBXSVF_HOST_HAS_PARALLEL() && LIBXSVF_HOST_PARALLEL(b->num, svf_batch_compile, b) == 0)
 		return 0;
+	for (i=0; i<b->num; i++)
+		svf_batch_compile(b, i);
+	return 0;
+}
 
-	LIBXSVF_HOST_REPORT_ERROR("TDO mismatch.");
-	return -1;
+/* read the next command, from the batch parser if the input is in memory */
+static int svf_next_command(struct libxsvf_host *h, struct svf_batch *b, char **buffer_p, int *len_p,
+		const char **command, struct svf_bits **bits)
+{
+	*bits = (void*)0;
+
+	if (h->input_data && b->index == b->num && svf_batch_fill(h, b) < 0)
+		return -1;
+
+	if (b->index < b->num) {
+		struct svf_cmd *c = &b->cmds[b->index++];
+		if (c->rc == -2) {
+			char message[128];
+			sprintf(message, "Line %ld: SVF Syntax Error: unexpected text after ';':", h->srcpos.next_line + c->line);
+			LIBXSVF_HOST_REPORT_ERROR(message);
+			LIBXSVF_HOST_REPORT_ERROR(c->text);
+		}
+		if (c->rc != 1)
+			return -1;
+		h->srcpos.line = h->srcpos.next_line + c->line;
+		h->srcpos.next_line += c->newlines;
+		h->input_pos = c->src.end - h->input_data;
+		*command = c->text;
+		if (c->has_bits)
+			*bits = &c->bits;
+		return 1;
+	}
+
+	int rc = read_command(h, (void*)0, &h->srcpos, buffer_p, len_p, LIBXSVF_SVF_STREAM_BITS);
+	*command = *buffer_p;
+	return rc;
 }
 
 /*
@@ -374,6 +1516,8 @@ int libxsvf_feed(struct libxsvf_host *h, char *buf, int len)
 	static int state_run = LIBXSVF_TAP_IDLE;
 	static int state_endrun = LIBXSVF_TAP_IDLE;
 
+	static struct svf_block blk;
+
         static int cmd_count = 0;
         static char cmd_reportstring[256];
 
@@ -396,6 +1540,8 @@ int libxsvf_feed(struct libxsvf_host *h, char *buf, int len)
 		state_run = LIBXSVF_TAP_IDLE;
 		state_endrun = LIBXSVF_TAP_IDLE;
 
+		block_init(h, &blk);
+
 		cmd_count = 0;
 		cmd_reportstring[0] = '\0';
 
@@ -405,8 +1551,11 @@ int libxsvf_feed(struct libxsvf_host *h, char *buf, int len)
         if(len == 0)
         {
 		/* zero len means the end of stream */
+		if (rc >= 0 && block_commit(h, &blk) < 0)
+			rc = -1;
+
 		if (LIBXSVF_HOST_SYNC() != 0 && rc >= 0 ) {
-			LIBXSVF_HOST_REPORT_ERROR("TDO mismatch.");
+			libxsvf_report_mismatch(h);
 			rc = -1;
 		}
 
@@ -416,6 +1565,7 @@ int libxsvf_feed(struct libxsvf_host *h, char *buf, int len)
 		bitdata_free(h, &bd_tir, LIBXSVF_MEM_SVF_TIR_TDI_DATA);
 		bitdata_free(h, &bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA);
 		bitdata_free(h, &bd_sir, LIBXSVF_MEM_SVF_SIR_TDI_DATA);
+		block_free(h, &blk);
 
 		LIBXSVF_HOST_REALLOC(command_buffer, 0, LIBXSVF_MEM_SVF_COMMANDBUF);
 		return -1;
@@ -424,7 +1574,7 @@ int libxsvf_feed(struct libxsvf_host *h, char *buf, int len)
         /* Buffer and len are not null - process chunk of data */
 	if(1)
 	{
-		rc = read_command(h, &command_buffer, &command_buffer_len);
+		rc = read_command(h, (void*)0, &h->srcpos, &command_buffer, &command_buffer_len, 0);
 		if (rc <= 0)
 			return rc;
 
@@ -441,30 +1591,36 @@ int libxsvf_feed(struct libxsvf_host *h, char *buf, int len)
 
 		LIBXSVF_HOST_REPORT_STATUS(command_buffer);
 
-		if (!strtokencmp(p, "ENDIR")) {
-			p += strtokenskip(p);
-			state_endir = token2tapstate(p);
+		h->srcpos.command++;
+		h->srcpos.bit = 0;
+
+		int cp_rc = libxsvf_checkpoint_next(h);
+		if (cp_rc < 0)
+			goto error;
+		if (cp_rc > 0 && svf_resume(h, &blk) < 0)
+			goto error;
+
+		switch (svf_keyword(&p)) {
+		case SVF_KW_NONE:
+			break;
+
+		case SVF_KW_ENDIR:
+			state_endir = keyword2tapstate(svf_keyword(&p));
 			if (state_endir < 0)
 				goto syntax_error;
-			p += strtokenskip(p);
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "ENDDR")) {
-			p += strtokenskip(p);
-			state_enddr = token2tapstate(p);
-			if (state_endir < 0)
+		case SVF_KW_ENDDR:
+			state_enddr = keyword2tapstate(svf_keyword(&p));
+			if (state_enddr < 0)
 				goto syntax_error;
-			p += strtokenskip(p);
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "FREQUENCY")) {
+		case SVF_KW_FREQUENCY: {
 			unsigned long number = 0;
 			int got_decimal_point = 0;
 			int decimal_digits = 0;
 			int exp = 0;
-			p += strtokenskip(p);
 			if (*p < '0' || *p > '9')
 				goto syntax_error;
 			while ((*p >= '0' && *p <= '9') || (*p == '.')) {
@@ -495,61 +1651,58 @@ int libxsvf_feed(struct libxsvf_host *h, char *buf, int len)
 				p++;
 			}
 			p += strtokenskip(p);
-			if (LIBXSVF_HOST_SET_FREQUENCY(number) < 0) {
+			if (block_commit(h, &blk) < 0)
+				goto error;
+			if (svf_frequency(h, &blk, number) < 0) {
 				LIBXSVF_HOST_REPORT_ERROR("FREQUENCY command failed!");
 				goto error;
 			}
 			goto eol_check;
 		}
 
-		if (!strtokencmp(p, "HDR")) {
-			p += strtokenskip(p);
+		case SVF_KW_HDR:
 			p = bitdata_parse(h, p, &bd_hdr, LIBXSVF_MEM_SVF_HDR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "HIR")) {
-			p += strtokenskip(p);
+		case SVF_KW_HIR:
 			p = bitdata_parse(h, p, &bd_hir, LIBXSVF_MEM_SVF_HIR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "PIO") || !strtokencmp(p, "PIOMAP")) {
+		case SVF_KW_PIO:
+		case SVF_KW_PIOMAP:
 			goto unsupported_error;
-		}
 
-		if (!strtokencmp(p, "RUNTEST")) {
-			p += strtokenskip(p);
+		case SVF_KW_RUNTEST: {
 			int tck_count = -1;
 			int sck_count = -1;
 			int min_time = -1;
 			int max_time = -1;
 			while (*p) {
 			        // printf("parsing p=\"%s\"\n", p);
+				int kw = svf_keyword(&p);
 				int got_maximum = 0;
-				if (!strtokencmp(p, "MAXIMUM")) {
-					p += strtokenskip(p);
+				if (kw == SVF_KW_MAXIMUM) {
+					kw = svf_keyword(&p);
 					got_maximum = 1;
 				}
 				int got_endstate = 0;
-				if (!strtokencmp(p, "ENDSTATE")) {
-					p += strtokenskip(p);
+				if (kw == SVF_KW_ENDSTATE) {
+					kw = svf_keyword(&p);
 					got_endstate = 1;
 				}
-				int st = token2tapstate(p);
+				int st = keyword2tapstate(kw);
 				if (st >= 0) {
-					p += strtokenskip(p);
 					if (got_endstate)
 						state_endrun = st;
 					else
 						state_run = st;
 					continue;
 				}
-				if (*p < '0' || *p > '9')
+				if (kw != SVF_KW_NONE || *p < '0' || *p > '9')
 					goto syntax_error;
 				int number = 0;
 				int exp = 0, expsign = 1;
@@ -600,132 +1753,113 @@ int libxsvf_feed(struct libxsvf_host *h, char *buf, int len)
 				while (*p == ' ') {
 					p++;
 				}
-				if (!strtokencmp(p, "SEC")) {
-					p += strtokenskip(p);
+				switch (svf_keyword(&p)) {
+				case SVF_KW_SEC:
 					if (got_maximum)
 						max_time = number_e6;
 					else
 						min_time = number_e6;
 					continue;
-				}
-				if (!strtokencmp(p, "TCK")) {
-					p += strtokenskip(p);
+				case SVF_KW_TCK:
 					tck_count = number;
 					continue;
-				}
-				if (!strtokencmp(p, "SCK")) {
-					p += strtokenskip(p);
+				case SVF_KW_SCK:
 					sck_count = number;
 					continue;
 				}
 				goto syntax_error;
 			}
-			if (libxsvf_tap_walk(h, state_run) < 0)
+			if (svf_tap(h, &blk, state_run) < 0)
 				goto error;
 			if (max_time >= 0) {
 				LIBXSVF_HOST_REPORT_ERROR("WARNING: Maximum time in SVF RUNTEST command is ignored.");
 			}
-			if (sck_count >= 0) {
-				for (i=0; i < sck_count; i++) {
-					LIBXSVF_HOST_PULSE_SCK();
-				}
-			}
-			if (min_time >= 0 || tck_count >= 0) {
-				LIBXSVF_HOST_UDELAY(min_time >= 0 ? min_time : 0, 0, tck_count >= 0 ? tck_count : 0);
-			}
-			if (libxsvf_tap_walk(h, state_endrun) < 0)
+			if (svf_runtest(h, &blk, min_time, tck_count, sck_count) < 0)
+				goto error;
+			if (svf_tap(h, &blk, state_endrun) < 0)
 				goto error;
 			goto eol_check;
 		}
 
-		if (!strtokencmp(p, "SDR")) {
-			p += strtokenskip(p);
+		case SVF_KW_SDR:
 			p = bitdata_parse(h, p, &bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
-			if (libxsvf_tap_walk(h, LIBXSVF_TAP_DRSHIFT) < 0)
+			if (svf_tap(h, &blk, LIBXSVF_TAP_DRSHIFT) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_hdr, bd_sdr.len+bd_tdr.len > 0 ? LIBXSVF_TAP_DRSHIFT : state_enddr) < 0)
+			if (svf_shift(h, &blk, &bd_hdr, bd_sdr.len+bd_tdr.len > 0 ? LIBXSVF_TAP_DRSHIFT : state_enddr) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_sdr, bd_tdr.len > 0 ? LIBXSVF_TAP_DRSHIFT : state_enddr) < 0)
+			if (svf_shift(h, &blk, &bd_sdr, bd_tdr.len > 0 ? LIBXSVF_TAP_DRSHIFT : state_enddr) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_tdr, state_enddr) < 0)
+			if (svf_shift(h, &blk, &bd_tdr, state_enddr) < 0)
 				goto error;
-			if (libxsvf_tap_walk(h, state_enddr) < 0)
+			if (svf_tap(h, &blk, state_enddr) < 0)
 				goto error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "SIR")) {
-			p += strtokenskip(p);
+		case SVF_KW_SIR:
 			p = bitdata_parse(h, p, &bd_sir, LIBXSVF_MEM_SVF_SIR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
-			if (libxsvf_tap_walk(h, LIBXSVF_TAP_IRSHIFT) < 0)
+			if (block_commit(h, &blk) < 0)
+				goto error;
+			if (libxsvf_checkpoint_boundary(h) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_hir, bd_sir.len+bd_tir.len > 0 ? LIBXSVF_TAP_IRSHIFT : state_endir) < 0)
+			if (svf_tap(h, &blk, LIBXSVF_TAP_IRSHIFT) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_sir, bd_tir.len > 0 ? LIBXSVF_TAP_IRSHIFT : state_endir) < 0)
+			if (svf_shift(h, &blk, &bd_hir, bd_sir.len+bd_tir.len > 0 ? LIBXSVF_TAP_IRSHIFT : state_endir) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_tir, state_endir) < 0)
+			if (svf_shift(h, &blk, &bd_sir, bd_tir.len > 0 ? LIBXSVF_TAP_IRSHIFT : state_endir) < 0)
 				goto error;
-			if (libxsvf_tap_walk(h, state_endir) < 0)
+			if (svf_shift(h, &blk, &bd_tir, state_endir) < 0)
+				goto error;
+			if (svf_tap(h, &blk, state_endir) < 0)
 				goto error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "STATE")) {
-			p += strtokenskip(p);
+		case SVF_KW_STATE:
 			while (*p) {
-				int st = token2tapstate(p);
+				int st = keyword2tapstate(svf_keyword(&p));
 				if (st < 0)
 					goto syntax_error;
-				if (libxsvf_tap_walk(h, st) < 0)
+				if (svf_tap(h, &blk, st) < 0)
 					goto error;
-				p += strtokenskip(p);
 			}
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "TDR")) {
-			p += strtokenskip(p);
+		case SVF_KW_TDR:
 			p = bitdata_parse(h, p, &bd_tdr, LIBXSVF_MEM_SVF_TDR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "TIR")) {
-			p += strtokenskip(p);
+		case SVF_KW_TIR:
 			p = bitdata_parse(h, p, &bd_tir, LIBXSVF_MEM_SVF_TIR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "TRST")) {
-			p += strtokenskip(p);
-			if (!strtokencmp(p, "ON")) {
-				p += strtokenskip(p);
-				LIBXSVF_HOST_SET_TRST(1);
+		case SVF_KW_TRST:
+			if (block_commit(h, &blk) < 0)
+				goto error;
+			switch (svf_keyword(&p)) {
+			case SVF_KW_ON:
+				svf_trst(h, &blk, 1);
 				goto eol_check;
-			}
-			if (!strtokencmp(p, "OFF")) {
-				p += strtokenskip(p);
-				LIBXSVF_HOST_SET_TRST(0);
+			case SVF_KW_OFF:
+				svf_trst(h, &blk, 0);
 				goto eol_check;
-			}
-			if (!strtokencmp(p, "Z")) {
-				p += strtokenskip(p);
-				LIBXSVF_HOST_SET_TRST(-1);
+			case SVF_KW_Z:
+				svf_trst(h, &blk, -1);
 				goto eol_check;
-			}
-			if (!strtokencmp(p, "ABSENT")) {
-				p += strtokenskip(p);
-				LIBXSVF_HOST_SET_TRST(-2);
+			case SVF_KW_ABSENT:
+				svf_trst(h, &blk, -2);
 				goto eol_check;
 			}
 			goto syntax_error;
+
+		default:
+			goto syntax_error;
 		}
 
 eol_check:
@@ -782,11 +1916,19 @@ int libxsvf_svf(struct libxsvf_host *h)
 	int state_run = LIBXSVF_TAP_IDLE;
 	int state_endrun = LIBXSVF_TAP_IDLE;
 
+	struct svf_block blk;
+	block_init(h, &blk);
+
+	struct svf_batch batch = { h, (void*)0, 0, 0, (void*)0, 0 };
+	struct svf_window window = { (void*)0, 0 };
+	struct svf_bits *bits;
+	const char *command;
+
         int cmd_count = 0;
         char cmd_reportstring[256];
 	while (1)
 	{
-		rc = read_command(h, &command_buffer, &command_buffer_len);
+		rc = svf_next_command(h, &batch, &command_buffer, &command_buffer_len, &command, &bits);
 
 		if (rc <= 0)
 			break;
@@ -800,34 +1942,40 @@ int libxsvf_svf(struct libxsvf_host *h)
 			LIBXSVF_HOST_REPORT_ERROR(cmd_reportstring);
 		}
 		#endif
-		const char *p = command_buffer;
+		const char *p = command;
 
-		LIBXSVF_HOST_REPORT_STATUS(command_buffer);
+		LIBXSVF_HOST_REPORT_STATUS(command);
 
-		if (!strtokencmp(p, "ENDIR")) {
-			p += strtokenskip(p);
-			state_endir = token2tapstate(p);
+		h->srcpos.command++;
+		h->srcpos.bit = 0;
+
+		int cp_rc = libxsvf_checkpoint_next(h);
+		if (cp_rc < 0)
+			goto error;
+		if (cp_rc > 0 && svf_resume(h, &blk) < 0)
+			goto error;
+
+		switch (svf_keyword(&p)) {
+		case SVF_KW_NONE:
+			break;
+
+		case SVF_KW_ENDIR:
+			state_endir = keyword2tapstate(svf_keyword(&p));
 			if (state_endir < 0)
 				goto syntax_error;
-			p += strtokenskip(p);
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "ENDDR")) {
-			p += strtokenskip(p);
-			state_enddr = token2tapstate(p);
-			if (state_endir < 0)
+		case SVF_KW_ENDDR:
+			state_enddr = keyword2tapstate(svf_keyword(&p));
+			if (state_enddr < 0)
 				goto syntax_error;
-			p += strtokenskip(p);
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "FREQUENCY")) {
+		case SVF_KW_FREQUENCY: {
 			unsigned long number = 0;
 			int got_decimal_point = 0;
 			int decimal_digits = 0;
 			int exp = 0;
-			p += strtokenskip(p);
 			if (*p < '0' || *p > '9')
 				goto syntax_error;
 			while ((*p >= '0' && *p <= '9') || (*p == '.')) {
@@ -858,61 +2006,60 @@ int libxsvf_svf(struct libxsvf_host *h)
 				p++;
 			}
 			p += strtokenskip(p);
-			if (LIBXSVF_HOST_SET_FREQUENCY(number) < 0) {
+			if (block_commit(h, &blk) < 0)
+				goto error;
+			if (svf_frequency(h, &blk, number) < 0) {
 				LIBXSVF_HOST_REPORT_ERROR("FREQUENCY command failed!");
 				goto error;
 			}
 			goto eol_check;
 		}
 
-		if (!strtokencmp(p, "HDR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_hdr, LIBXSVF_MEM_SVF_HDR_TDI_DATA);
+		case SVF_KW_HDR:
+			p = bits ? bitdata_load(h, p, bits, &bd_hdr, LIBXSVF_MEM_SVF_HDR_TDI_DATA) :
+					bitdata_parse(h, p, &bd_hdr, LIBXSVF_MEM_SVF_HDR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "HIR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_hir, LIBXSVF_MEM_SVF_HIR_TDI_DATA);
+		case SVF_KW_HIR:
+			p = bits ? bitdata_load(h, p, bits, &bd_hir, LIBXSVF_MEM_SVF_HIR_TDI_DATA) :
+					bitdata_parse(h, p, &bd_hir, LIBXSVF_MEM_SVF_HIR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "PIO") || !strtokencmp(p, "PIOMAP")) {
+		case SVF_KW_PIO:
+		case SVF_KW_PIOMAP:
 			goto unsupported_error;
-		}
 
-		if (!strtokencmp(p, "RUNTEST")) {
-			p += strtokenskip(p);
+		case SVF_KW_RUNTEST: {
 			int tck_count = -1;
 			int sck_count = -1;
 			int min_time = -1;
 			int max_time = -1;
 			while (*p) {
 			        // printf("parsing p=\"%s\"\n", p);
+				int kw = svf_keyword(&p);
 				int got_maximum = 0;
-				if (!strtokencmp(p, "MAXIMUM")) {
-					p += strtokenskip(p);
+				if (kw == SVF_KW_MAXIMUM) {
+					kw = svf_keyword(&p);
 					got_maximum = 1;
 				}
 				int got_endstate = 0;
-				if (!strtokencmp(p, "ENDSTATE")) {
-					p += strtokenskip(p);
+				if (kw == SVF_KW_ENDSTATE) {
+					kw = svf_keyword(&p);
 					got_endstate = 1;
 				}
-				int st = token2tapstate(p);
+				int st = keyword2tapstate(kw);
 				if (st >= 0) {
-					p += strtokenskip(p);
 					if (got_endstate)
 						state_endrun = st;
 					else
 						state_run = st;
 					continue;
 				}
-				if (*p < '0' || *p > '9')
+				if (kw != SVF_KW_NONE || *p < '0' || *p > '9')
 					goto syntax_error;
 				int number = 0;
 				int exp = 0, expsign = 1;
@@ -963,132 +2110,121 @@ int libxsvf_svf(struct libxsvf_host *h)
 				while (*p == ' ') {
 					p++;
 				}
-				if (!strtokencmp(p, "SEC")) {
-					p += strtokenskip(p);
+				switch (svf_keyword(&p)) {
+				case SVF_KW_SEC:
 					if (got_maximum)
 						max_time = number_e6;
 					else
 						min_time = number_e6;
 					continue;
-				}
-				if (!strtokencmp(p, "TCK")) {
-					p += strtokenskip(p);
+				case SVF_KW_TCK:
 					tck_count = number;
 					continue;
-				}
-				if (!strtokencmp(p, "SCK")) {
-					p += strtokenskip(p);
+				case SVF_KW_SCK:
 					sck_count = number;
 					continue;
 				}
 				goto syntax_error;
 			}
-			if (libxsvf_tap_walk(h, state_run) < 0)
+			if (svf_tap(h, &blk, state_run) < 0)
 				goto error;
 			if (max_time >= 0) {
 				LIBXSVF_HOST_REPORT_ERROR("WARNING: Maximum time in SVF RUNTEST command is ignored.");
 			}
-			if (sck_count >= 0) {
-				for (i=0; i < sck_count; i++) {
-					LIBXSVF_HOST_PULSE_SCK();
-				}
-			}
-			if (min_time >= 0 || tck_count >= 0) {
-				LIBXSVF_HOST_UDELAY(min_time >= 0 ? min_time : 0, 0, tck_count >= 0 ? tck_count : 0);
-			}
-			if (libxsvf_tap_walk(h, state_endrun) < 0)
+			if (svf_runtest(h, &blk, min_time, tck_count, sck_count) < 0)
+				goto error;
+			if (svf_tap(h, &blk, state_endrun) < 0)
 				goto error;
 			goto eol_check;
 		}
 
-		if (!strtokencmp(p, "SDR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA);
+		case SVF_KW_SDR:
+			if (rc == 3)
+				p = bitdata_stream(h, p, &bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA, &window);
+			else if (bits)
+				p = bitdata_load(h, p, bits, &bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA);
+			else
+				p = bitdata_parse(h, p, &bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
-			if (libxsvf_tap_walk(h, LIBXSVF_TAP_DRSHIFT) < 0)
+			if (svf_tap(h, &blk, LIBXSVF_TAP_DRSHIFT) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_hdr, bd_sdr.len+bd_tdr.len > 0 ? LIBXSVF_TAP_DRSHIFT : state_enddr) < 0)
+			if (svf_shift(h, &blk, &bd_hdr, bd_sdr.len+bd_tdr.len > 0 ? LIBXSVF_TAP_DRSHIFT : state_enddr) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_sdr, bd_tdr.len > 0 ? LIBXSVF_TAP_DRSHIFT : state_enddr) < 0)
+			if (svf_shift(h, &blk, &bd_sdr, bd_tdr.len > 0 ? LIBXSVF_TAP_DRSHIFT : state_enddr) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_tdr, state_enddr) < 0)
+			if (svf_shift(h, &blk, &bd_tdr, state_enddr) < 0)
 				goto error;
-			if (libxsvf_tap_walk(h, state_enddr) < 0)
+			if (svf_tap(h, &blk, state_enddr) < 0)
 				goto error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "SIR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_sir, LIBXSVF_MEM_SVF_SIR_TDI_DATA);
+		case SVF_KW_SIR:
+			p = bits ? bitdata_load(h, p, bits, &bd_sir, LIBXSVF_MEM_SVF_SIR_TDI_DATA) :
+					bitdata_parse(h, p, &bd_sir, LIBXSVF_MEM_SVF_SIR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
-			if (libxsvf_tap_walk(h, LIBXSVF_TAP_IRSHIFT) < 0)
+			if (block_commit(h, &blk) < 0)
+				goto error;
+			if (libxsvf_checkpoint_boundary(h) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_hir, bd_sir.len+bd_tir.len > 0 ? LIBXSVF_TAP_IRSHIFT : state_endir) < 0)
+			if (svf_tap(h, &blk, LIBXSVF_TAP_IRSHIFT) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_sir, bd_tir.len > 0 ? LIBXSVF_TAP_IRSHIFT : state_endir) < 0)
+			if (svf_shift(h, &blk, &bd_hir, bd_sir.len+bd_tir.len > 0 ? LIBXSVF_TAP_IRSHIFT : state_endir) < 0)
 				goto error;
-			if (bitdata_play(h, &bd_tir, state_endir) < 0)
+			if (svf_shift(h, &blk, &bd_sir, bd_tir.len > 0 ? LIBXSVF_TAP_IRSHIFT : state_endir) < 0)
 				goto error;
-			if (libxsvf_tap_walk(h, state_endir) < 0)
+			if (svf_shift(h, &blk, &bd_tir, state_endir) < 0)
+				goto error;
+			if (svf_tap(h, &blk, state_endir) < 0)
 				goto error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "STATE")) {
-			p += strtokenskip(p);
+		case SVF_KW_STATE:
 			while (*p) {
-				int st = token2tapstate(p);
+				int st = keyword2tapstate(svf_keyword(&p));
 				if (st < 0)
 					goto syntax_error;
-				if (libxsvf_tap_walk(h, st) < 0)
+				if (svf_tap(h, &blk, st) < 0)
 					goto error;
-				p += strtokenskip(p);
 			}
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "TDR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_tdr, LIBXSVF_MEM_SVF_TDR_TDI_DATA);
+		case SVF_KW_TDR:
+			p = bits ? bitdata_load(h, p, bits, &bd_tdr, LIBXSVF_MEM_SVF_TDR_TDI_DATA) :
+					bitdata_parse(h, p, &bd_tdr, LIBXSVF_MEM_SVF_TDR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "TIR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_tir, LIBXSVF_MEM_SVF_TIR_TDI_DATA);
+		case SVF_KW_TIR:
+			p = bits ? bitdata_load(h, p, bits, &bd_tir, LIBXSVF_MEM_SVF_TIR_TDI_DATA) :
+					bitdata_parse(h, p, &bd_tir, LIBXSVF_MEM_SVF_TIR_TDI_DATA);
 			if (!p)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "TRST")) {
-			p += strtokenskip(p);
-			if (!strtokencmp(p, "ON")) {
-				p += strtokenskip(p);
-				LIBXSVF_HOST_SET_TRST(1);
+		case SVF_KW_TRST:
+			if (block_commit(h, &blk) < 0)
+				goto error;
+			switch (svf_keyword(&p)) {
+			case SVF_KW_ON:
+				svf_trst(h, &blk, 1);
 				goto eol_check;
-			}
-			if (!strtokencmp(p, "OFF")) {
-				p += strtokenskip(p);
-				LIBXSVF_HOST_SET_TRST(0);
+			case SVF_KW_OFF:
+				svf_trst(h, &blk, 0);
 				goto eol_check;
-			}
-			if (!strtokencmp(p, "Z")) {
-				p += strtokenskip(p);
-				LIBXSVF_HOST_SET_TRST(-1);
+			case SVF_KW_Z:
+				svf_trst(h, &blk, -1);
 				goto eol_check;
-			}
-			if (!strtokencmp(p, "ABSENT")) {
-				p += strtokenskip(p);
-				LIBXSVF_HOST_SET_TRST(-2);
+			case SVF_KW_ABSENT:
+				svf_trst(h, &blk, -2);
 				goto eol_check;
 			}
 			goto syntax_error;
+
+		default:
+			goto syntax_error;
 		}
 
 eol_check:
@@ -1104,14 +2240,17 @@ syntax_error:
 unsupported_error:
 			LIBXSVF_HOST_REPORT_ERROR("Error in SVF input: unsupported command:");
 		}
-		LIBXSVF_HOST_REPORT_ERROR(command_buffer);
+		LIBXSVF_HOST_REPORT_ERROR(command);
 error:
 		rc = -1;
 		break;
 	}
 
+	if (rc >= 0 && block_commit(h, &blk) < 0)
+		rc = -1;
+
 	if (LIBXSVF_HOST_SYNC() != 0 && rc >= 0 ) {
-		LIBXSVF_HOST_REPORT_ERROR("TDO mismatch.");
+		libxsvf_report_mismatch(h);
 		rc = -1;
 	}
 
@@ -1121,8 +2260,11 @@ error:
 	bitdata_free(h, &bd_tir, LIBXSVF_MEM_SVF_TIR_TDI_DATA);
 	bitdata_free(h, &bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA);
 	bitdata_free(h, &bd_sir, LIBXSVF_MEM_SVF_SIR_TDI_DATA);
+	block_free(h, &blk);
 
 	LIBXSVF_HOST_REALLOC(command_buffer, 0, LIBXSVF_MEM_SVF_COMMANDBUF);
+	LIBXSVF_HOST_REALLOC(batch.buf, 0, LIBXSVF_MEM_SVF_BATCH);
+	LIBXSVF_HOST_REALLOC(window.buf, 0, LIBXSVF_MEM_SVF_HEX_WINDOW);
 
 	return rc;
 }
@@ -0,0 +1,108 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "libxsvf.h"
+
+/*
+ * Sync policy for asynchronous interfaces (see README). The players report
+ * every shift and delay here and the policy decides when the TDO checks
+ * must be synced. The time is estimated from the TCK frequency and the
+ * delays, so no clock is needed on the host.
+ */
+
+static int sync_now(struct libxsvf_host *h)
+{
+	struct libxsvf_sync_policy *p = h->sync_policy;
+
+	p->pending = 0;
+	p->cycles = 0;
+	p->usecs = 0;
+
+	if (LIBXSVF_HOST_HAS_SYNC_TAG()) {
+		LIBXSVF_HOST_SYNC_TAG();
+		return 0;
+	}
+
+	return LIBXSVF_HOST_SYNC() != 0 ? -1 : 0;
+}
+
+void libxsvf_sync_reset(struct libxsvf_host *h)
+{
+	struct libxsvf_sync_policy *p = h->sync_policy;
+
+	if (!p)
+		return;
+
+	p->pending = 0;
+	p->cycles = 0;
+	p->usecs = 0;
+}
+
+int libxsvf_sync_point(struct libxsvf_host *h, long cycles, long usecs, int checked)
+{
+	struct libxsvf_sync_policy *p = h->sync_policy;
+	long khz;
+
+	if (!p || (!p->pending && !checked))
+		return 0;
+
+	/* count from the first TDO check that has not been synced */
+	if (!p->pending) {
+		p->pending = 1;
+		p->cycles = 0;
+		p->usecs = 0;
+	}
+
+	p->cycles += cycles;
+	p->usecs += usecs;
+
+	khz = p->frequency / 1000;
+	if (khz > 0)
+		p->usecs += (cycles / khz) * 1000 + ((cycles % khz) * 1000) / khz;
+
+	if (p->max_cycles > 0 && p->cycles >= p->max_cycles)
+		return sync_now(h);
+
+	/* the sync point itself must fit in the budget */
+	if (p->max_usecs > 0 && p->usecs + p->sync_usecs >= p->max_usecs)
+		return sync_now(h);
+
+	return 0;
+}
+
+int libxsvf_sync_block(struct libxsvf_host *h)
+{
+	struct libxsvf_sync_policy *p = h->sync_policy;
+
+	if (!p || !p->block_sync || !p->pending)
+		return 0;
+
+	return sync_now(h);
+}
+
+void libxsvf_sync_cost(struct libxsvf_host *h, long usecs)
+{
+	struct libxsvf_sync_policy *p = h->sync_policy;
+
+	if (!p)
+		return;
+
+	p->sync_usecs = p->sync_usecs > 0 ? (7 * p->sync_usecs + usecs) / 8 : usecs;
+}
@@ -0,0 +1,271 @@
+#!/bin/sh
+#
+# Lib(X)SVF regression tests, run with "make check".
+
+set -e
+cd "$(dirname "$0")"
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+failed=0
+
+# check <name> [ svfcompare options ] < svf-data
+check() {
+	name=$1
+	shift
+	cat > "$tmp/$name.svf"
+	if ! ./svfcompare "$@" "$tmp/$name.svf" > "$tmp/$name.out" 2> "$tmp/$name.log"; then
+		cat "$tmp/$name.out"
+		cut -c1-200 "$tmp/$name.log"
+		failed=1
+	else
+		cat "$tmp/$name.out"
+	fi
+}
+
+# expect <name> <text>: the output of check <name> must contain <text>
+# (complete fields, up to the end of the line)
+expect() {
+	if ! grep -q " $2\( \|\$\)" "$tmp/$1.out"; then
+		echo "FAILED $1: expected $2"
+		failed=1
+	fi
+}
+
+# expect_error <name> <text>: check <name> must have reported <text>
+expect_error() {
+	if ! grep -qF "$2" "$tmp/$1.log"; then
+		echo "FAILED $1: expected error $2"
+		failed=1
+	fi
+}
+
+# check_xsvf <name> [ -f ] < xsvf-data
+# The static profile of the XSVF player (svfcompare-static) must play the
+# same TCK trace as the default build.
+check_xsvf() {
+	name=$1
+	shift
+	cat > "$tmp/$name.xsvf"
+	if ! ./svfcompare "$@" -x "$tmp/$name.xsvf" > "$tmp/$name.out" 2> "$tmp/$name.log" ||
+			! ./svfcompare-static "$@" -x "$tmp/$name.xsvf" > "$tmp/$name.static" 2>> "$tmp/$name.log" ||
+			! cmp -s "$tmp/$name.out" "$tmp/$name.static"; then
+		cat "$tmp/$name.out" "$tmp/$name.static"
+		cut -c1-200 "$tmp/$name.log"
+		failed=1
+	else
+		cat "$tmp/$name.out"
+	fi
+}
+
+# wait_for <file> <text>: wait up to 10 s until a server logged <text>
+wait_for() {
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		if grep -qF "$2" "$1"; then
+			return 0
+		fi
+		sleep 1
+	done
+	return 1
+}
+
+# xsvf <hex byte>...
+xsvf() {
+	for b in "$@"; do
+		printf "\\$(printf %o "0x$b")"
+	done
+}
+
+# four checked 8 bit scans, a new instruction and another checked scan (8 us
+# each at 1 MHz); the players sync twice at the end of the file
+scans() {
+	for i in 1 2 3 4; do
+		printf 'SDR 8 TDI (01) TDO (01);\n'
+	done
+	printf 'SIR 8 TDI (02);\nSDR 8 TDI (01) TDO (01);\n'
+}
+
+scans | check no-policy -p 0:0:0
+expect no-policy "syncs=2 tags=0"
+scans | check max-cycles -p 16:0:0
+expect max-cycles "syncs=4 tags=0"
+scans | check max-usecs -p 0:20:0
+expect max-usecs "syncs=4 tags=0"
+scans | check block-sync -p 0:0:1
+expect block-sync "syncs=3 tags=0"
+
+# sync points use sync_tag() if the host has it
+scans | check max-cycles-tags -t -p 16:0:0
+expect max-cycles-tags "syncs=2 tags=2"
+scans | check block-sync-tags -t -p 0:0:1
+expect block-sync-tags "syncs=2 tags=1"
+
+# unchecked scans never start a sync point
+printf 'SDR 8 TDI (01);\nSDR 8 TDI (01);\nSIR 8 TDI (02);\n' | check unchecked -p 8:8:1
+expect unchecked "syncs=2 tags=0"
+
+# four blocks with one checked scan each
+blocks() {
+	for i in 1 2 3 4; do
+		printf 'SIR 8 TDI (02);\nSDR 8 TDI (01) TDO (01);\n'
+	done
+}
+
+# the first check fails once: the block is replayed at half the frequency,
+# which is raised again after two clean blocks
+blocks | check block-retry -a -p 0:0:0:2:500000:2 -e 1
+expect block-retry "frequency=500000,1000000"
+blocks | check block-retry-sync -p 0:0:0:2:500000:2 -e 1
+expect block-retry-sync "frequency=500000,1000000"
+blocks | check block-retry-slow -a -p 0:0:0:2:500000:4 -e 1
+expect block-retry-slow "frequency=500000"
+
+# the first replay fails as well and halves the frequency again, a third
+# failure exceeds the block retries; without retries the file fails at once
+blocks | check block-retry-twice -a -p 0:0:0:2:250000:2 -e 1:16
+expect block-retry-twice "frequency=500000,250000,500000"
+blocks | check block-retry-failed -f -a -p 0:0:0:2:250000:2 -e 1:24
+blocks | check no-block-retry -f -a -p 0:0:0:0:500000:2 -e 1
+expect no-block-retry "syncs=2 tags=0"
+
+# all bits of a scan fail: the first failing bit is reported, also by
+# asynchronous hosts
+printf 'SDR 32 TDI (0) TDO (0) MASK (ffffffff);\n' | check mismatch-first -f -e 1:32
+expect_error mismatch-first "TDO mismatch in command 1 (line 1), bit 0: expected 0, got 1."
+printf 'SDR 32 TDI (0) TDO (0) MASK (ffffffff);\n' | check mismatch-first-async -f -a -p 0:0:0 -e 5:28
+expect_error mismatch-first-async "TDO mismatch in command 1 (line 1), bit 4: expected 0, got 1."
+
+# XREPEAT shifts are replayed from the first failing one (13 clocks each)
+{ xsvf 07 02  08 00 00 00 08  01 ff; for i in 1 2 3; do xsvf 09 1$i 1$i; done; xsvf 00; } | check xsvf-replay-all -x -a -e 1:8
+expect xsvf-replay-all "clocks=88"
+{ xsvf 07 02  08 00 00 00 08  01 ff; for i in 1 2 3; do xsvf 09 1$i 1$i; done; xsvf 00; } | check xsvf-replay-last -x -a -e 17:8
+expect xsvf-replay-last "clocks=62"
+
+# the XSVF player (XSDRSIZE 8, XTDOMASK ff, four XSDRTDO, XCOMPLETE)
+{ xsvf 08 00 00 00 08  01 ff; for i in 1 2 3 4; do xsvf 09 01 01; done; xsvf 00; } | check xsvf-max-cycles -x -p 16:0:0
+expect xsvf-max-cycles "syncs=4 tags=0"
+{ xsvf 08 00 00 00 08  01 ff; for i in 1 2 3 4; do xsvf 09 01 01; done; xsvf 00; } | check xsvf-max-usecs -x -p 0:20:0
+expect xsvf-max-usecs "syncs=3 tags=0"
+
+# resuming from a checkpoint plays the same TCK trace as the uninterrupted
+# run after it, with the END* states from before the checkpoint
+{ printf 'FREQUENCY 1E6 HZ;\nENDDR DRPAUSE;\n'
+  for i in 1 2 3 4 5 6; do printf 'SIR 8 TDI (0%d);\nSDR 8 TDI (1%d) TDO (1%d);\nRUNTEST 10 TCK;\n' $i $i $i; done
+} | check checkpoint -c 2
+expect checkpoint "resumed=12"
+{ printf 'ENDDR DRPAUSE;\n'
+  for i in 1 2 3 4; do printf 'SIR 8 TDI (0%d);\nSDR 8 TDI (1%d) TDO (1%d);\n' $i $i $i; done
+} | check checkpoint-drpause -c 2
+expect checkpoint-drpause "resumed=6"
+
+# the same for XSVF (XSIR and XSDRTDO after XREPEAT 0, XENDDR 1, XSDRSIZE
+# and XTDOMASK, and with the default XREPEAT)
+{ xsvf 07 00  14 01  08 00 00 00 08  01 ff
+  for i in 1 2 3 4; do xsvf 02 08 0$i  09 1$i 1$i; done; xsvf 00; } | check xsvf-checkpoint -x -c 2
+expect xsvf-checkpoint "resumed=9"
+{ xsvf 08 00 00 00 08  01 ff
+  for i in 1 2 3 4; do xsvf 02 08 0$i  09 1$i 1$i; done; xsvf 00; } | check xsvf-checkpoint-retries -x -c 2
+expect xsvf-checkpoint-retries "resumed=7"
+
+# comments end at any control character but tab (also in the prescan)
+printf 'SIR 8 TDI (01);\r! c\rSIR 8 TDI (02);\rSIR 8 TDI (03);\nSIR 8 TDI (04);\n' | check comment-cr
+printf 'SIR 8 TDI (01); // c\fSIR 8 TDI (02);\nSIR 8 TDI (03);\n' | check comment-ff
+printf 'SIR 8 TDI (01); ! a\tb ; c\nSIR 8 TDI (02);\n' | check comment-tab
+
+# text after the last ';' that is not a command
+printf 'SIR 8 TDI (01);\nSIR 8 TDI (02)\n' | check missing-semicolon -f
+
+# excess leading zeros in hex fields are valid, other excess digits are not
+printf 'HIR 0 TDI (0);\nHDR 0 TDI (00);\nSIR 8 TDI (0001) SMASK (00ff);\nSDR 4 TDI (0005) TDO (00a) MASK (0f);\n' | check leading-zeros
+printf 'SIR 8 TDI (101);\n' | check excess-digits -f
+awk 'BEGIN { printf "SDR 70000 TDI (000000"; for (i = 0; i < 17500; i++) printf "5"; printf ");\n" }' | check leading-zeros-stream
+awk 'BEGIN { printf "SDR 70000 TDI (1"; for (i = 0; i < 17500; i++) printf "5"; printf ");\n" }' | check excess-digits-stream -f
+
+# XSDRSIZE keeps the leading bytes of the TDO mask and data in the static
+# profile, also when they were read in place (above 16 bits)
+{ xsvf 08 00 00 00 08  01 ff; xsvf 08 00 00 00 20  01 0f 00 f0 00  09 01 02 03 04 12 34 56 78
+  xsvf 08 00 00 00 08  09 aa 55  03 aa; xsvf 00; } | check_xsvf xtdomask-in-place-to-static
+{ xsvf 08 00 00 00 08  01 0f  08 00 00 00 10  09 aa 55 12 34; xsvf 00; } | check_xsvf xtdomask-larger
+{ xsvf 08 00 00 00 08  01 0f  08 00 00 00 20  01 0f 00 f0 00  09 01 02 03 04 12 34 56 78; xsvf 00; } | check_xsvf xtdomask-larger-in-place
+{ xsvf 08 00 00 00 28  01 0f 00 f0 00 ff  08 00 00 00 20  09 01 02 03 04 12 34 56 78; xsvf 00; } | check_xsvf xtdomask-smaller-in-place
+{ xsvf 08 00 00 00 08  01 00  08 00 00 00 20  09 01 02 03 04 12 34 56 78; xsvf 00; } | check_xsvf xtdomask-zero-in-place
+
+# a TDO mask can't be kept for longer scans in place than it was read for
+{ xsvf 08 00 00 00 08  01 0f  08 00 00 00 20  09 01 02 03 04 12 34 56 78; xsvf 00; } > "$tmp/xtdomask-lost.xsvf"
+if ./svfcompare-static -f -x "$tmp/xtdomask-lost.xsvf" > /dev/null 2> "$tmp/xtdomask-lost.log" &&
+		grep -q "XSDRSIZE exceeds LIBXSVF_XSVF_MAX_DR_BITS and the last XTDOMASK" "$tmp/xtdomask-lost.log"; then
+	echo "ok $tmp/xtdomask-lost.xsvf: static profile fails"
+else
+	cat "$tmp/xtdomask-lost.log"
+	failed=1
+fi
+
+# xsvftoold: jobs on two simulated adapters (an IDCODE check that passes
+# and one that fails), then the counters and a quit that plays the queue
+idcode() {
+	printf 'TRST OFF;\nSTATE RESET;\nSIR 6 TDI (09);\nSDR 32 TDI (00000000) TDO (%s) MASK (FFFFFFFF);\nSTATE RESET;\n' "$1"
+}
+idcode 13631093 > "$tmp/idcode.svf"
+idcode 12345678 > "$tmp/idcode-wrong.svf"
+../xsvftoold -n 2 -S "$tmp/xsvftoold.sock" 2> "$tmp/xsvftoold.log" &
+daemon=$!
+printf 'svf 1 %s\nsvf 0 %s\n' "$tmp/idcode.svf" "$tmp/idcode-wrong.svf" | ./unixcat "$tmp/xsvftoold.sock" > "$tmp/xsvftoold.out"
+printf 'stats\nquit\n' | ./unixcat "$tmp/xsvftoold.sock" >> "$tmp/xsvftoold.out"
+if wait $daemon && grep -q "^done [0-9]* ok " "$tmp/xsvftoold.out" &&
+		grep -q "^done [0-9]* failed " "$tmp/xsvftoold.out" &&
+		grep -q "^jobs ok=1 failed=1 " "$tmp/xsvftoold.out" &&
+		[ "$(grep -c "^end$" "$tmp/xsvftoold.out")" = 2 ]; then
+	echo "ok xsvftoold: svf, stats and quit"
+else
+	echo "FAILED xsvftoold"
+	cat "$tmp/xsvftoold.out" "$tmp/xsvftoold.log"
+	failed=1
+fi
+
+# xsvftool-xvcd: a loopback server and the benchmark client checking TDO
+port=$((20000 + $$ % 20000))
+../xsvftool-xvcd -v -i loopback -a 127.0.0.1 -p $port 2> "$tmp/xvcd.log" &
+xvcd=$!
+: > "$tmp/xvcd.out"
+if wait_for "$tmp/xvcd.log" "Listening on port" &&
+		../xsvftool-xvcd -b -c -p $port -n 20 -l 4096 > "$tmp/xvcd.out" 2>> "$tmp/xvcd.log" &&
+		grep -q "^0 TDO bits differ" "$tmp/xvcd.out"; then
+	echo "ok xsvftool-xvcd: loopback shifts"
+else
+	echo "FAILED xsvftool-xvcd"
+	cat "$tmp/xvcd.out" "$tmp/xvcd.log"
+	failed=1
+fi
+kill $xvcd 2> /dev/null || true
+wait $xvcd || true
+
+# xsvftool-remote: the IDCODE SVF played through the stand-in servers
+for proto in rbb:-R xvc:-X; do
+	../xsvftool-remote -v -D ${proto%:*}:127.0.0.1:$port 2> "$tmp/remote.log" &
+	server=$!
+	: > "$tmp/remote.out"
+	if wait_for "$tmp/remote.log" "Listening on" &&
+			../xsvftool-remote ${proto#*:} 127.0.0.1:$port -s "$tmp/idcode.svf" > "$tmp/remote.out" 2>&1 &&
+			! ../xsvftool-remote ${proto#*:} 127.0.0.1:$port -s "$tmp/idcode-wrong.svf" >> "$tmp/remote.out" 2>&1; then
+		echo "ok xsvftool-remote: ${proto%:*} server"
+	else
+		echo "FAILED xsvftool-remote ${proto%:*}"
+		cat "$tmp/remote.out" "$tmp/remote.log"
+		failed=1
+	fi
+	kill $server 2> /dev/null || true
+	wait $server || true
+done
+
+# xsvftool-gang: four adapters playing the IDCODE SVF, the third one faulty
+../xsvftool-gang -n 4 -f 2 -s "$tmp/idcode.svf" > "$tmp/gang.out" 2>&1 && rc=0 || rc=$?
+if [ $rc = 1 ] && [ "$(grep -c ": FAILED," "$tmp/gang.out")" = 1 ] &&
+		grep -q "^adapter 2: FAILED," "$tmp/gang.out" && [ "$(grep -c ": ok," "$tmp/gang.out")" = 3 ]; then
+	echo "ok xsvftool-gang: one failed adapter"
+else
+	echo "FAILED xsvftool-gang: rc=$rc"
+	cat "$tmp/gang.out"
+	failed=1
+fi
+
+exit $failed
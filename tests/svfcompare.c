@@ -0,0 +1,321 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * Regression test for the SVF and XSVF players: play a file once without a
+ * policy and once with the policy given on the command line and compare
+ * the results and the clock cycles. The output line reports how often
+ * the second run called sync() and sync_tag() and the TCK frequencies it
+ * set. The second run is repeated from memory (input_data, i.e. the batch
+ * parser for SVF), which must give the same result and TCK trace.
+ *
+ * Usage: svfcompare [ -f ] [ -x ] [ -a ] [ -t ]
+ *        [ -p max_cycles:max_usecs:block_sync[:block_retries:min_frequency:clean_blocks] ]
+ *        [ -e check[:count] ] [ -c interval ] file
+ *
+ * Without -f both runs must succeed, with -f both runs must fail. The
+ * exit code is 0 if the runs agree and 1 otherwise. With -x the file is
+ * played as XSVF, with -t the host implements sync_tag(). The policy
+ * assumes a TCK frequency of 1 MHz.
+ *
+ * With -a the second run uses an asynchronous host, that reports TDO
+ * mismatches only in the next sync(). With -e the second run reads the
+ * wrong TDO level for <count> (default 1) TDO checks, starting with the
+ * <check>-th check (counted from 1). The TCK traces are not compared then.
+ *
+ * With -c the second run reports checkpoints every <interval> commands and
+ * a third run resumes from the middle one. The TCK trace of the third run
+ * must end with the trace of the second run after that checkpoint.
+ *
+ * svfcompare-static is linked with the XSVF player built for the static
+ * profile (LIBXSVF_XSVF_STATIC) with 16 bit DR buffers. It plays XSVF
+ * files from memory only, as longer scans are shifted in place from the
+ * input. The output line includes a hash of the TCK trace, so that
+ * run.sh can compare it with the default build.
+ */
+
+#include "../libxsvf.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define MAX_CHECKPOINTS 64
+
+struct options_s {
+	struct libxsvf_sync_policy *policy;
+	struct libxsvf_checkpoint *checkpoint;
+	int tags, async, in_memory;
+	long error_check, error_count;
+};
+
+struct udata_s {
+	FILE *f;
+	unsigned long clocks;
+	unsigned long hash;
+	unsigned char *trace;
+	int syncs, tags;
+	int async, mismatch;
+	long checks, error_check, error_count;
+	char frequencies[256];
+	int num_checkpoints;
+	struct libxsvf_checkpoint checkpoints[MAX_CHECKPOINTS];
+	unsigned long checkpoint_clocks[MAX_CHECKPOINTS];
+};
+
+static void add_clock(struct udata_s *u, int tms, int tdi, int tdo, int rmask)
+{
+	int code = tms*27 + (tdi+1)*9 + (tdo+1)*3 + rmask;
+	if ((u->clocks & 4095) == 0)
+		u->trace = realloc(u->trace, u->clocks + 4096);
+	u->trace[u->clocks++] = code;
+	u->hash = u->hash * 33 + code;
+}
+
+static int h_setup(struct libxsvf_host *h)
+{
+	return 0;
+}
+
+static int h_shutdown(struct libxsvf_host *h)
+{
+	return 0;
+}
+
+static void h_udelay(struct libxsvf_host *h, long usecs, int tms, long num_tck)
+{
+	struct udata_s *u = h->user_data;
+	while (num_tck-- > 0)
+		add_clock(u, tms, -1, -1, 0);
+}
+
+static int h_getbyte(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	return fgetc(u->f);
+}
+
+static int h_sync(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	int mismatch = u->mismatch;
+	u->syncs++;
+	u->mismatch = 0;
+	return mismatch ? -1 : 0;
+}
+
+static void h_sync_tag(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	u->tags++;
+}
+
+static int h_pulse_tck(struct libxsvf_host *h, int tms, int tdi, int tdo, int rmask, int sync)
+{
+	struct udata_s *u = h->user_data;
+	add_clock(u, tms, tdi, tdo, rmask);
+	if (tdo < 0)
+		return 1;
+	u->checks++;
+	if (u->error_check > 0 && u->checks >= u->error_check && u->checks < u->error_check + u->error_count) {
+		libxsvf_tdo_mismatch(h, &h->srcpos, tdo, !tdo);
+		if (!u->async)
+			return -1;
+		u->mismatch = 1;
+		return !tdo;
+	}
+	return tdo;
+}
+
+static int h_set_frequency(struct libxsvf_host *h, int v)
+{
+	struct udata_s *u = h->user_data;
+	int n = strlen(u->frequencies);
+	snprintf(u->frequencies + n, sizeof(u->frequencies) - n, "%s%d", n ? "," : "", v);
+	return 0;
+}
+
+static void h_report_checkpoint(struct libxsvf_host *h, const struct libxsvf_checkpoint *cp)
+{
+	struct udata_s *u = h->user_data;
+	if (u->num_checkpoints == MAX_CHECKPOINTS)
+		return;
+	u->checkpoints[u->num_checkpoints] = *cp;
+	u->checkpoint_clocks[u->num_checkpoints++] = u->clocks;
+}
+
+static void h_report_error(struct libxsvf_host *h, const char *file, int line, const char *message)
+{
+	fprintf(stderr, "  [%s:%d] %s\n", file, line, message);
+}
+
+static void *h_realloc(struct libxsvf_host *h, void *ptr, int size, enum libxsvf_mem which)
+{
+	return realloc(ptr, size);
+}
+
+static int play(const char *filename, enum libxsvf_mode mode, const struct options_s *opt, struct udata_s *u)
+{
+	struct libxsvf_host h = {
+		.udelay = h_udelay,
+		.setup = h_setup,
+		.shutdown = h_shutdown,
+		.getbyte = h_getbyte,
+		.sync = h_sync,
+		.pulse_tck = h_pulse_tck,
+		.set_frequency = h_set_frequency,
+		.report_checkpoint = h_report_checkpoint,
+		.report_error = h_report_error,
+		.realloc = h_realloc,
+		.sync_policy = opt->policy,
+		.checkpoint = opt->checkpoint,
+		.user_data = u
+	};
+	char *data = NULL;
+	long size = 0;
+	int rc, in_memory = opt->in_memory;
+
+	if (opt->tags)
+		h.sync_tag = h_sync_tag;
+
+	memset(u, 0, sizeof(*u));
+	u->hash = 5381;
+	u->async = opt->async;
+	u->error_check = opt->error_check;
+	u->error_count = opt->error_count;
+	u->f = fopen(filename, "rb");
+	if (u->f == NULL) {
+		perror(filename);
+		exit(1);
+	}
+
+#ifdef LIBXSVF_XSVF_STATIC
+	if (mode == LIBXSVF_MODE_XSVF)
+		in_memory = 1;
+#endif
+	if (in_memory) {
+		fseek(u->f, 0, SEEK_END);
+		size = ftell(u->f);
+		fseek(u->f, 0, SEEK_SET);
+		data = malloc(size + 1);
+		if (fread(data, 1, size, u->f) != (size_t)size) {
+			perror(filename);
+			exit(1);
+		}
+		h.input_data = data;
+		h.input_size = size;
+	}
+
+	rc = libxsvf_play(&h, mode);
+	fclose(u->f);
+	free(data);
+	return rc;
+}
+
+int main(int argc, char **argv)
+{
+	struct libxsvf_sync_policy policy = { .frequency = 1000000 };
+	struct libxsvf_checkpoint checkpoint = { .interval = 0 };
+	struct options_s reference = { .policy = NULL }, opt = { .policy = &policy, .error_count = 1 };
+	static struct udata_s u1, u2, u3, um;
+	enum libxsvf_mode mode = LIBXSVF_MODE_SVF;
+	int expect_fail = 0, rc1, rc2, rc3, rcm;
+	unsigned long suffix;
+	long resumed = 0;
+
+	while (argc >= 3 && argv[1][0] == '-') {
+		if (!strcmp(argv[1], "-f"))
+			expect_fail = 1;
+		else if (!strcmp(argv[1], "-x"))
+			mode = LIBXSVF_MODE_XSVF;
+		else if (!strcmp(argv[1], "-a"))
+			opt.async = 1;
+		else if (!strcmp(argv[1], "-t"))
+			opt.tags = 1;
+		else if (!strcmp(argv[1], "-p") && argc >= 4 &&
+				sscanf(argv[2], "%ld:%ld:%d:%d:%d:%d", &policy.max_cycles, &policy.max_usecs, &policy.block_sync,
+					&policy.block_retries, &policy.min_frequency, &policy.clean_blocks) >= 3)
+			argv++, argc--;
+		else if (!strcmp(argv[1], "-e") && argc >= 4 &&
+				sscanf(argv[2], "%ld:%ld", &opt.error_check, &opt.error_count) >= 1)
+			argv++, argc--;
+		else if (!strcmp(argv[1], "-c") && argc >= 4 &&
+				sscanf(argv[2], "%ld", &checkpoint.interval) == 1)
+			opt.checkpoint = &checkpoint, argv++, argc--;
+		else
+			break;
+		argv++, argc--;
+	}
+	if (argc >= 3 && !strcmp(argv[1], "-x")) {
+		mode = LIBXSVF_MODE_XSVF;
+		argv++, argc--;
+	}
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s [ -f ] [ -x ] [ -a ] [ -t ] [ -p max_cycles:max_usecs:block_sync"
+				"[:block_retries:min_frequency:clean_blocks] ] [ -e check[:count] ] [ -c interval ] file\n", argv[0]);
+		return 1;
+	}
+
+	rc1 = play(argv[1], mode, &reference, &u1);
+	rc2 = play(argv[1], mode, &opt, &u2);
+
+	if (opt.error_check > 0 ? (rc2 < 0) != expect_fail || rc1 < 0 :
+			rc1 != rc2 || (rc1 < 0) != expect_fail || (rc1 >= 0 && (u1.clocks != u2.clocks || u1.hash != u2.hash))) {
+		printf("FAILED %s: reference rc=%d clocks=%lu, policy rc=%d clocks=%lu\n",
+				argv[1], rc1, u1.clocks, rc2, u2.clocks);
+		return 1;
+	}
+
+	opt.in_memory = 1;
+	rcm = play(argv[1], mode, &opt, &um);
+	opt.in_memory = 0;
+	if (rcm != rc2 || um.clocks != u2.clocks || um.hash != u2.hash) {
+		printf("FAILED %s: getbyte rc=%d clocks=%lu, memory rc=%d clocks=%lu\n",
+				argv[1], rc2, u2.clocks, rcm, um.clocks);
+		return 1;
+	}
+
+	if (opt.checkpoint) {
+		if (u2.num_checkpoints == 0) {
+			printf("FAILED %s: no checkpoint\n", argv[1]);
+			return 1;
+		}
+		checkpoint = u2.checkpoints[u2.num_checkpoints / 2];
+		checkpoint.resume = 1;
+		resumed = checkpoint.command;
+		suffix = u2.clocks - u2.checkpoint_clocks[u2.num_checkpoints / 2];
+		rc3 = play(argv[1], mode, &opt, &u3);
+		if (rc3 != rc2 || u3.clocks < suffix || memcmp(u3.trace + u3.clocks - suffix, u2.trace + u2.clocks - suffix, suffix)) {
+			printf("FAILED %s: resumed at command %ld rc=%d clocks=%lu, expected rc=%d and the last %lu clocks\n",
+					argv[1], resumed, rc3, u3.clocks, rc2, suffix);
+			return 1;
+		}
+	}
+
+	printf("ok %s: rc=%d clocks=%lu hash=%08lx syncs=%d tags=%d", argv[1], rc2, u2.clocks,
+			u2.hash & 0xffffffff, u2.syncs, u2.tags);
+	if (u2.frequencies[0])
+		printf(" frequency=%s", u2.frequencies);
+	if (opt.checkpoint)
+		printf(" resumed=%ld", resumed);
+	printf("\n");
+	return 0;
+}
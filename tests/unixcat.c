@@ -0,0 +1,91 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+/*
+ * Minimal Unix socket client for the xsvftoold tests (run.sh): connect to
+ * the socket, send stdin, close the sending side and copy the replies to
+ * stdout until the server closes the connection. The connection is
+ * retried for up to 10 seconds, so that the test can start the daemon in
+ * the background and does not need to wait for it to listen.
+ *
+ * Usage: unixcat socket
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+static int write_all(int fd, const char *buf, int len)
+{
+	while (len > 0) {
+		int rc = write(fd, buf, len);
+		if (rc <= 0)
+			return -1;
+		buf += rc, len -= rc;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_un addr;
+	char buf[4096];
+	int fd = -1, i, len;
+
+	if (argc != 2 || strlen(argv[1]) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Usage: %s socket\n", argv[0]);
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, argv[1]);
+
+	for (i = 0; i < 100; i++) {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+			break;
+		close(fd);
+		fd = -1;
+		usleep(100000);
+	}
+	if (fd < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	while ((len = read(0, buf, sizeof(buf))) > 0) {
+		if (write_all(fd, buf, len) < 0) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+	shutdown(fd, SHUT_WR);
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		if (write_all(1, buf, len) < 0)
+			return 1;
+	}
+
+	close(fd);
+	return len < 0;
+}
@@ -88,15 +88,78 @@ enum xsvf_cmd {
 }VAL_CLOSE
 
 #define SHIFT_DATA(_inp, _outp, _maskp, _len, _state, _estate, _edelay, _ret) do { \
-	if (shift_data(h, _inp, _outp, _maskp, _len, _state, _estate, _edelay, _ret) < 0) { \
+	if (shift_data(h, &replay, _inp, _outp, _maskp, _len, _state, _estate, _edelay, _ret) < 0) { \
 		goto error;                                                 \
 	}                                                                   \
 } while (0)
 
+#define REPLAY_COMMIT() do {                                                \
+	if (replay_commit(h, &replay) < 0)                                  \
+		goto error;                                                 \
+} while (0)
+
 #define TAP(_state) do {                                                    \
-	if (libxsvf_tap_walk(h, _state) < 0)                                \
+	if (!libxsvf_checkpoint_skip(h) && libxsvf_tap_walk(h, _state) < 0) \
+		goto error;                                                 \
+} while (0)
+
+#define CHECKPOINT() do {                                                   \
+	if (libxsvf_checkpoint_due(h)) {                                    \
+		REPLAY_COMMIT();                                            \
+		if (libxsvf_checkpoint_boundary(h) < 0)                     \
+			goto error;                                         \
+	}                                                                   \
+} while (0)
+
+/* register reads, using the static buffers or the realloc() callback */
+#ifdef LIBXSVF_XSVF_STATIC
+#  define READ_DR(_buf, _which) do {                                        \
+	if (bits2bytes(state_dr_size) > (int)sizeof(xsvf_dr_buf[0])) {      \
+		_buf = read_inplace(h, state_dr_size);                      \
+		if (!_buf)                                                  \
+			goto error;                                         \
+	} else {                                                            \
+		_buf = xsvf_dr_buf[_which];                                 \
+		READ_BITS(_buf, state_dr_size);                             \
+	}                                                                   \
+} while (0)
+
+#  define READ_IR(_len) do {                                                \
+	if (bits2bytes(_len) > (int)sizeof(xsvf_ir_buf)) {                  \
+		buf_ir = read_inplace(h, _len);                             \
+		if (!buf_ir)                                                \
+			goto error;                                         \
+	} else {                                                            \
+		buf_ir = xsvf_ir_buf;                                       \
+		READ_BITS(buf_ir, _len);                                    \
+	}                                                                   \
+} while (0)
+
+/* the expected TDO data and mask that XSDRSIZE couldn't keep, see resize_dr() */
+#  define CHECK_TDO(_tdo_lost) do {                                         \
+	if (lost_tdo_mask || ((_tdo_lost) && buf_tdo_mask &&                \
+			!allbits(buf_tdo_mask, state_dr_size, 0))) {        \
+		LIBXSVF_HOST_REPORT_ERROR("XSDRSIZE exceeds LIBXSVF_XSVF_MAX_DR_BITS and the last XTDOMASK."); \
 		goto error;                                                 \
+	}                                                                   \
+} while (0)
+#else
+#  define READ_DR(_buf, _which) READ_BITS(_buf, state_dr_size)
+#  define CHECK_TDO(_tdo_lost) do { } while (0)
+
+#  define READ_IR(_len) do {                                                \
+	if (!buf_ir || bits2bytes(_len) > state_ir_bytes) {                 \
+		state_ir_bytes = bits2bytes(_len) ? bits2bytes(_len) : 1;   \
+		buf_ir = LIBXSVF_HOST_REALLOC(buf_ir, state_ir_bytes,       \
+				LIBXSVF_MEM_XSVF_IR_DATA);                  \
+		if (!buf_ir) {                                              \
+			LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed."); \
+			goto error;                                         \
+		}                                                           \
+	}                                                                   \
+	READ_BITS(buf_ir, _len);                                            \
 } while (0)
+#endif
 
 static int bits2bytes(int bits)
 {
@@ -108,6 +171,17 @@ static int getbit(unsigned char *data, int n)
 	return (data[n/8] & (1 << (7 - n%8))) ? 1 : 0;
 }
 
+static int allbits(unsigned char *data, int len, int v)
+{
+	int left_padding = (8 - len % 8) % 8;
+	int i, mask = 0xff >> left_padding;
+	for (i=0; i<bits2bytes(len); i++, mask = 0xff) {
+		if ((data[i] & mask) != (v ? mask : 0))
+			return 0;
+	}
+	return 1;
+}
+
 static void setbit(unsigned char *data, int n, int v)
 {
 	unsigned char mask = 1 << (7 - n%8);
@@ -117,6 +191,26 @@ static void setbit(unsigned char *data, int n, int v)
 		data[n/8] &= ~mask;
 }
 
+#ifdef LIBXSVF_XSVF_STATIC
+static unsigned char *read_inplace(struct libxsvf_host *h, int len)
+{
+	unsigned char *p;
+
+	if (!h->input_data) {
+		LIBXSVF_HOST_REPORT_ERROR("Scan exceeds the static register buffers.");
+		return (void*)0;
+	}
+	if (h->input_pos + bits2bytes(len) > h->input_size) {
+		LIBXSVF_HOST_REPORT_ERROR("Unexpected EOF.");
+		return (void*)0;
+	}
+
+	p = (unsigned char*)h->input_data + h->input_pos;
+	h->input_pos += bits2bytes(len);
+	return p;
+}
+#endif
+
 static int xilinx_tap(int state)
 {
 	/* state codes as defined in xilinx xapp503 */
@@ -174,62 +268,372 @@ static int xilinx_tap(int state)
 	return -1;
 }
 
-static int shift_data(struct libxsvf_host *h, unsigned char *inp, unsigned char *outp, unsigned char *maskp, int len, enum libxsvf_tap_state state, enum libxsvf_tap_state estate, int edelay, int retries)
+/*
+ * With LIBXSVF_XSVF_STATIC the player doesn't use the realloc() callback:
+ * the registers live in static buffers for scans of up to
+ * LIBXSVF_XSVF_MAX_DR_BITS and LIBXSVF_XSVF_MAX_IR_BITS bits. Longer scans
+ * are shifted in place from the input if it is in memory (input_data) and
+ * are an error otherwise.
+ */
+
+#ifdef LIBXSVF_XSVF_STATIC
+#  ifndef LIBXSVF_XSVF_MAX_DR_BITS
+#    define LIBXSVF_XSVF_MAX_DR_BITS 1024
+#  endif
+#  ifndef LIBXSVF_XSVF_MAX_IR_BITS
+#    define LIBXSVF_XSVF_MAX_IR_BITS 256
+#  endif
+#  ifndef LIBXSVF_REPLAY_MAX_BYTES
+#    define LIBXSVF_REPLAY_MAX_BYTES 256
+#  endif
+static unsigned char xsvf_dr_buf[5][(LIBXSVF_XSVF_MAX_DR_BITS+7) / 8];
+static unsigned char xsvf_ir_buf[(LIBXSVF_XSVF_MAX_IR_BITS+7) / 8];
+static unsigned char xsvf_replay_buf[LIBXSVF_REPLAY_MAX_BYTES];
+
+/*
+ * XSDRSIZE keeps the leading bytes of the expected TDO data and the masks,
+ * like the grow-only buffers of the default build. A register that was
+ * read in place is copied to its static buffer when the scans fit again.
+ * For longer scans than it was read for it can't be kept: it is NULL until
+ * it is read again, and *lost is set if it had any bits set.
+ */
+static unsigned char *resize_dr(unsigned char *buf, unsigned char *static_buf, long old_size, long new_size, int *lost)
 {
-	int left_padding = (8 - len % 8) % 8;
-	int with_retries = retries > 0;
 	int i;
 
-	if (with_retries && LIBXSVF_HOST_SYNC() < 0) {
-		LIBXSVF_HOST_REPORT_ERROR("TDO mismatch.");
-		return -1;
+	if (bits2bytes(new_size) <= (int)sizeof(xsvf_dr_buf[0])) {
+		if (buf && buf != static_buf) {
+			for (i=0; i<(int)sizeof(xsvf_dr_buf[0]); i++)
+				static_buf[i] = buf[i];
+		}
+		*lost = 0;
+		return static_buf;
 	}
+	if (buf && buf != static_buf && bits2bytes(new_size) <= bits2bytes(old_size))
+		return buf;
+	if (buf && !allbits(buf, old_size, 0))
+		*lost = 1;
+	return (void*)0;
+}
+#endif
 
-	while (1)
-	{
-		int tdo_error = 0;
-		int tms = 0;
+/*
+ * XREPEAT shifts are issued speculatively on asynchronous interfaces: instead
+ * of syncing before and after each shift, the shifts are recorded in a small
+ * replay log. The log is committed with a single sync when it is full or when
+ * a command follows that can't be replayed. If that sync reports a TDO
+ * mismatch, the shifts are played again synchronously from the failing one
+ * (the first mismatch reported by the host), each with its remaining retries.
+ * An instruction shift is only logged first, so that the replayed shifts see
+ * the same IR as the speculative ones.
+ */
 
-		TAP(state);
-		tms = 0;
+#ifndef LIBXSVF_REPLAY_LOG_SIZE
+#  define LIBXSVF_REPLAY_LOG_SIZE 8
+#endif
 
-		for (i=len+left_padding-1; i>=left_padding; i--) {
-			if (i == left_padding && h->tap_state != estate) {
-				h->tap_state++;
-				tms = 1;
-			}
-			int tdi = getbit(inp, i);
-			int tdo = -1;
-			if (maskp && getbit(maskp, i))
-				tdo = outp && getbit(outp, i);
-			int sync = with_retries && i == left_padding;
-			if (LIBXSVF_HOST_PULSE_TCK(tms, tdi, tdo, 0, sync) < 0)
-				tdo_error = 1;
-		}
+#ifndef LIBXSVF_REPLAY_MAX_BYTES
+#  define LIBXSVF_REPLAY_MAX_BYTES 4096
+#endif
+
+struct replay_entry {
+	int tdi_offset, tdo_offset, mask_offset;
+	int len, edelay, retries;
+	enum libxsvf_tap_state state, estate;
+	struct libxsvf_srcpos pos;
+};
+
+struct replay_log {
+	struct replay_entry entries[LIBXSVF_REPLAY_LOG_SIZE];
+	int num, clean;
+	unsigned char *buf;
+	int buf_size, buf_used;
+};
+
+/*
+ * The bit-by-bit shift is generated in variants without TDO checks, with
+ * checks against the expected data and with checks against zero (no
+ * expected data), selected once per shift. The TDO value is computed
+ * without branches and the exit bit is shifted after the loop.
+ */
+
+/* the expected bit if the mask bit is set, -1 otherwise */
+#define SHIFT_TDO(_check, _mask, _out, _i) (!(_check) ? -1 : \
+		((((_out) >> (_i)) & 1) & -(((_mask) >> (_i)) & 1)) | ((((_mask) >> (_i)) & 1) - 1))
+
+#define SHIFT_KERNEL(_check, _out)                                          \
+static int shift_kernel_ ## _check ## _out(struct libxsvf_host *h, unsigned char *inp, \
+		unsigned char *outp, unsigned char *maskp, int len, enum libxsvf_tap_state estate, \
+		int sync, int *tms, int *checked)                           \
+{                                                                           \
+	int nbytes = bits2bytes(len);                                       \
+	int in = 0, out = 0, mask = 0;                                      \
+	int tdo_error = 0;                                                  \
+	int i, k, n;                                                        \
+	for (k=0; k < len; k += 8) {                                        \
+		n = len - k < 8 ? len - k : 8;                              \
+		in = inp[nbytes-1-k/8];                                     \
+		if (_check) {                                               \
+			mask = maskp[nbytes-1-k/8] & (0xff >> (8-n));       \
+			*checked |= mask != 0;                              \
+		}                                                           \
+		if (_out)                                                   \
+			out = outp[nbytes-1-k/8];                           \
+		if (k + n == len)                                           \
+			n--;                                                \
+		for (i=0; i<n; i++) {                                       \
+			tdo_error |= LIBXSVF_HOST_PULSE_TCK(0, (in >> i) & 1, \
+					SHIFT_TDO(_check, mask, out, i), 0, 0) < 0; \
+			h->srcpos.bit++;                                    \
+		}                                                           \
+	}                                                                   \
+	i = (len-1) % 8;                                                    \
+	if (h->tap_state != estate) {                                       \
+		h->tap_state++;                                             \
+		*tms = 1;                                                   \
+	}                                                                   \
+	tdo_error |= LIBXSVF_HOST_PULSE_TCK(*tms, (in >> i) & 1,            \
+			SHIFT_TDO(_check, mask, out, i), 0, sync) < 0;      \
+	h->srcpos.bit++;                                                    \
+	return tdo_error;                                                   \
+}
 
-		if (tms)
-			LIBXSVF_HOST_REPORT_TAPSTATE();
-	
-		if (edelay) {
-			TAP(LIBXSVF_TAP_IDLE);
-			LIBXSVF_HOST_UDELAY(edelay, 0, edelay);
-		} else {
-			TAP(estate);
+SHIFT_KERNEL(0, 0)
+SHIFT_KERNEL(1, 0)
+SHIFT_KERNEL(1, 1)
+
+static int shift_once(struct libxsvf_host *h, unsigned char *inp, unsigned char *outp, unsigned char *maskp, int len, enum libxsvf_tap_state state, enum libxsvf_tap_state estate, int edelay, int sync, int *checked)
+{
+	int check = maskp && !allbits(maskp, len, 0);
+	int tdo_error = 0;
+	int tms = 0;
+
+	TAP(state);
+	tms = 0;
+	h->srcpos.bit = 0;
+
+	/* plain data shift without tdo checks: pass the whole register to the host */
+	if (LIBXSVF_HOST_HAS_SHIFT_BITS() && len > 0 && !sync && !check) {
+		if (h->tap_state != estate) {
+			h->tap_state++;
+			tms = 1;
 		}
+		if (LIBXSVF_HOST_SHIFT_BITS(len, inp, (void*)0, tms) < 0)
+			tdo_error = 1;
+		h->srcpos.bit += len;
+	}
+	else if (len > 0) {
+		if (!check)
+			tdo_error = shift_kernel_00(h, inp, outp, maskp, len, estate, sync, &tms, checked);
+		else if (!outp)
+			tdo_error = shift_kernel_10(h, inp, outp, maskp, len, estate, sync, &tms, checked);
+		else
+			tdo_error = shift_kernel_11(h, inp, outp, maskp, len, estate, sync, &tms, checked);
+	}
+
+	if (tms)
+		LIBXSVF_HOST_REPORT_TAPSTATE();
 
-		if (!tdo_error)
+	if (edelay) {
+		TAP(LIBXSVF_TAP_IDLE);
+		LIBXSVF_HOST_UDELAY(edelay, 0, edelay);
+	} else {
+		TAP(estate);
+	}
+
+	return tdo_error;
+
+error:
+	return -1;
+}
+
+static int shift_retry(struct libxsvf_host *h, unsigned char *inp, unsigned char *outp, unsigned char *maskp, int len, enum libxsvf_tap_state state, enum libxsvf_tap_state estate, int edelay, int retries)
+{
+	int checked = 0;
+
+	while (1)
+	{
+		h->mismatch.valid = 0;
+
+		int rc = shift_once(h, inp, outp, maskp, len, state, estate, edelay, 1, &checked);
+
+		if (rc < 0)
+			return -1;
+
+		if (rc == 0)
 			return 0;
 
 		if (retries <= 0) {
-			LIBXSVF_HOST_REPORT_ERROR("TDO mismatch.");
+			libxsvf_report_mismatch(h);
 			return -1;
 		}
 
 		retries--;
 	}
+}
 
-error:
-	return -1;
+static int replay_commit(struct libxsvf_host *h, struct replay_log *log)
+{
+	struct libxsvf_srcpos pos;
+	int i, first, num = log->num;
+
+	if (num == 0)
+		return 0;
+
+	log->num = 0;
+	log->buf_used = 0;
+	log->clean = 1;
+
+	if (LIBXSVF_HOST_SYNC() == 0) {
+		libxsvf_sync_reset(h);
+		return 0;
+	}
+
+	LIBXSVF_HOST_REPORT_STATUS("Replaying XREPEAT shifts.");
+
+	/* the shifts before the first failing one have passed */
+	first = 0;
+	for (i = 0; h->mismatch.valid && i < num; i++) {
+		if (log->entries[i].pos.command == h->mismatch.pos.command) {
+			first = i;
+			break;
+		}
+	}
+
+	pos = h->srcpos;
+	for (i = first; i < num; i++) {
+		struct replay_entry *e = &log->entries[i];
+		h->srcpos = e->pos;
+		if (shift_retry(h, log->buf + e->tdi_offset,
+				e->tdo_offset < 0 ? (void*)0 : log->buf + e->tdo_offset,
+				e->mask_offset < 0 ? (void*)0 : log->buf + e->mask_offset,
+				e->len, e->state, e->estate, e->edelay, e->retries - 1) < 0)
+			return -1;
+	}
+	h->srcpos = pos;
+
+	return 0;
+}
+
+static int replay_copy(struct replay_log *log, unsigned char *data, int nbytes)
+{
+	int offset = log->buf_used;
+	int i;
+
+	if (!data)
+		return -1;
+
+	for (i = 0; i < nbytes; i++)
+		log->buf[offset + i] = data[i];
+	log->buf_used += nbytes;
+
+	return offset;
+}
+
+static int replay_add(struct libxsvf_host *h, struct replay_log *log, unsigned char *inp, unsigned char *outp, unsigned char *maskp, int len, enum libxsvf_tap_state state, enum libxsvf_tap_state estate, int edelay, int retries)
+{
+	int nbytes = bits2bytes(len);
+	int need = nbytes * (1 + (outp != (void*)0) + (maskp != (void*)0));
+	struct replay_entry *e;
+
+	if (log->num == LIBXSVF_REPLAY_LOG_SIZE || log->buf_used + need > LIBXSVF_REPLAY_MAX_BYTES ||
+			(state == LIBXSVF_TAP_IRSHIFT && log->num > 0)) {
+		if (replay_commit(h, log) < 0)
+			return -1;
+	}
+
+	/* a TDO error from before the log must not be retried */
+	if (!log->clean) {
+		if (LIBXSVF_HOST_SYNC() < 0) {
+			libxsvf_report_mismatch(h);
+			return -1;
+		}
+		libxsvf_sync_reset(h);
+		log->clean = 1;
+	}
+
+	/* a mismatch reported later is in a shift of this log */
+	if (log->num == 0)
+		h->mismatch.valid = 0;
+
+#ifndef LIBXSVF_XSVF_STATIC
+	if (log->buf_used + need > log->buf_size) {
+		log->buf_size = log->buf_used + need;
+		log->buf = LIBXSVF_HOST_REALLOC(log->buf, log->buf_size, LIBXSVF_MEM_XSVF_REPLAY);
+		if (!log->buf) {
+			LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
+			return -1;
+		}
+	}
+#endif
+
+	e = &log->entries[log->num++];
+	e->tdi_offset = replay_copy(log, inp, nbytes);
+	e->tdo_offset = replay_copy(log, outp, nbytes);
+	e->mask_offset = replay_copy(log, maskp, nbytes);
+	e->len = len;
+	e->state = state;
+	e->estate = estate;
+	e->edelay = edelay;
+	e->retries = retries;
+	e->pos = h->srcpos;
+
+	return 0;
+}
+
+static int shift_data(struct libxsvf_host *h, struct replay_log *log, unsigned char *inp, unsigned char *outp, unsigned char *maskp, int len, enum libxsvf_tap_state state, enum libxsvf_tap_state estate, int edelay, int retries)
+{
+	int checked = 0;
+	int rc;
+
+	if (libxsvf_checkpoint_skip(h))
+		return 0;
+
+	/* speculative XREPEAT shift: log it and don't wait for the result */
+	if (retries > 0 && LIBXSVF_HOST_HAS_SYNC() &&
+			bits2bytes(len) * 3 <= LIBXSVF_REPLAY_MAX_BYTES) {
+		if (replay_add(h, log, inp, outp, maskp, len, state, estate, edelay, retries) < 0)
+			return -1;
+		rc = shift_once(h, inp, outp, maskp, len, state, estate, edelay, 0, &checked);
+		if (rc < 0)
+			return -1;
+		if (rc > 0)
+			return replay_commit(h, log);
+		return 0;
+	}
+
+	if (replay_commit(h, log) < 0)
+		return -1;
+
+	if (retries > 0) {
+		if (LIBXSVF_HOST_SYNC() < 0) {
+			libxsvf_report_mismatch(h);
+			return -1;
+		}
+		return shift_retry(h, inp, outp, maskp, len, state, estate, edelay, retries);
+	}
+
+	log->clean = 0;
+
+	/* a new instruction starts a new block */
+	if (state == LIBXSVF_TAP_IRSHIFT && libxsvf_sync_block(h) < 0) {
+		libxsvf_report_mismatch(h);
+		return -1;
+	}
+
+	rc = shift_once(h, inp, outp, maskp, len, state, estate, edelay, 0, &checked);
+	if (rc < 0)
+		return -1;
+
+	if (libxsvf_sync_point(h, len + edelay, edelay, checked) < 0)
+		rc = 1;
+
+	if (rc > 0) {
+		libxsvf_report_mismatch(h);
+		return -1;
+	}
+
+	return 0;
 }
 
 int libxsvf_xsvf(struct libxsvf_host *h)
@@ -237,11 +641,24 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 	int rc = 0;
 	int i, j;
 
+#ifdef LIBXSVF_XSVF_STATIC
+	unsigned char *buf_tdi_data = xsvf_dr_buf[LIBXSVF_MEM_XSVF_TDI_DATA];
+	unsigned char *buf_tdo_data = xsvf_dr_buf[LIBXSVF_MEM_XSVF_TDO_DATA];
+	unsigned char *buf_tdo_mask = xsvf_dr_buf[LIBXSVF_MEM_XSVF_TDO_MASK];
+	unsigned char *buf_addr_mask = xsvf_dr_buf[LIBXSVF_MEM_XSVF_ADDR_MASK];
+	unsigned char *buf_data_mask = xsvf_dr_buf[LIBXSVF_MEM_XSVF_DATA_MASK];
+	unsigned char *buf_ir = xsvf_ir_buf;
+	int lost_tdo_data = 0, lost_tdo_mask = 0, lost_sdr_masks = 0;
+#else
 	unsigned char *buf_tdi_data = (void*)0;
 	unsigned char *buf_tdo_data = (void*)0;
 	unsigned char *buf_tdo_mask = (void*)0;
 	unsigned char *buf_addr_mask = (void*)0;
 	unsigned char *buf_data_mask = (void*)0;
+	unsigned char *buf_ir = (void*)0;
+	long state_dr_bytes = 0;
+	int state_ir_bytes = 0;
+#endif
 
 	long state_dr_size = 0;
 	long state_data_size = 0;
@@ -251,37 +668,69 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 	unsigned char state_retries = 0;
 	unsigned char cmd = 0;
 
+#ifdef LIBXSVF_XSVF_STATIC
+	/* the log is the largest local, keep it off the stack */
+	static struct replay_log replay;
+#else
+	struct replay_log replay;
+#endif
+	replay.num = 0;
+	replay.clean = 0;
+#ifdef LIBXSVF_XSVF_STATIC
+	/* the registers start out zero, like the buffers of the default build */
+	for (i=0; i<5; i++) {
+		for (j=0; j<(int)sizeof(xsvf_dr_buf[0]); j++)
+			xsvf_dr_buf[i][j] = 0;
+	}
+	replay.buf = xsvf_replay_buf;
+	replay.buf_size = sizeof(xsvf_replay_buf);
+#else
+	replay.buf = (void*)0;
+	replay.buf_size = 0;
+#endif
+	replay.buf_used = 0;
+
 	while (1)
 	{
 		unsigned char last_cmd = cmd;
 		cmd = LIBXSVF_HOST_GETBYTE();
 
+		h->srcpos.command++;
+
+		if (libxsvf_checkpoint_next(h) < 0)
+			goto error;
+
 #define STATUS(_c) LIBXSVF_HOST_REPORT_STATUS("XSVF Command " #_c);
 
 		switch (cmd)
 		{
 		case XCOMPLETE: {
 			STATUS(XCOMPLETE);
+			REPLAY_COMMIT();
 			goto got_complete_command;
 		  }
 		case XTDOMASK: {
 			STATUS(XTDOMASK);
-			READ_BITS(buf_tdo_mask, state_dr_size);
+			READ_DR(buf_tdo_mask, LIBXSVF_MEM_XSVF_TDO_MASK);
+#ifdef LIBXSVF_XSVF_STATIC
+			lost_tdo_mask = 0;
+#endif
 			break;
 		  }
 		case XSIR: {
 			STATUS(XSIR);
+			CHECKPOINT();
 			int length = READ_BYTE();
-			unsigned char buf[bits2bytes(length)];
-			READ_BITS(buf, length);
-			SHIFT_DATA(buf, (void*)0, (void*)0, length, LIBXSVF_TAP_IRSHIFT,
+			READ_IR(length);
+			SHIFT_DATA(buf_ir, (void*)0, (void*)0, length, LIBXSVF_TAP_IRSHIFT,
 					state_xendir ? LIBXSVF_TAP_IRPAUSE : LIBXSVF_TAP_IDLE,
 					state_runtest, state_retries);
 			break;
 		  }
 		case XSDR: {
 			STATUS(XSDR);
-			READ_BITS(buf_tdi_data, state_dr_size);
+			READ_DR(buf_tdi_data, LIBXSVF_MEM_XSVF_TDI_DATA);
+			CHECK_TDO(lost_tdo_data);
 			SHIFT_DATA(buf_tdi_data, buf_tdo_data, buf_tdo_mask, state_dr_size, LIBXSVF_TAP_DRSHIFT,
 					state_xenddr ? LIBXSVF_TAP_DRPAUSE : LIBXSVF_TAP_IDLE,
 					state_runtest, state_retries);
@@ -299,22 +748,53 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 		  }
 		case XSDRSIZE: {
 			STATUS(XSDRSIZE);
+#ifdef LIBXSVF_XSVF_STATIC
+			long old_size = state_dr_size;
+#endif
 			state_dr_size = READ_LONG();
-			buf_tdi_data = LIBXSVF_HOST_REALLOC(buf_tdi_data, bits2bytes(state_dr_size), LIBXSVF_MEM_XSVF_TDI_DATA);
-			buf_tdo_data = LIBXSVF_HOST_REALLOC(buf_tdo_data, bits2bytes(state_dr_size), LIBXSVF_MEM_XSVF_TDO_DATA);
-			buf_tdo_mask = LIBXSVF_HOST_REALLOC(buf_tdo_mask, bits2bytes(state_dr_size), LIBXSVF_MEM_XSVF_TDO_MASK);
-			buf_addr_mask = LIBXSVF_HOST_REALLOC(buf_addr_mask, bits2bytes(state_dr_size), LIBXSVF_MEM_XSVF_ADDR_MASK);
-			buf_data_mask = LIBXSVF_HOST_REALLOC(buf_data_mask, bits2bytes(state_dr_size), LIBXSVF_MEM_XSVF_DATA_MASK);
+#ifdef LIBXSVF_XSVF_STATIC
+			if (bits2bytes(state_dr_size) > (int)sizeof(xsvf_dr_buf[0]) && !h->input_data) {
+				LIBXSVF_HOST_REPORT_ERROR("XSDRSIZE exceeds LIBXSVF_XSVF_MAX_DR_BITS.");
+				goto error;
+			}
+			buf_tdo_data = resize_dr(buf_tdo_data, xsvf_dr_buf[LIBXSVF_MEM_XSVF_TDO_DATA],
+					old_size, state_dr_size, &lost_tdo_data);
+			buf_tdo_mask = resize_dr(buf_tdo_mask, xsvf_dr_buf[LIBXSVF_MEM_XSVF_TDO_MASK],
+					old_size, state_dr_size, &lost_tdo_mask);
+			/* XSDRINC is never shifted in place, so these are only needed again in the static buffers */
+			buf_addr_mask = resize_dr(buf_addr_mask, xsvf_dr_buf[LIBXSVF_MEM_XSVF_ADDR_MASK],
+					old_size, state_dr_size, &lost_sdr_masks);
+			buf_data_mask = resize_dr(buf_data_mask, xsvf_dr_buf[LIBXSVF_MEM_XSVF_DATA_MASK],
+					old_size, state_dr_size, &lost_sdr_masks);
+#else
+			/* the buffers only grow, so alternating sizes don't reallocate them */
+			if (bits2bytes(state_dr_size) <= state_dr_bytes)
+				break;
+			long old_bytes = state_dr_bytes;
+			state_dr_bytes = bits2bytes(state_dr_size);
+			buf_tdi_data = LIBXSVF_HOST_REALLOC(buf_tdi_data, state_dr_bytes, LIBXSVF_MEM_XSVF_TDI_DATA);
+			buf_tdo_data = LIBXSVF_HOST_REALLOC(buf_tdo_data, state_dr_bytes, LIBXSVF_MEM_XSVF_TDO_DATA);
+			buf_tdo_mask = LIBXSVF_HOST_REALLOC(buf_tdo_mask, state_dr_bytes, LIBXSVF_MEM_XSVF_TDO_MASK);
+			buf_addr_mask = LIBXSVF_HOST_REALLOC(buf_addr_mask, state_dr_bytes, LIBXSVF_MEM_XSVF_ADDR_MASK);
+			buf_data_mask = LIBXSVF_HOST_REALLOC(buf_data_mask, state_dr_bytes, LIBXSVF_MEM_XSVF_DATA_MASK);
 			if (!buf_tdi_data || !buf_tdo_data || !buf_tdo_mask || !buf_addr_mask || !buf_data_mask) {
 				LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
 				goto error;
 			}
+			/* the registers are zero where they grow, like the static buffers */
+			for (i=old_bytes; i<state_dr_bytes; i++)
+				buf_tdo_data[i] = buf_tdo_mask[i] = buf_addr_mask[i] = buf_data_mask[i] = 0;
+#endif
 			break;
 		  }
 		case XSDRTDO: {
 			STATUS(XSDRTDO);
-			READ_BITS(buf_tdi_data, state_dr_size);
-			READ_BITS(buf_tdo_data, state_dr_size);
+			READ_DR(buf_tdi_data, LIBXSVF_MEM_XSVF_TDI_DATA);
+			READ_DR(buf_tdo_data, LIBXSVF_MEM_XSVF_TDO_DATA);
+#ifdef LIBXSVF_XSVF_STATIC
+			lost_tdo_data = 0;
+#endif
+			CHECK_TDO(0);
 			SHIFT_DATA(buf_tdi_data, buf_tdo_data, buf_tdo_mask, state_dr_size, LIBXSVF_TAP_DRSHIFT,
 					state_xenddr ? LIBXSVF_TAP_DRPAUSE : LIBXSVF_TAP_IDLE,
 					state_runtest, state_retries);
@@ -322,8 +802,8 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 		  }
 		case XSETSDRMASKS: {
 			STATUS(XSETSDRMASKS);
-			READ_BITS(buf_addr_mask, state_dr_size);
-			READ_BITS(buf_data_mask, state_dr_size);
+			READ_DR(buf_addr_mask, LIBXSVF_MEM_XSVF_ADDR_MASK);
+			READ_DR(buf_data_mask, LIBXSVF_MEM_XSVF_DATA_MASK);
 			state_data_size = 0;
 			for (i=0; i<state_dr_size; i++)
 				state_data_size += getbit(buf_data_mask, i);
@@ -331,7 +811,14 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 		  }
 		case XSDRINC: {
 			STATUS(XSDRINC);
-			READ_BITS(buf_tdi_data, state_dr_size);
+#ifdef LIBXSVF_XSVF_STATIC
+			/* the increments are written to the TDI buffer */
+			if (bits2bytes(state_dr_size) > (int)sizeof(xsvf_dr_buf[0])) {
+				LIBXSVF_HOST_REPORT_ERROR("XSDRINC exceeds LIBXSVF_XSVF_MAX_DR_BITS.");
+				goto error;
+			}
+#endif
+			READ_DR(buf_tdi_data, LIBXSVF_MEM_XSVF_TDI_DATA);
 			int num = READ_BYTE();
 			while (1) {
 				SHIFT_DATA(buf_tdi_data, buf_tdo_data, buf_tdo_mask, state_dr_size, LIBXSVF_TAP_DRSHIFT,
@@ -363,50 +850,52 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 		  }
 		case XSDRB: {
 			STATUS(XSDRB);
-			READ_BITS(buf_tdi_data, state_dr_size);
+			READ_DR(buf_tdi_data, LIBXSVF_MEM_XSVF_TDI_DATA);
 			SHIFT_DATA(buf_tdi_data, (void*)0, (void*)0, state_dr_size, LIBXSVF_TAP_DRSHIFT, LIBXSVF_TAP_DRSHIFT, 0, 0);
 			break;
 		  }
 		case XSDRC: {
 			STATUS(XSDRC);
-			READ_BITS(buf_tdi_data, state_dr_size);
+			READ_DR(buf_tdi_data, LIBXSVF_MEM_XSVF_TDI_DATA);
 			SHIFT_DATA(buf_tdi_data, (void*)0, (void*)0, state_dr_size, LIBXSVF_TAP_DRSHIFT, LIBXSVF_TAP_DRSHIFT, 0, 0);
 			break;
 		  }
 		case XSDRE: {
 			STATUS(XSDRE);
-			READ_BITS(buf_tdi_data, state_dr_size);
+			READ_DR(buf_tdi_data, LIBXSVF_MEM_XSVF_TDI_DATA);
 			SHIFT_DATA(buf_tdi_data, (void*)0, (void*)0, state_dr_size, LIBXSVF_TAP_DRSHIFT,
 					state_xenddr ? LIBXSVF_TAP_DRPAUSE : LIBXSVF_TAP_IDLE, 0, 0);
 			break;
 		  }
 		case XSDRTDOB: {
 			STATUS(XSDRTDOB);
-			READ_BITS(buf_tdi_data, state_dr_size);
-			READ_BITS(buf_tdo_data, state_dr_size);
+			READ_DR(buf_tdi_data, LIBXSVF_MEM_XSVF_TDI_DATA);
+			READ_DR(buf_tdo_data, LIBXSVF_MEM_XSVF_TDO_DATA);
 			SHIFT_DATA(buf_tdi_data, buf_tdo_data, (void*)0, state_dr_size, LIBXSVF_TAP_DRSHIFT, LIBXSVF_TAP_DRSHIFT, 0, 0);
 			break;
 		  }
 		case XSDRTDOC: {
 			STATUS(XSDRTDOC);
-			READ_BITS(buf_tdi_data, state_dr_size);
-			READ_BITS(buf_tdo_data, state_dr_size);
+			READ_DR(buf_tdi_data, LIBXSVF_MEM_XSVF_TDI_DATA);
+			READ_DR(buf_tdo_data, LIBXSVF_MEM_XSVF_TDO_DATA);
 			SHIFT_DATA(buf_tdi_data, buf_tdo_data, (void*)0, state_dr_size, LIBXSVF_TAP_DRSHIFT, LIBXSVF_TAP_DRSHIFT, 0, 0);
 			break;
 		  }
 		case XSDRTDOE: {
 			STATUS(XSDRTDOE);
-			READ_BITS(buf_tdi_data, state_dr_size);
-			READ_BITS(buf_tdo_data, state_dr_size);
+			READ_DR(buf_tdi_data, LIBXSVF_MEM_XSVF_TDI_DATA);
+			READ_DR(buf_tdo_data, LIBXSVF_MEM_XSVF_TDO_DATA);
 			SHIFT_DATA(buf_tdi_data, buf_tdo_data, (void*)0, state_dr_size, LIBXSVF_TAP_DRSHIFT,
 					state_xenddr ? LIBXSVF_TAP_DRPAUSE : LIBXSVF_TAP_IDLE, 0, 0);
 			break;
 		  }
 		case XSTATE: {
 			STATUS(XSTATE);
+			REPLAY_COMMIT();
 			if (state_runtest && last_cmd == XRUNTEST) {
 				TAP(LIBXSVF_TAP_IDLE);
-				LIBXSVF_HOST_UDELAY(state_runtest, 0, state_runtest);
+				if (!libxsvf_checkpoint_skip(h))
+					LIBXSVF_HOST_UDELAY(state_runtest, 0, state_runtest);
 			}
 			unsigned char state = READ_BYTE();
 			TAP(xilinx_tap(state));
@@ -424,11 +913,11 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 		  }
 		case XSIR2: {
 			STATUS(XSIR2);
+			CHECKPOINT();
 			int length = READ_BYTE();
 			length = length << 8 | READ_BYTE();
-			unsigned char buf[bits2bytes(length)];
-			READ_BITS(buf, length);
-			SHIFT_DATA(buf, (void*)0, (void*)0, length, LIBXSVF_TAP_IRSHIFT,
+			READ_IR(length);
+			SHIFT_DATA(buf_ir, (void*)0, (void*)0, length, LIBXSVF_TAP_IRSHIFT,
 					state_xendir ? LIBXSVF_TAP_IRPAUSE : LIBXSVF_TAP_IDLE,
 					state_runtest, state_retries);
 			break;
@@ -444,11 +933,13 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 		case XWAIT:
 		case XWAITSTATE: {
 			STATUS(XWAIT);
+			REPLAY_COMMIT();
 			unsigned char state1 = READ_BYTE();
 			unsigned char state2 = READ_BYTE();
 			long usecs = READ_LONG();
 			TAP(xilinx_tap(state1));
-			LIBXSVF_HOST_UDELAY(usecs, 0, 0);
+			if (!libxsvf_checkpoint_skip(h))
+				LIBXSVF_HOST_UDELAY(usecs, 0, 0);
 			TAP(xilinx_tap(state2));
 			if (cmd==XWAITSTATE) {
 				READ_LONG();   /* XWAITSTATE has count, time arguments */
@@ -471,15 +962,19 @@ error:
 
 got_complete_command:
 	if (LIBXSVF_HOST_SYNC() != 0 && rc >= 0 ) {
-		LIBXSVF_HOST_REPORT_ERROR("TDO mismatch.");
+		libxsvf_report_mismatch(h);
 		rc = -1;
 	}
 
+#ifndef LIBXSVF_XSVF_STATIC
 	LIBXSVF_HOST_REALLOC(buf_tdi_data, 0, LIBXSVF_MEM_XSVF_TDI_DATA);
 	LIBXSVF_HOST_REALLOC(buf_tdo_data, 0, LIBXSVF_MEM_XSVF_TDO_DATA);
 	LIBXSVF_HOST_REALLOC(buf_tdo_mask, 0, LIBXSVF_MEM_XSVF_TDO_MASK);
 	LIBXSVF_HOST_REALLOC(buf_addr_mask, 0, LIBXSVF_MEM_XSVF_ADDR_MASK);
 	LIBXSVF_HOST_REALLOC(buf_data_mask, 0, LIBXSVF_MEM_XSVF_DATA_MASK);
+	LIBXSVF_HOST_REALLOC(buf_ir, 0, LIBXSVF_MEM_XSVF_IR_DATA);
+	LIBXSVF_HOST_REALLOC(replay.buf, 0, LIBXSVF_MEM_XSVF_REPLAY);
+#endif
 
 	return rc;
 }
@@ -38,18 +38,25 @@
 
 #define BUFFER_SIZE (1024*16)
 
+/* Source positions of the queued bits with TDO checks, for reporting the
+ * first TDO mismatch. Must cover all bits in the buffer and in the read jobs.
+ */
+#define SRCPOS_RING_SIZE (BUFFER_SIZE*2)
+
 #define BLOCK_WRITE
 // #define ASYNC_WRITE
 // #define BACKGROUND_READ
 // #define INTERLACED_READ_WRITE
 
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ftdi.h>
 #include <math.h>
 #ifdef BACKGROUND_READ
@@ -64,6 +71,7 @@ typedef void job_handler_t(struct udata_s *u, struct read_job_s *job, unsigned c
 
 struct read_job_s {
 	struct read_job_s *next;
+	unsigned long seq;
 	int data_len, bits_len;
 	struct buffer_s *buffer;
 	job_handler_t *handler;
@@ -77,6 +85,13 @@ struct buffer_s {
 	unsigned int tdo:1;
 	unsigned int tdo_enable:1;
 	unsigned int rmask:1;
+	unsigned int capture:1;
+};
+
+/* a range of checked bits, starting with bit number 'seq' in the buffer */
+struct srcpos_range_s {
+	unsigned long seq;
+	struct libxsvf_srcpos pos;
 };
 
 struct udata_s {
@@ -89,12 +104,20 @@ struct udata_s {
 	int eeprom_size;
 	int buffer_size;
 	struct buffer_s buffer[BUFFER_SIZE];
+	unsigned long buffer_seq;
+	struct srcpos_range_s srcpos_ring[SRCPOS_RING_SIZE];
+	int srcpos_ring_i, srcpos_ring_n;
+	int has_mismatch;
+	struct libxsvf_srcpos mismatch_pos;
+	int mismatch_expected, mismatch_actual;
 	struct read_job_s *job_fifo_out, *job_fifo_in;
 	int last_tms;
 	int last_tdo;
 	int buffer_i;
 	int retval_i;
 	int retval[256];
+	unsigned char *capture_data;
+	int capture_nbytes, capture_i;
 	int error_rc;
 	int verbose;
 	int syncmode;
@@ -223,6 +246,7 @@ static struct read_job_s *new_read_job(struct udata_s *u, int data_len, int bits
 	memcpy(job->buffer, buffer, bits_len*sizeof(struct buffer_s));
 	job->handler = handler;
 	job->command_id = command_count++;
+	job->seq = u->buffer_seq + (buffer - u->buffer);
 
 	if (u->job_fifo_in)
 		u->job_fifo_in->next = job;
@@ -239,6 +263,40 @@ static struct read_job_s *new_read_job(struct udata_s *u, int data_len, int bits
 	return job;
 }
 
+static void job_tdo_mismatch(struct udata_s *u, struct read_job_s *job, int i, int line_tdo)
+{
+	unsigned long seq = job->seq + i;
+	int k, j = u->srcpos_ring_i;
+
+	if (u->forcemode)
+		return;
+
+	/* remember the position of the first mismatch since the last sync */
+	if (u->error_rc == 0 && !u->has_mismatch) {
+		for (k = 0; k < u->srcpos_ring_n; k++, j = (j + SRCPOS_RING_SIZE - 1) % SRCPOS_RING_SIZE) {
+			struct srcpos_range_s *r = &u->srcpos_ring[j];
+			if (r->seq <= seq) {
+				u->mismatch_pos = r->pos;
+				u->mismatch_pos.bit += seq - r->seq;
+				u->mismatch_expected = job->buffer[i].tdo;
+				u->mismatch_actual = line_tdo;
+				u->has_mismatch = 1;
+				break;
+			}
+		}
+	}
+
+	u->error_rc = -1;
+}
+
+/* store the next TDO bit of a shift_bits() call with a tdo buffer */
+static void capture_tdo(struct udata_s *u, int line_tdo)
+{
+	int k = u->capture_i++;
+	if (line_tdo)
+		u->capture_data[u->capture_nbytes-1-k/8] |= 1 << (k%8);
+}
+
 static void transfer_tms_job_handler(struct udata_s *u, struct read_job_s *job, unsigned char *data)
 {
 	int i;
@@ -246,10 +304,12 @@ static void transfer_tms_job_handler(struct udata_s *u, struct read_job_s *job,
 		// seams like output is align to the MSB in the byte and is LSB first
 		int bitpos = i + (8 - job->bits_len);
 		int line_tdo = (*data & (1 << bitpos)) != 0 ? 1 : 0;
-		if (job->buffer[i].tdo_enable && job->buffer[i].tdo != line_tdo && !u->forcemode)
-			u->error_rc = -1;
+		if (job->buffer[i].tdo_enable && job->buffer[i].tdo != line_tdo)
+			job_tdo_mismatch(u, job, i, line_tdo);
 		if (job->buffer[i].rmask && u->retval_i < 256)
 			u->retval[u->retval_i++] = line_tdo;
+		if (job->buffer[i].capture)
+			capture_tdo(u, line_tdo);
 		u->last_tdo = line_tdo;
 	}
 }
@@ -288,20 +348,22 @@ static void transfer_tdi_job_handler(struct udata_s *u, struct read_job_s *job,
 		for (k=0; k<8; k++, i++) {
 			int line_tdo = (data[j] & (1 << k)) != 0 ? 1 : 0;
 			if (job->buffer[i].tdo_enable && job->buffer[i].tdo != line_tdo)
-				if (!u->forcemode)
-					u->error_rc = -1;
+				job_tdo_mismatch(u, job, i, line_tdo);
 			if (job->buffer[j*8+k].rmask && u->retval_i < 256)
 				u->retval[u->retval_i++] = line_tdo;
+			if (job->buffer[i].capture)
+				capture_tdo(u, line_tdo);
 		}
 	}
 	for (j=0; j<bits; j++, i++) {
 		int bitpos = j + (8 - bits);
 		int line_tdo = (data[bytes] & (1 << bitpos)) != 0 ? 1 : 0;
 		if (job->buffer[i].tdo_enable && job->buffer[i].tdo != line_tdo)
-			if (!u->forcemode)
-				u->error_rc = -1;
+			job_tdo_mismatch(u, job, i, line_tdo);
 		if (job->buffer[i].rmask && u->retval_i < 256)
 			u->retval[u->retval_i++] = line_tdo;
+		if (job->buffer[i].capture)
+			capture_tdo(u, line_tdo);
 		u->last_tdo = line_tdo;
 	}
 }
@@ -466,6 +528,7 @@ static void buffer_flush(struct udata_s *u)
 		transfer_tdi(u, u->buffer+pos, len);
 		pos += len;
 	}
+	u->buffer_seq += u->buffer_i;
 	u->buffer_i = 0;
 
 #ifdef BLOCK_WRITE
@@ -503,14 +566,28 @@ static void buffer_sync(struct udata_s *u)
 #endif
 }
 
-static void buffer_add(struct udata_s *u, int tms, int tdi, int tdo, int rmask)
+static void buffer_add(struct udata_s *u, int tms, int tdi, int tdo, int rmask, const struct libxsvf_srcpos *pos)
 {
+	if (tdo >= 0) {
+		unsigned long seq = u->buffer_seq + u->buffer_i;
+		struct srcpos_range_s *r = &u->srcpos_ring[u->srcpos_ring_i];
+		if (u->srcpos_ring_n == 0 || r->pos.command != pos->command || r->pos.bit + (long)(seq - r->seq) != pos->bit) {
+			u->srcpos_ring_i = (u->srcpos_ring_i + 1) % SRCPOS_RING_SIZE;
+			if (u->srcpos_ring_n < SRCPOS_RING_SIZE)
+				u->srcpos_ring_n++;
+			r = &u->srcpos_ring[u->srcpos_ring_i];
+			r->seq = seq;
+			r->pos = *pos;
+		}
+	}
+
 	u->buffer[u->buffer_i].tms = tms;
 	u->buffer[u->buffer_i].tdi = tdi;
 	u->buffer[u->buffer_i].tdi_enable = tdi >= 0;
 	u->buffer[u->buffer_i].tdo = tdo;
 	u->buffer[u->buffer_i].tdo_enable = tdo >= 0;
 	u->buffer[u->buffer_i].rmask = rmask;
+	u->buffer[u->buffer_i].capture = u->capture_data != NULL;
 	u->buffer_i++;
 
 	if (u->buffer_i >= u->buffer_size)
@@ -523,6 +600,10 @@ static int h_setup(struct libxsvf_host *h)
 
 	struct udata_s *u = h->user_data;
 	u->buffer_size = BUFFER_SIZE;
+	u->buffer_seq = 0;
+	u->srcpos_ring_i = 0;
+	u->srcpos_ring_n = 0;
+	u->has_mismatch = 0;
 #ifdef BLOCK_WRITE
 	u->ftdibuf_len = 0;
 #endif
@@ -709,7 +790,7 @@ static void h_udelay(struct libxsvf_host *h, long usecs, int tms, long num_tck)
 		struct timeval tv1, tv2;
 		gettimeofday(&tv1, NULL);
 		while (num_tck > 0) {
-			buffer_add(u, tms, -1, -1, 0);
+			buffer_add(u, tms, -1, -1, 0, &h->srcpos);
 			num_tck--;
 		}
 		buffer_sync(u);
@@ -731,11 +812,26 @@ static int h_getbyte(struct libxsvf_host *h)
 	return fgetc(u->f);
 }
 
+/* return the error state and pass the first mismatch to the library */
+static int take_error(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	if (u->error_rc < 0 && u->has_mismatch)
+		libxsvf_tdo_mismatch(h, &u->mismatch_pos, u->mismatch_expected, u->mismatch_actual);
+	if (u->error_rc < 0)
+		u->has_mismatch = 0;
+	return u->error_rc;
+}
+
 static int h_sync(struct libxsvf_host *h)
 {
 	struct udata_s *u = h->user_data;
+	struct timeval tv1, tv2;
+	gettimeofday(&tv1, NULL);
 	buffer_sync(u);
-	int rc = u->error_rc;
+	gettimeofday(&tv2, NULL);
+	libxsvf_sync_cost(h, (tv2.tv_sec - tv1.tv_sec)*1000000 + (tv2.tv_usec - tv1.tv_usec));
+	int rc = take_error(h);
 	u->error_rc = 0;
 	return rc;
 }
@@ -745,14 +841,44 @@ static int h_pulse_tck(struct libxsvf_host *h, int tms, int tdi, int tdo, int rm
 	struct udata_s *u = h->user_data;
 	if (u->syncmode)
 		sync = 1;
-	buffer_add(u, tms, tdi, tdo, rmask);
+	buffer_add(u, tms, tdi, tdo, rmask, &h->srcpos);
 	if (sync) {
 		buffer_sync(u);
-		int rc = u->error_rc < 0 ? u->error_rc : u->last_tdo;
+		int rc = take_error(h) < 0 ? -1 : u->last_tdo;
 		u->error_rc = 0;
 		return rc;
 	}
-	return u->error_rc < 0 ? u->error_rc : 1;
+	return take_error(h) < 0 ? -1 : 1;
+}
+
+static int h_shift_bits(struct libxsvf_host *h, int len, const unsigned char *tdi, unsigned char *tdo, int tms_last)
+{
+	struct udata_s *u = h->user_data;
+	int k, nbytes = (len+7)/8;
+
+	/* queue all bits and, when tdo values are requested, read them
+	 * back in a single round trip */
+	if (tdo) {
+		memset(tdo, 0, nbytes);
+		buffer_sync(u);
+		u->capture_data = tdo;
+		u->capture_nbytes = nbytes;
+		u->capture_i = 0;
+	}
+
+	for (k = 0; k < len; k++) {
+		int tms = k == len-1 ? tms_last : 0;
+		buffer_add(u, tms, (tdi[nbytes-1-k/8] >> (k%8)) & 1, -1, 0, &h->srcpos);
+	}
+
+	if (tdo || u->syncmode) {
+		buffer_sync(u);
+		u->capture_data = NULL;
+		int rc = take_error(h);
+		u->error_rc = 0;
+		return rc < 0 ? -1 : 0;
+	}
+	return take_error(h) < 0 ? -1 : 0;
 }
 
 static int h_set_frequency(struct libxsvf_host *h, int v)
@@ -764,6 +890,8 @@ static int h_set_frequency(struct libxsvf_host *h, int v)
 	int div = fmax(ceil(12e6 / (2*v) - 1), 2);
 	setfreq_command[1] = div >> 0;
 	setfreq_command[2] = div >> 8;
+	if (h->sync_policy)
+		h->sync_policy->frequency = 12000000 / (2*div + 2);
 	write_dumpfile(1, setfreq_command, sizeof(setfreq_command), 0);
 	int rc = my_ftdi_write_data(u, setfreq_command, sizeof(setfreq_command), 1);
 	if (rc != sizeof(setfreq_command)) {
@@ -807,6 +935,73 @@ static void *h_realloc(struct libxsvf_host *h, void *ptr, int size, enum libxsvf
 static struct udata_s u = {
 };
 
+/* Number of commands between checkpoints (-j and -J options) */
+#define CHECKPOINT_INTERVAL 1000
+
+static const char *checkpoint_file;
+
+/* size of the file the loaded checkpoint was written for */
+static long checkpoint_size = -1;
+
+static struct libxsvf_checkpoint checkpoint = {
+	.interval = CHECKPOINT_INTERVAL
+};
+
+/* the size of a regular file, -1 for pipes etc. */
+static long input_file_size(FILE *f)
+{
+	struct stat st;
+
+	if (fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode))
+		return -1;
+	return st.st_size;
+}
+
+static void h_report_checkpoint(struct libxsvf_host *h, const struct libxsvf_checkpoint *cp)
+{
+	struct udata_s *u = h->user_data;
+	char tmpname[1024];
+	FILE *f;
+
+	/* write a new file and rename it, so there always is a valid checkpoint */
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", checkpoint_file);
+	f = fopen(tmpname, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Can't write checkpoint file `%s': %s\n", tmpname, strerror(errno));
+		return;
+	}
+	fprintf(f, "%ld %d %ld %ld\n", cp->command, cp->tap_state, ftell(u->f), input_file_size(u->f));
+	if (fclose(f) != 0 || rename(tmpname, checkpoint_file) != 0)
+		fprintf(stderr, "Can't write checkpoint file `%s': %s\n", checkpoint_file, strerror(errno));
+}
+
+static void load_checkpoint()
+{
+	FILE *f = fopen(checkpoint_file, "r");
+	long offset;
+	int tap_state;
+
+	/* no checkpoint file: start from the beginning */
+	if (f == NULL)
+		return;
+
+	if (fscanf(f, "%ld %d %ld %ld", &checkpoint.command, &tap_state, &offset, &checkpoint_size) == 4) {
+		checkpoint.tap_state = tap_state;
+		checkpoint.resume = 1;
+		fprintf(stderr, "Resuming at command %ld (file offset %ld) from checkpoint file `%s'.\n",
+				checkpoint.command, offset, checkpoint_file);
+	} else {
+		fprintf(stderr, "Ignoring invalid checkpoint file `%s'.\n", checkpoint_file);
+	}
+
+	fclose(f);
+}
+
+static struct libxsvf_sync_policy sync_policy = {
+	.block_sync = 1,
+	.clean_blocks = 32
+};
+
 static struct libxsvf_host h = {
 	.udelay = h_udelay,
 	.setup = h_setup,
@@ -814,12 +1009,14 @@ static struct libxsvf_host h = {
 	.getbyte = h_getbyte,
 	.sync = h_sync,
 	.pulse_tck = h_pulse_tck,
+	.shift_bits = h_shift_bits,
 	.set_frequency = h_set_frequency,
 	.report_tapstate = h_report_tapstate,
 	.report_device = h_report_device,
 	.report_status = h_report_status,
 	.report_error = h_report_error,
 	.realloc = h_realloc,
+	.report_checkpoint = h_report_checkpoint,
 	.user_data = &u
 };
 
@@ -837,6 +1034,55 @@ static uint16_t eeprom_checksum(unsigned char *data, int len)
 	return checksum;
 }
 
+/* The adapter stays open between files and is only set up again when an
+ * option changes its configuration. */
+static int session_open;
+
+static int session_play(enum libxsvf_mode mode)
+{
+	if (!session_open) {
+		if (libxsvf_session_open(&h) < 0)
+			return -1;
+		session_open = 1;
+	} else {
+		/* undo FREQUENCY commands of the previous file */
+		h.set_frequency(&h, u.frequency > 0 ? u.frequency : 2000000);
+	}
+	return libxsvf_session_play(&h, mode);
+}
+
+static int session_end(void)
+{
+	if (!session_open)
+		return 0;
+	session_open = 0;
+	return libxsvf_session_close(&h);
+}
+
+/* Start reading the next SVF or XSVF file on the command line into the
+ * page cache, so it is ready when the current file has been played. */
+static void prefetch_next(int argc, char **argv)
+{
+	const char *fn = NULL;
+	int i, fd;
+
+	for (i = optind; i < argc && !fn; i++) {
+		if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "-x"))
+			fn = i+1 < argc ? argv[++i] : NULL;
+		else if (!strncmp(argv[i], "-s", 2) || !strncmp(argv[i], "-x", 2))
+			fn = argv[i] + 2;
+	}
+
+	if (!fn || !strcmp(fn, "-"))
+		return;
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
+
 const char *progname;
 
 static void help()
@@ -850,7 +1096,8 @@ static void help()
 	fprintf(stderr, "Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>\n");
 	fprintf(stderr, "Lib(X)SVF is free software licensed under the ISC license.\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "Usage: %s [ -v[v..] ] [ -d dumpfile ] [ -L | -B ] [ -S ] [ -F ] \\\n", progname);
+	fprintf(stderr, "Usage: %s [ -v[v..] ] [ -d dumpfile ] [ -L | -B ] [ -S ] [ -F ] [ -l ms ] \\\n", progname);
+	fprintf(stderr, "      %*s [ -b retries [ -m kHz ] ] [ -j file | -J file ] \\\n", (int)(strlen(progname)+1), "");
 	fprintf(stderr, "      %*s [ -D vendor:product ] [ -C channel ] [ -f freq[k|M] ] \\\n", (int)(strlen(progname)+1), "");
 	fprintf(stderr, "      %*s [ -Z eeprom-size] [ [-G|-I] -W eeprom-filename ] [ -R eeprom-filename ] \\\n", (int)(strlen(progname)+1), "");
 	fprintf(stderr, "      %*s { -s svf-file | -x xsvf-file | -c } ...\n", (int)(strlen(progname)+1), "");
@@ -870,6 +1117,25 @@ static void help()
 	fprintf(stderr, "   -F\n");
 	fprintf(stderr, "          Force mode (ignore all TDO mismatches)\n");
 	fprintf(stderr, "\n");
+	fprintf(stderr, "   -l ms\n");
+	fprintf(stderr, "          Report TDO mismatches within the specified time\n");
+	fprintf(stderr, "          (default: only at the end of the file and before delays)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -b retries\n");
+	fprintf(stderr, "          Replay an SVF block (the commands from one SIR to the next)\n");
+	fprintf(stderr, "          up to this many times on TDO mismatches before giving up\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -m kHz\n");
+	fprintf(stderr, "          Lower the frequency for block replays down to this value\n");
+	fprintf(stderr, "          (it is raised again after 32 clean blocks)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -j file\n");
+	fprintf(stderr, "          Write checkpoints for the next SVF or XSVF file to this file\n");
+	fprintf(stderr, "          (it is removed when the file has been played without errors)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -J file\n");
+	fprintf(stderr, "          Like -j, but resume at the checkpoint in this file (if it exists)\n");
+	fprintf(stderr, "\n");
 	fprintf(stderr, "   -f freq[k|M]\n");
 	fprintf(stderr, "          Set maximum frequency in Hz, kHz or MHz\n");
 	fprintf(stderr, "\n");
@@ -924,8 +1190,12 @@ int main(int argc, char **argv)
 	int opt, i, j;
 
 	progname = argc >= 1 ? argv[0] : "xsvftool-ft232h";
-	while ((opt = getopt(argc, argv, "vd:LBSFD:C:Z:GIW:R:f:x:s:c")) != -1)
+	while ((opt = getopt(argc, argv, "vd:LBSFl:b:m:j:J:D:C:Z:GIW:R:f:x:s:c")) != -1)
 	{
+		/* options that configure the adapter need a new setup */
+		if (!strchr("vxscjJLBlbm", opt) && session_end() < 0)
+			rc = 1;
+
 		switch (opt)
 		{
 		case 'v':
@@ -1091,23 +1361,39 @@ int main(int argc, char **argv)
 				rc = 1;
 				break;
 			}
-			if (libxsvf_play(&h, opt == 's' ? LIBXSVF_MODE_SVF : LIBXSVF_MODE_XSVF) < 0) {
+			if (h.checkpoint && checkpoint.resume && input_file_size(u.f) != checkpoint_size) {
+				fprintf(stderr, "Checkpoint file `%s' was written for a different file (size %ld, not %ld).\n",
+						checkpoint_file, checkpoint_size, input_file_size(u.f));
+				if (strcmp(optarg, "-"))
+					fclose(u.f);
+				rc = 1;
+				break;
+			}
+			prefetch_next(argc, argv);
+			if (session_play(opt == 's' ? LIBXSVF_MODE_SVF : LIBXSVF_MODE_XSVF) < 0) {
 				fprintf(stderr, "Error while playing %s file `%s'.\n", opt == 's' ? "SVF" : "XSVF", optarg);
 				rc = 1;
+			} else if (h.checkpoint) {
+				unlink(checkpoint_file);
 			}
+			h.checkpoint = NULL;
 			if (strcmp(optarg, "-"))
 				fclose(u.f);
 			break;
 		case 'c':
 			gotaction = 1;
-			int old_frequency = u.frequency;
-			if (u.frequency == 0)
-				u.frequency = 10000;
-			if (libxsvf_play(&h, LIBXSVF_MODE_SCAN) < 0) {
+			if (session_play(LIBXSVF_MODE_SCAN) < 0) {
 				fprintf(stderr, "Error while scanning JTAG chain.\n");
 				rc = 1;
 			}
-			u.frequency = old_frequency;
+			break;
+		case 'j':
+		case 'J':
+			checkpoint_file = optarg;
+			checkpoint.resume = 0;
+			if (opt == 'J')
+				load_checkpoint();
+			h.checkpoint = &checkpoint;
 			break;
 		case 'L':
 			hex_mode = 1;
@@ -1123,12 +1409,27 @@ int main(int argc, char **argv)
 		case 'F':
 			u.forcemode = 1;
 			break;
+		case 'l':
+			sync_policy.max_usecs = atoi(optarg) * 1000L;
+			h.sync_policy = &sync_policy;
+			break;
+		case 'b':
+			sync_policy.block_retries = atoi(optarg);
+			h.sync_policy = &sync_policy;
+			break;
+		case 'm':
+			sync_policy.min_frequency = atoi(optarg) * 1000;
+			h.sync_policy = &sync_policy;
+			break;
 		default:
 			help();
 			break;
 		}
 	}
 
+	if (session_end() < 0)
+		rc = 1;
+
 	if (!gotaction)
 		help();
 
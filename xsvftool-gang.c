@@ -0,0 +1,775 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * xsvftool-gang plays one SVF/XSVF file on many identical boards. The
+ * file is parsed once: the parser process plays it on a recording host
+ * that writes the host calls (clock cycles with their TDI and expected
+ * TDO values, shifts, delays, ...) into a ring buffer in shared memory.
+ * One worker process per adapter replays the ring at its own pace on its
+ * own libxsvf_host and checks the TDO values itself. So the parse CPU
+ * time and the memory use don't grow with the number of adapters.
+ *
+ * The recording host sees every TDO check as successful, so the players
+ * never branch on TDO values: XSVF XREPEAT retries and SVF block replays
+ * are not available and a board fails on its first TDO mismatch.
+ *
+ * The adapters are simulated TAPs with an IDCODE register. The sim_*()
+ * functions are the place to drive real hardware.
+ */
+
+#include "libxsvf.h"
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define MAX_ADAPTERS 64
+#define DEFAULT_RING_KB 1024
+
+/* max. number of clock cycles in one OP_PULSES or OP_SHIFT record */
+#define MAX_PULSES 4096
+#define MAX_SHIFT_BITS 65536
+
+enum op_type {
+	OP_PULSES = 1,
+	OP_SHIFT,
+	OP_UDELAY,
+	OP_SYNC,
+	OP_SRCPOS,
+	OP_FREQUENCY,
+	OP_TRST,
+	OP_SCK,
+	OP_END
+};
+
+/* flags of the clock cycles in an OP_PULSES record */
+#define PULSE_TMS     0x01
+#define PULSE_TDI     0x02
+#define PULSE_TDI_EN  0x04
+#define PULSE_TDO     0x08
+#define PULSE_TDO_EN  0x10
+#define PULSE_RMASK   0x20
+#define PULSE_SYNC    0x40
+
+/* records are 8 byte aligned: a header and 'size' bytes of payload */
+struct op_s {
+	unsigned char type;
+	unsigned char arg;
+	unsigned short reserved;
+	int size;
+};
+
+struct udelay_s {
+	long usecs;
+	long num_tck;
+};
+
+struct result_s {
+	int failed;
+	long long clocks;
+	long long usecs;
+	struct libxsvf_mismatch mismatch;
+	int retval_i;
+	int retval[256];
+};
+
+struct gang_s {
+	pthread_mutex_t mutex;
+	pthread_cond_t data_cond;
+	pthread_cond_t space_cond;
+	/* bytes written by the parser and read by each worker (-1 = done) */
+	long long head;
+	long long tail[MAX_ADAPTERS];
+	int num_adapters;
+	long ring_size;
+	struct result_s result[MAX_ADAPTERS];
+	unsigned char ring[];
+};
+
+static struct gang_s *gang;
+static int verbose;
+
+
+/** Ring buffer **/
+
+static void ring_copy_in(long long pos, const void *buf, int len)
+{
+	long offset = pos % gang->ring_size;
+	int n = len < gang->ring_size - offset ? len : gang->ring_size - offset;
+	memcpy(gang->ring + offset, buf, n);
+	memcpy(gang->ring, (const unsigned char*)buf + n, len - n);
+}
+
+static void ring_copy_out(long long pos, void *buf, int len)
+{
+	long offset = pos % gang->ring_size;
+	int n = len < gang->ring_size - offset ? len : gang->ring_size - offset;
+	memcpy(buf, gang->ring + offset, n);
+	memcpy((unsigned char*)buf + n, gang->ring, len - n);
+}
+
+static long long min_tail(void)
+{
+	long long t = gang->head;
+	int i;
+	for (i = 0; i < gang->num_adapters; i++)
+		if (gang->tail[i] >= 0 && gang->tail[i] < t)
+			t = gang->tail[i];
+	return t;
+}
+
+
+/** Parser: recording host **/
+
+static struct {
+	FILE *f;
+	/* written, but not yet published in gang->head */
+	long long head;
+	unsigned char pulses[MAX_PULSES];
+	int num_pulses;
+	/* position of the next checked bit, if it is a continuation */
+	struct libxsvf_srcpos next_pos;
+	int have_pos;
+	long long space_waits;
+} rec;
+
+static void rec_publish(void)
+{
+	pthread_mutex_lock(&gang->mutex);
+	gang->head = rec.head;
+	pthread_cond_broadcast(&gang->data_cond);
+	pthread_mutex_unlock(&gang->mutex);
+}
+
+static void rec_op(int type, int arg, const void *payload, int size)
+{
+	static const unsigned char zeros[8];
+	struct op_s op = { type, arg, 0, size };
+	int total = sizeof(op) + ((size + 7) & ~7);
+
+	/* publish whole records only, so the workers never see half of one */
+	if (rec.head - gang->head >= gang->ring_size / 8)
+		rec_publish();
+
+	if (rec.head + total - min_tail() > gang->ring_size) {
+		rec_publish();
+		pthread_mutex_lock(&gang->mutex);
+		while (rec.head + total - min_tail() > gang->ring_size) {
+			rec.space_waits++;
+			pthread_cond_wait(&gang->space_cond, &gang->mutex);
+		}
+		pthread_mutex_unlock(&gang->mutex);
+	}
+
+	ring_copy_in(rec.head, &op, sizeof(op));
+	ring_copy_in(rec.head + sizeof(op), payload, size);
+	ring_copy_in(rec.head + sizeof(op) + size, zeros, total - sizeof(op) - size);
+	rec.head += total;
+}
+
+static void rec_flush_pulses(void)
+{
+	if (rec.num_pulses > 0)
+		rec_op(OP_PULSES, 0, rec.pulses, rec.num_pulses);
+	rec.num_pulses = 0;
+}
+
+static int rec_setup(struct libxsvf_host *h)
+{
+	return 0;
+}
+
+static int rec_shutdown(struct libxsvf_host *h)
+{
+	rec_flush_pulses();
+	return 0;
+}
+
+static void rec_udelay(struct libxsvf_host *h, long usecs, int tms, long num_tck)
+{
+	struct udelay_s d = { usecs, num_tck };
+	rec_flush_pulses();
+	rec_op(OP_UDELAY, tms, &d, sizeof(d));
+}
+
+static int rec_getbyte(struct libxsvf_host *h)
+{
+	return fgetc(rec.f);
+}
+
+static int rec_sync(struct libxsvf_host *h)
+{
+	rec_flush_pulses();
+	rec_op(OP_SYNC, 0, NULL, 0);
+	return 0;
+}
+
+static int rec_pulse_tck(struct libxsvf_host *h, int tms, int tdi, int tdo, int rmask, int sync)
+{
+	if (tdo >= 0) {
+		struct libxsvf_srcpos *p = &rec.next_pos;
+		if (!rec.have_pos || p->command != h->srcpos.command || p->bit != h->srcpos.bit) {
+			rec_flush_pulses();
+			rec_op(OP_SRCPOS, 0, &h->srcpos, sizeof(h->srcpos));
+			rec.next_pos = h->srcpos;
+			rec.have_pos = 1;
+		}
+		rec.next_pos.bit++;
+	}
+
+	rec.pulses[rec.num_pulses++] = (tms ? PULSE_TMS : 0) |
+			(tdi > 0 ? PULSE_TDI : 0) | (tdi >= 0 ? PULSE_TDI_EN : 0) |
+			(tdo > 0 ? PULSE_TDO : 0) | (tdo >= 0 ? PULSE_TDO_EN : 0) |
+			(rmask ? PULSE_RMASK : 0) | (sync ? PULSE_SYNC : 0);
+	if (rec.num_pulses == MAX_PULSES)
+		rec_flush_pulses();
+
+	/* the workers check the tdo values */
+	return tdo < 0 ? 1 : tdo;
+}
+
+/* the payload of an OP_SHIFT record is the number of bits and the tdi data */
+static void rec_shift(int len, const unsigned char *tdi, int tms_last)
+{
+	static unsigned char buf[sizeof(int) + MAX_SHIFT_BITS / 8];
+	memcpy(buf, &len, sizeof(int));
+	memcpy(buf + sizeof(int), tdi, (len+7)/8);
+	rec_op(OP_SHIFT, tms_last, buf, sizeof(int) + (len+7)/8);
+}
+
+static int rec_shift_bits(struct libxsvf_host *h, int len, const unsigned char *tdi, unsigned char *tdo, int tms_last)
+{
+	static unsigned char buf[MAX_SHIFT_BITS / 8];
+	int i, k, nbytes = (len+7)/8;
+
+	if (tdo) {
+		LIBXSVF_HOST_REPORT_ERROR("Shifts with TDO capture can't be shared.");
+		return -1;
+	}
+
+	rec_flush_pulses();
+
+	if (len <= MAX_SHIFT_BITS) {
+		rec_shift(len, tdi, tms_last);
+		return 0;
+	}
+
+	/* split long shifts, TMS stays 0 up to the last bit */
+	for (i = 0; i < len; i += MAX_SHIFT_BITS) {
+		int n = len - i < MAX_SHIFT_BITS ? len - i : MAX_SHIFT_BITS;
+		int nb = (n+7)/8;
+		memset(buf, 0, nb);
+		for (k = 0; k < n; k++)
+			buf[nb-1-k/8] |= ((tdi[nbytes-1-(i+k)/8] >> ((i+k)%8)) & 1) << (k%8);
+		rec_shift(n, buf, i + n == len ? tms_last : 0);
+	}
+	return 0;
+}
+
+static void rec_set_trst(struct libxsvf_host *h, int v)
+{
+	rec_flush_pulses();
+	rec_op(OP_TRST, 0, &v, sizeof(v));
+}
+
+static int rec_set_frequency(struct libxsvf_host *h, int v)
+{
+	rec_flush_pulses();
+	rec_op(OP_FREQUENCY, 0, &v, sizeof(v));
+	return 0;
+}
+
+static void rec_pulse_sck(struct libxsvf_host *h)
+{
+	rec_flush_pulses();
+	rec_op(OP_SCK, 0, NULL, 0);
+}
+
+static void rec_report_error(struct libxsvf_host *h, const char *file, int line, const char *message)
+{
+	fprintf(stderr, "[%s:%d] %s\n", file, line, message);
+}
+
+static void *rec_realloc(struct libxsvf_host *h, void *ptr, int size, enum libxsvf_mem which)
+{
+	return realloc(ptr, size);
+}
+
+static struct libxsvf_host rec_host = {
+	.udelay = rec_udelay,
+	.setup = rec_setup,
+	.shutdown = rec_shutdown,
+	.getbyte = rec_getbyte,
+	.sync = rec_sync,
+	.pulse_tck = rec_pulse_tck,
+	.shift_bits = rec_shift_bits,
+	.pulse_sck = rec_pulse_sck,
+	.set_trst = rec_set_trst,
+	.set_frequency = rec_set_frequency,
+	.report_error = rec_report_error,
+	.realloc = rec_realloc
+};
+
+
+/** Workers: simulated adapters **/
+
+#define SIM_IDCODE 0x13631093
+#define SIM_IR_LEN 6
+#define SIM_IR_IDCODE 0x09
+
+static const unsigned char sim_tap_next[17][2] = {
+	[LIBXSVF_TAP_RESET]     = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_RESET     },
+	[LIBXSVF_TAP_IDLE]      = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  },
+	[LIBXSVF_TAP_DRSELECT]  = { LIBXSVF_TAP_DRCAPTURE, LIBXSVF_TAP_IRSELECT  },
+	[LIBXSVF_TAP_DRCAPTURE] = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DREXIT1   },
+	[LIBXSVF_TAP_DRSHIFT]   = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DREXIT1   },
+	[LIBXSVF_TAP_DREXIT1]   = { LIBXSVF_TAP_DRPAUSE,   LIBXSVF_TAP_DRUPDATE  },
+	[LIBXSVF_TAP_DRPAUSE]   = { LIBXSVF_TAP_DRPAUSE,   LIBXSVF_TAP_DREXIT2   },
+	[LIBXSVF_TAP_DREXIT2]   = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DRUPDATE  },
+	[LIBXSVF_TAP_DRUPDATE]  = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  },
+	[LIBXSVF_TAP_IRSELECT]  = { LIBXSVF_TAP_IRCAPTURE, LIBXSVF_TAP_RESET     },
+	[LIBXSVF_TAP_IRCAPTURE] = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IREXIT1   },
+	[LIBXSVF_TAP_IRSHIFT]   = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IREXIT1   },
+	[LIBXSVF_TAP_IREXIT1]   = { LIBXSVF_TAP_IRPAUSE,   LIBXSVF_TAP_IRUPDATE  },
+	[LIBXSVF_TAP_IRPAUSE]   = { LIBXSVF_TAP_IRPAUSE,   LIBXSVF_TAP_IREXIT2   },
+	[LIBXSVF_TAP_IREXIT2]   = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IRUPDATE  },
+	[LIBXSVF_TAP_IRUPDATE]  = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  }
+};
+
+struct adapter_s {
+	int index;
+	unsigned long idcode;
+	struct result_s *result;
+	/* simulated TAP */
+	int state;
+	int ir, ir_shift;
+	int dr_len;
+	unsigned long dr_shift;
+};
+
+static void sim_setup(struct adapter_s *a)
+{
+	a->state = LIBXSVF_TAP_RESET;
+	a->ir = SIM_IR_IDCODE;
+}
+
+static void sim_shutdown(struct adapter_s *a)
+{
+}
+
+/* one clock cycle, returns the tdo value before the rising edge */
+static int sim_clock(struct adapter_s *a, int tms, int tdi)
+{
+	int tdo = 1;
+
+	a->result->clocks++;
+	tdi = tdi < 0 ? 1 : tdi;
+
+	switch (a->state)
+	{
+	case LIBXSVF_TAP_IRCAPTURE:
+		a->ir_shift = 0x01;
+		break;
+	case LIBXSVF_TAP_IRSHIFT:
+		tdo = a->ir_shift & 1;
+		a->ir_shift = a->ir_shift >> 1 | tdi << (SIM_IR_LEN-1);
+		break;
+	case LIBXSVF_TAP_DRCAPTURE:
+		a->dr_len = a->ir == SIM_IR_IDCODE ? 32 : 1;
+		a->dr_shift = a->ir == SIM_IR_IDCODE ? a->idcode : 0;
+		break;
+	case LIBXSVF_TAP_DRSHIFT:
+		tdo = a->dr_shift & 1;
+		a->dr_shift = a->dr_shift >> 1 | (unsigned long)tdi << (a->dr_len-1);
+		break;
+	}
+
+	a->state = sim_tap_next[a->state][tms];
+	if (a->state == LIBXSVF_TAP_IRUPDATE)
+		a->ir = a->ir_shift;
+	if (a->state == LIBXSVF_TAP_RESET)
+		a->ir = SIM_IR_IDCODE;
+
+	return tdo;
+}
+
+static int h_setup(struct libxsvf_host *h)
+{
+	sim_setup(h->user_data);
+	return 0;
+}
+
+static int h_shutdown(struct libxsvf_host *h)
+{
+	sim_shutdown(h->user_data);
+	return 0;
+}
+
+static void h_udelay(struct libxsvf_host *h, long usecs, int tms, long num_tck)
+{
+	struct adapter_s *a = h->user_data;
+	while (num_tck-- > 0)
+		sim_clock(a, tms, -1);
+	if (usecs > 0)
+		usleep(usecs);
+}
+
+static int h_pulse_tck(struct libxsvf_host *h, int tms, int tdi, int tdo, int rmask, int sync)
+{
+	struct adapter_s *a = h->user_data;
+	struct result_s *r = a->result;
+	int line_tdo = sim_clock(a, tms, tdi);
+
+	if (rmask == 1 && r->retval_i < 256)
+		r->retval[r->retval_i++] = line_tdo;
+
+	if (tdo >= 0 && tdo != line_tdo) {
+		libxsvf_tdo_mismatch(h, &h->srcpos, tdo, line_tdo);
+		return -1;
+	}
+
+	return line_tdo;
+}
+
+static int h_shift_bits(struct libxsvf_host *h, int len, const unsigned char *tdi, unsigned char *tdo, int tms_last)
+{
+	struct adapter_s *a = h->user_data;
+	int k, nbytes = (len+7)/8;
+
+	for (k = 0; k < len; k++)
+		sim_clock(a, k == len-1 ? tms_last : 0, (tdi[nbytes-1-k/8] >> (k%8)) & 1);
+
+	return 0;
+}
+
+static int h_set_frequency(struct libxsvf_host *h, int v)
+{
+	struct adapter_s *a = h->user_data;
+	if (verbose >= 2)
+		fprintf(stderr, "[adapter %d] Setting frequency to %d Hz.\n", a->index, v);
+	return 0;
+}
+
+static void h_report_error(struct libxsvf_host *h, const char *file, int line, const char *message)
+{
+	struct adapter_s *a = h->user_data;
+	fprintf(stderr, "[adapter %d] [%s:%d] %s\n", a->index, file, line, message);
+}
+
+/* replay the ring on one adapter */
+static void worker(int index, unsigned long idcode)
+{
+	static unsigned char payload[sizeof(int) + MAX_SHIFT_BITS / 8];
+	struct adapter_s a = { .index = index, .idcode = idcode, .result = &gang->result[index] };
+	struct libxsvf_host h = {
+		.udelay = h_udelay,
+		.setup = h_setup,
+		.shutdown = h_shutdown,
+		.pulse_tck = h_pulse_tck,
+		.shift_bits = h_shift_bits,
+		.set_frequency = h_set_frequency,
+		.report_error = h_report_error,
+		.user_data = &a
+	};
+	struct result_s *r = a.result;
+	struct timeval tv1, tv2;
+	long long tail = 0, head = 0;
+	int i, rc = 0, done = 0;
+
+	gettimeofday(&tv1, NULL);
+	if (h.setup(&h) < 0)
+		rc = -1;
+
+	while (rc == 0 && !done)
+	{
+		struct op_s op;
+
+		/* hand back the space that has been read and wait for more */
+		if (tail == head || tail - gang->tail[index] >= gang->ring_size / 8) {
+			pthread_mutex_lock(&gang->mutex);
+			gang->tail[index] = tail;
+			pthread_cond_broadcast(&gang->space_cond);
+			while (gang->head == tail)
+				pthread_cond_wait(&gang->data_cond, &gang->mutex);
+			head = gang->head;
+			pthread_mutex_unlock(&gang->mutex);
+		}
+
+		ring_copy_out(tail, &op, sizeof(op));
+		ring_copy_out(tail + sizeof(op), payload, op.size);
+		tail += sizeof(op) + ((op.size + 7) & ~7);
+
+		switch (op.type)
+		{
+		case OP_PULSES:
+			for (i = 0; rc >= 0 && i < op.size; i++) {
+				int f = payload[i];
+				rc = h.pulse_tck(&h, (f & PULSE_TMS) != 0,
+						(f & PULSE_TDI_EN) ? (f & PULSE_TDI) != 0 : -1,
+						(f & PULSE_TDO_EN) ? (f & PULSE_TDO) != 0 : -1,
+						(f & PULSE_RMASK) != 0, (f & PULSE_SYNC) != 0);
+				if (f & PULSE_TDO_EN)
+					h.srcpos.bit++;
+			}
+			rc = rc < 0 ? -1 : 0;
+			break;
+		case OP_SHIFT:
+			rc = h.shift_bits(&h, *(int*)payload, payload + sizeof(int), NULL, op.arg);
+			break;
+		case OP_UDELAY: {
+			struct udelay_s *d = (struct udelay_s*)payload;
+			h.udelay(&h, d->usecs, op.arg, d->num_tck);
+			break;
+		}
+		case OP_SYNC:
+			rc = h.sync ? h.sync(&h) : 0;
+			break;
+		case OP_SRCPOS:
+			memcpy(&h.srcpos, payload, sizeof(h.srcpos));
+			break;
+		case OP_FREQUENCY:
+			rc = h.set_frequency ? h.set_frequency(&h, *(int*)payload) : 0;
+			break;
+		case OP_TRST:
+			if (h.set_trst)
+				h.set_trst(&h, *(int*)payload);
+			break;
+		case OP_SCK:
+			if (h.pulse_sck)
+				h.pulse_sck(&h);
+			break;
+		case OP_END:
+			rc = op.arg ? -1 : 0;
+			done = 1;
+			break;
+		}
+	}
+
+	if (rc < 0 && h.mismatch.valid) {
+		r->mismatch = h.mismatch;
+		libxsvf_report_mismatch(&h);
+	}
+	if (h.shutdown(&h) < 0)
+		rc = -1;
+
+	gettimeofday(&tv2, NULL);
+	r->usecs = (tv2.tv_sec - tv1.tv_sec)*1000000LL + (tv2.tv_usec - tv1.tv_usec);
+	r->failed = rc < 0;
+
+	/* stop holding back the parser */
+	pthread_mutex_lock(&gang->mutex);
+	gang->tail[index] = -1;
+	pthread_cond_broadcast(&gang->space_cond);
+	pthread_mutex_unlock(&gang->mutex);
+}
+
+
+/** Main **/
+
+const char *progname;
+
+static void copyleft()
+{
+	static int already_printed = 0;
+	if (already_printed)
+		return;
+	fprintf(stderr, "xsvftool-gang, part of Lib(X)SVF (http://www.clifford.at/libxsvf/).\n");
+	fprintf(stderr, "Copyright (C) 2009  RIEGL Research ForschungsGmbH\n");
+	fprintf(stderr, "Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>\n");
+	fprintf(stderr, "Lib(X)SVF is free software licensed under the ISC license.\n");
+	already_printed = 1;
+}
+
+static void help()
+{
+	copyleft();
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: %s [ -v ... ] [ -n adapters ] [ -m ring-kb ] [ -f adapter ]\n", progname);
+	fprintf(stderr, "       %*s { -s svf-file | -x xsvf-file }\n", (int)strlen(progname), "");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -v, -vv\n");
+	fprintf(stderr, "          Verbose and more verbose\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -n adapters\n");
+	fprintf(stderr, "          Number of (simulated) adapters (default: 1, max. %d)\n", MAX_ADAPTERS);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -m ring-kb\n");
+	fprintf(stderr, "          Size of the shared ring buffer in kB (default: %d)\n", DEFAULT_RING_KB);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -f adapter\n");
+	fprintf(stderr, "          Simulate a faulty board (wrong IDCODE) on this adapter\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -s svf-file\n");
+	fprintf(stderr, "          Play the specified SVF file\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -x xsvf-file\n");
+	fprintf(stderr, "          Play the specified XSVF file\n");
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *filename = NULL;
+	enum libxsvf_mode mode = LIBXSVF_MODE_SVF;
+	int num_adapters = 1, ring_kb = DEFAULT_RING_KB, faulty = -1;
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+	struct timeval tv1, tv2;
+	struct rusage ru;
+	pid_t pids[MAX_ADAPTERS];
+	int opt, i, j, rc = 0;
+
+	progname = argc >= 1 ? argv[0] : "xsvftool-gang";
+
+	while ((opt = getopt(argc, argv, "vn:m:f:s:x:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'v':
+			copyleft();
+			verbose++;
+			break;
+		case 'n':
+			num_adapters = atoi(optarg);
+			if (num_adapters < 1 || num_adapters > MAX_ADAPTERS)
+				help();
+			break;
+		case 'm':
+			ring_kb = atoi(optarg);
+			if (ring_kb < 64)
+				help();
+			break;
+		case 'f':
+			faulty = atoi(optarg);
+			break;
+		case 's':
+		case 'x':
+			if (filename)
+				help();
+			filename = optarg;
+			mode = opt == 's' ? LIBXSVF_MODE_SVF : LIBXSVF_MODE_XSVF;
+			break;
+		default:
+			help();
+			break;
+		}
+	}
+
+	if (!filename || optind != argc)
+		help();
+
+	if (!strcmp(filename, "-"))
+		rec.f = stdin;
+	else
+		rec.f = fopen(filename, "rb");
+	if (rec.f == NULL) {
+		fprintf(stderr, "Can't open %s file `%s': %s\n", mode == LIBXSVF_MODE_SVF ? "SVF" : "XSVF", filename, strerror(errno));
+		return 1;
+	}
+
+	gang = mmap(NULL, sizeof(struct gang_s) + ring_kb * 1024L, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (gang == MAP_FAILED) {
+		fprintf(stderr, "Can't map the ring buffer: %s\n", strerror(errno));
+		return 1;
+	}
+	gang->ring_size = ring_kb * 1024L;
+	gang->num_adapters = num_adapters;
+
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&gang->mutex, &mattr);
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+	pthread_cond_init(&gang->data_cond, &cattr);
+	pthread_cond_init(&gang->space_cond, &cattr);
+
+	fflush(stdout);
+	fflush(stderr);
+	for (i = 0; i < num_adapters; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			fprintf(stderr, "Can't start worker: %s\n", strerror(errno));
+			num_adapters = i;
+			rc = 1;
+			break;
+		}
+		if (pids[i] == 0) {
+			fclose(rec.f);
+			worker(i, i == faulty ? SIM_IDCODE ^ 0x10000000 : SIM_IDCODE);
+			_exit(0);
+		}
+	}
+
+	if (verbose)
+		fprintf(stderr, "Playing %s file `%s' on %d adapters.\n", mode == LIBXSVF_MODE_SVF ? "SVF" : "XSVF", filename, num_adapters);
+
+	gettimeofday(&tv1, NULL);
+	if (rc == 0 && libxsvf_play(&rec_host, mode) < 0) {
+		fprintf(stderr, "Error while playing %s file `%s'.\n", mode == LIBXSVF_MODE_SVF ? "SVF" : "XSVF", filename);
+		rc = 1;
+	}
+	rec_flush_pulses();
+	rec_op(OP_END, rc, NULL, 0);
+	rec_publish();
+	getrusage(RUSAGE_SELF, &ru);
+
+	for (i = 0; i < num_adapters; i++)
+		waitpid(pids[i], NULL, 0);
+	gettimeofday(&tv2, NULL);
+
+	for (i = 0; i < num_adapters; i++) {
+		struct result_s *r = &gang->result[i];
+		if (r->failed)
+			rc = 1;
+		printf("adapter %d: %s, %lld clock cycles, %.3f s", i, r->failed ? "FAILED" : "ok", r->clocks, r->usecs * 1e-6);
+		if (r->mismatch.valid)
+			printf(", TDO mismatch in command %ld, bit %ld", r->mismatch.pos.command, r->mismatch.pos.bit);
+		printf("\n");
+		if (r->retval_i) {
+			printf("adapter %d: %d rmask bits:", i, r->retval_i);
+			for (j = 0; j < r->retval_i; j++)
+				printf(" %d", r->retval[j]);
+			printf("\n");
+		}
+	}
+
+	if (verbose) {
+		fprintf(stderr, "Parser: %.3f s CPU, %lld bytes of records, %ld kB ring, waited %lld times for the slowest adapter.\n",
+				ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6, rec.head, gang->ring_size / 1024, rec.space_waits);
+		fprintf(stderr, "Total time: %.3f s\n", (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) * 1e-6);
+		if (rc == 0) {
+			fprintf(stderr, "Finished without errors.\n");
+		} else {
+			fprintf(stderr, "Finished with errors!\n");
+		}
+	}
+
+	return rc;
+}
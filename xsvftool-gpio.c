@@ -19,6 +19,7 @@
  */
 
 #include "libxsvf.h"
+#include "gpio.h"
 
 #include <sys/time.h>
 #include <unistd.h>
@@ -26,165 +27,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
-
-
-/** BEGIN: Low-Level I/O Implementation **/
-
-#ifdef XSVFTOOL_RLMS_VLINE
-
-// Simple example with MPC8349E GPIO pins
-// (RIEGL LMS V-Line motherboard)
-
-#include <sys/types.h>
-#include <sys/stat.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 
-#define IO_PORT_ADDR 0xE0000C00
-
-struct io_layout {
-	unsigned long tdi:1;
-	unsigned long tdo:1;
-	unsigned long tms:1;
-	unsigned long tck:1;
-	unsigned long reserved:28;
-};
-
-static volatile struct io_layout *io_direction;
-static volatile struct io_layout *io_opendrain;
-static volatile struct io_layout *io_data;
-
-static void io_setup(void)
-{
-	/* open /dev/mem device file */
-	int fd = open("/dev/mem", O_RDWR);
-	if (fd < 0) {
-		fprintf(stderr, "Can't open /dev/mem: %s\n", strerror(errno));
-		exit(1);
-	}
-
-	/* calculate offsets to page and within page */
-	unsigned long psize = getpagesize();
-	unsigned long off_inpage = IO_PORT_ADDR % psize;
-	unsigned long off_topage = IO_PORT_ADDR - off_inpage;
-	unsigned long mapsize = off_inpage + sizeof(struct io_layout) * 3;
-
-	/* map it into logical memory */
-	void *io_addr_map = mmap(0, mapsize, PROT_WRITE, MAP_SHARED, fd, off_topage);
-	if (io_addr_map == MAP_FAILED) {
-		fprintf(stderr, "Can't map physical memory: %s\n", strerror(errno));
-		exit(1);
-	}
-
-	/* calculate register addresses */
-	io_direction = io_addr_map + off_inpage;
-	io_opendrain = io_addr_map + off_inpage + 4;
-	io_data = io_addr_map + off_inpage + 8;
-
-	/* set direction reg */
-	io_direction->tms = 1;
-	io_direction->tck = 1;
-	io_direction->tdo = 0;
-	io_direction->tdi = 1;
-
-	/* set open drain reg */
-	io_opendrain->tms = 0;
-	io_opendrain->tck = 0;
-	io_opendrain->tdo = 0;
-	io_opendrain->tdi = 0;
-
-#ifdef HAVE_TRST
-	/* for boards with TRST, must be driven high */
-	io_data->trst = 1;
-	io_direction->trst = 1;
-	io_opendrain->trst = 0;
-#endif
-}
-
-static void io_shutdown(void)
-{
-	/* set all to z-state */
-	io_direction->tms = 0;
-	io_direction->tck = 0;
-	io_direction->tdo = 0;
-	io_direction->tdi = 0;
-
-#ifdef HAVE_TRST
-	/* for boards with TRST, assuming there is a pull-down resistor */
-	io_direction->trst = 0;
-#endif
-}
-
-static void io_tms(int val)
-{
-	io_data->tms = val;
-}
-
-static void io_tdi(int val)
-{
-	io_data->tdi = val;
-}
-
-static void io_tck(int val)
-{
-	io_data->tck = val;
-	// usleep(1);
-}
-
-static void io_sck(int val)
-{
-	/* not available */
-}
-
-static void io_trst(int val)
-{
-	/* not available */
-}
-
-static int io_tdo()
-{
-	return io_data->tdo ? 1 : 0;
-}
-
-#else
-
-static void io_setup(void)
-{
-}
-
-static void io_shutdown(void)
-{
-}
-
-static void io_tms(int val)
-{
-}
-
-static void io_tdi(int val)
-{
-}
-
-static void io_tck(int val)
-{
-}
-
-static void io_sck(int val)
-{
-}
-
-static void io_trst(int val)
-{
-}
-
-static int io_tdo()
-{
-	return -1;
-}
-
-#endif
-
-/** END: Low-Level I/O Implementation **/
-
 
 struct udata_s {
 	FILE *f;
@@ -203,7 +50,7 @@ static int h_setup(struct libxsvf_host *h)
 		fprintf(stderr, "[SETUP]\n");
 		fflush(stderr);
 	}
-	io_setup();
+	gpio_setup();
 	return 0;
 }
 
@@ -214,7 +61,7 @@ static int h_shutdown(struct libxsvf_host *h)
 		fprintf(stderr, "[SHUTDOWN]\n");
 		fflush(stderr);
 	}
-	io_shutdown();
+	gpio_shutdown();
 	return 0;
 }
 
@@ -228,10 +75,10 @@ static void h_udelay(struct libxsvf_host *h, long usecs, int tms, long num_tck)
 	if (num_tck > 0) {
 		struct timeval tv1, tv2;
 		gettimeofday(&tv1, NULL);
-		io_tms(tms);
+		gpio_tms(tms);
 		while (num_tck > 0) {
-			io_tck(0);
-			io_tck(1);
+			gpio_tck(0);
+			gpio_tck(1);
 			num_tck--;
 		}
 		gettimeofday(&tv2, NULL);
@@ -260,17 +107,17 @@ static int h_pulse_tck(struct libxsvf_host *h, int tms, int tdi, int tdo, int rm
 {
 	struct udata_s *u = h->user_data;
 
-	io_tms(tms);
+	gpio_tms(tms);
 
 	if (tdi >= 0) {
 		u->bitcount_tdi++;
-		io_tdi(tdi);
+		gpio_tdi(tdi);
 	}
 
-	io_tck(0);
-	io_tck(1);
+	gpio_tck(0);
+	gpio_tck(1);
 
-	int line_tdo = io_tdo();
+	int line_tdo = gpio_tdo();
 	int rc = line_tdo >= 0 ? line_tdo : 0;
 
 	if (rmask == 1 && u->retval_i < 256)
@@ -278,8 +125,10 @@ static int h_pulse_tck(struct libxsvf_host *h, int tms, int tdi, int tdo, int rm
 
 	if (tdo >= 0 && line_tdo >= 0) {
 		u->bitcount_tdo++;
-		if (tdo != line_tdo)
+		if (tdo != line_tdo) {
+			libxsvf_tdo_mismatch(h, &h->srcpos, tdo, line_tdo);
 			rc = -1;
+		}
 	}
 
 	if (u->verbose >= 4) {
@@ -290,14 +139,33 @@ static int h_pulse_tck(struct libxsvf_host *h, int tms, int tdi, int tdo, int rm
 	return rc;
 }
 
+static int h_shift_bits(struct libxsvf_host *h, int len, const unsigned char *tdi, unsigned char *tdo, int tms_last)
+{
+	int k, nbytes = (len+7)/8;
+
+	if (tdo)
+		memset(tdo, 0, nbytes);
+
+	for (k = 0; k < len; k++) {
+		int tms = k == len-1 ? tms_last : 0;
+		int rc = h_pulse_tck(h, tms, (tdi[nbytes-1-k/8] >> (k%8)) & 1, -1, 0, 0);
+		if (rc < 0)
+			return -1;
+		if (tdo && rc)
+			tdo[nbytes-1-k/8] |= 1 << (k%8);
+	}
+
+	return 0;
+}
+
 static void h_pulse_sck(struct libxsvf_host *h)
 {
 	struct udata_s *u = h->user_data;
 	if (u->verbose >= 4) {
 		fprintf(stderr, "[SCK]\n");
 	}
-	io_sck(0);
-	io_sck(1);
+	gpio_sck(0);
+	gpio_sck(1);
 }
 
 static void h_set_trst(struct libxsvf_host *h, int v)
@@ -306,7 +174,7 @@ static void h_set_trst(struct libxsvf_host *h, int v)
 	if (u->verbose >= 4) {
 		fprintf(stderr, "[TRST:%d]\n", v);
 	}
-	io_trst(v);
+	gpio_trst(v);
 }
 
 static int h_set_frequency(struct libxsvf_host *h, int v)
@@ -345,6 +213,30 @@ static void h_report_error(struct libxsvf_host *h, const char *file, int line, c
 
 static int realloc_maxsize[LIBXSVF_MEM_NUM];
 
+/* Arena mode (-a): after each run the arena is grown to the largest
+ * allocations seen so far, so playing similar files again does not
+ * allocate any memory. */
+static int use_arena;
+static struct libxsvf_arena arena;
+
+static void *heap_realloc(void *ptr, int size)
+{
+	return realloc(ptr, size);
+}
+
+static void update_arena(void)
+{
+	long size = libxsvf_arena_size(&arena);
+	void *base;
+
+	if (!use_arena || size <= arena.size)
+		return;
+
+	free(arena.base);
+	base = malloc(size);
+	libxsvf_arena_init(&arena, base, base ? size : 0);
+}
+
 static void *h_realloc(struct libxsvf_host *h, void *ptr, int size, enum libxsvf_mem which)
 {
 	struct udata_s *u = h->user_data;
@@ -353,9 +245,181 @@ static void *h_realloc(struct libxsvf_host *h, void *ptr, int size, enum libxsvf
 	if (u->verbose >= 3) {
 		fprintf(stderr, "[REALLOC:%s:%d]\n", libxsvf_mem2str(which), size);
 	}
+	if (use_arena)
+		return libxsvf_arena_realloc(&arena, ptr, size, which, heap_realloc);
 	return realloc(ptr, size);
 }
 
+/* Number of commands between checkpoints (-j and -J options) */
+#define CHECKPOINT_INTERVAL 1000
+
+static const char *checkpoint_file;
+
+/* size of the file the loaded checkpoint was written for */
+static long checkpoint_size = -1;
+
+static struct libxsvf_checkpoint checkpoint = {
+	.interval = CHECKPOINT_INTERVAL
+};
+
+/* the size of a regular file, -1 for pipes etc. */
+static long input_file_size(FILE *f)
+{
+	struct stat st;
+
+	if (fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode))
+		return -1;
+	return st.st_size;
+}
+
+static void h_report_checkpoint(struct libxsvf_host *h, const struct libxsvf_checkpoint *cp)
+{
+	struct udata_s *u = h->user_data;
+	char tmpname[1024];
+	FILE *f;
+
+	if (u->verbose >= 2) {
+		fprintf(stderr, "[CHECKPOINT] command %ld\n", cp->command);
+	}
+
+	/* write a new file and rename it, so there always is a valid checkpoint */
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", checkpoint_file);
+	f = fopen(tmpname, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Can't write checkpoint file `%s': %s\n", tmpname, strerror(errno));
+		return;
+	}
+	/* with a mapped file, the library reads from memory and not from u->f */
+	fprintf(f, "%ld %d %ld %ld\n", cp->command, cp->tap_state,
+			h->input_data ? h->input_pos : ftell(u->f), input_file_size(u->f));
+	if (fclose(f) != 0 || rename(tmpname, checkpoint_file) != 0)
+		fprintf(stderr, "Can't write checkpoint file `%s': %s\n", checkpoint_file, strerror(errno));
+}
+
+static void load_checkpoint()
+{
+	FILE *f = fopen(checkpoint_file, "r");
+	long offset;
+	int tap_state;
+
+	/* no checkpoint file: start from the beginning */
+	if (f == NULL)
+		return;
+
+	if (fscanf(f, "%ld %d %ld %ld", &checkpoint.command, &tap_state, &offset, &checkpoint_size) == 4) {
+		checkpoint.tap_state = tap_state;
+		checkpoint.resume = 1;
+		fprintf(stderr, "Resuming at command %ld (file offset %ld) from checkpoint file `%s'.\n",
+				checkpoint.command, offset, checkpoint_file);
+	} else {
+		fprintf(stderr, "Ignoring invalid checkpoint file `%s'.\n", checkpoint_file);
+	}
+
+	fclose(f);
+}
+
+/* Worker threads for decoding large SVF payloads (-T option) */
+#define MAX_THREADS 16
+
+static int num_threads = 1;
+
+struct parallel_worker_s {
+	pthread_t thread;
+	int running;
+	int first, num, step;
+	void (*func)(void *arg, int i);
+	void *arg;
+};
+
+static void *parallel_worker_main(void *p)
+{
+	struct parallel_worker_s *w = p;
+	int i;
+	for (i = w->first; i < w->num; i += w->step)
+		w->func(w->arg, i);
+	return NULL;
+}
+
+static int h_parallel(struct libxsvf_host *h, int num, void (*func)(void *arg, int i), void *arg)
+{
+	struct parallel_worker_s workers[MAX_THREADS];
+	int t, n = num < num_threads ? num : num_threads;
+
+	for (t = 0; t < n; t++) {
+		workers[t].first = t;
+		workers[t].num = num;
+		workers[t].step = n;
+		workers[t].func = func;
+		workers[t].arg = arg;
+		workers[t].running = t > 0 && pthread_create(&workers[t].thread, NULL, parallel_worker_main, &workers[t]) == 0;
+	}
+
+	for (t = 0; t < n; t++) {
+		if (workers[t].running)
+			pthread_join(workers[t].thread, NULL);
+		else
+			parallel_worker_main(&workers[t]);
+	}
+
+	return 0;
+}
+
+static void set_threads(int n)
+{
+	num_threads = n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+}
+
+/* Regular files are mapped and parsed from memory. This is only an
+ * optimization: on failure the library reads the file with getbyte(). */
+static void map_input(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	struct stat st;
+	void *data;
+
+	h->input_data = NULL;
+	if (fstat(fileno(u->f), &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return;
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(u->f), 0);
+	if (data == MAP_FAILED)
+		return;
+
+	h->input_data = data;
+	h->input_size = st.st_size;
+}
+
+static void unmap_input(struct libxsvf_host *h)
+{
+	if (h->input_data)
+		munmap((void*)h->input_data, h->input_size);
+	h->input_data = NULL;
+}
+
+/* Start reading the next SVF or XSVF file on the command line into the
+ * page cache, so it is ready when the current file has been played. */
+static void prefetch_next(int argc, char **argv)
+{
+	const char *fn = NULL;
+	int i, fd;
+
+	for (i = optind; i < argc && !fn; i++) {
+		if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "-x"))
+			fn = i+1 < argc ? argv[++i] : NULL;
+		else if (!strncmp(argv[i], "-s", 2) || !strncmp(argv[i], "-x", 2))
+			fn = argv[i] + 2;
+	}
+
+	if (!fn || !strcmp(fn, "-"))
+		return;
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
+
 static struct udata_s u;
 
 static struct libxsvf_host h = {
@@ -364,6 +428,7 @@ static struct libxsvf_host h = {
 	.shutdown = h_shutdown,
 	.getbyte = h_getbyte,
 	.pulse_tck = h_pulse_tck,
+	.shift_bits = h_shift_bits,
 	.pulse_sck = h_pulse_sck,
 	.set_trst = h_set_trst,
 	.set_frequency = h_set_frequency,
@@ -372,9 +437,23 @@ static struct libxsvf_host h = {
 	.report_status = h_report_status,
 	.report_error = h_report_error,
 	.realloc = h_realloc,
+	.report_checkpoint = h_report_checkpoint,
 	.user_data = &u
 };
 
+/* The interface stays set up between files: one session for all actions. */
+static int session_open;
+
+static int session_play(enum libxsvf_mode mode)
+{
+	if (!session_open) {
+		if (libxsvf_session_open(&h) < 0)
+			return -1;
+		session_open = 1;
+	}
+	return libxsvf_session_play(&h, mode);
+}
+
 const char *progname;
 
 static void copyleft()
@@ -393,7 +472,8 @@ static void help()
 {
 	copyleft();
 	fprintf(stderr, "\n");
-	fprintf(stderr, "Usage: %s [ -r funcname ] [ -v ... ] [ -L | -B ] { -s svf-file | -x xsvf-file | -c } ...\n", progname);
+	fprintf(stderr, "Usage: %s [ -r funcname ] [ -v ... ] [ -L | -B ] [ -T threads ] [ -a ] [ -j file | -J file ]\n", progname);
+	fprintf(stderr, "       %*s { -s svf-file | -x xsvf-file | -c } ...\n", (int)strlen(progname), "");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "   -r funcname\n");
 	fprintf(stderr, "          Dump C-code for pseudo-allocator based on example files\n");
@@ -404,6 +484,21 @@ static void help()
 	fprintf(stderr, "   -L, -B\n");
 	fprintf(stderr, "          Print RMASK bits as hex value (little or big endian)\n");
 	fprintf(stderr, "\n");
+	fprintf(stderr, "   -T threads\n");
+	fprintf(stderr, "          Number of threads for decoding large SVF payloads\n");
+	fprintf(stderr, "          (default: number of CPUs, max. %d)\n", MAX_THREADS);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -a\n");
+	fprintf(stderr, "          Arena mode: keep the memory of each run for the next\n");
+	fprintf(stderr, "          SVF or XSVF file (only the first run allocates memory)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -j file\n");
+	fprintf(stderr, "          Write checkpoints for the next SVF or XSVF file to this file\n");
+	fprintf(stderr, "          (it is removed when the file has been played without errors)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -J file\n");
+	fprintf(stderr, "          Like -j, but resume at the checkpoint in this file (if it exists)\n");
+	fprintf(stderr, "\n");
 	fprintf(stderr, "   -s svf-file\n");
 	fprintf(stderr, "          Play the specified SVF file\n");
 	fprintf(stderr, "\n");
@@ -425,13 +520,23 @@ int main(int argc, char **argv)
 	int opt, i, j;
 
 	progname = argc >= 1 ? argv[0] : "xvsftool";
-	while ((opt = getopt(argc, argv, "r:vLBx:s:c")) != -1)
+	set_threads(sysconf(_SC_NPROCESSORS_ONLN));
+	h.parallel = num_threads > 1 ? h_parallel : NULL;
+
+	while ((opt = getopt(argc, argv, "r:vLBT:aj:J:x:s:c")) != -1)
 	{
 		switch (opt)
 		{
+		case 'T':
+			set_threads(atoi(optarg));
+			h.parallel = num_threads > 1 ? h_parallel : NULL;
+			break;
 		case 'r':
 			realloc_name = optarg;
 			break;
+		case 'a':
+			use_arena = 1;
+			break;
 		case 'v':
 			copyleft();
 			u.verbose++;
@@ -450,19 +555,43 @@ int main(int argc, char **argv)
 				rc = 1;
 				break;
 			}
-			if (libxsvf_play(&h, opt == 's' ? LIBXSVF_MODE_SVF : LIBXSVF_MODE_XSVF) < 0) {
+			if (h.checkpoint && checkpoint.resume && input_file_size(u.f) != checkpoint_size) {
+				fprintf(stderr, "Checkpoint file `%s' was written for a different file (size %ld, not %ld).\n",
+						checkpoint_file, checkpoint_size, input_file_size(u.f));
+				if (strcmp(optarg, "-"))
+					fclose(u.f);
+				rc = 1;
+				break;
+			}
+			map_input(&h);
+			prefetch_next(argc, argv);
+			if (session_play(opt == 's' ? LIBXSVF_MODE_SVF : LIBXSVF_MODE_XSVF) < 0) {
 				fprintf(stderr, "Error while playing %s file `%s'.\n", opt == 's' ? "SVF" : "XSVF", optarg);
 				rc = 1;
+			} else if (h.checkpoint) {
+				unlink(checkpoint_file);
 			}
+			h.checkpoint = NULL;
+			unmap_input(&h);
+			update_arena();
 			if (strcmp(optarg, "-"))
 				fclose(u.f);
 			break;
 		case 'c':
 			gotaction = 1;
-			if (libxsvf_play(&h, LIBXSVF_MODE_SCAN) < 0) {
+			if (session_play(LIBXSVF_MODE_SCAN) < 0) {
 				fprintf(stderr, "Error while scanning JTAG chain.\n");
 				rc = 1;
 			}
+			update_arena();
+			break;
+		case 'j':
+		case 'J':
+			checkpoint_file = optarg;
+			checkpoint.resume = 0;
+			if (opt == 'J')
+				load_checkpoint();
+			h.checkpoint = &checkpoint;
 			break;
 		case 'L':
 			hex_mode = 1;
@@ -479,6 +608,9 @@ int main(int argc, char **argv)
 	if (!gotaction)
 		help();
 
+	if (session_open && libxsvf_session_close(&h) < 0)
+		rc = 1;
+
 	if (u.verbose) {
 		fprintf(stderr, "Total number of clock cycles: %d\n", u.clockcount);
 		fprintf(stderr, "Number of significant TDI bits: %d\n", u.bitcount_tdi);
@@ -0,0 +1,954 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * xsvftool-remote plays SVF/XSVF files on a JTAG TAP behind a socket:
+ * an XVC 1.0 server (e.g. xsvftool-xvcd) or an OpenOCD-style
+ * remote_bitbang server (e.g. a Verilator simulation with a JTAG stub).
+ * The clock cycles are collected into requests of up to -b bits and up
+ * to -d requests are sent before the client waits for the first reply.
+ *
+ * With -D the program is a stand-in server with a simulated TAP instead.
+ */
+
+#include "libxsvf.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+
+#define PROTO_XVC 1
+#define PROTO_RBB 2
+
+#define DEFAULT_REQUEST_BITS 32768
+#define DEFAULT_DEPTH 4
+
+struct bit_s {
+	unsigned int tms:1;
+	unsigned int tdi:1;
+	unsigned int tdo:1;
+	unsigned int tdo_enable:1;
+	unsigned int rmask:1;
+	unsigned int capture:1;
+	unsigned int read:1;
+};
+
+/* the checked bits from bit 'i' of a request on belong to 'pos' */
+struct range_s {
+	int i;
+	struct libxsvf_srcpos pos;
+};
+
+struct request_s {
+	int len, reads;
+	struct bit_s *bits;
+	int num_ranges;
+	struct range_s *ranges;
+};
+
+struct udata_s {
+	FILE *f;
+	int proto;
+	const char *address;
+	int fd;
+	int verbose;
+	int request_bits;
+	int depth;
+	/* ring of depth+1 requests: 'num_out' sent requests starting at
+	 * 'req_out', followed by the request that is being filled */
+	struct request_s *req;
+	int req_out, num_out;
+	unsigned char *msg, *reply;
+	int last_tdo;
+	int error_rc;
+	int has_mismatch;
+	struct libxsvf_srcpos mismatch_pos;
+	int mismatch_expected, mismatch_actual;
+	unsigned char *capture_data;
+	int capture_nbytes, capture_i;
+	int retval_i;
+	int retval[256];
+	long long clockcount;
+	long long requests, waits, waits_usecs;
+};
+
+static int read_all(int fd, void *buf, int len)
+{
+	int pos, rc;
+	for (pos = 0; pos < len; pos += rc) {
+		rc = read(fd, (char*)buf + pos, len - pos);
+		if (rc < 0 && errno == EINTR)
+			rc = 0;
+		else if (rc <= 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, int len)
+{
+	int pos, rc;
+	for (pos = 0; pos < len; pos += rc) {
+		rc = write(fd, (const char*)buf + pos, len - pos);
+		if (rc < 0 && errno == EINTR)
+			rc = 0;
+		else if (rc <= 0)
+			return -1;
+	}
+	return 0;
+}
+
+static unsigned long get_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static void put_le32(unsigned char *p, unsigned long v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void set_nodelay(int fd)
+{
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/* parse "[host:]port" */
+static int parse_address(const char *str, struct sockaddr_in *addr)
+{
+	char host[256];
+	const char *p = strrchr(str, ':');
+	struct hostent *he;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(atoi(p ? p+1 : str));
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (p && p != str) {
+		snprintf(host, sizeof(host), "%.*s", (int)(p - str), str);
+		he = gethostbyname(host);
+		if (he == NULL || he->h_addrtype != AF_INET)
+			return -1;
+		memcpy(&addr->sin_addr, he->h_addr_list[0], sizeof(addr->sin_addr));
+	}
+
+	return ntohs(addr->sin_port) > 0 ? 0 : -1;
+}
+
+
+/** Requests **/
+
+static struct request_s *req_in(struct udata_s *u)
+{
+	return &u->req[(u->req_out + u->num_out) % (u->depth + 1)];
+}
+
+static void record_mismatch(struct udata_s *u, struct request_s *r, int i, int expected, int actual)
+{
+	int k;
+
+	u->error_rc = -1;
+	if (u->has_mismatch)
+		return;
+
+	for (k = r->num_ranges-1; k > 0 && r->ranges[k].i > i; k--) { }
+	u->mismatch_pos = r->ranges[k].pos;
+	u->mismatch_pos.bit += i - r->ranges[k].i;
+	u->mismatch_expected = expected;
+	u->mismatch_actual = actual;
+	u->has_mismatch = 1;
+}
+
+/* wait for the reply to the oldest request and check its tdo bits */
+static void request_complete(struct udata_s *u)
+{
+	struct request_s *r = &u->req[u->req_out];
+	struct timeval tv1, tv2;
+	int i, j, nbytes = u->proto == PROTO_XVC ? (r->len+7)/8 : r->reads;
+
+	gettimeofday(&tv1, NULL);
+	if (read_all(u->fd, u->reply, nbytes) < 0) {
+		fprintf(stderr, "IO Error: Connection closed while waiting for TDO data.\n");
+		u->error_rc = -1;
+		r->len = 0;
+	}
+	gettimeofday(&tv2, NULL);
+	u->waits++;
+	u->waits_usecs += (tv2.tv_sec - tv1.tv_sec)*1000000 + (tv2.tv_usec - tv1.tv_usec);
+
+	for (i = j = 0; i < r->len; i++)
+	{
+		struct bit_s *b = &r->bits[i];
+		int line_tdo;
+
+		if (u->proto == PROTO_XVC)
+			line_tdo = (u->reply[i/8] >> (i%8)) & 1;
+		else if (b->read)
+			line_tdo = u->reply[j++] == '1';
+		else
+			continue;
+
+		if (b->tdo_enable && b->tdo != line_tdo)
+			record_mismatch(u, r, i, b->tdo, line_tdo);
+		if (b->rmask && u->retval_i < 256)
+			u->retval[u->retval_i++] = line_tdo;
+		if (b->capture && u->capture_i < 8*u->capture_nbytes) {
+			if (line_tdo)
+				u->capture_data[u->capture_nbytes-1-u->capture_i/8] |= 1 << (u->capture_i%8);
+			u->capture_i++;
+		}
+		u->last_tdo = line_tdo;
+	}
+
+	r->len = r->reads = r->num_ranges = 0;
+	u->req_out = (u->req_out + 1) % (u->depth + 1);
+	u->num_out--;
+}
+
+/* send the request that is being filled, without waiting for the reply
+ * unless 'depth' requests are already on their way */
+static void request_send(struct udata_s *u)
+{
+	struct request_s *r = req_in(u);
+	int i, len = 0;
+
+	if (r->len == 0)
+		return;
+
+	if (u->num_out == u->depth)
+		request_complete(u);
+
+	if (u->proto == PROTO_XVC) {
+		int nbytes = (r->len+7)/8;
+		unsigned char *tms = u->msg + 10, *tdi = u->msg + 10 + nbytes;
+		memcpy(u->msg, "shift:", 6);
+		put_le32(u->msg + 6, r->len);
+		memset(tms, 0, 2*nbytes);
+		for (i = 0; i < r->len; i++) {
+			tms[i/8] |= r->bits[i].tms << (i%8);
+			tdi[i/8] |= r->bits[i].tdi << (i%8);
+		}
+		len = 10 + 2*nbytes;
+	} else {
+		/* tck low with the new tms/tdi, sample tdo, tck high */
+		for (i = 0; i < r->len; i++) {
+			int v = r->bits[i].tms << 1 | r->bits[i].tdi;
+			u->msg[len++] = '0' + v;
+			if (r->bits[i].read)
+				u->msg[len++] = 'R';
+			u->msg[len++] = '4' + v;
+		}
+	}
+
+	if (write_all(u->fd, u->msg, len) < 0) {
+		fprintf(stderr, "IO Error: Write to server failed: %s\n", strerror(errno));
+		u->error_rc = -1;
+	}
+
+	u->requests++;
+	u->num_out++;
+}
+
+static void buffer_sync(struct udata_s *u)
+{
+	request_send(u);
+	while (u->num_out > 0)
+		request_complete(u);
+}
+
+static void buffer_add(struct udata_s *u, int tms, int tdi, int tdo, int rmask, int read, const struct libxsvf_srcpos *pos)
+{
+	struct request_s *r = req_in(u);
+	struct bit_s *b = &r->bits[r->len];
+
+	if (tdo >= 0) {
+		struct range_s *rg = r->num_ranges ? &r->ranges[r->num_ranges-1] : NULL;
+		if (!rg || rg->pos.command != pos->command || rg->pos.bit + (r->len - rg->i) != pos->bit) {
+			rg = &r->ranges[r->num_ranges++];
+			rg->i = r->len;
+			rg->pos = *pos;
+		}
+	}
+
+	b->tms = tms;
+	b->tdi = tdi < 0 ? 1 : tdi;
+	b->tdo = tdo;
+	b->tdo_enable = tdo >= 0;
+	b->rmask = rmask;
+	b->capture = u->capture_data != NULL;
+	b->read = read || tdo >= 0 || rmask || b->capture;
+	r->reads += b->read;
+	r->len++;
+	u->clockcount++;
+
+	if (r->len == u->request_bits)
+		request_send(u);
+}
+
+
+/** Host callbacks **/
+
+static int h_setup(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	struct sockaddr_in addr;
+	int i;
+
+	if (parse_address(u->address, &addr) < 0) {
+		fprintf(stderr, "Invalid server address `%s'.\n", u->address);
+		return -1;
+	}
+
+	u->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (u->fd < 0 || connect(u->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Can't connect to `%s': %s\n", u->address, strerror(errno));
+		if (u->fd >= 0)
+			close(u->fd);
+		return -1;
+	}
+	set_nodelay(u->fd);
+
+	if (u->proto == PROTO_XVC) {
+		char info[64];
+		int rc;
+		memset(info, 0, sizeof(info));
+		if (write_all(u->fd, "getinfo:", 8) < 0 || (rc = read(u->fd, info, sizeof(info)-1)) <= 0 ||
+				strncmp(info, "xvcServer_v1.", 13) || strchr(info, ':') == NULL) {
+			fprintf(stderr, "Server at `%s' doesn't speak XVC 1.0.\n", u->address);
+			close(u->fd);
+			return -1;
+		}
+		int max_bits = 8 * atoi(strchr(info, ':') + 1);
+		if (max_bits > 0 && u->request_bits > max_bits)
+			u->request_bits = max_bits;
+		if (u->verbose)
+			fprintf(stderr, "Server: %.*s (%d bits per request).\n", (int)strcspn(info, "\n"), info, u->request_bits);
+	}
+
+	u->req = calloc(u->depth + 1, sizeof(struct request_s));
+	for (i = 0; i <= u->depth; i++) {
+		u->req[i].bits = malloc(u->request_bits * sizeof(struct bit_s));
+		u->req[i].ranges = malloc(u->request_bits * sizeof(struct range_s));
+	}
+	u->msg = malloc(10 + 3*u->request_bits);
+	u->reply = malloc(u->request_bits);
+	u->req_out = u->num_out = 0;
+	u->error_rc = 0;
+	u->has_mismatch = 0;
+
+	return 0;
+}
+
+static int h_shutdown(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	int i;
+
+	buffer_sync(u);
+	if (u->proto == PROTO_RBB)
+		write_all(u->fd, "Q", 1);
+	close(u->fd);
+
+	for (i = 0; i <= u->depth; i++) {
+		free(u->req[i].bits);
+		free(u->req[i].ranges);
+	}
+	free(u->req);
+	free(u->msg);
+	free(u->reply);
+
+	return u->error_rc;
+}
+
+static void h_udelay(struct libxsvf_host *h, long usecs, int tms, long num_tck)
+{
+	struct udata_s *u = h->user_data;
+	while (num_tck-- > 0)
+		buffer_add(u, tms, -1, -1, 0, 0, &h->srcpos);
+	if (usecs > 0) {
+		buffer_sync(u);
+		usleep(usecs);
+	}
+}
+
+static int h_getbyte(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	return fgetc(u->f);
+}
+
+/* return the error state and pass the first mismatch to the library */
+static int take_error(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	int rc = u->error_rc;
+	if (rc < 0 && u->has_mismatch)
+		libxsvf_tdo_mismatch(h, &u->mismatch_pos, u->mismatch_expected, u->mismatch_actual);
+	u->has_mismatch = 0;
+	u->error_rc = 0;
+	return rc;
+}
+
+static int h_sync(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	struct timeval tv1, tv2;
+	gettimeofday(&tv1, NULL);
+	buffer_sync(u);
+	gettimeofday(&tv2, NULL);
+	libxsvf_sync_cost(h, (tv2.tv_sec - tv1.tv_sec)*1000000 + (tv2.tv_usec - tv1.tv_usec));
+	return take_error(h);
+}
+
+static int h_pulse_tck(struct libxsvf_host *h, int tms, int tdi, int tdo, int rmask, int sync)
+{
+	struct udata_s *u = h->user_data;
+	buffer_add(u, tms, tdi, tdo, rmask, sync, &h->srcpos);
+	if (sync) {
+		buffer_sync(u);
+		return take_error(h) < 0 ? -1 : u->last_tdo;
+	}
+	return u->error_rc < 0 ? -1 : 1;
+}
+
+static int h_shift_bits(struct libxsvf_host *h, int len, const unsigned char *tdi, unsigned char *tdo, int tms_last)
+{
+	struct udata_s *u = h->user_data;
+	int k, nbytes = (len+7)/8;
+
+	if (tdo) {
+		memset(tdo, 0, nbytes);
+		buffer_sync(u);
+		u->capture_data = tdo;
+		u->capture_nbytes = nbytes;
+		u->capture_i = 0;
+	}
+
+	for (k = 0; k < len; k++) {
+		int tms = k == len-1 ? tms_last : 0;
+		buffer_add(u, tms, (tdi[nbytes-1-k/8] >> (k%8)) & 1, -1, 0, 0, &h->srcpos);
+	}
+
+	if (tdo) {
+		buffer_sync(u);
+		u->capture_data = NULL;
+		return take_error(h) < 0 ? -1 : 0;
+	}
+	return u->error_rc < 0 ? -1 : 0;
+}
+
+static void h_set_trst(struct libxsvf_host *h, int v)
+{
+	struct udata_s *u = h->user_data;
+	if (u->proto != PROTO_RBB)
+		return;
+	buffer_sync(u);
+	/* 'r' .. 'u': trst and srst asserted */
+	if (write_all(u->fd, v == 0 ? "t" : "r", 1) < 0)
+		u->error_rc = -1;
+}
+
+static int h_set_frequency(struct libxsvf_host *h, int v)
+{
+	struct udata_s *u = h->user_data;
+	unsigned char cmd[11];
+
+	if (u->proto != PROTO_XVC)
+		return 0;
+
+	buffer_sync(u);
+	memcpy(cmd, "settck:", 7);
+	put_le32(cmd + 7, v > 0 ? 1000000000 / v : 0);
+	if (write_all(u->fd, cmd, 11) < 0 || read_all(u->fd, cmd, 4) < 0) {
+		fprintf(stderr, "IO Error: settck: failed.\n");
+		u->error_rc = -1;
+		return -1;
+	}
+	if (h->sync_policy && get_le32(cmd) > 0)
+		h->sync_policy->frequency = 1000000000 / get_le32(cmd);
+	return 0;
+}
+
+static void h_report_tapstate(struct libxsvf_host *h)
+{
+	struct udata_s *u = h->user_data;
+	if (u->verbose >= 3)
+		fprintf(stderr, "[%s]\n", libxsvf_state2str(h->tap_state));
+}
+
+static void h_report_device(struct libxsvf_host *h, unsigned long idcode)
+{
+	printf("idcode=0x%08lx, revision=0x%01lx, part=0x%04lx, manufactor=0x%03lx\n", idcode,
+			(idcode >> 28) & 0xf, (idcode >> 12) & 0xffff, (idcode >> 1) & 0x7ff);
+}
+
+static void h_report_status(struct libxsvf_host *h, const char *message)
+{
+	struct udata_s *u = h->user_data;
+	if (u->verbose >= 2)
+		fprintf(stderr, "[STATUS] %s\n", message);
+}
+
+static void h_report_error(struct libxsvf_host *h, const char *file, int line, const char *message)
+{
+	fprintf(stderr, "[%s:%d] %s\n", file, line, message);
+}
+
+static void *h_realloc(struct libxsvf_host *h, void *ptr, int size, enum libxsvf_mem which)
+{
+	return realloc(ptr, size);
+}
+
+static struct udata_s u = {
+	.request_bits = DEFAULT_REQUEST_BITS,
+	.depth = DEFAULT_DEPTH
+};
+
+static struct libxsvf_sync_policy sync_policy = {
+	.block_sync = 1
+};
+
+static struct libxsvf_host h = {
+	.udelay = h_udelay,
+	.setup = h_setup,
+	.shutdown = h_shutdown,
+	.getbyte = h_getbyte,
+	.sync = h_sync,
+	.pulse_tck = h_pulse_tck,
+	.shift_bits = h_shift_bits,
+	.set_trst = h_set_trst,
+	.set_frequency = h_set_frequency,
+	.report_tapstate = h_report_tapstate,
+	.report_device = h_report_device,
+	.report_status = h_report_status,
+	.report_error = h_report_error,
+	.realloc = h_realloc,
+	.sync_policy = &sync_policy,
+	.user_data = &u
+};
+
+
+/** Stand-in server with a simulated TAP **/
+
+#define SIM_IDCODE 0x13631093
+#define SIM_IR_LEN 6
+#define SIM_IR_IDCODE 0x09
+#define SIM_MAX_VECTOR_BYTES (64 * 1024)
+
+static const unsigned char sim_tap_next[17][2] = {
+	[LIBXSVF_TAP_RESET]     = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_RESET     },
+	[LIBXSVF_TAP_IDLE]      = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  },
+	[LIBXSVF_TAP_DRSELECT]  = { LIBXSVF_TAP_DRCAPTURE, LIBXSVF_TAP_IRSELECT  },
+	[LIBXSVF_TAP_DRCAPTURE] = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DREXIT1   },
+	[LIBXSVF_TAP_DRSHIFT]   = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DREXIT1   },
+	[LIBXSVF_TAP_DREXIT1]   = { LIBXSVF_TAP_DRPAUSE,   LIBXSVF_TAP_DRUPDATE  },
+	[LIBXSVF_TAP_DRPAUSE]   = { LIBXSVF_TAP_DRPAUSE,   LIBXSVF_TAP_DREXIT2   },
+	[LIBXSVF_TAP_DREXIT2]   = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DRUPDATE  },
+	[LIBXSVF_TAP_DRUPDATE]  = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  },
+	[LIBXSVF_TAP_IRSELECT]  = { LIBXSVF_TAP_IRCAPTURE, LIBXSVF_TAP_RESET     },
+	[LIBXSVF_TAP_IRCAPTURE] = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IREXIT1   },
+	[LIBXSVF_TAP_IRSHIFT]   = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IREXIT1   },
+	[LIBXSVF_TAP_IREXIT1]   = { LIBXSVF_TAP_IRPAUSE,   LIBXSVF_TAP_IRUPDATE  },
+	[LIBXSVF_TAP_IRPAUSE]   = { LIBXSVF_TAP_IRPAUSE,   LIBXSVF_TAP_IREXIT2   },
+	[LIBXSVF_TAP_IREXIT2]   = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IRUPDATE  },
+	[LIBXSVF_TAP_IRUPDATE]  = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  }
+};
+
+/* one device with an IDCODE register; all other instructions select
+ * the BYPASS register */
+struct sim_s {
+	int state;
+	int tck;
+	int ir, ir_shift;
+	int dr_len;
+	unsigned long dr_shift;
+};
+
+static void sim_reset(struct sim_s *s)
+{
+	s->state = LIBXSVF_TAP_RESET;
+	s->tck = 1;
+	s->ir = SIM_IR_IDCODE;
+}
+
+static int sim_tdo(struct sim_s *s)
+{
+	if (s->state == LIBXSVF_TAP_IRSHIFT)
+		return s->ir_shift & 1;
+	if (s->state == LIBXSVF_TAP_DRSHIFT)
+		return s->dr_shift & 1;
+	return 1;
+}
+
+static void sim_clock(struct sim_s *s, int tms, int tdi)
+{
+	switch (s->state)
+	{
+	case LIBXSVF_TAP_IRCAPTURE:
+		s->ir_shift = 0x01;
+		break;
+	case LIBXSVF_TAP_IRSHIFT:
+		s->ir_shift = s->ir_shift >> 1 | tdi << (SIM_IR_LEN-1);
+		break;
+	case LIBXSVF_TAP_DRCAPTURE:
+		s->dr_len = s->ir == SIM_IR_IDCODE ? 32 : 1;
+		s->dr_shift = s->ir == SIM_IR_IDCODE ? SIM_IDCODE : 0;
+		break;
+	case LIBXSVF_TAP_DRSHIFT:
+		s->dr_shift = s->dr_shift >> 1 | (unsigned long)tdi << (s->dr_len-1);
+		break;
+	}
+
+	s->state = sim_tap_next[s->state][tms];
+	if (s->state == LIBXSVF_TAP_IRUPDATE)
+		s->ir = s->ir_shift;
+	if (s->state == LIBXSVF_TAP_RESET)
+		s->ir = SIM_IR_IDCODE;
+}
+
+static void sim_serve_xvc(int fd, struct sim_s *s)
+{
+	static unsigned char vectors[2 * SIM_MAX_VECTOR_BYTES], tdo[SIM_MAX_VECTOR_BYTES];
+	unsigned char cmd[16];
+	char info[64];
+	long k;
+
+	while (read_all(fd, cmd, 2) == 0)
+	{
+		if (!memcmp(cmd, "ge", 2) && read_all(fd, cmd, 6) == 0) {
+			snprintf(info, sizeof(info), "xvcServer_v1.0:%d\n", SIM_MAX_VECTOR_BYTES);
+			write_all(fd, info, strlen(info));
+			continue;
+		}
+		if (!memcmp(cmd, "se", 2) && read_all(fd, cmd, 9) == 0) {
+			write_all(fd, cmd + 5, 4);
+			continue;
+		}
+		if (!memcmp(cmd, "sh", 2) && read_all(fd, cmd, 8) == 0) {
+			long len = get_le32(cmd + 4);
+			int nbytes = (len+7) / 8;
+			if (nbytes > SIM_MAX_VECTOR_BYTES || read_all(fd, vectors, 2 * nbytes) < 0)
+				break;
+			memset(tdo, 0, nbytes);
+			for (k = 0; k < len; k++) {
+				tdo[k/8] |= sim_tdo(s) << (k%8);
+				sim_clock(s, (vectors[k/8] >> (k%8)) & 1, (vectors[nbytes + k/8] >> (k%8)) & 1);
+			}
+			write_all(fd, tdo, nbytes);
+			continue;
+		}
+		break;
+	}
+}
+
+static void sim_serve_rbb(int fd, struct sim_s *s)
+{
+	static unsigned char buf[64 * 1024], reply[64 * 1024];
+	int i, len, n;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+	{
+		for (i = n = 0; i < len; i++) {
+			int c = buf[i];
+			if (c >= '0' && c <= '7') {
+				int tck = (c - '0') >> 2 & 1;
+				if (tck && !s->tck)
+					sim_clock(s, (c - '0') >> 1 & 1, (c - '0') & 1);
+				s->tck = tck;
+			} else if (c == 'R') {
+				reply[n++] = '0' + sim_tdo(s);
+			} else if (c == 't' || c == 'u') {
+				sim_reset(s);
+			} else if (c == 'Q') {
+				len = 0;
+				break;
+			}
+		}
+		if (n > 0 && write_all(fd, reply, n) < 0)
+			return;
+		if (len == 0)
+			return;
+	}
+}
+
+static int sim_server(const char *spec)
+{
+	struct sockaddr_in addr;
+	int one = 1, proto = !strncmp(spec, "xvc:", 4) ? PROTO_XVC : PROTO_RBB;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (parse_address(spec + 4, &addr) < 0) {
+		fprintf(stderr, "Invalid server address `%s'.\n", spec + 4);
+		return 1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+		fprintf(stderr, "Can't listen on `%s': %s\n", spec + 4, strerror(errno));
+		return 1;
+	}
+
+	if (u.verbose)
+		fprintf(stderr, "Listening on `%s' (%s).\n", spec + 4, proto == PROTO_XVC ? "xvc" : "rbb");
+
+	while (1)
+	{
+		struct sim_s s;
+		int client = accept(fd, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Accept failed: %s\n", strerror(errno));
+			break;
+		}
+		set_nodelay(client);
+		sim_reset(&s);
+		if (u.verbose)
+			fprintf(stderr, "Client connected.\n");
+		if (proto == PROTO_XVC)
+			sim_serve_xvc(client, &s);
+		else
+			sim_serve_rbb(client, &s);
+		close(client);
+		if (u.verbose)
+			fprintf(stderr, "Client disconnected.\n");
+	}
+
+	close(fd);
+	return 1;
+}
+
+
+/** Main **/
+
+static int session_open;
+
+static int session_play(enum libxsvf_mode mode)
+{
+	if (!session_open) {
+		if (libxsvf_session_open(&h) < 0)
+			return -1;
+		session_open = 1;
+	}
+	return libxsvf_session_play(&h, mode);
+}
+
+const char *progname;
+
+static void copyleft()
+{
+	static int already_printed = 0;
+	if (already_printed)
+		return;
+	fprintf(stderr, "xsvftool-remote, part of Lib(X)SVF (http://www.clifford.at/libxsvf/).\n");
+	fprintf(stderr, "Copyright (C) 2009  RIEGL Research ForschungsGmbH\n");
+	fprintf(stderr, "Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>\n");
+	fprintf(stderr, "Lib(X)SVF is free software licensed under the ISC license.\n");
+	already_printed = 1;
+}
+
+static void help()
+{
+	copyleft();
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: %s { -X [host:]port | -R [host:]port } [ -v ... ] [ -L | -B ]\n", progname);
+	fprintf(stderr, "       %*s [ -b bits ] [ -d depth ] { -s svf-file | -x xsvf-file | -c } ...\n", (int)strlen(progname), "");
+	fprintf(stderr, "       %s [ -v ] -D { xvc | rbb }:[host:]port\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -X [host:]port\n");
+	fprintf(stderr, "          Connect to a Xilinx Virtual Cable (XVC 1.0) server\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -R [host:]port\n");
+	fprintf(stderr, "          Connect to an OpenOCD-style remote_bitbang server\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -v, -vv, -vvv\n");
+	fprintf(stderr, "          Verbose, more verbose and even more verbose\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -L, -B\n");
+	fprintf(stderr, "          Print RMASK bits as hex value (little or big endian)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -b bits\n");
+	fprintf(stderr, "          Max. number of clock cycles per request (default: %d)\n", DEFAULT_REQUEST_BITS);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -d depth\n");
+	fprintf(stderr, "          Max. number of requests sent before waiting for a reply\n");
+	fprintf(stderr, "          (default: %d)\n", DEFAULT_DEPTH);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -s svf-file\n");
+	fprintf(stderr, "          Play the specified SVF file\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -x xsvf-file\n");
+	fprintf(stderr, "          Play the specified XSVF file\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -c\n");
+	fprintf(stderr, "          List devices in JTAG chain\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -D { xvc | rbb }:[host:]port\n");
+	fprintf(stderr, "          Stand-in server with a simulated TAP (one device,\n");
+	fprintf(stderr, "          idcode 0x%08x, %d bit IR)\n", SIM_IDCODE, SIM_IR_LEN);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int rc = 0;
+	int gotaction = 0;
+	int hex_mode = 0;
+	const char *server_spec = NULL;
+	struct timeval tv1, tv2;
+	int opt, i, j;
+
+	progname = argc >= 1 ? argv[0] : "xsvftool-remote";
+	signal(SIGPIPE, SIG_IGN);
+	gettimeofday(&tv1, NULL);
+
+	while ((opt = getopt(argc, argv, "X:R:D:vLBb:d:x:s:c")) != -1)
+	{
+		switch (opt)
+		{
+		case 'X':
+		case 'R':
+			if (session_open)
+				help();
+			u.proto = opt == 'X' ? PROTO_XVC : PROTO_RBB;
+			u.address = optarg;
+			break;
+		case 'D':
+			server_spec = optarg;
+			break;
+		case 'v':
+			copyleft();
+			u.verbose++;
+			break;
+		case 'b':
+			if (session_open || atoi(optarg) < 1)
+				help();
+			u.request_bits = atoi(optarg);
+			break;
+		case 'd':
+			if (session_open || atoi(optarg) < 1)
+				help();
+			u.depth = atoi(optarg);
+			break;
+		case 'x':
+		case 's':
+			gotaction = 1;
+			if (!u.proto)
+				help();
+			if (u.verbose)
+				fprintf(stderr, "Playing %s file `%s'.\n", opt == 's' ? "SVF" : "XSVF", optarg);
+			if (!strcmp(optarg, "-"))
+				u.f = stdin;
+			else
+				u.f = fopen(optarg, "rb");
+			if (u.f == NULL) {
+				fprintf(stderr, "Can't open %s file `%s': %s\n", opt == 's' ? "SVF" : "XSVF", optarg, strerror(errno));
+				rc = 1;
+				break;
+			}
+			if (session_play(opt == 's' ? LIBXSVF_MODE_SVF : LIBXSVF_MODE_XSVF) < 0) {
+				fprintf(stderr, "Error while playing %s file `%s'.\n", opt == 's' ? "SVF" : "XSVF", optarg);
+				rc = 1;
+			}
+			if (strcmp(optarg, "-"))
+				fclose(u.f);
+			break;
+		case 'c':
+			gotaction = 1;
+			if (!u.proto)
+				help();
+			if (session_play(LIBXSVF_MODE_SCAN) < 0) {
+				fprintf(stderr, "Error while scanning JTAG chain.\n");
+				rc = 1;
+			}
+			break;
+		case 'L':
+			hex_mode = 1;
+			break;
+		case 'B':
+			hex_mode = 2;
+			break;
+		default:
+			help();
+			break;
+		}
+	}
+
+	if (server_spec) {
+		if (gotaction || optind != argc || (strncmp(server_spec, "xvc:", 4) && strncmp(server_spec, "rbb:", 4)))
+			help();
+		return sim_server(server_spec);
+	}
+
+	if (!gotaction || optind != argc)
+		help();
+
+	if (session_open && libxsvf_session_close(&h) < 0)
+		rc = 1;
+
+	if (u.verbose) {
+		gettimeofday(&tv2, NULL);
+		double secs = (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) * 1e-6;
+		fprintf(stderr, "Total number of clock cycles: %lld\n", u.clockcount);
+		fprintf(stderr, "Requests: %lld (max. %d bits, %d in flight), waits for replies: %lld (%.3f s)\n",
+				u.requests, u.request_bits, u.depth, u.waits, u.waits_usecs * 1e-6);
+		fprintf(stderr, "Time: %.3f s, %.2f Mbit/s\n", secs, u.clockcount / secs * 1e-6);
+		if (rc == 0) {
+			fprintf(stderr, "Finished without errors.\n");
+		} else {
+			fprintf(stderr, "Finished with errors!\n");
+		}
+	}
+
+	if (u.retval_i) {
+		if (hex_mode) {
+			printf("0x");
+			for (i=0; i < u.retval_i; i+=4) {
+				int val = 0;
+				for (j=i; j<i+4; j++)
+					val = val << 1 | u.retval[hex_mode > 1 ? j : u.retval_i - j - 1];
+				printf("%x", val);
+			}
+		} else {
+			printf("%d rmask bits:", u.retval_i);
+			for (i=0; i < u.retval_i; i++)
+				printf(" %d", u.retval[i]);
+		}
+		printf("\n");
+	}
+
+	return rc;
+}
@@ -64,6 +64,54 @@
  *  Response: OK (X)
  *    Exit. Restore FX2 default settings and enter endless loop
  *
+ *  Request: A<n>
+ *  Response: OK (A<n>)
+ *    Enable (<n> = 1) or disable (<n> = 0) asynchronous status records.
+ *    Disabled by the R command.
+ *
+ *  Request: D<n>
+ *  Response: OK (D<n>)
+ *    Enable (<n> = 1) or disable (<n> = 0) the TDO capture stream on EP6.
+ *    Disabled by the R command.
+ *
+ *  Request: V / V1
+ *  Response: <nnnnnn><c> (V)
+ *    Read the firmware checksum <nnnnnn> and the CPLD-CHECKED flag <c>.
+ *    V1 sets the flag before responding. The host sets it after verifying
+ *    the CPLD checksum. It is reset on firmware start and by the J command,
+ *    as the J command may reprogram the CPLD.
+ *
+ *
+ *  Asynchronous Status Records (EP1)
+ *  ---------------------------------
+ *
+ *  Record: Y<s><e>
+ *    Sent whenever the CPLD sync signal changes while asynchronous status
+ *    records are enabled. <s> is the new sync signal value and <e> is the
+ *    CPLD-JTAG-ERR flag as latched by the CPLD when the sync signal was set.
+ *    The error flag is sticky until the next S command, so a record without
+ *    error acknowledges all TDO checks before that sync signal.
+ *
+ *    Records are only sent while EP1 IN is idle and command responses wait
+ *    for a pending record to be read, so the host must keep reading EP1 IN
+ *    and skip records while waiting for a command response.
+ *
+ *
+ *  TDO Capture Stream (EP6)
+ *  ------------------------
+ *
+ *  The CPLD collects the TDO values of transactions prefixed with the
+ *  capture code (see below) and moves them to a readout buffer when the
+ *  sync signal is set. At most 16 bits may be captured between two sync
+ *  signal changes. The firmware reads the buffer and sends 3-byte records
+ *  on EP6: <n> <data[15:8]> <data[7:0]>, where <n> is the number of bits
+ *  and the first captured bit is data[n-1]. Partial packets are committed
+ *  before the W, S and P responses are sent.
+ *
+ *  If the readout buffer is still full when the next sync signal is set,
+ *  the captured bits are dropped and the CPLD-JTAG-ERR flag is set. The host
+ *  must leave enough time (NOP codes) between such sync points.
+ *
  *
  *  Target JTAG Programming (EP2)
  *  -----------------------------
@@ -81,8 +129,17 @@
  *  0001 xxxx:
  *    Set sync signal to 'xxxx' (engine on CPLD only)
  *
- *  001x:
- *    reserved for future use
+ *  0010:
+ *    Capture TDO in the next transaction (engine on CPLD only)
+ *
+ *  dddd 0011 knnnnnnn <data>:
+ *    Extended opcode (engine on CPLD only, 8bit/cycle mode only)
+ *    Run 8 JTAG cycles for each of the following n+1 data bytes. With k=0
+ *    the cycles shift the data bits (LSB first) to TDI with TMS=0, with k=1
+ *    the cycles keep TMS and TDI from the last transaction (data ignored).
+ *    The CPLD clocks the cycles itself with TCK = 48MHz / (2*d + 2), so the
+ *    byte period set with the T command must be at least 16*(d+1) clocks,
+ *    i.e. T >= 8*(d+1). No TDO checks and no capture.
  *
  *  01xy:
  *    JTAG transaction without TDO check. TMS=x, TDI=y
@@ -101,10 +158,13 @@
  *
  *  PC[7:4]   <---   SYNC
  *  PC3       <---   TDO
- *  PC2       <---   CKSUM
+ *  PC2       <---   CKSUM (PD5=0) / SYNC_ERR (PD5=1) / CAPBUF (PD6=1)
  *  PC1       <---   INIT_B_INT
  *  PC0       <---   ERR
  *
+ *  PD7       --->   SHIFT_CAPBUF
+ *  PD6       --->   SEL_CAPBUF
+ *  PD5       --->   SEL_SYNC_ERR
  *  PD4       --->   RESET_SYNC
  *  PD3       --->   RESET_ERR
  *  PD2       --->   INIT_INT
@@ -136,8 +196,25 @@
 // set to '1' on CPLD JTAG error
 BYTE state_err;
 
-// use quad buffering and larger buffers
-#define ALL_RESOURCES_ON_EP2
+// asynchronous status records (A command)
+BYTE async_status;
+BYTE async_last_sync;
+
+// tdo capture stream (D command)
+BYTE capture_stream;
+WORD capture_len;
+
+// firmware checksum and CPLD-CHECKED flag (V command)
+char *firmware_cksum =
+#include "firmware_cksum_c.inc"
+;
+BYTE cpld_checked;
+
+// use quad buffering and larger buffers (no tdo capture stream)
+// #define ALL_RESOURCES_ON_EP2
+
+// use larger buffers and reserve EP6 for the tdo capture stream
+#define CAPTURE_STREAM_ON_EP6
 
 void sleep3us(void)
 {
@@ -173,6 +250,12 @@ void setup(void)
 	EP4CFG = 0x00; // VALID=0, DIR=0, TYPE=00, SIZE=0, BUF=00
 	EP6CFG = 0x00; // VALID=0, DIR=0, TYPE=00, SIZE=0, BUF=00
 	EP8CFG = 0x00; // VALID=0, DIR=0, TYPE=00, SIZE=0, BUF=00
+#elif defined(CAPTURE_STREAM_ON_EP6)
+	/* Configure the Endpoints (EP2 => 2x 1kB, EP6 => 2x 512B IN) */
+	EP2CFG = 0xAA; // VALID=1, DIR=0, TYPE=10, SIZE=1, BUF=10
+	EP4CFG = 0x00; // VALID=0, DIR=0, TYPE=00, SIZE=0, BUF=00
+	EP6CFG = 0xE2; // VALID=1, DIR=1, TYPE=10, SIZE=0, BUF=10
+	EP8CFG = 0x00; // VALID=0, DIR=0, TYPE=00, SIZE=0, BUF=00
 #else
 	/* Configure the Endpoints (default config) */
 	EP2CFG = 0xA2; // VALID=1, DIR=0, TYPE=10, SIZE=0, BUF=10
@@ -219,7 +302,7 @@ void setup(void)
 	IOC = 0;
 
 	/* FX2 <-> CPLD signals on port D */
-	OED = bmBIT0 | bmBIT1 | bmBIT2 | bmBIT3 | bmBIT4;
+	OED = bmBIT0 | bmBIT1 | bmBIT2 | bmBIT3 | bmBIT4 | bmBIT5 | bmBIT6 | bmBIT7;
 	IOD = 0;
 
 	/* TURN ON CPLD VCC */
@@ -396,6 +479,12 @@ void proc_command_r(void)
 	/* Reset JTAG error state */
 	state_err = 0;
 
+	/* Disable asynchronous status records and tdo capture stream */
+	async_status = 0;
+	async_last_sync = 0;
+	capture_stream = 0;
+	capture_len = 0;
+
 	/* Reset LEDs and BUFFER_OE */
 	PA0 = PA1 = PA5 = 0;
 
@@ -415,6 +504,54 @@ void proc_command_r(void)
 
 void proc_bulkdata(void);
 
+void proc_capture_flush(void)
+{
+	if (capture_len == 0)
+		return;
+	EP6BCH = MSB(capture_len); SYNCDELAY;
+	EP6BCL = LSB(capture_len); SYNCDELAY;
+	capture_len = 0;
+}
+
+void proc_capture(void)
+{
+	BYTE i, n = 0;
+	WORD data = 0;
+
+	/* check the readout buffer full flag */
+	PD6 = 1;
+	SYNCDELAY;
+	if (!PC2) {
+		PD6 = 0;
+		return;
+	}
+
+	for (i = 0; i < 21; i++) {
+		PD7 = 1;
+		SYNCDELAY;
+		PD7 = 0;
+		SYNCDELAY;
+		if (i < 5)
+			n = n << 1 | PC2;
+		else
+			data = data << 1 | PC2;
+	}
+
+	/* release the readout buffer */
+	PD6 = 0;
+
+	if (capture_len == 0) {
+		while ((EP6CS & bmBIT3) != 0) { /* EP6 IN is full */ }
+	}
+
+	EP6FIFOBUF[capture_len++] = n; SYNCDELAY;
+	EP6FIFOBUF[capture_len++] = MSB(data); SYNCDELAY;
+	EP6FIFOBUF[capture_len++] = LSB(data); SYNCDELAY;
+
+	if (capture_len > 512-3)
+		proc_capture_flush();
+}
+
 void proc_command_w_ok(BYTE v)
 {
 	EP1INBUF[0] = 'O'; SYNCDELAY;
@@ -458,10 +595,18 @@ void proc_command_w(BYTE v)
 	{
 		/* check for wait condition */
 		if ((IOC >> 4) == v) {
+			if (capture_stream) {
+				proc_capture();
+				proc_capture_flush();
+			}
 			proc_command_w_ok(v);
 			return;
 		}
 
+		/* check for captured tdo bits */
+		if (capture_stream)
+			proc_capture();
+
 		/* check for data on EP2 */
 		if((EP2CS & bmBIT2) == 0) {
 			PA0 = 1;
@@ -477,6 +622,9 @@ void proc_command_c(void)
 {
 	BYTE i, j, buf;
 
+	/* Select chksum register on PC2 */
+	PD5 = 0;
+
 	/* Reset chksum register */
 	PD0 = 1;
 	PD1 = 0;
@@ -503,6 +651,8 @@ void proc_command_c(void)
 	EP1INBUF[8] = 'C'; SYNCDELAY;
 	EP1INBUF[9] = ')'; SYNCDELAY;
 	EP1INBC = 10; SYNCDELAY;
+
+	PD5 = async_status;
 }
 
 void proc_command_b(BYTE v)
@@ -535,6 +685,11 @@ void proc_command_i(BYTE v)
 
 void proc_command_s(void)
 {
+	if (capture_stream) {
+		proc_capture();
+		proc_capture_flush();
+	}
+
 	EP1INBUF[0] =            PC0 ? '1' : '0'; SYNCDELAY;
 	EP1INBUF[1] =      state_err ? '1' : '0'; SYNCDELAY;
 	EP1INBUF[2] =            PC1 ? '1' : '0'; SYNCDELAY;
@@ -554,10 +709,18 @@ void proc_command_s(void)
 	SYNCDELAY;
 	SYNCDELAY;
 	IOD &= ~bmBIT3;
+
+	/* IOD = bmBIT3 also cleared the SYNC_ERR select */
+	PD5 = async_status;
 }
 
 void proc_command_p(void)
 {
+	if (capture_stream) {
+		proc_capture();
+		proc_capture_flush();
+	}
+
 	EP1INBUF[0] =            PC0 ? '1' : '0'; SYNCDELAY;
 	EP1INBUF[1] =      state_err ? '1' : '0'; SYNCDELAY;
 	EP1INBUF[2] =            PC1 ? '1' : '0'; SYNCDELAY;
@@ -572,6 +735,88 @@ void proc_command_p(void)
 	EP1INBC = 11; SYNCDELAY;
 }
 
+void proc_command_a(BYTE v)
+{
+	async_status = v;
+	async_last_sync = IOC >> 4;
+	PD5 = v;
+
+	EP1INBUF[0] = 'O'; SYNCDELAY;
+	EP1INBUF[1] = 'K'; SYNCDELAY;
+	EP1INBUF[2] = ' '; SYNCDELAY;
+	EP1INBUF[3] = '('; SYNCDELAY;
+	EP1INBUF[4] = 'A'; SYNCDELAY;
+	EP1INBUF[5] = v ? '1' : '0'; SYNCDELAY;
+	EP1INBUF[6] = ')'; SYNCDELAY;
+	EP1INBC = 7; SYNCDELAY;
+}
+
+void proc_command_d(BYTE v)
+{
+#ifdef CAPTURE_STREAM_ON_EP6
+	capture_stream = v;
+	capture_len = 0;
+
+	EP1INBUF[0] = 'O'; SYNCDELAY;
+	EP1INBUF[1] = 'K'; SYNCDELAY;
+	EP1INBUF[2] = ' '; SYNCDELAY;
+	EP1INBUF[3] = '('; SYNCDELAY;
+	EP1INBUF[4] = 'D'; SYNCDELAY;
+	EP1INBUF[5] = v ? '1' : '0'; SYNCDELAY;
+	EP1INBUF[6] = ')'; SYNCDELAY;
+	EP1INBC = 7; SYNCDELAY;
+#else
+	EP1INBUF[0] = 'N'; SYNCDELAY;
+	EP1INBUF[1] = 'O'; SYNCDELAY;
+	EP1INBUF[2] = ' '; SYNCDELAY;
+	EP1INBUF[3] = '('; SYNCDELAY;
+	EP1INBUF[4] = 'D'; SYNCDELAY;
+	EP1INBUF[5] = v ? '1' : '0'; SYNCDELAY;
+	EP1INBUF[6] = ')'; SYNCDELAY;
+	EP1INBC = 7; SYNCDELAY;
+#endif
+}
+
+void proc_async_status(void)
+{
+	BYTE s, e;
+
+	s = IOC >> 4;
+	if (s == async_last_sync)
+		return;
+
+	/* the sync signal may change while the error flag is sampled */
+	e = PC2;
+	if ((IOC >> 4) != s)
+		return;
+
+	async_last_sync = s;
+
+	EP1INBUF[0] = 'Y'; SYNCDELAY;
+	EP1INBUF[1] = nibble2hex(s); SYNCDELAY;
+	EP1INBUF[2] = e ? '1' : '0'; SYNCDELAY;
+	EP1INBC = 3; SYNCDELAY;
+}
+
+void proc_command_v(BYTE v)
+{
+	BYTE i;
+
+	if (v)
+		cpld_checked = 1;
+
+	for (i = 0; i < 6; i++) {
+		EP1INBUF[i] = firmware_cksum[i]; SYNCDELAY;
+	}
+
+	EP1INBUF[6] = cpld_checked ? '1' : '0'; SYNCDELAY;
+	EP1INBUF[7] = ' '; SYNCDELAY;
+	EP1INBUF[8] = '('; SYNCDELAY;
+	EP1INBUF[9] = 'V'; SYNCDELAY;
+	EP1INBUF[10] = ')'; SYNCDELAY;
+	EP1INBC = 11; SYNCDELAY;
+}
+
 BYTE proc_command_j_exec_skip_next;
 void proc_command_j_exec(BYTE cmd)
 {
@@ -586,6 +831,7 @@ void proc_command_j_exec(BYTE cmd)
 		proc_command_j_exec_skip_next = 1;
 		return;
 	}
+	// 0010, 0011: capture and extended opcodes (engine on CPLD only)
 	if ((cmd & 0x0c) == 0x04)
 	{
 		// 01xy: JTAG transaction without TDO check. TMS=x, TDI=y
@@ -645,6 +891,7 @@ void proc_command_j_exec(BYTE cmd)
 void proc_command_j(BYTE len)
 {
 	BYTE i;
+	cpld_checked = 0;
 	proc_command_j_exec_skip_next = 0;
 	for (i = 1; i < len; i++) {
 		BYTE cmd = EP1OUTBUF[i];
@@ -673,6 +920,9 @@ void proc_command(void)
 {
 	BYTE len, cmd;
 
+	/* wait for a pending status record to be read */
+	while ((EP1INCS & bmBIT1) != 0) { /* EP1 IN is busy */ }
+
 	/* process command(s) */
 	len = EP1OUTBC;
 	cmd = EP1OUTBUF[0];
@@ -697,6 +947,14 @@ void proc_command(void)
 		proc_command_j(len);
 	else if (cmd == 'X')
 		proc_command_x();
+	else if (cmd == 'A' && len == 2)
+		proc_command_a(EP1OUTBUF[1] == '1');
+	else if (cmd == 'D' && len == 2)
+		proc_command_d(EP1OUTBUF[1] == '1');
+	else if (cmd == 'V' && len == 1)
+		proc_command_v(0);
+	else if (cmd == 'V' && len == 2)
+		proc_command_v(EP1OUTBUF[1] == '1');
 	else
 	{
 		/* send error response */
@@ -751,6 +1009,11 @@ void proc_bulkdata(void)
 void main(void)
 {
 	state_err = 0;
+	async_status = 0;
+	async_last_sync = 0;
+	capture_stream = 0;
+	capture_len = 0;
+	cpld_checked = 0;
 
 	setup();
 
@@ -777,6 +1040,14 @@ void main(void)
 			proc_bulkdata();
 			PA0 = 0;
 		}
+
+		/* check for sync signal changes */
+		if (async_status && (EP1INCS & bmBIT1) == 0)
+			proc_async_status();
+
+		/* check for captured tdo bits */
+		if (capture_stream)
+			proc_capture();
 	}
 }
 
@@ -21,57 +21,80 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/time.h>
 #include "fx2usb-interface.h"
 
-usb_dev_handle *fx2usb_open(int vendor_id, int device_id, char *dev)
+static int fx2usb_match(libusb_device *d, int vendor_id, int device_id, const char *dd)
 {
-	struct usb_bus *b;
-	struct usb_device *d;
+	struct libusb_device_descriptor desc;
+	char busname[4], devname[4];
+
+	if (dd) {
+		snprintf(busname, 4, "%03d", libusb_get_bus_number(d));
+		snprintf(devname, 4, "%03d", libusb_get_device_address(d));
+		return dd[0] == '/' && !strncmp(dd+1, busname, 3) &&
+				dd[4] == '/' && !strncmp(dd+5, devname, 3);
+	}
+
+	if (libusb_get_device_descriptor(d, &desc) < 0)
+		return 0;
+
+	if (vendor_id || device_id)
+		return (desc.idVendor == vendor_id) && (desc.idProduct == device_id);
+
+	// The Xilinx Platform Cable USB Vendor/Device IDs
+	if ((desc.idVendor == 0x03FD) && (desc.idProduct == 0x0009))
+		return 1;
+	if ((desc.idVendor == 0x03FD) && (desc.idProduct == 0x000D))
+		return 1;
+	if ((desc.idVendor == 0x03FD) && (desc.idProduct == 0x000F))
+		return 1;
+	// The plain CY7C68013 dev kit Vendor/Device IDs
+	if ((desc.idVendor == 0x04b4) && (desc.idProduct == 0x8613))
+		return 1;
+	return 0;
+}
+
+libusb_device_handle *fx2usb_open(int vendor_id, int device_id, char *dev)
+{
+	libusb_device **list;
+	libusb_device_handle *dh = NULL;
 	char *dd = NULL;
 	int devlen;
+	ssize_t i, n;
 
 	if (dev) {
 		devlen = strlen(dev);
 		dd = devlen > 8 ? &dev[devlen-8] : "|xxx|xxx";
 	}
 
-	for (b = usb_get_busses(); b; b = b->next) {
-		for (d = b->devices; d; d = d->next) {
-			if (dd) {
-				if (dd[0] == '/' && !strncmp(dd+1, b->dirname, 3) &&
-						dd[4] == '/' && !strncmp(dd+5, d->filename, 3))
-					return usb_open(d);
-			} else
-			if (vendor_id || device_id) {
-				if ((d->descriptor.idVendor == vendor_id) && (d->descriptor.idProduct == device_id))
-					return usb_open(d);
-			} else {
-				// The Xilinx Platform Cable USB Vendor/Device IDs
-				if ((d->descriptor.idVendor == 0x03FD) && (d->descriptor.idProduct == 0x0009))
-					return usb_open(d);
-				if ((d->descriptor.idVendor == 0x03FD) && (d->descriptor.idProduct == 0x000D))
-					return usb_open(d);
-				if ((d->descriptor.idVendor == 0x03FD) && (d->descriptor.idProduct == 0x000F))
-					return usb_open(d);
-				// The plain CY7C68013 dev kit Vendor/Device IDs
-				if ((d->descriptor.idVendor == 0x04b4) && (d->descriptor.idProduct == 0x8613))
-					return usb_open(d);
-			}
-		}
+	n = libusb_get_device_list(NULL, &list);
+	if (n < 0) {
+		fprintf(stderr, "fx2usb_open: can't get USB device list: %s\n", libusb_error_name(n));
+		return NULL;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!fx2usb_match(list[i], vendor_id, device_id, dd))
+			continue;
+		if (libusb_open(list[i], &dh) < 0)
+			dh = NULL;
+		break;
 	}
 
-	return NULL;
+	libusb_free_device_list(list, 1);
+	return dh;
 }
 
-static int fx2usb_fwload_ctrl_msg(usb_dev_handle *dh, int addr, const void *data, int len)
+static int fx2usb_fwload_ctrl_msg(libusb_device_handle *dh, int addr, const void *data, int len)
 {
-	int ret = usb_control_msg(dh, 0x40, 0xA0, addr, 0, (char*)data, len, 1000);
+	int ret = libusb_control_transfer(dh, 0x40, 0xA0, addr, 0, (unsigned char*)data, len, 1000);
 	if (ret != len)
-		fprintf(stderr, "fx2usb_fwload_ctrl_msg: usb_control_msg for addr=0x%04X, len=%d returned %d: %s\n", addr, len, ret, ret >= 0 ? "NO ERROR" : usb_strerror());
+		fprintf(stderr, "fx2usb_fwload_ctrl_msg: libusb_control_transfer for addr=0x%04X, len=%d returned %d: %s\n", addr, len, ret, ret >= 0 ? "NO ERROR" : libusb_error_name(ret));
 	return ret == len ? 0 : -1;
 }
 
-int fx2usb_upload_ihex(usb_dev_handle *dh, FILE *fp)
+int fx2usb_upload_ihex(libusb_device_handle *dh, FILE *fp)
 {
 	uint8_t on = 1, off = 0;
 
@@ -133,43 +156,66 @@ int fx2usb_upload_ihex(usb_dev_handle *dh, FILE *fp)
 	return 0;
 }
 
-int fx2usb_claim(usb_dev_handle *dh)
+int fx2usb_claim(libusb_device_handle *dh)
 {
-#ifdef LIBUSB_HAS_DETACH_KERNEL_DRIVER_NP
-	usb_detach_kernel_driver_np(dh, 0);
-#endif
-	if (usb_claim_interface(dh, 0) < 0) {
-		fprintf(stderr, "fx2usb_claim: claiming interface 0 failed: %s!\n", usb_strerror());
+	int ret;
+	if (libusb_kernel_driver_active(dh, 0) == 1)
+		libusb_detach_kernel_driver(dh, 0);
+	if ((ret = libusb_claim_interface(dh, 0)) < 0) {
+		fprintf(stderr, "fx2usb_claim: claiming interface 0 failed: %s!\n", libusb_error_name(ret));
 		return -1;
 	}
-	if (usb_set_altinterface(dh, 1) < 0) {
-		usb_release_interface(dh, 0);
-		fprintf(stderr, "fx2usb_claim: setting alternate interface 1 failed: %s!\n", usb_strerror());
+	if ((ret = libusb_set_interface_alt_setting(dh, 0, 1)) < 0) {
+		libusb_release_interface(dh, 0);
+		fprintf(stderr, "fx2usb_claim: setting alternate interface 1 failed: %s!\n", libusb_error_name(ret));
 		return -1;
 	}
 	return 0;
 }
 
-void fx2usb_release(usb_dev_handle *dh)
+void fx2usb_release(libusb_device_handle *dh)
 {
-	usb_release_interface(dh, 0);
+	fx2usb_queue_drain(dh);
+	fx2usb_recv_stop(dh);
+	libusb_release_interface(dh, 0);
 }
 
-void fx2usb_flush(usb_dev_handle *dh)
+void fx2usb_flush(libusb_device_handle *dh)
 {
 	while (1)
 	{
 		unsigned char readbuf[2] = { 0, 0 };
-		int ret = usb_bulk_read(dh, 1, (char*)readbuf, 2, 10);
-		if (ret <= 0)
+		int len = 0;
+		int ret = libusb_bulk_transfer(dh, 1 | LIBUSB_ENDPOINT_IN, readbuf, 2, &len, 10);
+		if (ret < 0 || len <= 0)
 			return;
-		fprintf(stderr, "Unexpected data word from device: 0x%02x 0x%02x (%d)\n", readbuf[0], readbuf[1], ret);
+		fprintf(stderr, "Unexpected data word from device: 0x%02x 0x%02x (%d)\n", readbuf[0], readbuf[1], len);
 	}
 }
 
-int fx2usb_send_chunk(usb_dev_handle *dh, int ep, const void *data, int len)
+void fx2usb_discard(libusb_device_handle *dh, int ep)
 {
-	int ret;
+	unsigned char buf[512];
+	int len;
+	while (libusb_bulk_transfer(dh, ep | LIBUSB_ENDPOINT_IN, buf, sizeof(buf), &len, 10) == 0) {
+		/* discard stale data */
+	}
+}
+
+int fx2usb_query(libusb_device_handle *dh, const char *cmd, void *data, int len, int timeout)
+{
+	int ret, got = 0;
+	fx2usb_discard(dh, 1);
+	ret = libusb_bulk_transfer(dh, 1, (unsigned char*)cmd, strlen(cmd), &got, timeout);
+	if (ret < 0 || got != (int)strlen(cmd))
+		return -1;
+	ret = libusb_bulk_transfer(dh, 1 | LIBUSB_ENDPOINT_IN, data, len, &got, timeout);
+	return ret < 0 ? -1 : got;
+}
+
+int fx2usb_send_chunk(libusb_device_handle *dh, int ep, const void *data, int len)
+{
+	int ret, done = 0, chunk;
 #if 0
 	if (ep == 2) {
 		int i;
@@ -182,31 +228,248 @@ int fx2usb_send_chunk(usb_dev_handle *dh, int ep, const void *data, int len)
 		fprintf(stderr, "\n");
 	}
 #endif
-retry_write:
-	ret = usb_bulk_write(dh, ep, data, len, 1000);
-	if (ret == -ETIMEDOUT) {
-		fprintf(stderr, "fx2usb_recv_chunk: usb write timeout -> retry\n");
-		fx2usb_flush(dh);
-		goto retry_write;
+	while (done < len) {
+		chunk = 0;
+		ret = libusb_bulk_transfer(dh, ep, (unsigned char*)data + done, len - done, &chunk, 1000);
+		done += chunk;
+		if (ret == LIBUSB_ERROR_TIMEOUT) {
+			fprintf(stderr, "fx2usb_send_chunk: usb write timeout -> retry\n");
+			fx2usb_flush(dh);
+			continue;
+		}
+		if (ret < 0) {
+			fprintf(stderr, "fx2usb_send_chunk: write of %d bytes to ep %d returned %d: %s\n", len, ep, done, libusb_error_name(ret));
+			return -1;
+		}
 	}
-	if (ret != len)
-		fprintf(stderr, "fx2usb_send_chunk: write of %d bytes to ep %d returned %d: %s\n", len, ep, ret, ret >= 0 ? "NO ERROR" : usb_strerror());
-	return ret == len ? 0 : -1;
+	return 0;
 }
 
-int fx2usb_recv_chunk(usb_dev_handle *dh, int ep, void *data, int len, int *ret_len)
+int fx2usb_recv_chunk(libusb_device_handle *dh, int ep, void *data, int len, int *ret_len)
 {
-	int ret;
+	int ret, got;
 retry_read:
-	ret = usb_bulk_read(dh, ep, data, len, 1000);
-	if (ret == -ETIMEDOUT) {
+	got = 0;
+	ret = libusb_bulk_transfer(dh, ep | LIBUSB_ENDPOINT_IN, data, len, &got, 1000);
+	if (ret == LIBUSB_ERROR_TIMEOUT && got == 0) {
 		fprintf(stderr, "fx2usb_recv_chunk: usb read timeout -> retry\n");
 		goto retry_read;
 	}
-	if (ret > 0 && ret_len != NULL)
-		len = *ret_len = ret;
-	if (ret != len)
-		fprintf(stderr, "fx2usb_recv_chunk: read of %d bytes from ep %d returned %d: %s\n", len, ep, ret, ret >= 0 ? "NO ERROR" : usb_strerror());
-	return ret == len ? 0 : -1;
+	if (ret == 0 && got > 0 && ret_len != NULL)
+		len = *ret_len = got;
+	if (ret < 0 || got != len)
+		fprintf(stderr, "fx2usb_recv_chunk: read of %d bytes from ep %d returned %d: %s\n", len, ep, got, ret < 0 ? libusb_error_name(ret) : "NO ERROR");
+	return ret == 0 && got == len ? 0 : -1;
+}
+
+/*
+ *  Asynchronous bulk OUT queue
+ *
+ *  fx2usb_queue_buffer() returns one of FX2USB_QUEUE_DEPTH transfer buffers
+ *  (FX2USB_QUEUE_BUFSIZE bytes) for the caller to fill in place, and
+ *  fx2usb_queue_submit() sends it without waiting for completion. The same
+ *  buffer is returned until it is submitted. fx2usb_queue_buffer() only blocks
+ *  when all transfers are in flight. The transfers on one endpoint are completed by
+ *  the host controller in submission order, so the byte stream seen by the
+ *  device is the same as with fx2usb_send_chunk(). Transfer errors are latched
+ *  and reported by the next fx2usb_queue_buffer() or fx2usb_queue_drain() call.
+ *
+ *  The libusb event loop is also run by the synchronous transfers in
+ *  fx2usb_send_chunk() and fx2usb_recv_chunk(), so the queued transfers keep
+ *  moving while the host waits for an EP1 command response.
+ */
+
+struct fx2usb_queue_s {
+	struct libusb_transfer *xfer;
+	unsigned char buf[FX2USB_QUEUE_BUFSIZE];
+	int busy;
+};
+
+static struct fx2usb_queue_s fx2usb_queue[FX2USB_QUEUE_DEPTH];
+static struct fx2usb_queue_s *fx2usb_queue_next;
+static int fx2usb_queue_busy;
+static int fx2usb_queue_error;
+
+static void LIBUSB_CALL fx2usb_queue_callback(struct libusb_transfer *xfer)
+{
+	struct fx2usb_queue_s *q = xfer->user_data;
+
+	if (xfer->status == LIBUSB_TRANSFER_TIMED_OUT && xfer->actual_length < xfer->length) {
+		fprintf(stderr, "fx2usb_queue_callback: usb write timeout -> retry\n");
+		xfer->buffer += xfer->actual_length;
+		xfer->length -= xfer->actual_length;
+		if (libusb_submit_transfer(xfer) == 0)
+			return;
+	}
+
+	if (xfer->status != LIBUSB_TRANSFER_COMPLETED || xfer->actual_length != xfer->length) {
+		fprintf(stderr, "fx2usb_queue_callback: write of %d bytes to ep %d returned %d (status %d)\n",
+				xfer->length, xfer->endpoint, xfer->actual_length, xfer->status);
+		fx2usb_queue_error = 1;
+	}
+
+	q->busy = 0;
+	fx2usb_queue_busy--;
+}
+
+static int fx2usb_queue_wait(int max_busy)
+{
+	while (fx2usb_queue_busy > max_busy) {
+		if (fx2usb_poll(1) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+unsigned char *fx2usb_queue_buffer(libusb_device_handle *dh __attribute__((unused)))
+{
+	int i;
+
+	if (fx2usb_queue_next != NULL)
+		return fx2usb_queue_next->buf;
+
+	if (fx2usb_queue_wait(FX2USB_QUEUE_DEPTH-1) < 0 || fx2usb_queue_error)
+		return NULL;
+
+	for (i = 0; i < FX2USB_QUEUE_DEPTH; i++) {
+		if (!fx2usb_queue[i].busy) {
+			fx2usb_queue_next = &fx2usb_queue[i];
+			break;
+		}
+	}
+
+	return fx2usb_queue_next->buf;
+}
+
+int fx2usb_queue_submit(libusb_device_handle *dh, int ep, int len)
+{
+	struct fx2usb_queue_s *q = fx2usb_queue_next;
+	int ret;
+
+	if (q == NULL || len <= 0 || len > FX2USB_QUEUE_BUFSIZE)
+		return -1;
+
+	if (q->xfer == NULL && (q->xfer = libusb_alloc_transfer(0)) == NULL) {
+		fprintf(stderr, "fx2usb_queue_submit: can't allocate usb transfer!\n");
+		return -1;
+	}
+
+	libusb_fill_bulk_transfer(q->xfer, dh, ep, q->buf, len, fx2usb_queue_callback, q, 1000);
+
+	if ((ret = libusb_submit_transfer(q->xfer)) < 0) {
+		fprintf(stderr, "fx2usb_queue_submit: submitting %d bytes to ep %d failed: %s\n", len, ep, libusb_error_name(ret));
+		return -1;
+	}
+
+	fx2usb_queue_next = NULL;
+	q->busy = 1;
+	fx2usb_queue_busy++;
+	return 0;
+}
+
+int fx2usb_queue_pending(void)
+{
+	return fx2usb_queue_busy;
+}
+
+int fx2usb_queue_drain(libusb_device_handle *dh __attribute__((unused)))
+{
+	int ret = fx2usb_queue_wait(0) < 0 || fx2usb_queue_error ? -1 : 0;
+	fx2usb_queue_error = 0;
+	return ret;
+}
+
+/*
+ *  Asynchronous bulk IN reader
+ *
+ *  fx2usb_recv_start() keeps one IN transfer of up to len bytes pending on the
+ *  endpoint and calls the callback for every transfer received. Use the max.
+ *  packet size of the endpoint as len to get one callback per packet. The callback runs from within the
+ *  libusb event loop, i.e. from fx2usb_poll() or any other fx2usb_* call that
+ *  waits for a transfer. fx2usb_recv_chunk() must not be used on the same
+ *  endpoint while the reader is active.
+ */
+
+#define FX2USB_READERS 2
+
+struct fx2usb_reader_s {
+	struct libusb_transfer *xfer;
+	unsigned char buf[512];
+	fx2usb_recv_cb_t cb;
+	int active;
+};
+
+static struct fx2usb_reader_s fx2usb_reader[FX2USB_READERS];
+
+static void LIBUSB_CALL fx2usb_reader_callback(struct libusb_transfer *xfer)
+{
+	struct fx2usb_reader_s *r = xfer->user_data;
+
+	if (xfer->status == LIBUSB_TRANSFER_COMPLETED && xfer->actual_length > 0)
+		r->cb(xfer->buffer, xfer->actual_length);
+
+	if (xfer->status == LIBUSB_TRANSFER_COMPLETED || xfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
+		if (r->active > 0 && libusb_submit_transfer(xfer) == 0)
+			return;
+	} else if (xfer->status != LIBUSB_TRANSFER_CANCELLED) {
+		fprintf(stderr, "fx2usb_reader_callback: read from ep %d failed (status %d)\n",
+				xfer->endpoint & 0x7f, xfer->status);
+	}
+
+	r->active = 0;
+}
+
+int fx2usb_recv_start(libusb_device_handle *dh, int ep, int len, fx2usb_recv_cb_t cb)
+{
+	struct fx2usb_reader_s *r = NULL;
+	int i, ret;
+
+	for (i = 0; i < FX2USB_READERS; i++) {
+		if (!fx2usb_reader[i].active) {
+			r = &fx2usb_reader[i];
+			break;
+		}
+	}
+
+	if (r == NULL || len > (int)sizeof(r->buf))
+		return -1;
+
+	if (r->xfer == NULL && (r->xfer = libusb_alloc_transfer(0)) == NULL) {
+		fprintf(stderr, "fx2usb_recv_start: can't allocate usb transfer!\n");
+		return -1;
+	}
+
+	r->cb = cb;
+	libusb_fill_bulk_transfer(r->xfer, dh, ep | LIBUSB_ENDPOINT_IN, r->buf, len, fx2usb_reader_callback, r, 0);
+
+	if ((ret = libusb_submit_transfer(r->xfer)) < 0) {
+		fprintf(stderr, "fx2usb_recv_start: submitting read from ep %d failed: %s\n", ep, libusb_error_name(ret));
+		return -1;
+	}
+
+	r->active = 1;
+	return 0;
+}
+
+void fx2usb_recv_stop(libusb_device_handle *dh __attribute__((unused)))
+{
+	int i;
+	for (i = 0; i < FX2USB_READERS; i++) {
+		if (!fx2usb_reader[i].active)
+			continue;
+		fx2usb_reader[i].active = -1;
+		libusb_cancel_transfer(fx2usb_reader[i].xfer);
+		while (fx2usb_reader[i].active != 0 && fx2usb_poll(1) == 0) { }
+	}
 }
 
+int fx2usb_poll(int block)
+{
+	struct timeval tv = { 0, 0 };
+	int ret = block ? libusb_handle_events(NULL) : libusb_handle_events_timeout(NULL, &tv);
+	if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED) {
+		fprintf(stderr, "fx2usb_poll: libusb_handle_events returned %d: %s\n", ret, libusb_error_name(ret));
+		return -1;
+	}
+	return 0;
+}
@@ -21,17 +21,34 @@
 #ifndef FX2USB_INTERFACE_H
 #define FX2USB_INTERFACE_H
 
-#include <usb.h>
+#include <libusb.h>
 #include <stdio.h>
 
-usb_dev_handle *fx2usb_open(int vendor_id, int device_id, char *dev);
-int fx2usb_upload_ihex(usb_dev_handle *dh, FILE *fp);
-int fx2usb_claim(usb_dev_handle *dh);
-void fx2usb_release(usb_dev_handle *dh);
+/* number of asynchronous bulk OUT transfers that may be in flight at once
+ * and the maximum size of a single queued chunk */
+#define FX2USB_QUEUE_DEPTH 8
+#define FX2USB_QUEUE_BUFSIZE 16384
 
-void fx2usb_flush(usb_dev_handle *dh);
-int fx2usb_send_chunk(usb_dev_handle *dh, int ep, const void *data, int len);
-int fx2usb_recv_chunk(usb_dev_handle *dh, int ep, void *data, int len, int *ret_len);
+libusb_device_handle *fx2usb_open(int vendor_id, int device_id, char *dev);
+int fx2usb_upload_ihex(libusb_device_handle *dh, FILE *fp);
+int fx2usb_claim(libusb_device_handle *dh);
+void fx2usb_release(libusb_device_handle *dh);
+
+void fx2usb_flush(libusb_device_handle *dh);
+void fx2usb_discard(libusb_device_handle *dh, int ep);
+int fx2usb_query(libusb_device_handle *dh, const char *cmd, void *data, int len, int timeout);
+int fx2usb_send_chunk(libusb_device_handle *dh, int ep, const void *data, int len);
+int fx2usb_recv_chunk(libusb_device_handle *dh, int ep, void *data, int len, int *ret_len);
+
+unsigned char *fx2usb_queue_buffer(libusb_device_handle *dh);
+int fx2usb_queue_submit(libusb_device_handle *dh, int ep, int len);
+int fx2usb_queue_drain(libusb_device_handle *dh);
+int fx2usb_queue_pending(void);
+
+typedef void (*fx2usb_recv_cb_t)(const unsigned char *data, int len);
+int fx2usb_recv_start(libusb_device_handle *dh, int ep, int len, fx2usb_recv_cb_t cb);
+void fx2usb_recv_stop(libusb_device_handle *dh);
+int fx2usb_poll(int block);
 
 #endif /* FX2USB_INTERFACE_H */
 
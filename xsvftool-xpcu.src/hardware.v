@@ -60,16 +60,29 @@ always @(posedge chksum_clk) begin
 end
 assign chksum_rst = pd0;
 assign chksum_clk = pd1;
-assign pc2 = chksum_buffer[23];
 
 // main engine
 reg [3:0] sync;
 reg [7:0] lastbyte;
-reg go_exec0, go_exec1, set_sync, err;
+reg go_exec0, go_exec1, set_sync, err, sync_err;
 reg reg_tck, reg_tms, reg_tdi, reg_tdo, reg_tdo_en;
+
+// tdo capture stream
+reg cap_next, reg_cap, cap_full, cap_shifted, pd6_q, pd7_q;
+reg [4:0] cap_count;
+reg [15:0] cap_data;
+reg [21:0] capbuf;
+
+// extended opcodes: dense tdi shift and idle clocks
+reg ext_hdr, ext_idle, ext_slot;
+reg [3:0] ext_div, burst_cnt, burst_bits;
+reg [7:0] ext_count, burst_data;
+
 always @(negedge clk) begin
 	go_exec0 <= 0;
 	go_exec1 <= 0;
+	pd6_q <= pd6;
+	pd7_q <= pd7;
 	if (!ctl0) begin
 		lastbyte <= { fd7, fd6, fd5, fd4, fd3, fd2, fd1, fd0 };
 		go_exec0 <= 1;
@@ -81,11 +94,62 @@ always @(negedge clk) begin
 	if (!ctl2) begin
 		go_exec1 <= 1;
 	end
+	if (burst_bits != 0) begin
+		/* self-clocked burst: TCK = clk / (2*ext_div + 2) */
+		if (burst_cnt != 0)
+			burst_cnt <= burst_cnt - 1;
+		else begin
+			burst_cnt <= ext_div;
+			if (!reg_tck)
+				reg_tck <= 1;
+			else if (burst_bits != 1) begin
+				reg_tck <= 0;
+				if (!ext_idle)
+					reg_tdi <= burst_data[1];
+				burst_data <= burst_data >> 1;
+			end
+			if (reg_tck)
+				burst_bits <= burst_bits - 1;
+		end
+	end
 	if (go_exec0) begin
 		reg_tdo_en <= 0;
+		reg_cap <= 0;
+		ext_slot <= 0;
 		if (set_sync) begin
 			sync <= lastbyte[3:0];
+			sync_err <= err;
 			set_sync <= 0;
+			if (cap_count != 0) begin
+				/* move captured bits to readout buffer */
+				if (cap_full)
+					err <= 1;
+				else begin
+					capbuf <= { 1'b1, cap_count, cap_data };
+					cap_full <= 1;
+					cap_shifted <= 0;
+				end
+				cap_count <= 0;
+			end
+		end else
+		if (ext_hdr) begin
+			/* extended opcode: kind and number of data bytes */
+			ext_hdr <= 0;
+			ext_idle <= lastbyte[7];
+			ext_count <= lastbyte[6:0] + 1;
+		end else
+		if (ext_count != 0) begin
+			/* extended opcode: data byte, 8 cycles */
+			ext_count <= ext_count - 1;
+			ext_slot <= 1;
+			burst_data <= lastbyte;
+			burst_bits <= 8;
+			burst_cnt <= ext_div;
+			reg_tck <= 0;
+			if (!ext_idle) begin
+				reg_tms <= 0;
+				reg_tdi <= lastbyte[0];
+			end
 		end else
 		if (lastbyte[3:0] == 0) begin
 			/* NOP */
@@ -94,11 +158,19 @@ always @(negedge clk) begin
 			/* Set sync signal in next insn */
 			set_sync <= 1;
 		end else
-		if (lastbyte[3:1] == 1) begin
-			/* reserved */
+		if (lastbyte[3:0] == 2) begin
+			/* Capture TDO in next transaction */
+			cap_next <= 1;
+		end else
+		if (lastbyte[3:0] == 3) begin
+			/* extended opcode (8 bit mode only) */
+			ext_div <= lastbyte[7:4];
+			ext_hdr <= 1;
 		end else
 		if (lastbyte[3:2] == 1) begin
 			/* transaction with or without TDO check */
+			reg_cap <= cap_next;
+			cap_next <= 0;
 			reg_tck <= 0;
 			reg_tdo <= 'bx;
 			reg_tms <= lastbyte[1];
@@ -106,6 +178,8 @@ always @(negedge clk) begin
 		end else
 		if (lastbyte[3] == 1) begin
 			/* transaction with TDO check */
+			reg_cap <= cap_next;
+			cap_next <= 0;
 			reg_tck <= 0;
 			reg_tdo <= lastbyte[2];
 			reg_tms <= lastbyte[1];
@@ -113,19 +187,41 @@ always @(negedge clk) begin
 			reg_tdo_en <= 1;
 		end
 	end
-	if (go_exec1) begin
+	if (go_exec1 && !ext_slot) begin
 		reg_tck <= 1;
 		if (reg_tdo_en && tdo != reg_tdo)
 			err <= 1;
+		if (reg_cap) begin
+			cap_data <= { cap_data[14:0], tdo };
+			cap_count <= cap_count + 1;
+		end
+	end
+	if (pd6 && pd7 && !pd7_q) begin
+		/* shift readout buffer */
+		capbuf <= capbuf << 1;
+		cap_shifted <= 1;
+	end
+	if (!pd6 && pd6_q && cap_shifted) begin
+		/* readout done */
+		cap_full <= 0;
+		cap_shifted <= 0;
 	end
 	if (pd3) begin
 		/* RESET ERR */
 		err <= 0;
+		sync_err <= 0;
 	end
 	if (pd4) begin
 		/* RESET SYNC */
 		set_sync <= 0;
 		sync <= 0;
+		cap_next <= 0;
+		cap_count <= 0;
+		cap_full <= 0;
+		capbuf <= 0;
+		ext_hdr <= 0;
+		ext_count <= 0;
+		burst_bits <= 0;
 	end
 end
 assign tck = reg_tck;
@@ -136,6 +232,7 @@ assign pc6 = sync[2];
 assign pc5 = sync[1];
 assign pc4 = sync[0];
 assign pc0 = err;
+assign pc2 = pd6 ? capbuf[21] : pd5 ? sync_err : chksum_buffer[23];
 
 endmodule
 
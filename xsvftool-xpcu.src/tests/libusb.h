@@ -0,0 +1,127 @@
+/*
+ *  xsvftool-xpcu - An (X)SVF player for the Xilinx Platform Cable USB
+ *
+ *  Copyright (C) 2011  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2011  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+/*
+ *  The subset of the libusb-1.0 API used by xsvftool-xpcu. The regression
+ *  tests build the host code against this header and link it with probe.c,
+ *  which implements the functions with a software model of the probe.
+ */
+
+#ifndef LIBUSB_H
+#define LIBUSB_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#define LIBUSB_CALL
+
+#define LIBUSB_ENDPOINT_IN 0x80
+#define LIBUSB_TRANSFER_TYPE_BULK 2
+
+enum libusb_error {
+	LIBUSB_SUCCESS = 0,
+	LIBUSB_ERROR_IO = -1,
+	LIBUSB_ERROR_INVALID_PARAM = -2,
+	LIBUSB_ERROR_NO_DEVICE = -4,
+	LIBUSB_ERROR_TIMEOUT = -7,
+	LIBUSB_ERROR_INTERRUPTED = -10
+};
+
+enum libusb_transfer_status {
+	LIBUSB_TRANSFER_COMPLETED,
+	LIBUSB_TRANSFER_ERROR,
+	LIBUSB_TRANSFER_TIMED_OUT,
+	LIBUSB_TRANSFER_CANCELLED,
+	LIBUSB_TRANSFER_STALL,
+	LIBUSB_TRANSFER_NO_DEVICE,
+	LIBUSB_TRANSFER_OVERFLOW
+};
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device libusb_device;
+typedef struct libusb_device_handle libusb_device_handle;
+
+struct libusb_device_descriptor {
+	uint16_t idVendor;
+	uint16_t idProduct;
+};
+
+struct libusb_transfer;
+typedef void (LIBUSB_CALL *libusb_transfer_cb_fn)(struct libusb_transfer *transfer);
+
+struct libusb_transfer {
+	libusb_device_handle *dev_handle;
+	unsigned char endpoint;
+	unsigned char type;
+	unsigned int timeout;
+	enum libusb_transfer_status status;
+	int length;
+	int actual_length;
+	libusb_transfer_cb_fn callback;
+	void *user_data;
+	unsigned char *buffer;
+};
+
+int libusb_init(libusb_context **ctx);
+void libusb_exit(libusb_context *ctx);
+const char *libusb_error_name(int errcode);
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list);
+void libusb_free_device_list(libusb_device **list, int unref_devices);
+int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc);
+uint8_t libusb_get_bus_number(libusb_device *dev);
+uint8_t libusb_get_device_address(libusb_device *dev);
+
+int libusb_open(libusb_device *dev, libusb_device_handle **handle);
+void libusb_close(libusb_device_handle *dev_handle);
+libusb_device *libusb_get_device(libusb_device_handle *dev_handle);
+int libusb_kernel_driver_active(libusb_device_handle *dev_handle, int interface_number);
+int libusb_detach_kernel_driver(libusb_device_handle *dev_handle, int interface_number);
+int libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number);
+int libusb_release_interface(libusb_device_handle *dev_handle, int interface_number);
+int libusb_set_interface_alt_setting(libusb_device_handle *dev_handle, int interface_number, int alternate_setting);
+
+int libusb_control_transfer(libusb_device_handle *dev_handle, uint8_t request_type, uint8_t request,
+		uint16_t value, uint16_t index, unsigned char *data, uint16_t length, unsigned int timeout);
+int libusb_bulk_transfer(libusb_device_handle *dev_handle, unsigned char endpoint,
+		unsigned char *data, int length, int *actual_length, unsigned int timeout);
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets);
+int libusb_submit_transfer(struct libusb_transfer *transfer);
+int libusb_cancel_transfer(struct libusb_transfer *transfer);
+int libusb_handle_events(libusb_context *ctx);
+int libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv);
+
+static inline void libusb_fill_bulk_transfer(struct libusb_transfer *transfer,
+		libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *buffer,
+		int length, libusb_transfer_cb_fn callback, void *user_data, unsigned int timeout)
+{
+	transfer->dev_handle = dev_handle;
+	transfer->endpoint = endpoint;
+	transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+	transfer->timeout = timeout;
+	transfer->buffer = buffer;
+	transfer->length = length;
+	transfer->user_data = user_data;
+	transfer->callback = callback;
+}
+
+#endif /* LIBUSB_H */
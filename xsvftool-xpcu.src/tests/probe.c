@@ -0,0 +1,859 @@
+/*
+ *  xsvftool-xpcu - An (X)SVF player for the Xilinx Platform Cable USB
+ *
+ *  Copyright (C) 2011  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2011  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+/*
+ *  Software model of the Xilinx Platform Cable USB running firmware.c and
+ *  hardware.v, behind the subset of the libusb-1.0 API in libusb.h. It is
+ *  linked with the unmodified host code (xsvftool-xpcu.c, fx2usb-interface.c)
+ *  for the regression tests in run.sh.
+ *
+ *  The model follows the command reference in firmware.c: the EP1 commands
+ *  and asynchronous status records, the EP6 capture stream and the JTAG
+ *  transaction codes and extended opcodes on EP2 (executed by the CPLD
+ *  engine) and in the J command (executed by the firmware on the CPLD's own
+ *  JTAG port). The JTAG connector and the CPLD are target models (target.c).
+ *
+ *  The probe executes all submitted EP2 data when the host runs the libusb
+ *  event loop. Time is counted in 48 MHz clocks of the EP2 data as executed
+ *  by the GPIF and the CPLD, so timing constraints of the protocol (e.g. the
+ *  capture buffer readout) are checked against the data rate. Protocol
+ *  violations abort the program with a "probe model:" message.
+ *
+ *  The environment variable XPCU_MODEL_START selects the state of the probe:
+ *  "cold" (no firmware), "warm" (firmware running, CPLD not yet checked) or
+ *  "checked" (the default: firmware running and the CPLD checksum verified).
+ *  The firmware uploaded by the host behaves like the embedded image: the
+ *  prebuilt prep_firmware.ihx may predate firmware.c, then it has none of the
+ *  A, D and V commands and no EP6 endpoint. XPCU_MODEL_FIRMWARE=current
+ *  makes it behave like an image built from firmware.c (as after "make
+ *  prep").
+ *
+ *  XPCU_MODEL_CPLD selects the CPLD image at program start: "current" (the
+ *  default: built from hardware.v), "image" (the image embedded in the host,
+ *  prep_hardware.svf may predate hardware.v) or the checksum of some other
+ *  image. Images that are not built from hardware.v have no SYNC_ERR select,
+ *  no capture datapath and no extended opcodes. A long J command sequence
+ *  (more than CPLD_PROGRAM_CLOCKS internal JTAG clocks between two R
+ *  commands) programs the embedded image.
+ *  Some counters are printed to stderr on exit, e.g. for checking that no
+ *  blocking syncs were needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "libusb.h"
+#include "target.h"
+
+static const char *cpld_cksum =
+#include "../hardware_cksum_c.inc"
+;
+
+static const char *cpld_image_cksum =
+#include "../hardware_image_cksum_c.inc"
+;
+
+static const char *firmware_cksum =
+#include "../firmware_cksum_c.inc"
+;
+
+static const char *firmware_image_cksum =
+#include "../firmware_image_cksum_c.inc"
+;
+
+/* Time the firmware needs to notice and read out the capture buffer
+ * (in 48 MHz clocks, the host assumes 30 us) */
+#define PROBE_READOUT_CLOCKS (20 * 48)
+
+/* Internal JTAG clocks that make a CPLD programming run */
+#define CPLD_PROGRAM_CLOCKS 100000
+
+#define PROBE_MAX_MSGS 16
+#define PROBE_MAX_PACKETS 256
+#define PROBE_MAX_XFERS 16
+
+struct probe_msg {
+	unsigned char data[512];
+	int len;
+};
+
+struct probe_queue {
+	struct probe_msg msgs[PROBE_MAX_PACKETS];
+	int first, num, size;
+};
+
+static struct target target, cpld;
+
+/* the FX2 and its firmware */
+static enum { FW_NONE, FW_RUNNING, FW_HALTED } fw_state;
+static int fw_reset, fw_uploaded, fw_legacy, fw_image_legacy;
+static int mode_8bit, byte_clocks;
+static int state_err, async_status, async_last_sync;
+static int capture_stream, cpld_checked;
+static int pd5;
+static struct probe_msg capture_buf;
+static struct probe_queue ep1_in = { .size = PROBE_MAX_MSGS };
+static struct probe_queue ep6_in = { .size = PROBE_MAX_PACKETS };
+
+/* the CPLD engine */
+static char cpld_image[7];
+static int cpld_legacy, cpld_program_clocks;
+static long long now;
+static int sync_val, set_sync, err, sync_err;
+static int reg_tms, reg_tdi;
+static int ext_hdr, ext_idle, ext_div, ext_count;
+static int cap_next, cap_count, cap_data, cap_full;
+static int capbuf_n, capbuf_data;
+static long long capbuf_time;
+
+/* the host's transfers */
+static struct libusb_transfer *out_xfers[PROBE_MAX_XFERS];
+static int num_out_xfers;
+static struct libusb_transfer *in_xfers[PROBE_MAX_XFERS];
+static int in_cancel[PROBE_MAX_XFERS];
+static int num_in_xfers;
+
+static struct libusb_device {
+	int dummy;
+} probe_device;
+
+static struct libusb_device_handle {
+	int dummy;
+} probe_handle;
+
+/* statistics */
+static int stat_s, stat_w, stat_records, stat_error_records;
+
+static void probe_error(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	fprintf(stderr, "probe model: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	abort();
+}
+
+static void queue_put(struct probe_queue *q, const void *data, int len)
+{
+	struct probe_msg *m;
+	if (q->num == q->size)
+		probe_error("%s queue overflow (the host does not read the endpoint)", q == &ep1_in ? "EP1 IN" : "EP6 IN");
+	m = &q->msgs[(q->first + q->num++) % q->size];
+	memcpy(m->data, data, len);
+	m->len = len;
+}
+
+static struct probe_msg *queue_get(struct probe_queue *q)
+{
+	struct probe_msg *m;
+	if (q->num == 0)
+		return NULL;
+	m = &q->msgs[q->first];
+	q->first = (q->first + 1) % q->size;
+	q->num--;
+	return m;
+}
+
+static void respond(const char *fmt, ...)
+{
+	char buf[65];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	queue_put(&ep1_in, buf, strlen(buf));
+}
+
+/*
+ *  CPLD (hardware.v)
+ */
+
+static void cpld_reset_sync(void)
+{
+	set_sync = 0;
+	sync_val = 0;
+	cap_next = 0;
+	cap_count = 0;
+	cap_full = 0;
+	ext_hdr = 0;
+	ext_count = 0;
+}
+
+static void fw_capture(int force);
+
+/* move the captured bits to the readout buffer (when the sync signal is set) */
+static void cpld_capture_latch(void)
+{
+	fw_capture(0);
+	if (cap_full)
+		probe_error("captured TDO bits lost: the readout buffer is still full %lld clocks after it was filled",
+				now - capbuf_time);
+	capbuf_n = cap_count;
+	capbuf_data = cap_data & 0xffff;
+	capbuf_time = now;
+	cap_full = 1;
+	cap_count = 0;
+}
+
+/* extended opcode data byte: the CPLD clocks 8 cycles itself, with TDI from
+ * the data (LSB first) and TMS=0, or keeping TMS and TDI for idle cycles */
+static void cpld_ext_byte(int v)
+{
+	int i;
+
+	if (!ext_idle)
+		reg_tms = 0;
+	for (i = 0; i < 8; i++) {
+		if (!ext_idle)
+			reg_tdi = (v >> i) & 1;
+		target_clock(&target, reg_tms, reg_tdi);
+	}
+}
+
+/* one transaction code (4-bit mode) or byte (8-bit mode) */
+static void cpld_exec(int v)
+{
+	int tdo, check;
+
+	if (set_sync) {
+		sync_val = v & 15;
+		sync_err = err;
+		set_sync = 0;
+		if (cap_count != 0)
+			cpld_capture_latch();
+		return;
+	}
+
+	if (ext_hdr) {
+		ext_hdr = 0;
+		ext_idle = (v >> 7) & 1;
+		ext_count = (v & 0x7f) + 1;
+		return;
+	}
+
+	if (ext_count != 0) {
+		ext_count--;
+		cpld_ext_byte(v);
+		return;
+	}
+
+	switch (v & 15)
+	{
+	case 0:
+		return;
+	case 1:
+		set_sync = 1;
+		return;
+	case 2:
+		if (cpld_legacy)
+			probe_error("capture code, but the CPLD image has no capture datapath");
+		cap_next = 1;
+		return;
+	case 3:
+		if (cpld_legacy)
+			probe_error("extended opcode, but the CPLD image predates them");
+		ext_div = (v >> 4) & 15;
+		ext_hdr = 1;
+		if (!mode_8bit)
+			probe_error("extended opcode in 4 bit mode");
+		if (byte_clocks < 16 * (ext_div+1))
+			probe_error("extended opcode with d=%d needs %d clocks per byte, the T command set %d",
+					ext_div, 16 * (ext_div+1), byte_clocks);
+		return;
+	}
+
+	check = (v & 8) != 0;
+	reg_tms = (v >> 1) & 1;
+	reg_tdi = v & 1;
+	tdo = target_clock(&target, reg_tms, reg_tdi);
+
+	if (check && tdo != ((v >> 2) & 1))
+		err = 1;
+
+	if (cap_next) {
+		cap_data = cap_data << 1 | tdo;
+		if (++cap_count > 16)
+			probe_error("more than 16 TDO bits captured between two sync points");
+		cap_next = 0;
+	}
+}
+
+/*
+ *  FX2 firmware (firmware.c)
+ */
+
+static void fw_capture_flush(void)
+{
+	if (capture_buf.len == 0)
+		return;
+	queue_put(&ep6_in, capture_buf.data, capture_buf.len);
+	capture_buf.len = 0;
+}
+
+/* proc_capture(): read out the capture buffer once the firmware has had the
+ * time for it (force: the host has waited for a response in the meantime) */
+static void fw_capture(int force)
+{
+	if (!capture_stream || !cap_full)
+		return;
+	if (!force && now - capbuf_time < PROBE_READOUT_CLOCKS)
+		return;
+
+	capture_buf.data[capture_buf.len++] = capbuf_n;
+	capture_buf.data[capture_buf.len++] = capbuf_data >> 8;
+	capture_buf.data[capture_buf.len++] = capbuf_data;
+	cap_full = 0;
+
+	if (capture_buf.len > 512-3)
+		fw_capture_flush();
+}
+
+/* the main loop between two commands or EP2 packets */
+static void fw_idle(void)
+{
+	if (fw_state != FW_RUNNING)
+		return;
+
+	fw_capture(0);
+
+	if (async_status && ep1_in.num == 0 && sync_val != async_last_sync) {
+		if (!pd5 || cpld_legacy)
+			probe_error("status record with PD5=0 or without SYNC_ERR select: PC2 is the checksum bit");
+		async_last_sync = sync_val;
+		respond("Y%X%c", sync_val, sync_err ? '1' : '0');
+		stat_records++;
+		stat_error_records += sync_err;
+	}
+}
+
+static void fw_ep2_data(const unsigned char *data, int len)
+{
+	int i, k;
+
+	if (fw_state == FW_HALTED)
+		return;
+
+	/* the GPIF executes the data one USB packet at a time */
+	for (i = 0; i < len; i += 512) {
+		for (k = i; k < len && k < i+512; k++) {
+			if (mode_8bit) {
+				now += byte_clocks;
+				cpld_exec(data[k]);
+			} else {
+				now += 2;
+				cpld_exec(data[k] & 15);
+				now += 2;
+				cpld_exec(data[k] >> 4);
+			}
+		}
+		fw_idle();
+	}
+}
+
+static void cpld_program(const char *cksum)
+{
+	snprintf(cpld_image, sizeof(cpld_image), "%s", cksum);
+	cpld_legacy = strcmp(cpld_image, cpld_cksum) != 0;
+}
+
+static void fw_internal_clock(int tms, int tdi)
+{
+	target_clock(&cpld, tms, tdi);
+	if (++cpld_program_clocks == CPLD_PROGRAM_CLOCKS)
+		cpld_program(cpld_image_cksum);
+}
+
+static void fw_tap_reset(void)
+{
+	int i;
+	for (i = 0; i < 16; i++)
+		fw_internal_clock(1, 1);
+}
+
+/* proc_command_j() */
+static void fw_command_j(const unsigned char *data, int len)
+{
+	int i, k, cmd, skip_next = 0;
+
+	cpld_checked = 0;
+	for (i = 1; i < len; i++)
+	for (k = 0; k < 2; k++) {
+		cmd = k ? data[i] >> 4 : data[i] & 15;
+		if (skip_next) {
+			skip_next = 0;
+			continue;
+		}
+		if (cmd == 0x01)
+			skip_next = 1;
+		if ((cmd & 0x0c) == 0x04)
+			fw_internal_clock((cmd >> 1) & 1, cmd & 1);
+		if ((cmd & 0x08) == 0x08) {
+			fw_internal_clock((cmd >> 1) & 1, cmd & 1);
+			if (((cmd & 0x04) == 0) != (cpld.tdo == 0))
+				state_err = 1;
+		}
+	}
+}
+
+static void fw_status(char cmd)
+{
+	fw_capture(1);
+	fw_capture_flush();
+	respond("%c%c1%c%c%c%X (%c)", err ? '1' : '0', state_err ? '1' : '0', '0',
+			target.tdo ? '1' : '0', cpld.tdo ? '1' : '0', sync_val, cmd);
+}
+
+static int hex2nibble(int v)
+{
+	if (v >= '0' && v <= '9')
+		return v - '0';
+	if (v >= 'a' && v <= 'f')
+		return 0x0A + v - 'a';
+	if (v >= 'A' && v <= 'F')
+		return 0x0A + v - 'A';
+	return 0;
+}
+
+/* proc_command() */
+static void fw_command(const unsigned char *data, int len)
+{
+	int cmd = data[0];
+	int v = len == 2 && data[1] == '1';
+
+	if (fw_state == FW_HALTED)
+		return;
+
+	fw_idle();
+
+	if (cmd == 'T' && len == 3) {
+		int t = hex2nibble(data[1]) << 4 | hex2nibble(data[2]);
+		mode_8bit = t != 0;
+		byte_clocks = 2*t + 2;
+		respond("OK (T%02X)", t);
+	} else if (cmd == 'R' && len == 1) {
+		fw_tap_reset();
+		cpld_program_clocks = 0;
+		mode_8bit = 0;
+		state_err = 0;
+		async_status = 0;
+		async_last_sync = 0;
+		capture_stream = 0;
+		capture_buf.len = 0;
+		pd5 = 0;
+		err = 0;
+		sync_err = 0;
+		cpld_reset_sync();
+		respond("OK (R)");
+	} else if (cmd == 'W' && len == 2) {
+		int n = hex2nibble(data[1]);
+		stat_w++;
+		if (sync_val == n) {
+			fw_capture(1);
+			fw_capture_flush();
+			respond("OK (W%X)", n);
+		} else {
+			respond("TIMEOUT! S=%X (W%X)", sync_val, n);
+		}
+	} else if (cmd == 'C' && len == 1) {
+		respond("%.6s (C)", cpld_image);
+	} else if (cmd == 'B' && len == 2) {
+		respond("OK (B%c)", v ? '1' : '0');
+	} else if (cmd == 'I' && len == 2) {
+		respond("OK (I%c)", v ? '1' : '0');
+	} else if (cmd == 'S' && len == 1) {
+		stat_s++;
+		fw_status('S');
+		state_err = 0;
+		err = 0;
+		sync_err = 0;
+		pd5 = async_status;
+	} else if (cmd == 'P' && len == 1) {
+		fw_status('P');
+	} else if (cmd == 'J') {
+		fw_command_j(data, len);
+	} else if (cmd == 'X') {
+		respond("OK (X)");
+		fw_state = FW_HALTED;
+	} else if (fw_legacy) {
+		respond("ERROR!");
+	} else if (cmd == 'A' && len == 2) {
+		async_status = v;
+		async_last_sync = sync_val;
+		pd5 = v;
+		respond("OK (A%c)", v ? '1' : '0');
+	} else if (cmd == 'D' && len == 2) {
+		capture_stream = v;
+		capture_buf.len = 0;
+		respond("OK (D%c)", v ? '1' : '0');
+	} else if (cmd == 'V' && len <= 2) {
+		if (v)
+			cpld_checked = 1;
+		respond("%.6s%c (V)", firmware_cksum, cpld_checked ? '1' : '0');
+	} else {
+		respond("ERROR!");
+	}
+}
+
+/* main(): firmware start after the upload */
+static void fw_start(int legacy)
+{
+	fw_state = FW_RUNNING;
+	fw_legacy = legacy;
+	state_err = 0;
+	async_status = 0;
+	async_last_sync = 0;
+	capture_stream = 0;
+	capture_buf.len = 0;
+	cpld_checked = 0;
+	mode_8bit = 0;
+	pd5 = 0;
+	ep1_in.num = 0;
+	ep6_in.num = 0;
+	fw_tap_reset();
+}
+
+/*
+ *  USB
+ */
+
+static void probe_out(struct libusb_transfer *xfer)
+{
+	int ep = xfer->endpoint & 0x7f;
+	if (fw_state == FW_NONE || (ep != 1 && ep != 2)) {
+		xfer->status = LIBUSB_TRANSFER_ERROR;
+		xfer->actual_length = 0;
+		return;
+	}
+	if (ep == 1)
+		fw_command(xfer->buffer, xfer->length);
+	else
+		fw_ep2_data(xfer->buffer, xfer->length);
+	xfer->status = LIBUSB_TRANSFER_COMPLETED;
+	xfer->actual_length = xfer->length;
+}
+
+static struct probe_queue *probe_in_queue(int ep)
+{
+	return (ep & 0x7f) == 1 ? &ep1_in : (ep & 0x7f) == 6 ? &ep6_in : NULL;
+}
+
+/* complete the transfers the probe can complete, returns the number of completed transfers */
+static int probe_events(void)
+{
+	struct libusb_transfer *xfer;
+	struct probe_queue *q;
+	struct probe_msg *m;
+	int i, progress = 0, done;
+
+	do {
+		done = 0;
+
+		while (num_out_xfers > 0) {
+			xfer = out_xfers[0];
+			memmove(out_xfers, out_xfers+1, --num_out_xfers * sizeof(*out_xfers));
+			probe_out(xfer);
+			xfer->callback(xfer);
+			done++;
+		}
+
+		fw_idle();
+
+		for (i = 0; i < num_in_xfers; i++) {
+			xfer = in_xfers[i];
+			q = probe_in_queue(xfer->endpoint);
+			if (in_cancel[i]) {
+				xfer->status = LIBUSB_TRANSFER_CANCELLED;
+				xfer->actual_length = 0;
+			} else if (q != NULL && q->num > 0) {
+				m = queue_get(q);
+				if (m->len > xfer->length)
+					probe_error("%d byte packet on EP%d for a %d byte transfer", m->len, xfer->endpoint & 0x7f, xfer->length);
+				memcpy(xfer->buffer, m->data, m->len);
+				xfer->status = LIBUSB_TRANSFER_COMPLETED;
+				xfer->actual_length = m->len;
+			} else {
+				continue;
+			}
+			num_in_xfers--;
+			memmove(in_xfers+i, in_xfers+i+1, (num_in_xfers-i) * sizeof(*in_xfers));
+			memmove(in_cancel+i, in_cancel+i+1, (num_in_xfers-i) * sizeof(*in_cancel));
+			xfer->callback(xfer);
+			done++;
+			break;
+		}
+
+		progress += done;
+	} while (done);
+
+	return progress;
+}
+
+int libusb_init(libusb_context **ctx)
+{
+	const char *start = getenv("XPCU_MODEL_START");
+	const char *image = getenv("XPCU_MODEL_CPLD");
+	const char *firmware = getenv("XPCU_MODEL_FIRMWARE");
+
+	if (ctx != NULL)
+		*ctx = NULL;
+
+	target_init(&target, "target", TARGET_IDCODE);
+	target_init(&cpld, "cpld", CPLD_IDCODE);
+
+	if (image == NULL || !strcmp(image, "current"))
+		cpld_program(cpld_cksum);
+	else if (!strcmp(image, "image"))
+		cpld_program(cpld_image_cksum);
+	else
+		cpld_program(image);
+
+	fw_image_legacy = strcmp(firmware_image_cksum, firmware_cksum) != 0;
+	if (firmware != NULL && !strcmp(firmware, "current"))
+		fw_image_legacy = 0;
+
+	if (start != NULL && !strcmp(start, "cold")) {
+		fw_state = FW_NONE;
+	} else {
+		fw_start(0);
+		cpld_checked = start == NULL || strcmp(start, "warm") != 0;
+	}
+
+	return 0;
+}
+
+void libusb_exit(libusb_context *ctx __attribute__((unused)))
+{
+	if (fw_state == FW_RUNNING && fw_legacy)
+		probe_error("firmware without V command left running: the next run can't recognize it");
+	target_report(&target);
+	target_report(&cpld);
+	fprintf(stderr, "probe model: S=%d W=%d records=%d error_records=%d\n",
+			stat_s, stat_w, stat_records, stat_error_records);
+}
+
+const char *libusb_error_name(int errcode)
+{
+	switch (errcode) {
+	case LIBUSB_SUCCESS:
+		return "LIBUSB_SUCCESS";
+	case LIBUSB_ERROR_IO:
+		return "LIBUSB_ERROR_IO";
+	case LIBUSB_ERROR_INVALID_PARAM:
+		return "LIBUSB_ERROR_INVALID_PARAM";
+	case LIBUSB_ERROR_NO_DEVICE:
+		return "LIBUSB_ERROR_NO_DEVICE";
+	case LIBUSB_ERROR_TIMEOUT:
+		return "LIBUSB_ERROR_TIMEOUT";
+	case LIBUSB_ERROR_INTERRUPTED:
+		return "LIBUSB_ERROR_INTERRUPTED";
+	}
+	return "**UNKNOWN**";
+}
+
+ssize_t libusb_get_device_list(libusb_context *ctx __attribute__((unused)), libusb_device ***list)
+{
+	*list = calloc(2, sizeof(**list));
+	(*list)[0] = &probe_device;
+	return 1;
+}
+
+void libusb_free_device_list(libusb_device **list, int unref_devices __attribute__((unused)))
+{
+	free(list);
+}
+
+int libusb_get_device_descriptor(libusb_device *dev __attribute__((unused)), struct libusb_device_descriptor *desc)
+{
+	desc->idVendor = 0x03fd;
+	desc->idProduct = 0x000d;
+	return 0;
+}
+
+uint8_t libusb_get_bus_number(libusb_device *dev __attribute__((unused)))
+{
+	return 1;
+}
+
+uint8_t libusb_get_device_address(libusb_device *dev __attribute__((unused)))
+{
+	return 2;
+}
+
+int libusb_open(libusb_device *dev __attribute__((unused)), libusb_device_handle **handle)
+{
+	*handle = &probe_handle;
+	return 0;
+}
+
+void libusb_close(libusb_device_handle *dev_handle __attribute__((unused)))
+{
+}
+
+libusb_device *libusb_get_device(libusb_device_handle *dev_handle __attribute__((unused)))
+{
+	return &probe_device;
+}
+
+int libusb_kernel_driver_active(libusb_device_handle *dev_handle __attribute__((unused)), int interface_number __attribute__((unused)))
+{
+	return 0;
+}
+
+int libusb_detach_kernel_driver(libusb_device_handle *dev_handle __attribute__((unused)), int interface_number __attribute__((unused)))
+{
+	return 0;
+}
+
+int libusb_claim_interface(libusb_device_handle *dev_handle __attribute__((unused)), int interface_number __attribute__((unused)))
+{
+	return 0;
+}
+
+int libusb_release_interface(libusb_device_handle *dev_handle __attribute__((unused)), int interface_number __attribute__((unused)))
+{
+	return 0;
+}
+
+int libusb_set_interface_alt_setting(libusb_device_handle *dev_handle __attribute__((unused)),
+		int interface_number __attribute__((unused)), int alternate_setting __attribute__((unused)))
+{
+	return 0;
+}
+
+/* firmware upload: writes to the FX2 RAM and the CPUCS register (0xE600) */
+int libusb_control_transfer(libusb_device_handle *dev_handle __attribute__((unused)), uint8_t request_type, uint8_t request,
+		uint16_t value, uint16_t index __attribute__((unused)), unsigned char *data, uint16_t length,
+		unsigned int timeout __attribute__((unused)))
+{
+	if (request_type != 0x40 || request != 0xA0)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	if (value == 0xE600 && length == 1) {
+		if (data[0] & 1) {
+			fw_reset = 1;
+			fw_state = FW_NONE;
+		} else {
+			if (!fw_reset || fw_uploaded == 0)
+				probe_error("firmware started without an upload");
+			fw_reset = 0;
+			fw_start(fw_image_legacy);
+		}
+	} else {
+		if (!fw_reset)
+			probe_error("firmware upload to 0x%04x while the CPU is running", value);
+		fw_uploaded += length;
+	}
+
+	return length;
+}
+
+int libusb_bulk_transfer(libusb_device_handle *dev_handle, unsigned char endpoint,
+		unsigned char *data, int length, int *actual_length, unsigned int timeout)
+{
+	struct libusb_transfer xfer;
+	struct probe_queue *q;
+	struct probe_msg *m;
+	int i;
+
+	/* the firmware does not wait for the EP2 data before it changes the timing */
+	if (endpoint == 1 && length > 0 && data[0] == 'T' && num_out_xfers > 0)
+		probe_error("T command with %d EP2 transfers pending", num_out_xfers);
+
+	/* the libusb event loop also runs during synchronous transfers */
+	probe_events();
+
+	*actual_length = 0;
+	libusb_fill_bulk_transfer(&xfer, dev_handle, endpoint, data, length, NULL, NULL, timeout);
+
+	if ((endpoint & LIBUSB_ENDPOINT_IN) == 0) {
+		if (fw_state == FW_NONE)
+			return LIBUSB_ERROR_TIMEOUT;
+		probe_out(&xfer);
+		*actual_length = xfer.actual_length;
+		probe_events();
+		return xfer.status == LIBUSB_TRANSFER_COMPLETED ? 0 : LIBUSB_ERROR_IO;
+	}
+
+	for (i = 0; i < num_in_xfers; i++)
+		if (in_xfers[i]->endpoint == endpoint)
+			probe_error("synchronous read from EP%d while a reader is active", endpoint & 0x7f);
+
+	q = probe_in_queue(endpoint);
+	m = q == NULL ? NULL : queue_get(q);
+	if (m == NULL)
+		return LIBUSB_ERROR_TIMEOUT;
+
+	if (m->len > length)
+		probe_error("%d byte packet on EP%d for a %d byte read", m->len, endpoint & 0x7f, length);
+	memcpy(data, m->data, m->len);
+	*actual_length = m->len;
+	return 0;
+}
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets __attribute__((unused)))
+{
+	return calloc(1, sizeof(struct libusb_transfer));
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+	if (transfer->endpoint & LIBUSB_ENDPOINT_IN) {
+		if (fw_legacy && (transfer->endpoint & 0x7f) == 6)
+			probe_error("EP6 read, but the firmware image has no capture stream");
+		if (num_in_xfers == PROBE_MAX_XFERS)
+			probe_error("too many IN transfers");
+		in_cancel[num_in_xfers] = 0;
+		in_xfers[num_in_xfers++] = transfer;
+	} else {
+		if (num_out_xfers == PROBE_MAX_XFERS)
+			probe_error("too many OUT transfers");
+		out_xfers[num_out_xfers++] = transfer;
+	}
+	return 0;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+	int i;
+	for (i = 0; i < num_in_xfers; i++) {
+		if (in_xfers[i] == transfer) {
+			in_cancel[i] = 1;
+			return 0;
+		}
+	}
+	return LIBUSB_ERROR_INVALID_PARAM;
+}
+
+int libusb_handle_events(libusb_context *ctx __attribute__((unused)))
+{
+	if (probe_events() == 0)
+		probe_error("the host waits in libusb_handle_events() for a transfer the probe never completes");
+	return 0;
+}
+
+int libusb_handle_events_timeout(libusb_context *ctx __attribute__((unused)), struct timeval *tv __attribute__((unused)))
+{
+	probe_events();
+	return 0;
+}
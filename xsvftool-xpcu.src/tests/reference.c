@@ -0,0 +1,135 @@
+/*
+ *  xsvftool-xpcu - An (X)SVF player for the Xilinx Platform Cable USB
+ *
+ *  Copyright (C) 2011  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2011  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+/*
+ * Reference player for the xsvftool-xpcu regression tests: plays an SVF or
+ * XSVF file (or scans the chain) on the target model directly, without the
+ * probe, and prints the same results as xsvftool-xpcu on the probe model.
+ *
+ * Usage: reference { -s svf-file | -x xsvf-file | -c }
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libxsvf.h"
+#include "target.h"
+
+#define UNUSED __attribute__((unused))
+
+static FILE *file_fp;
+static struct target target;
+static int tdo_error;
+
+static int rmask_bits;
+static char rmask_data[1 << 16];
+
+static int ref_setup(struct libxsvf_host *h UNUSED)
+{
+	return 0;
+}
+
+static int ref_shutdown(struct libxsvf_host *h UNUSED)
+{
+	return tdo_error ? -1 : 0;
+}
+
+static void ref_udelay(struct libxsvf_host *h UNUSED, long usecs UNUSED, int tms, long num_tck)
+{
+	while (num_tck-- > 0)
+		target_clock(&target, tms, 0);
+}
+
+static int ref_getbyte(struct libxsvf_host *h UNUSED)
+{
+	return fgetc(file_fp);
+}
+
+static int ref_pulse_tck(struct libxsvf_host *h UNUSED, int tms, int tdi, int tdo, int rmask, int sync UNUSED)
+{
+	/* the probe drives TDI high when it is don't care */
+	int line_tdo = target_clock(&target, tms, tdi < 0 ? 1 : tdi);
+
+	if (rmask && rmask_bits < (int)sizeof(rmask_data))
+		rmask_data[rmask_bits++] = line_tdo ? '1' : '0';
+
+	if (tdo >= 0 && tdo != line_tdo) {
+		tdo_error = 1;
+		return -1;
+	}
+	return line_tdo;
+}
+
+static void ref_report_device(struct libxsvf_host *h UNUSED, unsigned long idcode)
+{
+	printf("idcode=0x%08lx, revision=0x%01lx, part=0x%04lx, manufactor=0x%03lx\n", idcode,
+			(idcode >> 28) & 0xf, (idcode >> 12) & 0xffff, (idcode >> 1) & 0x7ff);
+}
+
+static void ref_report_error(struct libxsvf_host *h UNUSED, const char *file, int line, const char *message)
+{
+	fprintf(stderr, "[%s:%d] %s\n", file, line, message);
+}
+
+static void *ref_realloc(struct libxsvf_host *h UNUSED, void *ptr, int size, enum libxsvf_mem which UNUSED)
+{
+	return realloc(ptr, size);
+}
+
+static struct libxsvf_host h = {
+	.udelay = ref_udelay,
+	.setup = ref_setup,
+	.shutdown = ref_shutdown,
+	.getbyte = ref_getbyte,
+	.pulse_tck = ref_pulse_tck,
+	.report_device = ref_report_device,
+	.report_error = ref_report_error,
+	.realloc = ref_realloc
+};
+
+int main(int argc, char **argv)
+{
+	enum libxsvf_mode mode;
+	int rc;
+
+	if (argc == 2 && !strcmp(argv[1], "-c")) {
+		mode = LIBXSVF_MODE_SCAN;
+	} else if (argc == 3 && (!strcmp(argv[1], "-s") || !strcmp(argv[1], "-x"))) {
+		mode = argv[1][1] == 's' ? LIBXSVF_MODE_SVF : LIBXSVF_MODE_XSVF;
+		file_fp = fopen(argv[2], "rb");
+		if (file_fp == NULL) {
+			perror(argv[2]);
+			return 1;
+		}
+	} else {
+		fprintf(stderr, "Usage: %s { -s svf-file | -x xsvf-file | -c }\n", argv[0]);
+		return 1;
+	}
+
+	target_init(&target, "target", TARGET_IDCODE);
+	rc = libxsvf_play(&h, mode);
+
+	if (rmask_bits > 0)
+		printf("%.*s\n", rmask_bits, rmask_data);
+	target_report(&target);
+
+	return rc < 0 ? 1 : 0;
+}
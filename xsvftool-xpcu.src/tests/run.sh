@@ -0,0 +1,143 @@
+#!/bin/sh
+#
+# xsvftool-xpcu regression tests, run with "make check". The host code runs
+# against the probe model (probe.c) and must give the same results as libxsvf
+# driving the target model directly (reference.c): the same RMASK bits, the
+# same JTAG cycles on the target and the same exit status.
+
+set -e
+cd "$(dirname "$0")"
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+failed=0
+
+# state of the probe, the CPLD image at program start and the uploaded
+# firmware image (see probe.c)
+start=checked
+cpld=current
+firmware=current
+
+fail() {
+	echo "FAILED: $1"
+	cut -c1-200 "$tmp/$1.log" | grep -v '^Total\|^READY' | tail -5
+	failed=1
+}
+
+# check <name> { svf | xsvf } [ xsvftool-xpcu options ] < file-data
+check() {
+	name=$1 type=$2
+	shift 2
+	cat > "$tmp/$name.$type"
+	if [ "$type" = svf ]; then opt=-s; else opt=-x; fi
+	./reference $opt "$tmp/$name.$type" > "$tmp/$name.ref" 2> /dev/null && ref=0 || ref=$?
+	XPCU_MODEL_START=$start XPCU_MODEL_CPLD=$cpld XPCU_MODEL_FIRMWARE=$firmware \
+		./xsvftool-xpcu-model "$@" $opt "$tmp/$name.$type" \
+		> "$tmp/$name.out" 2> "$tmp/$name.log" && rc=0 || rc=$?
+	if [ $rc != $ref ]; then
+		fail "$name"
+	elif [ $ref = 0 ] && ! grep -v '^cpld:' "$tmp/$name.out" | cmp -s - "$tmp/$name.ref"; then
+		fail "$name"
+	fi
+}
+
+# check_scan <name> <idcode> [ xsvftool-xpcu options ]
+check_scan() {
+	name=$1 idcode=$2
+	shift 2
+	XPCU_MODEL_START=$start XPCU_MODEL_CPLD=$cpld XPCU_MODEL_FIRMWARE=$firmware \
+		./xsvftool-xpcu-model "$@" -c > "$tmp/$name.out" 2> "$tmp/$name.log" || true
+	if ! grep -q "^idcode=$idcode," "$tmp/$name.out"; then
+		fail "$name"
+	fi
+}
+
+cat > "$tmp/scratch.svf" << EOT
+STATE RESET;
+ENDIR IDLE;
+ENDDR IDLE;
+SIR 8 TDI (01) TDO (01) MASK (03);
+SDR 32 TDI (00000000) TDO (0a001093) MASK (ffffffff);
+SIR 8 TDI (02);
+SDR 32 TDI (12345678);
+RUNTEST 100 TCK;
+SDR 32 TDI (9abcdef0) TDO (12345678);
+SDR 32 TDI (a5c3f00f) TDO (9abcdef0) MASK (ffffffff);
+RUNTEST 1000 TCK;
+SDR 32 TDI (00000000) RMASK (ffffffff);
+SIR 8 TDI (01);
+SDR 32 TDI (00000000) RMASK (0000ffff);
+STATE RESET;
+EOT
+
+# chain scan (with a captured shift_bits) and the CPLD on the probe (J command)
+check_scan scan 0x0a001093
+check_scan scan-internal 0x16d4a093 -P
+
+# 24 MHz is the 4 bit mode, the other frequencies use the 8 bit mode
+for f in 24000 6000 1000 100; do
+	check scratch-$f svf -f $f < "$tmp/scratch.svf"
+	check scratch-async-$f svf -A -f $f < "$tmp/scratch.svf"
+done
+
+# firmware upload and internal JTAG scan test, or only the CPLD checksum. The
+# embedded firmware image may predate firmware.c, then the host does without
+# the status records.
+for firmware in image current; do
+	start=cold check scratch-cold-$firmware svf < "$tmp/scratch.svf"
+	start=cold check scratch-cold-async-$firmware svf -A < "$tmp/scratch.svf"
+done
+firmware=current
+start=warm check scratch-warm svf < "$tmp/scratch.svf"
+
+# long captures: the sync points must leave the firmware time for the readout
+awk 'BEGIN { print "STATE RESET;\nSIR 8 TDI (ff);"; printf "SDR 4000 TDI (";
+	for (i = 0; i < 1000; i++) printf "%x", (i*7)%16; printf ") RMASK (";
+	for (i = 0; i < 1000; i++) printf "f"; print ");\nRUNTEST 3000 TCK;" }' > "$tmp/capture.svf"
+for f in 24000 12000 1000; do
+	check capture-$f svf -f $f < "$tmp/capture.svf"
+done
+start=cold firmware=image check capture-cold svf < "$tmp/capture.svf"
+
+# the embedded CPLD image, which may predate hardware.v, is kept or programmed
+# instead of an unknown one: only a CPLD built from hardware.v gets the status
+# records and the capture stream
+start=warm
+for cpld in image 000000; do
+	check scratch-cpld-$cpld svf -A < "$tmp/scratch.svf"
+	check capture-cpld-$cpld svf -A < "$tmp/capture.svf"
+	start=cold check capture-cold-cpld-$cpld svf < "$tmp/capture.svf"
+done
+start=checked cpld=current
+
+# extended opcodes: long TDI shifts and RUNTEST above DENSE_MIN_CYCLES, the
+# burst clock divider depends on the frequency (none below 1.5 MHz)
+awk 'BEGIN { print "STATE RESET;\nSIR 8 TDI (02);"; printf "SDR 20000 TDI (";
+	for (i = 0; i < 5000; i++) printf "%x", (i*11+3)%16;
+	print ");\nRUNTEST 10000 TCK;\nSDR 32 TDI (00000000) RMASK (ffffffff);\nRUNTEST 5001 TCK;";
+	printf "SIR 8 TDI (ff);\nSDR 9001 TDI (0";
+	for (i = 0; i < 2250; i++) printf "%x", (i*5+1)%16; print ");" }' > "$tmp/dense.svf"
+for f in 24000 6000 3000 1500 1000; do
+	check dense-$f svf -f $f < "$tmp/dense.svf"
+	check dense-async-$f svf -A -f $f < "$tmp/dense.svf"
+done
+
+# the same without the extended opcodes: the embedded CPLD image may predate them
+start=warm cpld=image
+for f in 24000 6000; do
+	check dense-cpld-image-$f svf -f $f < "$tmp/dense.svf"
+done
+start=checked cpld=current
+
+# TDO mismatches
+printf 'STATE RESET;\nSIR 8 TDI (01);\nSDR 32 TDI (00000000) TDO (0a001094);\nSDR 32 TDI (00000000) TDO (0a001093);\n' > "$tmp/mismatch.svf"
+check mismatch svf < "$tmp/mismatch.svf"
+check mismatch-async svf -A < "$tmp/mismatch.svf"
+
+# XSVF: XREPEAT 0, XSTATE RESET/IDLE, XSIR 01, XSDRSIZE 32, XTDOMASK, XSDRTDO
+printf '\007\000\022\000\022\001\002\010\001\010\000\000\000\040\001\377\377\377\377\011\000\000\000\000\012\000\020\223\000' |
+	check idcode xsvf
+printf '\007\000\022\000\022\001\002\010\001\010\000\000\000\040\001\377\377\377\377\011\000\000\000\000\012\000\020\224\000' |
+	check idcode-mismatch xsvf
+
+exit $failed
@@ -0,0 +1,109 @@
+/*
+ *  xsvftool-xpcu - An (X)SVF player for the Xilinx Platform Cable USB
+ *
+ *  Copyright (C) 2011  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2011  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include "target.h"
+
+enum {
+	RESET, IDLE,
+	DRSELECT, DRCAPTURE, DRSHIFT, DREXIT1, DRPAUSE, DREXIT2, DRUPDATE,
+	IRSELECT, IRCAPTURE, IRSHIFT, IREXIT1, IRPAUSE, IREXIT2, IRUPDATE
+};
+
+/* next state for tms=0 and tms=1 */
+static const int target_next[16][2] = {
+	[RESET]     = { IDLE, RESET },
+	[IDLE]      = { IDLE, DRSELECT },
+	[DRSELECT]  = { DRCAPTURE, IRSELECT },
+	[DRCAPTURE] = { DRSHIFT, DREXIT1 },
+	[DRSHIFT]   = { DRSHIFT, DREXIT1 },
+	[DREXIT1]   = { DRPAUSE, DRUPDATE },
+	[DRPAUSE]   = { DRPAUSE, DREXIT2 },
+	[DREXIT2]   = { DRSHIFT, DRUPDATE },
+	[DRUPDATE]  = { IDLE, DRSELECT },
+	[IRSELECT]  = { IRCAPTURE, RESET },
+	[IRCAPTURE] = { IRSHIFT, IREXIT1 },
+	[IRSHIFT]   = { IRSHIFT, IREXIT1 },
+	[IREXIT1]   = { IRPAUSE, IRUPDATE },
+	[IRPAUSE]   = { IRPAUSE, IREXIT2 },
+	[IREXIT2]   = { IRSHIFT, IRUPDATE },
+	[IRUPDATE]  = { IDLE, DRSELECT }
+};
+
+void target_init(struct target *t, const char *name, unsigned long idcode)
+{
+	t->name = name;
+	t->idcode = idcode;
+	t->state = RESET;
+	t->tdo = 1;
+	t->ir = 0x01;
+	t->ir_shift = 0;
+	t->scratch = 0;
+	t->dr_shift = 0;
+	t->dr_len = 1;
+	t->cycles = 0;
+	t->hash = 5381;
+}
+
+/* One TCK cycle. Returns the TDO value sampled at the rising edge. */
+int target_clock(struct target *t, int tms, int tdi)
+{
+	int tdo = t->state == DRSHIFT ? (int)(t->dr_shift & 1) :
+			t->state == IRSHIFT ? (int)(t->ir_shift & 1) : 1;
+
+	t->cycles++;
+	t->hash = (t->hash * 33 + (tms << 1 | tdi)) & 0xffffffff;
+
+	switch (t->state)
+	{
+	case RESET:
+		t->ir = 0x01;
+		break;
+	case DRCAPTURE:
+		t->dr_len = t->ir == 0x01 || t->ir == 0x02 ? 32 : 1;
+		t->dr_shift = t->ir == 0x01 ? t->idcode : t->ir == 0x02 ? t->scratch : 0;
+		break;
+	case DRSHIFT:
+		t->dr_shift = (t->dr_shift >> 1) | ((unsigned long)tdi << (t->dr_len-1));
+		break;
+	case DRUPDATE:
+		if (t->ir == 0x02)
+			t->scratch = t->dr_shift;
+		break;
+	case IRCAPTURE:
+		t->ir_shift = 0x01;
+		break;
+	case IRSHIFT:
+		t->ir_shift = (t->ir_shift >> 1) | (tdi << 7);
+		break;
+	case IRUPDATE:
+		t->ir = t->ir_shift;
+		break;
+	}
+
+	t->state = target_next[t->state][tms & 1];
+	t->tdo = tdo;
+	return tdo;
+}
+
+void target_report(const struct target *t)
+{
+	printf("%s: cycles=%ld hash=%08lx\n", t->name, t->cycles, t->hash);
+}
@@ -0,0 +1,52 @@
+/*
+ *  xsvftool-xpcu - An (X)SVF player for the Xilinx Platform Cable USB
+ *
+ *  Copyright (C) 2011  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2011  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+/*
+ *  Software model of a JTAG target for the xsvftool-xpcu regression tests:
+ *  one device with an 8 bit instruction register and the BYPASS (0xff),
+ *  IDCODE (0x01, also selected in Test-Logic-Reset) and SCRATCH (0x02, a
+ *  32 bit register that keeps the value shifted in) instructions. All other
+ *  instructions select the bypass register. Every clock cycle is counted
+ *  and hashed, so two runs can be compared cycle by cycle.
+ */
+
+#ifndef TARGET_H
+#define TARGET_H
+
+/* the device on the probe's JTAG connector and the CPLD on the probe */
+#define TARGET_IDCODE 0x0a001093
+#define CPLD_IDCODE 0x16d4a093
+
+struct target {
+	const char *name;
+	unsigned long idcode;
+	int state, tdo;
+	unsigned int ir, ir_shift;
+	unsigned long scratch, dr_shift;
+	int dr_len;
+	long cycles;
+	unsigned long hash;
+};
+
+void target_init(struct target *t, const char *name, unsigned long idcode);
+int target_clock(struct target *t, int tms, int tdi);
+void target_report(const struct target *t);
+
+#endif /* TARGET_H */
@@ -21,9 +21,12 @@
 #define _GNU_SOURCE
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 
 #include "libxsvf.h"
 #include "fx2usb-interface.h"
@@ -34,6 +37,14 @@ char *correct_cksum =
 #include "hardware_cksum_c.inc"
 ;
 
+char *image_cksum =
+#include "hardware_image_cksum_c.inc"
+;
+
+char *correct_fw_cksum =
+#include "firmware_cksum_c.inc"
+;
+
 #define UNUSED __attribute__((unused))
 
 /**** BEGIN: http://svn.clifford.at/tools/trunk/examples/check.h ****/
@@ -75,62 +86,166 @@ int usb_device_id = 0;
 char *usb_device_file = NULL;
 
 int mode_frequency = 6000;
-int mode_async_check = 0;
 int mode_internal_cpld = 0;
 int mode_8bit_per_cycle = 0;
 int mode_hex_rmask = 0;
+int mode_exit_firmware = 0;
 
-usb_dev_handle *fx2usb;
+libusb_device_handle *fx2usb;
 int internal_jtag_scan_test = 0;
 
+/* The firmware on the probe answers the V command with the checksum of
+ * firmware.c, so it has the A and D commands and the EP6 capture stream.
+ * Prebuilt firmware images (prep_firmware.ihx) may predate these.
+ */
+int fw_current;
+
+/* The CPLD checksum matches hardware.v, so the CPLD has the SYNC_ERR select,
+ * the capture datapath and the extended opcodes. The embedded CPLD image
+ * (image_cksum) may be older than hardware.v.
+ */
+int cpld_current;
+
 int sync_count;
 int tck_cycle_count;
-int blocks_without_sync;
 
-int tdo_check_period_100;
-int tdo_check_thisperiod;
+int mode_async_status;
+int tag_sent, tag_acked, tag_error;
+
+int mode_capture_stream;
+int capture_pending, capture_expected, capture_latch_tck;
+int capture_readout_usecs;
+int xpcu_frequency;
+int xpcu_delay;
+int dense_div;
 
 int rmask_bits = 0, rmask_bytes = 0;
 unsigned char *rmask_data = NULL;
 
-/* This constant are used to determine when the error status should be synced.
- * Syncinc to often would slow things down, syncinc not often enough might cause
- * errors beeing reported by far to late.
+/* Default budget for reporting TDO errors (-l option). The library sync policy
+ * decides when the TDO checks are synced, see struct libxsvf_sync_policy.
+ */
+#define SYNC_POLICY_MAX_USECS 10000
+
+/* Clean SVF blocks before a lowered TCK frequency is raised again (-b option) */
+#define SYNC_POLICY_CLEAN_BLOCKS 32
+
+struct libxsvf_sync_policy sync_policy = {
+	.max_usecs = SYNC_POLICY_MAX_USECS,
+	.block_sync = 1,
+	.clean_blocks = SYNC_POLICY_CLEAN_BLOCKS
+};
+
+/* Max. number of sync points that may be in flight without an asynchronous
+ * status record from the probe. Must be less than 8 (the number of distinct
+ * sync values used by the host).
+ */
+#define ASYNC_STATUS_WINDOW 4
+
+/* Time the firmware needs to read out the CPLD capture buffer. Sync points that
+ * move captured TDO bits to the capture buffer are padded with NOP codes so
+ * they are at least this far apart. Doubled whenever captured bits get lost.
  */
-#define FORCE_SYNC_AFTER_N_BLOCKS 100
-#define FORCE_SYNC_MIN_PERIOD   10000
-#define FORCE_SYNC_INIT_PERIOD 100000
+#define CAPTURE_READOUT_USECS 30
 
-// send larger junks to USB stack and let the kernel split it up
-// #define MAXBUF() (mode_internal_cpld ? 50 : mode_8bit_per_cycle ? 500 : 1000)
-#define MAXBUF() (mode_internal_cpld ? 50 : 4000)
+/* Min. number of cycles for using the extended opcodes (dense TDI shift and
+ * idle clocks). They need a different T setting, so switching to them costs
+ * two sync round trips.
+ */
+#define DENSE_MIN_CYCLES 4096
 
 unsigned char fx2usb_retbuf[65];
 int fx2usb_retlen;
+int fx2usb_retready;
+int fx2usb_reader;
+
+/* Opcodes are encoded directly into the transfer buffer: one per byte in 8-bit
+ * mode, two per byte (low nibble first) in 4-bit mode and for the 'J' command
+ * of the internal CPLD. EP2 data is written in place to the next buffer of the
+ * USB queue, 'J' data to jcmdbuf.
+ */
+unsigned char jcmdbuf[64];
+unsigned char *encbuf;
+int encbuf_len, encbuf_size, encbuf_half, encbuf_packed;
 
-unsigned char commandbuf[4096];
-int commandbuf_len;
+// opcodes for 4 TDI bits (first bit in the low nibble) of a TDI byte
+unsigned char shift_lut[256][4];
 
-static void shrink_8bit_to_4bit()
+static void xpcu_status_record(const unsigned char *data)
 {
-	int i;
-	if ((commandbuf_len & 1) != 0)
-		commandbuf[commandbuf_len++] = 0;
-	for (i = 0; i<commandbuf_len; i++) {
-		if ((i & 1) == 0)
-			commandbuf[i >> 1] = (commandbuf[i >> 1] & 0xf0) | commandbuf[i];
-		else
-			commandbuf[i >> 1] = (commandbuf[i >> 1] & 0x0f) | (commandbuf[i] << 4);
+	// one hex digit (the sync value), followed by the SYNC_ERR flag
+	int v = data[1] >= 'A' ? data[1] - 'A' + 10 : data[1] - '0';
+
+	if ((v & 0x08) == 0)
+		return;
+
+	// sync values are 0x08 | (n & 7) for the n-th sync point
+	int d = ((v & 7) - tag_acked) & 7;
+	if (d <= tag_sent - tag_acked)
+		tag_acked += d;
+
+	if (data[2] == '1')
+		tag_error = 1;
+}
+
+static void rmask_append(int bit)
+{
+	if (rmask_bits >= 8*rmask_bytes) {
+		int old_rmask_bytes = rmask_bytes;
+		rmask_bytes = rmask_bytes ? rmask_bytes*2 : 64;
+		rmask_data = realloc(rmask_data, rmask_bytes);
+		memset(rmask_data + old_rmask_bytes, 0, rmask_bytes-old_rmask_bytes);
+	}
+	if (bit)
+		rmask_data[rmask_bits/8] |= 1 << (rmask_bits%8);
+	rmask_bits++;
+}
+
+static void xpcu_ep6_callback(const unsigned char *data, int len)
+{
+	int i, j;
+	for (i = 0; i+2 < len; i += 3) {
+		int n = data[i], bits = (data[i+1] << 8) | data[i+2];
+		for (j = n-1; j >= 0; j--)
+			rmask_append((bits >> j) & 1);
 	}
-	commandbuf_len = commandbuf_len >> 1;
+}
+
+static void xpcu_ep1_callback(const unsigned char *data, int len)
+{
+	if (len == 3 && data[0] == 'Y') {
+		xpcu_status_record(data);
+		return;
+	}
+	if (len > (int)sizeof(fx2usb_retbuf)-1)
+		len = sizeof(fx2usb_retbuf)-1;
+	memcpy(fx2usb_retbuf, data, len);
+	fx2usb_retbuf[len] = 0;
+	fx2usb_retlen = len;
+	fx2usb_retready = 1;
+}
+
+static void fx2usb_response()
+{
+	if (!fx2usb_reader) {
+		fx2usb_recv_chunk(fx2usb, 1, fx2usb_retbuf, sizeof(fx2usb_retbuf)-1, &fx2usb_retlen);
+		fx2usb_retbuf[fx2usb_retlen] = 0;
+		return;
+	}
+	while (!fx2usb_retready) {
+		if (fx2usb_poll(1) < 0) {
+			fprintf(stderr, "Internal ERROR in communication with probe: EP1 transfer failed.\n");
+			abort();
+		}
+	}
+	fx2usb_retready = 0;
 }
 
 void fx2usb_command(const char *cmd)
 {
 	// fprintf(stderr, "Sending FX2USB Command: '%s' => ", cmd);
 	fx2usb_send_chunk(fx2usb, 1, cmd, strlen(cmd));
-	fx2usb_recv_chunk(fx2usb, 1, fx2usb_retbuf, sizeof(fx2usb_retbuf)-1, &fx2usb_retlen);
-	fx2usb_retbuf[fx2usb_retlen] = 0;
+	fx2usb_response();
 	// fprintf(stderr, "'%s'\n", fx2usb_retbuf);
 	
 	if (strchr((char*)fx2usb_retbuf, '!') != NULL) {
@@ -139,42 +254,205 @@ void fx2usb_command(const char *cmd)
 	}
 }
 
+/* Wait for the CPLD to reach the given sync count. EP2 data is queued
+ * asynchronously, so the firmware may still be busy with earlier chunks when
+ * its 'W' loop gives up. Retry as long as there are transfers in flight.
+ */
+static void fx2usb_wait_sync(int count)
+{
+	char cmd[3];
+	int pending;
+	snprintf(cmd, 3, "W%x", count);
+	while (1) {
+		pending = fx2usb_queue_pending();
+		fx2usb_send_chunk(fx2usb, 1, cmd, strlen(cmd));
+		fx2usb_response();
+		if (strncmp((char*)fx2usb_retbuf, "TIMEOUT!", 8) || pending == 0)
+			break;
+	}
+	if (strchr((char*)fx2usb_retbuf, '!') != NULL) {
+		fprintf(stderr, "Internal ERROR in communication with probe: '%s' => '%s'\n", cmd, fx2usb_retbuf);
+		abort();
+	}
+}
+
+static void xpcu_flush()
+{
+	if (encbuf_half) {
+		encbuf_len++;
+		encbuf_half = 0;
+	}
+	if (encbuf_len == 0)
+		return;
+	if (mode_internal_cpld) {
+		jcmdbuf[0] = 'J';
+		fx2usb_send_chunk(fx2usb, 1, jcmdbuf, encbuf_len + 1);
+	} else if (fx2usb_queue_submit(fx2usb, 2, encbuf_len) < 0) {
+		fprintf(stderr, "Internal ERROR in communication with probe: EP2 transfer failed.\n");
+		abort();
+	}
+	encbuf = NULL;
+	encbuf_len = 0;
+}
+
+/* Make room for the given number of opcodes, flush the buffer if it is full. */
+static void xpcu_reserve(int ops)
+{
+	int bytes = encbuf_packed ? (ops + encbuf_half + 1) / 2 : ops;
+	if (encbuf != NULL && encbuf_len + bytes <= encbuf_size)
+		return;
+	xpcu_flush();
+	encbuf_packed = mode_internal_cpld || !mode_8bit_per_cycle;
+	if (mode_internal_cpld) {
+		encbuf = jcmdbuf + 1;
+		encbuf_size = sizeof(jcmdbuf) - 1;
+	} else {
+		encbuf = fx2usb_queue_buffer(fx2usb);
+		encbuf_size = FX2USB_QUEUE_BUFSIZE;
+		if (encbuf == NULL) {
+			fprintf(stderr, "Internal ERROR in communication with probe: EP2 transfer failed.\n");
+			abort();
+		}
+	}
+}
+
+static inline void xpcu_put(unsigned char op)
+{
+	if (!encbuf_packed) {
+		encbuf[encbuf_len++] = op;
+	} else if (!encbuf_half) {
+		encbuf[encbuf_len] = op;
+		encbuf_half = 1;
+	} else {
+		encbuf[encbuf_len++] |= op << 4;
+		encbuf_half = 0;
+	}
+}
+
+static void xpcu_add_sync()
+{
+	if (capture_pending > 0) {
+		// this sync point moves the captured bits to the capture buffer:
+		// give the firmware time to read out the previous ones
+		long pad = (long)capture_readout_usecs * (xpcu_frequency / 1000) / 1000 - (tck_cycle_count - capture_latch_tck);
+		while (pad-- > 0) {
+			xpcu_reserve(1);
+			xpcu_put(0x00);
+		}
+		capture_latch_tck = tck_cycle_count;
+		capture_pending = 0;
+	}
+
+	sync_count = 0x08 | ((sync_count+1) & 0x0f);
+	xpcu_reserve(2);
+	xpcu_put(0x01);
+	xpcu_put(sync_count);
+	tag_sent++;
+}
+
+/* Called after a blocking 'S' command: the status bits cover all sync points. */
+static void xpcu_status_synced()
+{
+	tag_acked = tag_sent;
+	tag_error = 0;
+}
+
+/* Collect pending status records, block if too many sync points are unacknowledged. */
+static void xpcu_status_window()
+{
+	fx2usb_poll(0);
+	while (tag_sent - tag_acked >= ASYNC_STATUS_WINDOW && !tag_error) {
+		if (fx2usb_poll(1) < 0) {
+			fprintf(stderr, "Internal ERROR in communication with probe: EP1 transfer failed.\n");
+			abort();
+		}
+	}
+}
+
 static int xpcu_set_frequency(struct libxsvf_host *h UNUSED, int v);
+static void xpcu_sync_tag(struct libxsvf_host *h UNUSED);
+static void xpcu_dense(const unsigned char *tdi, int nbytes, int n);
 static int xpcu_pulse_tck(struct libxsvf_host *h UNUSED, int tms, int tdi, int tdo, int rmask UNUSED, int sync);
 
-static int xpcu_setup(struct libxsvf_host *h UNUSED)
+static int xpcu_setup(struct libxsvf_host *h)
 {
+	int i, k;
+
+	for (i = 0; i < 256; i++)
+	for (k = 0; k < 4; k++)
+		shift_lut[i][k] = (0x04 | ((i >> 2*k) & 1)) | ((0x04 | ((i >> (2*k+1)) & 1)) << 4);
+
 	sync_count = 0;
-	blocks_without_sync = 0;
-	commandbuf_len = 0;
+	encbuf_len = 0;
+	encbuf_half = 0;
 	fx2usb_command("R");
 
+	tag_sent = 0;
+	tag_acked = 0;
+	tag_error = 0;
+	mode_async_status = 0;
+
+	capture_pending = 0;
+	capture_expected = rmask_bits;
+	capture_latch_tck = tck_cycle_count;
+	mode_capture_stream = 0;
+	xpcu_frequency = 24000000;
+	xpcu_delay = 0;
+	dense_div = mode_internal_cpld || !cpld_current ? -1 : 0;
+	if (capture_readout_usecs == 0)
+		capture_readout_usecs = CAPTURE_READOUT_USECS;
+
 	if (!mode_internal_cpld) {
 		fx2usb_command("B1");
+		if (fx2usb_reader && fw_current && cpld_current) {
+			fx2usb_command("A1");
+			mode_async_status = 1;
+			fx2usb_command("D1");
+			mode_capture_stream = 1;
+		}
 	}
 
 	if (mode_frequency)
 		xpcu_set_frequency(h, mode_frequency * 1000);
 
-	tdo_check_period_100 = FORCE_SYNC_INIT_PERIOD * 100;
-	tdo_check_thisperiod = 0;
+	// sync points are cheap tags with asynchronous status records
+	h->sync_tag = mode_async_status ? xpcu_sync_tag : NULL;
+	sync_policy.frequency = mode_internal_cpld ? 0 : xpcu_frequency;
 
 	return 0;
 }
 
 static int xpcu_shutdown(struct libxsvf_host *h UNUSED)
 {
-	int rc = 0;
-	if (commandbuf_len != 0) {
-		fprintf(stderr, "Found %d unsynced commands in command buffer on interface shutdown!\n", commandbuf_len);
-		commandbuf_len = 0;
+	int i, rc = 0;
+	if (encbuf_len != 0 || encbuf_half) {
+		fprintf(stderr, "Found %d unsynced bytes in command buffer on interface shutdown!\n", encbuf_len + encbuf_half);
+		encbuf_len = 0;
+		encbuf_half = 0;
+		rc = -1;
+	}
+	if (fx2usb_queue_drain(fx2usb) < 0) {
+		fprintf(stderr, "Found failed EP2 transfers on interface shutdown!\n");
 		rc = -1;
 	}
 	fx2usb_command("S");
+	xpcu_status_synced();
 	if (fx2usb_retbuf[mode_internal_cpld ? 1 : 0] == '1') {
 		fprintf(stderr, "Found pending errors in interface status on shutdown!\n");
 		rc = -1;
 	}
+	if (mode_capture_stream) {
+		for (i = 0; i < 1000 && rmask_bits < capture_expected; i++) {
+			fx2usb_poll(0);
+			usleep(1000);
+		}
+		if (rmask_bits < capture_expected) {
+			fprintf(stderr, "Lost %d of %d captured TDO bits in capture stream!\n",
+					capture_expected - rmask_bits, capture_expected);
+			capture_readout_usecs *= 2;
+			rc = -1;
+		}
+	}
 	fx2usb_command("R");
 	return rc;
 }
@@ -186,33 +464,26 @@ static void xpcu_udelay(struct libxsvf_host *h UNUSED, long usecs, int tms, long
 
 	if (mode_internal_cpld)
 	{
-		if (!mode_8bit_per_cycle)
-			shrink_8bit_to_4bit();
-		unsigned char tempbuf[64];
-		tempbuf[0] = 'J';
-		memcpy(tempbuf+1, commandbuf, commandbuf_len);
-		fx2usb_send_chunk(fx2usb, 1, tempbuf, commandbuf_len + 1);
-
+		xpcu_flush();
 		fx2usb_command("P");
-		commandbuf_len = 0;
 	}
 	else
 	{
-		sync_count = 0x08 | ((sync_count+1) & 0x0f);
-		commandbuf[commandbuf_len++] = 0x01;
-		commandbuf[commandbuf_len++] = sync_count;
-		if (!mode_8bit_per_cycle)
-			shrink_8bit_to_4bit();
-		fx2usb_send_chunk(fx2usb, 2, commandbuf, commandbuf_len);
-		commandbuf_len = 0;
-
-		char cmd[3];
-		snprintf(cmd, 3, "W%x", sync_count);
-		fx2usb_command(cmd);
+		xpcu_add_sync();
+		xpcu_flush();
+		fx2usb_wait_sync(sync_count);
 	}
 
 	gettimeofday(&tv1, NULL);
 
+	if (dense_div >= 0 && num_tck > DENSE_MIN_CYCLES) {
+		xpcu_pulse_tck(h, tms, 0, -1, 0, 0);
+		num_tck--;
+		xpcu_dense(NULL, 0, num_tck / 8);
+		tck_cycle_count += num_tck - num_tck % 8;
+		num_tck = num_tck % 8;
+	}
+
 	while (num_tck > 0) {
 		xpcu_pulse_tck(h, tms, 0, -1, 0, 0);
 		num_tck--;
@@ -220,29 +491,14 @@ static void xpcu_udelay(struct libxsvf_host *h UNUSED, long usecs, int tms, long
 
 	if (mode_internal_cpld)
 	{
-		if (!mode_8bit_per_cycle)
-			shrink_8bit_to_4bit();
-		unsigned char tempbuf[64];
-		tempbuf[0] = 'J';
-		memcpy(tempbuf+1, commandbuf, commandbuf_len);
-		fx2usb_send_chunk(fx2usb, 1, tempbuf, commandbuf_len + 1);
-
+		xpcu_flush();
 		fx2usb_command("P");
-		commandbuf_len = 0;
 	}
 	else
 	{
-		sync_count = 0x08 | ((sync_count+1) & 0x0f);
-		commandbuf[commandbuf_len++] = 0x01;
-		commandbuf[commandbuf_len++] = sync_count;
-		if (!mode_8bit_per_cycle)
-			shrink_8bit_to_4bit();
-		fx2usb_send_chunk(fx2usb, 2, commandbuf, commandbuf_len);
-		commandbuf_len = 0;
-
-		char cmd[3];
-		snprintf(cmd, 3, "W%x", sync_count);
-		fx2usb_command(cmd);
+		xpcu_add_sync();
+		xpcu_flush();
+		fx2usb_wait_sync(sync_count);
 	}
 
 	while (usecs > 0) {
@@ -262,76 +518,61 @@ static int xpcu_getbyte(struct libxsvf_host *h UNUSED)
 static int xpcu_pulse_tck(struct libxsvf_host *h UNUSED, int tms, int tdi, int tdo, int rmask, int sync)
 {
 	int dummy_sync = 0;
+	int tag = 0;
 
 	tck_cycle_count++;
+	xpcu_reserve(2);
+
+	if (rmask && mode_capture_stream) {
+		xpcu_put(0x02);
+		capture_pending++;
+		capture_expected++;
+	}
 
 	if (tdo >= 0) {
-		commandbuf[commandbuf_len++] = 0x08 | ((tdo & 1) << 2) | ((tms & 1) << 1) | ((tdi & 1) << 0);
-		tdo_check_period_100 = (tdo_check_period_100 * 99) / 100 + tdo_check_thisperiod;
-		tdo_check_thisperiod = 0;
+		xpcu_put(0x08 | ((tdo & 1) << 2) | ((tms & 1) << 1) | ((tdi & 1) << 0));
 	} else {
-		commandbuf[commandbuf_len++] = 0x04 | ((tms & 1) << 1) | ((tdi & 1) << 0);
+		xpcu_put(0x04 | ((tms & 1) << 1) | ((tdi & 1) << 0));
 	}
 
-	if (mode_async_check == 0)
-	{
-		if (!sync && tdo >= 0 && (blocks_without_sync > FORCE_SYNC_AFTER_N_BLOCKS || tdo_check_period_100 > FORCE_SYNC_MIN_PERIOD))
-			sync = 1;
-		if (!sync && !mode_internal_cpld && blocks_without_sync > 10*FORCE_SYNC_AFTER_N_BLOCKS && commandbuf_len >= (MAXBUF() - 10))
-			dummy_sync = 1;
-	}
+	// a status record reported an error: get the full status and reset the error flag
+	if (tag_error && mode_async_status)
+		sync = 1;
+
+	// the capture buffer in the CPLD holds 16 bits
+	if (capture_pending >= 16 && !sync)
+		tag = 1;
 
-	if (rmask && !sync)
+	if (rmask && !sync && !mode_capture_stream)
 		dummy_sync = 1;
 
-	if ((dummy_sync || sync) && !mode_internal_cpld) {
-		sync_count = 0x08 | ((sync_count+1) & 0x0f);
-		commandbuf[commandbuf_len++] = 0x01;
-		commandbuf[commandbuf_len++] = sync_count;
-	}
+	if (sync || dummy_sync)
+		tag = 0;
 
-	if (commandbuf_len >= (MAXBUF() - 4) || sync || dummy_sync) {
-		if (!mode_8bit_per_cycle)
-			shrink_8bit_to_4bit();
-		if (mode_internal_cpld) {
-			unsigned char tempbuf[64];
-			tempbuf[0] = 'J';
-			memcpy(tempbuf+1, commandbuf, commandbuf_len);
-			fx2usb_send_chunk(fx2usb, 1, tempbuf, commandbuf_len + 1);
-		} else {
-			fx2usb_send_chunk(fx2usb, 2, commandbuf, commandbuf_len);
-		}
-		blocks_without_sync++;
-		commandbuf_len = 0;
+	if ((dummy_sync || sync || tag) && !mode_internal_cpld) {
+		xpcu_add_sync();
 	}
 
+	if (sync || dummy_sync || tag)
+		xpcu_flush();
+
+	if (tag)
+		xpcu_status_window();
+
 	if ((sync || dummy_sync) && !mode_internal_cpld) {
-		char cmd[3];
-		snprintf(cmd, 3, "W%x", sync_count);
-		fx2usb_command(cmd);
+		fx2usb_wait_sync(sync_count);
 	}
 
 	if (sync) {
 		fx2usb_command("S");
-		blocks_without_sync = 0;
+		xpcu_status_synced();
 	}
 
-	if (dummy_sync) {
+	if (dummy_sync)
 		fx2usb_command("P");
-		blocks_without_sync = 0;
-	}
 
-	if (rmask) {
-		if (rmask_bits >= 8*rmask_bytes) {
-			int old_rmask_bytes = rmask_bytes;
-			rmask_bytes = rmask_bytes ? rmask_bytes*2 : 64;
-			rmask_data = realloc(rmask_data, rmask_bytes);
-			memset(rmask_data + old_rmask_bytes, 0, rmask_bytes-old_rmask_bytes);
-		}
-		if (fx2usb_retbuf[mode_internal_cpld ? 5 : 4] == '1')
-			rmask_data[rmask_bits/8] |= 1 << (rmask_bits%8);
-		rmask_bits++;
-	}
+	if (rmask && !mode_capture_stream)
+		rmask_append(fx2usb_retbuf[mode_internal_cpld ? 5 : 4] == '1');
 
 	if (sync) {
 		if (fx2usb_retbuf[mode_internal_cpld ? 1 : 0] == '1')
@@ -341,70 +582,178 @@ static int xpcu_pulse_tck(struct libxsvf_host *h UNUSED, int tms, int tdi, int t
 	return tdo < 0 ? 1 : tdo;
 }
 
-static int xpcu_sync(struct libxsvf_host *h UNUSED)
+/* Shift len TDI bits and read back the TDO bits through the capture stream,
+ * so there is only one round trip for the whole shift. The captured bits are
+ * removed from the rmask buffer again.
+ */
+static int xpcu_shift_capture(struct libxsvf_host *h, int len, const unsigned char *tdi, unsigned char *tdo, int tms_last)
 {
-	if (!mode_internal_cpld) {
-		sync_count = 0x08 | ((sync_count+1) & 0x0f);
-		commandbuf[commandbuf_len++] = 0x01;
-		commandbuf[commandbuf_len++] = sync_count;
+	int i, k, nbytes = (len+7)/8;
+	int first_bit = capture_expected;
+
+	for (k = 0; k < len; k++) {
+		int tms = k == len-1 ? tms_last : 0;
+		xpcu_pulse_tck(h, tms, (tdi[nbytes-1-k/8] >> (k%8)) & 1, -1, 1, 0);
 	}
 
-	if (!mode_8bit_per_cycle)
-		shrink_8bit_to_4bit();
-	if (mode_internal_cpld) {
-		unsigned char tempbuf[64];
-		tempbuf[0] = 'J';
-		memcpy(tempbuf+1, commandbuf, commandbuf_len);
-		fx2usb_send_chunk(fx2usb, 1, tempbuf, commandbuf_len + 1);
-	} else {
-		fx2usb_send_chunk(fx2usb, 2, commandbuf, commandbuf_len);
+	// the firmware sends partial EP6 packets only on W, S and P
+	xpcu_add_sync();
+	xpcu_flush();
+	fx2usb_wait_sync(sync_count);
+
+	for (i = 0; i < 1000 && rmask_bits < capture_expected; i++) {
+		fx2usb_poll(0);
+		if (rmask_bits < capture_expected)
+			usleep(100);
+	}
+	if (rmask_bits < capture_expected) {
+		fprintf(stderr, "Lost %d of %d captured TDO bits in capture stream!\n",
+				capture_expected - rmask_bits, len);
+		capture_readout_usecs *= 2;
+		return -1;
+	}
+
+	memset(tdo, 0, nbytes);
+	for (k = 0; k < len; k++) {
+		int pos = first_bit + k;
+		if (rmask_data[pos/8] & (1 << (pos%8)))
+			tdo[nbytes-1-k/8] |= 1 << (k%8);
+		rmask_data[pos/8] &= ~(1 << (pos%8));
+	}
+	rmask_bits = capture_expected = first_bit;
+
+	return tag_error ? -1 : 0;
+}
+
+/* Shift len TDI bits without TDO check. Long shifts use the extended opcodes,
+ * otherwise the opcodes for whole bytes of TDI data come from shift_lut in
+ * 4-bit mode. Errors show up at the next sync point.
+ */
+static int xpcu_shift_bits(struct libxsvf_host *h, int len, const unsigned char *tdi, unsigned char *tdo, int tms_last)
+{
+	int i, k, nbytes = (len+7)/8;
+
+	if (tdo != NULL && mode_capture_stream)
+		return xpcu_shift_capture(h, len, tdi, tdo, tms_last);
+
+	if (tdo != NULL) {
+		memset(tdo, 0, nbytes);
+		for (k = 0; k < len; k++) {
+			int tms = k == len-1 ? tms_last : 0;
+			int ret = xpcu_pulse_tck(h, tms, (tdi[nbytes-1-k/8] >> (k%8)) & 1, -1, 0, 1);
+			if (ret < 0)
+				return -1;
+			if (ret)
+				tdo[nbytes-1-k/8] |= 1 << (k%8);
+		}
+		return 0;
+	}
+
+	tck_cycle_count += len;
+
+	// leave the last byte to the 4-bit/cycle code: the last bit needs TMS
+	k = 0;
+	if (dense_div >= 0 && len > DENSE_MIN_CYCLES) {
+		xpcu_dense(tdi, nbytes, (len-1) / 8);
+		k = 8 * ((len-1) / 8);
+	}
+
+	xpcu_reserve(9);
+	if (encbuf_half)
+		xpcu_put(0x00);
+
+	for (; len - k > 8; k += 8) {
+		unsigned char v = tdi[nbytes-1-k/8];
+		xpcu_reserve(8);
+		if (encbuf_packed && !encbuf_half) {
+			memcpy(encbuf + encbuf_len, shift_lut[v], 4);
+			encbuf_len += 4;
+		} else {
+			for (i = 0; i < 8; i++)
+				xpcu_put(0x04 | ((v >> i) & 1));
+		}
+	}
+
+	for (; k < len; k++) {
+		int tms = k == len-1 ? tms_last : 0;
+		xpcu_reserve(1);
+		xpcu_put(0x04 | ((tms & 1) << 1) | ((tdi[nbytes-1-k/8] >> (k%8)) & 1));
+	}
+
+	return 0;
+}
+
+/* Sync point without waiting: the status record for the tag reports errors. */
+static void xpcu_sync_tag(struct libxsvf_host *h UNUSED)
+{
+	xpcu_add_sync();
+	xpcu_flush();
+	xpcu_status_window();
+}
+
+static int xpcu_sync(struct libxsvf_host *h)
+{
+	struct timeval tv1, tv2;
+
+	gettimeofday(&tv1, NULL);
+
+	if (!mode_internal_cpld) {
+		xpcu_add_sync();
 	}
-	commandbuf_len = 0;
+
+	xpcu_flush();
 
 	if (!mode_internal_cpld) {
-		char cmd[3];
-		snprintf(cmd, 3, "W%x", sync_count);
-		fx2usb_command(cmd);
+		fx2usb_wait_sync(sync_count);
 	}
 
 	fx2usb_command("S");
-	blocks_without_sync = 0;
+	xpcu_status_synced();
+
+	gettimeofday(&tv2, NULL);
+	libxsvf_sync_cost(h, (tv2.tv_sec - tv1.tv_sec)*1000000 + (tv2.tv_usec - tv1.tv_usec));
+
 	if (fx2usb_retbuf[mode_internal_cpld ? 1 : 0] == '1')
 		return -1;
 
 	return 0;
 }
 
-static int xpcu_set_frequency(struct libxsvf_host *h UNUSED, int v)
+/* Set the byte period of the EP2 data (T command). Waits for all pending
+ * transactions to be executed with the old setting.
+ */
+static void xpcu_set_timing(int delay)
 {
-	int freq = 24000000, delay = 0;
+	if (!mode_internal_cpld) {
+		xpcu_add_sync();
+	}
 
-	if (mode_internal_cpld)
-		return 0;
+	xpcu_flush();
 
 	if (!mode_internal_cpld) {
-		sync_count = 0x08 | ((sync_count+1) & 0x0f);
-		commandbuf[commandbuf_len++] = 0x01;
-		commandbuf[commandbuf_len++] = sync_count;
+		fx2usb_wait_sync(sync_count);
 	}
 
-	if (!mode_8bit_per_cycle)
-		shrink_8bit_to_4bit();
-	if (mode_internal_cpld) {
-		unsigned char tempbuf[64];
-		tempbuf[0] = 'J';
-		memcpy(tempbuf+1, commandbuf, commandbuf_len);
-		fx2usb_send_chunk(fx2usb, 1, tempbuf, commandbuf_len + 1);
-	} else {
-		fx2usb_send_chunk(fx2usb, 2, commandbuf, commandbuf_len);
-	}
-	commandbuf_len = 0;
+	char cmd[4];
+	snprintf(cmd, 4, "T%02x", delay);
+	fx2usb_command(cmd);
 
-	if (!mode_internal_cpld) {
-		char cmd[3];
-		snprintf(cmd, 3, "W%x", sync_count);
-		fx2usb_command(cmd);
+	mode_8bit_per_cycle = delay != 0;
+
+	if (!mode_internal_cpld)
+	{
+		xpcu_add_sync();
+		xpcu_flush();
+		fx2usb_wait_sync(sync_count);
 	}
+}
+
+static int xpcu_set_frequency(struct libxsvf_host *h UNUSED, int v)
+{
+	int freq = 24000000, delay = 0;
+
+	if (mode_internal_cpld)
+		return 0;
 
 	while (delay < 250 && v < freq) {
 		delay++;
@@ -416,28 +765,41 @@ static int xpcu_set_frequency(struct libxsvf_host *h UNUSED, int v)
 	else if (v-freq > 10)
 		fprintf(stderr, "Requested FREQUENCY is %dHz. Using %dHz (24MHz/%d) instead.\n", v, freq, delay+1);
 
-	char cmd[4];
-	snprintf(cmd, 4, "T%02x", delay);
-	fx2usb_command(cmd);
+	xpcu_set_timing(delay);
+	xpcu_delay = delay;
+	xpcu_frequency = freq;
+	sync_policy.frequency = freq;
 
-	mode_8bit_per_cycle = delay != 0;
+	// burst clock divider for the extended opcodes: 24MHz/(d+1) <= freq
+	for (dense_div = 0; dense_div < 16; dense_div++)
+		if (24000000 / (dense_div+1) <= freq)
+			break;
+	if (dense_div == 16 || !cpld_current)
+		dense_div = -1;
 
-	if (!mode_internal_cpld)
-	{
-		sync_count = 0x08 | ((sync_count+1) & 0x0f);
-		commandbuf[commandbuf_len++] = 0x01;
-		commandbuf[commandbuf_len++] = sync_count;
-		if (!mode_8bit_per_cycle)
-			shrink_8bit_to_4bit();
-		fx2usb_send_chunk(fx2usb, 2, commandbuf, commandbuf_len);
-		commandbuf_len = 0;
+	return 0;
+}
+
+/* Run n*8 cycles using the extended opcodes. The TDI bits are taken from the
+ * last n bytes of the libxsvf bit array tdi, starting with its LSB. Without tdi
+ * the cycles keep TMS and TDI from the last transaction.
+ */
+static void xpcu_dense(const unsigned char *tdi, int nbytes, int n)
+{
+	int i, k, chunk;
+
+	xpcu_set_timing(8 * (dense_div+1));
 
-		char cmd[3];
-		snprintf(cmd, 3, "W%x", sync_count);
-		fx2usb_command(cmd);
+	for (k = 0; k < n; k += chunk) {
+		chunk = n-k < 128 ? n-k : 128;
+		xpcu_reserve(chunk + 2);
+		xpcu_put((dense_div << 4) | 0x03);
+		xpcu_put((tdi == NULL ? 0x80 : 0x00) | (chunk-1));
+		for (i = 0; i < chunk; i++)
+			xpcu_put(tdi == NULL ? 0x00 : tdi[nbytes-1-k-i]);
 	}
 
-	return 0;
+	xpcu_set_timing(xpcu_delay);
 }
 
 static void xpcu_report_tapstate(struct libxsvf_host *h UNUSED)
@@ -474,23 +836,100 @@ static void *xpcu_realloc(struct libxsvf_host *h UNUSED, void *ptr, int size, en
 	return realloc(ptr, size);
 }
 
+/* Number of commands between checkpoints (-j and -J options) */
+#define CHECKPOINT_INTERVAL 1000
+
+static const char *checkpoint_file;
+
+/* size of the file the loaded checkpoint was written for */
+static long checkpoint_size = -1;
+
+/* the size of a regular file, -1 for pipes etc. */
+static long input_file_size(FILE *f)
+{
+	struct stat st;
+
+	if (fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode))
+		return -1;
+	return st.st_size;
+}
+
+static struct libxsvf_checkpoint checkpoint = {
+	.interval = CHECKPOINT_INTERVAL
+};
+
+static void xpcu_report_checkpoint(struct libxsvf_host *h UNUSED, const struct libxsvf_checkpoint *cp)
+{
+	char tmpname[1024];
+	FILE *f;
+
+	/* write a new file and rename it, so there always is a valid checkpoint */
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", checkpoint_file);
+	f = fopen(tmpname, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Can't write checkpoint file `%s': %s\n", tmpname, strerror(errno));
+		return;
+	}
+	fprintf(f, "%ld %d %ld %ld\n", cp->command, cp->tap_state, ftell(file_fp), input_file_size(file_fp));
+	if (fclose(f) != 0 || rename(tmpname, checkpoint_file) != 0)
+		fprintf(stderr, "Can't write checkpoint file `%s': %s\n", checkpoint_file, strerror(errno));
+}
+
+static void load_checkpoint()
+{
+	FILE *f = fopen(checkpoint_file, "r");
+	long offset;
+	int tap_state;
+
+	/* no checkpoint file: start from the beginning */
+	if (f == NULL)
+		return;
+
+	if (fscanf(f, "%ld %d %ld %ld", &checkpoint.command, &tap_state, &offset, &checkpoint_size) == 4) {
+		checkpoint.tap_state = tap_state;
+		checkpoint.resume = 1;
+		fprintf(stderr, "Resuming at command %ld (file offset %ld) from checkpoint file `%s'.\n",
+				checkpoint.command, offset, checkpoint_file);
+	} else {
+		fprintf(stderr, "Ignoring invalid checkpoint file `%s'.\n", checkpoint_file);
+	}
+
+	fclose(f);
+}
+
 static struct libxsvf_host h = {
 	.udelay = xpcu_udelay,
 	.setup = xpcu_setup,
 	.shutdown = xpcu_shutdown,
 	.getbyte = xpcu_getbyte,
 	.pulse_tck = xpcu_pulse_tck,
+	.shift_bits = xpcu_shift_bits,
 	.sync = xpcu_sync,
 	.set_frequency = xpcu_set_frequency,
 	.report_tapstate = xpcu_report_tapstate,
 	.report_device = xpcu_report_device,
 	.report_status = xpcu_report_status,
 	.report_error = xpcu_report_error,
-	.realloc = xpcu_realloc
+	.realloc = xpcu_realloc,
+	.sync_policy = &sync_policy,
+	.report_checkpoint = xpcu_report_checkpoint
 };
 
 const char *progname;
 
+/* Check if the probe already runs this firmware (warm start). Returns 0 if
+ * not, 1 if it does and 2 if it does and the CPLD checksum has already been
+ * verified since the firmware was started.
+ */
+static int xpcu_check_firmware()
+{
+	unsigned char buf[64];
+	int len = fx2usb_query(fx2usb, "V", buf, sizeof(buf), 100);
+	if (len != 11 || memcmp(buf, correct_fw_cksum, 6) || memcmp(buf+7, " (V)", 4))
+		return 0;
+	return buf[6] == '1' ? 2 : 1;
+}
+
 static void help()
 {
 	fprintf(stderr, "\n");
@@ -501,7 +940,8 @@ static void help()
 	fprintf(stderr, "Copyright (C) 2011  Clifford Wolf <clifford@clifford.at>\n");
 	fprintf(stderr, "Lib(X)SVF is free software licensed under the ISC license.\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "Usage: %s [ -L | -B ] [ -d <vendor>:<device> | -D <device_file> ] [ -f kHz ] [ -A ] [ -P ]\n", progname);
+	fprintf(stderr, "Usage: %s [ -L | -B ] [ -d <vendor>:<device> | -D <device_file> ] [ -f kHz ] [ -A | -l ms ]\n", progname);
+	fprintf(stderr, "       %*s [ -b retries [ -m kHz ] ] [ -j file | -J file ] [ -P ] [ -X ]\n", (int)strlen(progname), "");
 	fprintf(stderr, "       %*s { -E | -p | -s svf-file | -x xsvf-file | -c } ...\n", (int)strlen(progname), "");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "   -L, -B\n");
@@ -521,9 +961,32 @@ static void help()
 	fprintf(stderr, "          Use full asynchonous error checking\n");
 	fprintf(stderr, "          (very fast but error reporting might be delayed)\n");
 	fprintf(stderr, "\n");
+	fprintf(stderr, "   -l ms\n");
+	fprintf(stderr, "          Report TDO errors within the specified time (default=%d)\n", SYNC_POLICY_MAX_USECS / 1000);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -b retries\n");
+	fprintf(stderr, "          Replay an SVF block (the commands from one SIR to the next)\n");
+	fprintf(stderr, "          up to this many times on TDO errors before giving up\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -m kHz\n");
+	fprintf(stderr, "          Lower the frequency for block replays down to this value\n");
+	fprintf(stderr, "          (it is raised again after %d clean blocks)\n", SYNC_POLICY_CLEAN_BLOCKS);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -j file\n");
+	fprintf(stderr, "          Write checkpoints for the next SVF or XSVF file to this file\n");
+	fprintf(stderr, "          (it is removed when the file has been played without errors)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -J file\n");
+	fprintf(stderr, "          Like -j, but resume at the checkpoint in this file (if it exists)\n");
+	fprintf(stderr, "\n");
 	fprintf(stderr, "   -P\n");
 	fprintf(stderr, "          Use CPLD on probe as target device\n");
 	fprintf(stderr, "\n");
+	fprintf(stderr, "   -X\n");
+	fprintf(stderr, "          Stop the firmware on the probe and power down the CPLD on exit\n");
+	fprintf(stderr, "          (default: keep it running, so the next run can skip the upload,\n");
+	fprintf(stderr, "          unless the firmware image predates firmware.c)\n");
+	fprintf(stderr, "\n");
 	fprintf(stderr, "   -p\n");
 	fprintf(stderr, "          Force (re-)programming the CPLD on the probe\n");
 	fprintf(stderr, "\n");
@@ -546,18 +1009,16 @@ int main(int argc, char **argv)
 {
 	int rc = 0;
 	int gotaction = 0;
-	int opt, i, j;
+	int opt, i, j, warm;
 
 	int done_initialization = 0;
 
 	progname = argc >= 1 ? argv[0] : "xsvftool-xpcu";
-	while ((opt = getopt(argc, argv, "LBd:D:f:APpEs:x:c")) != -1)
+	while ((opt = getopt(argc, argv, "LBd:D:f:Al:b:m:j:J:PXpEs:x:c")) != -1)
 	{
 		if (!done_initialization && (opt == 'p' || opt == 'E' || opt == 's' || opt == 'x' || opt == 'c'))
 		{
-			usb_init();
-			usb_find_busses();
-			usb_find_devices();
+			CHECK(libusb_init(NULL), == 0);
 
 			fx2usb = fx2usb_open(usb_vendor_id, usb_device_id, usb_device_file);
 			if (fx2usb == NULL) {
@@ -566,37 +1027,72 @@ int main(int argc, char **argv)
 			}
 			CHECK(fx2usb_claim(fx2usb), == 0);
 
-			FILE *ihexf = CHECK_PTR(fmemopen(firmware_ihx, sizeof(firmware_ihx), "r"), != NULL);
-			CHECK(fx2usb_upload_ihex(fx2usb, ihexf), == 0);
-			CHECK(fclose(ihexf), == 0);
-
-			i = mode_internal_cpld;
-			mode_internal_cpld = 1;
-			internal_jtag_scan_test = 1;
-			libxsvf_play(&h, LIBXSVF_MODE_SCAN);
+			warm = xpcu_check_firmware();
+			if (warm == 0) {
+				FILE *ihexf = CHECK_PTR(fmemopen(firmware_ihx, sizeof(firmware_ihx), "r"), != NULL);
+				CHECK(fx2usb_upload_ihex(fx2usb, ihexf), == 0);
+				CHECK(fclose(ihexf), == 0);
+				fw_current = xpcu_check_firmware() != 0;
+				if (!fw_current)
+					fprintf(stderr, "Firmware image predates firmware.c: using the protocol without status records and capture stream.\n");
+			} else {
+				fw_current = 1;
+				// stale capture data from the last run
+				fx2usb_discard(fx2usb, 6);
+			}
 
-			if (internal_jtag_scan_test != 2) {
-				fprintf(stderr, "Probe (device %s on bus %s) failed internal JTAG scan test!\n",
-					usb_device(fx2usb)->filename, usb_device(fx2usb)->bus->dirname);
-				exit(1);
+			CHECK(fx2usb_recv_start(fx2usb, 1, 64, xpcu_ep1_callback), == 0);
+			if (fw_current)
+				CHECK(fx2usb_recv_start(fx2usb, 6, 512, xpcu_ep6_callback), == 0);
+			fx2usb_reader = 1;
+
+			if (warm == 2) {
+				fprintf(stderr, "Connected to probe (device %03d on bus %03d), firmware and CPLD already up to date.\n",
+					libusb_get_device_address(libusb_get_device(fx2usb)), libusb_get_bus_number(libusb_get_device(fx2usb)));
+				// the firmware only remembers a CPLD that matches hardware.v
+				cpld_current = 1;
+				done_initialization = 1;
 			}
-			mode_internal_cpld = i;
-			internal_jtag_scan_test = 0;
 
-			fprintf(stderr, "Connected to probe (device %s on bus %s) and passed internal JTAG scan test.\n",
-				usb_device(fx2usb)->filename, usb_device(fx2usb)->bus->dirname);
+			if (!done_initialization) {
+				i = mode_internal_cpld;
+				mode_internal_cpld = 1;
+				internal_jtag_scan_test = 1;
+				libxsvf_play(&h, LIBXSVF_MODE_SCAN);
+
+				if (internal_jtag_scan_test != 2) {
+					fprintf(stderr, "Probe (device %03d on bus %03d) failed internal JTAG scan test!\n",
+						libusb_get_device_address(libusb_get_device(fx2usb)), libusb_get_bus_number(libusb_get_device(fx2usb)));
+					exit(1);
+				}
+				mode_internal_cpld = i;
+				internal_jtag_scan_test = 0;
+
+				fprintf(stderr, "Connected to probe (device %03d on bus %03d) and passed internal JTAG scan test.\n",
+					libusb_get_device_address(libusb_get_device(fx2usb)), libusb_get_bus_number(libusb_get_device(fx2usb)));
+			}
 
-			if (opt != 'p' && opt != 'E' && !mode_internal_cpld) {
+			if (!done_initialization && opt != 'p' && opt != 'E' && !mode_internal_cpld) {
 				fx2usb_command("C");
-				if (memcmp(correct_cksum, fx2usb_retbuf, 6)) {
+				if (!memcmp(correct_cksum, fx2usb_retbuf, 6)) {
+					// remember the verdict in the firmware for the next run
+					cpld_current = 1;
+					if (fw_current)
+						fx2usb_command("V1");
+				} else if (!memcmp(image_cksum, fx2usb_retbuf, 6)) {
+					// reprogramming would not get a newer CPLD image
+					cpld_current = 0;
+					fprintf(stderr, "CPLD image predates hardware.v: using the protocol without status records, capture stream and extended opcodes.\n");
+				} else {
 					fprintf(stderr, "Mismatch in CPLD checksum (is=%.6s, should=%s): reprogramming CPLD on probe..\n",
-							fx2usb_retbuf, correct_cksum);
+							fx2usb_retbuf, image_cksum);
 					i = mode_internal_cpld;
 					mode_internal_cpld = 1;
 					file_fp = CHECK_PTR(fmemopen(hardware_svf, sizeof(hardware_svf), "r"), != NULL);
 					libxsvf_play(&h, LIBXSVF_MODE_SVF);
 					mode_internal_cpld = i;
 					fclose(file_fp);
+					cpld_current = !strcmp(image_cksum, correct_cksum);
 				}
 			}
 
@@ -629,7 +1125,28 @@ int main(int argc, char **argv)
 			mode_internal_cpld = 1;
 			break;
 		case 'A':
-			mode_async_check = 1;
+			sync_policy.max_usecs = 0;
+			sync_policy.block_sync = 0;
+			break;
+		case 'l':
+			sync_policy.max_usecs = atoi(optarg) * 1000L;
+			break;
+		case 'b':
+			sync_policy.block_retries = atoi(optarg);
+			break;
+		case 'm':
+			sync_policy.min_frequency = atoi(optarg) * 1000;
+			break;
+		case 'j':
+		case 'J':
+			checkpoint_file = optarg;
+			checkpoint.resume = 0;
+			if (opt == 'J')
+				load_checkpoint();
+			h.checkpoint = &checkpoint;
+			break;
+		case 'X':
+			mode_exit_firmware = 1;
 			break;
 		case 'p':
 		case 'E':
@@ -646,6 +1163,7 @@ int main(int argc, char **argv)
 			libxsvf_play(&h, LIBXSVF_MODE_SVF);
 			mode_internal_cpld = i;
 			fclose(file_fp);
+			cpld_current = opt == 'p' && !strcmp(image_cksum, correct_cksum);
 			break;
 		case 'x':
 		case 's':
@@ -659,11 +1177,22 @@ int main(int argc, char **argv)
 				rc = 1;
 				break;
 			}
+			if (h.checkpoint && checkpoint.resume && input_file_size(file_fp) != checkpoint_size) {
+				fprintf(stderr, "Checkpoint file `%s' was written for a different file (size %ld, not %ld).\n",
+						checkpoint_file, checkpoint_size, input_file_size(file_fp));
+				if (strcmp(optarg, "-"))
+					fclose(file_fp);
+				rc = 1;
+				break;
+			}
 			fprintf(stderr, "Playing %s file `%s'..\n", opt == 's' ? "SVF" : "XSVF", optarg);
 			if (libxsvf_play(&h, opt == 's' ? LIBXSVF_MODE_SVF : LIBXSVF_MODE_XSVF) < 0) {
 				fprintf(stderr, "Error while playing %s file `%s'.\n", opt == 's' ? "SVF" : "XSVF", optarg);
 				rc = 1;
+			} else if (h.checkpoint) {
+				unlink(checkpoint_file);
 			}
+			h.checkpoint = NULL;
 			if (strcmp(optarg, "-"))
 				fclose(file_fp);
 			break;
@@ -704,9 +1233,14 @@ int main(int argc, char **argv)
 	}
 
 	if (done_initialization) {
-		fx2usb_command("X");
+		fx2usb_queue_drain(fx2usb);
+		// a firmware without the V command can't be warm started
+		if (mode_exit_firmware || !fw_current)
+			fx2usb_command("X");
 		fx2usb_release(fx2usb);
-		usb_close(fx2usb);
+		fx2usb_reader = 0;
+		libusb_close(fx2usb);
+		libusb_exit(NULL);
 	}
 
 	fprintf(stderr, "Total number of JTAG clock cycles performed: %d\n", tck_cycle_count);
@@ -0,0 +1,538 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * xsvftool-xvcd is a Xilinx Virtual Cable (XVC 1.0) server. Each shift:
+ * request is played with libxsvf_xvc_shift(), which passes the bits in
+ * the shift states to the host's shift_bits() in one call.
+ *
+ * The JTAG interface is selected with -i: the GPIO pins of xsvftool-gpio
+ * (gpio.c) or a simulated cable with TDI looped back to TDO. With -b the
+ * program is a client that benchmarks a running server, -c checks the
+ * looped back data.
+ */
+
+#include "libxsvf.h"
+#include "gpio.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+
+#define DEFAULT_PORT 2542
+
+/* largest TMS/TDI vector of a shift: request */
+#define MAX_VECTOR_BYTES (256 * 1024)
+
+
+/** BEGIN: Low-Level I/O Implementation **/
+
+/* simulated cable with TDI looped back to TDO, for benchmarks */
+static int loop_tdi_value;
+
+static void loop_setup(void)
+{
+}
+
+static void loop_pin(int val)
+{
+}
+
+static void loop_tdi(int val)
+{
+	loop_tdi_value = val;
+}
+
+static int loop_tdo(void)
+{
+	return loop_tdi_value;
+}
+
+struct io_interface {
+	const char *name;
+	void (*setup)(void);
+	void (*shutdown)(void);
+	void (*tms)(int val);
+	void (*tdi)(int val);
+	void (*tck)(int val);
+	/* returns the TDO line or -1 if there is none */
+	int (*tdo)(void);
+};
+
+static const struct io_interface interfaces[] = {
+	{ "gpio", gpio_setup, gpio_shutdown, gpio_tms, gpio_tdi, gpio_tck, gpio_tdo },
+	{ "loopback", loop_setup, loop_setup, loop_pin, loop_tdi, loop_pin, loop_tdo },
+	{ NULL }
+};
+
+static const struct io_interface *io = &interfaces[0];
+
+/** END: Low-Level I/O Implementation **/
+
+
+static int verbose;
+static long long clockcount;
+
+static int h_setup(struct libxsvf_host *h)
+{
+	io->setup();
+	return 0;
+}
+
+static int h_shutdown(struct libxsvf_host *h)
+{
+	io->shutdown();
+	return 0;
+}
+
+static void h_udelay(struct libxsvf_host *h, long usecs, int tms, long num_tck)
+{
+	io->tms(tms);
+	while (num_tck-- > 0) {
+		io->tck(0);
+		io->tck(1);
+		clockcount++;
+	}
+	if (usecs > 0)
+		usleep(usecs);
+}
+
+static int h_getbyte(struct libxsvf_host *h)
+{
+	return -1;
+}
+
+static int h_pulse_tck(struct libxsvf_host *h, int tms, int tdi, int tdo, int rmask, int sync)
+{
+	int line_tdo;
+
+	io->tms(tms);
+	if (tdi >= 0)
+		io->tdi(tdi);
+	io->tck(0);
+	io->tck(1);
+	clockcount++;
+
+	/* without a TDO line the TDO vector is all zeros */
+	line_tdo = io->tdo();
+	if (line_tdo < 0)
+		return 0;
+	return tdo < 0 || line_tdo == tdo ? line_tdo : -1;
+}
+
+static int h_shift_bits(struct libxsvf_host *h, int len, const unsigned char *tdi, unsigned char *tdo, int tms_last)
+{
+	int k, nbytes = (len+7)/8;
+
+	if (tdo)
+		memset(tdo, 0, nbytes);
+
+	for (k = 0; k < len; k++) {
+		int tms = k == len-1 ? tms_last : 0;
+		int rc = h_pulse_tck(h, tms, (tdi[nbytes-1-k/8] >> (k%8)) & 1, -1, 0, 0);
+		if (rc < 0)
+			return -1;
+		if (tdo && rc)
+			tdo[nbytes-1-k/8] |= 1 << (k%8);
+	}
+
+	return 0;
+}
+
+static int h_set_frequency(struct libxsvf_host *h, int v)
+{
+	if (verbose)
+		fprintf(stderr, "Setting TCK frequency to %d Hz.\n", v);
+	return 0;
+}
+
+static void h_report_tapstate(struct libxsvf_host *h)
+{
+	if (verbose >= 3)
+		fprintf(stderr, "[%s]\n", libxsvf_state2str(h->tap_state));
+}
+
+static void h_report_error(struct libxsvf_host *h, const char *file, int line, const char *message)
+{
+	fprintf(stderr, "[%s:%d] %s\n", file, line, message);
+}
+
+static void *h_realloc(struct libxsvf_host *h, void *ptr, int size, enum libxsvf_mem which)
+{
+	return realloc(ptr, size);
+}
+
+static struct libxsvf_host h = {
+	.udelay = h_udelay,
+	.setup = h_setup,
+	.shutdown = h_shutdown,
+	.getbyte = h_getbyte,
+	.pulse_tck = h_pulse_tck,
+	.shift_bits = h_shift_bits,
+	.set_frequency = h_set_frequency,
+	.report_tapstate = h_report_tapstate,
+	.report_error = h_report_error,
+	.realloc = h_realloc
+};
+
+
+/** XVC protocol **/
+
+static int read_all(int fd, void *buf, int len)
+{
+	int pos, rc;
+	for (pos = 0; pos < len; pos += rc) {
+		rc = read(fd, (char*)buf + pos, len - pos);
+		if (rc < 0 && errno == EINTR)
+			rc = 0;
+		else if (rc <= 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, int len)
+{
+	int pos, rc;
+	for (pos = 0; pos < len; pos += rc) {
+		rc = write(fd, (const char*)buf + pos, len - pos);
+		if (rc < 0 && errno == EINTR)
+			rc = 0;
+		else if (rc <= 0)
+			return -1;
+	}
+	return 0;
+}
+
+static unsigned long get_le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static void put_le32(unsigned char *p, unsigned long v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void set_nodelay(int fd)
+{
+	int one = 1, bufsize = 2 * MAX_VECTOR_BYTES + 64;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+}
+
+/* serve one client; returns when the connection is closed */
+static void serve(int fd)
+{
+	static unsigned char vectors[2 * MAX_VECTOR_BYTES], tdo[MAX_VECTOR_BYTES];
+	unsigned char cmd[16];
+	char info[64];
+
+	while (1)
+	{
+		/* all commands start with at least 2 characters */
+		if (read_all(fd, cmd, 2) < 0)
+			return;
+
+		if (!memcmp(cmd, "ge", 2)) {
+			if (read_all(fd, cmd, 6) < 0 || memcmp(cmd, "tinfo:", 6))
+				break;
+			snprintf(info, sizeof(info), "xvcServer_v1.0:%d\n", MAX_VECTOR_BYTES);
+			if (write_all(fd, info, strlen(info)) < 0)
+				return;
+			continue;
+		}
+
+		if (!memcmp(cmd, "se", 2)) {
+			if (read_all(fd, cmd, 9) < 0 || memcmp(cmd, "ttck:", 5))
+				break;
+			unsigned long period = get_le32(cmd + 5);
+			if (period > 0)
+				h.set_frequency(&h, 1000000000 / period);
+			if (write_all(fd, cmd + 5, 4) < 0)
+				return;
+			continue;
+		}
+
+		if (!memcmp(cmd, "sh", 2)) {
+			if (read_all(fd, cmd, 8) < 0 || memcmp(cmd, "ift:", 4))
+				break;
+			long len = get_le32(cmd + 4);
+			int nbytes = (len+7) / 8;
+			if (nbytes > MAX_VECTOR_BYTES) {
+				fprintf(stderr, "Shift of %ld bits exceeds the vector size.\n", len);
+				break;
+			}
+			/* read both vectors at once and answer with a single write */
+			if (read_all(fd, vectors, 2 * nbytes) < 0)
+				return;
+			if (libxsvf_xvc_shift(&h, len, vectors, vectors + nbytes, tdo) < 0) {
+				fprintf(stderr, "Shift of %ld bits failed.\n", len);
+				break;
+			}
+			if (write_all(fd, tdo, nbytes) < 0)
+				return;
+			continue;
+		}
+
+		break;
+	}
+
+	fprintf(stderr, "Protocol error, closing connection.\n");
+}
+
+static int server(const char *address, int port)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = address ? inet_addr(address) : htonl(INADDR_ANY);
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+		fprintf(stderr, "Can't listen on port %d: %s\n", port, strerror(errno));
+		return 1;
+	}
+
+	if (libxsvf_session_open(&h) < 0)
+		return 1;
+
+	if (io->tdo() < 0)
+		fprintf(stderr, "WARNING: The %s interface has no TDO line, TDO reads as 0.\n", io->name);
+
+	if (verbose)
+		fprintf(stderr, "Listening on port %d (%s interface).\n", port, io->name);
+
+	/* XVC has one client at a time */
+	while (1)
+	{
+		int client = accept(fd, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Accept failed: %s\n", strerror(errno));
+			break;
+		}
+		set_nodelay(client);
+		if (verbose)
+			fprintf(stderr, "Client connected.\n");
+		serve(client);
+		close(client);
+		if (verbose)
+			fprintf(stderr, "Client disconnected (%lld clock cycles so far).\n", clockcount);
+	}
+
+	libxsvf_session_close(&h);
+	close(fd);
+	return 1;
+}
+
+
+/** Benchmark client **/
+
+static int xvc_shift(int fd, int len, const unsigned char *tms, const unsigned char *tdi, unsigned char *tdo)
+{
+	static unsigned char msg[10 + 2 * MAX_VECTOR_BYTES];
+	int nbytes = (len+7) / 8;
+
+	memcpy(msg, "shift:", 6);
+	put_le32(msg + 6, len);
+	memcpy(msg + 10, tms, nbytes);
+	memcpy(msg + 10 + nbytes, tdi, nbytes);
+	if (write_all(fd, msg, 10 + 2 * nbytes) < 0)
+		return -1;
+	return read_all(fd, tdo, nbytes);
+}
+
+static int benchmark(const char *address, int port, int num, int bits, int check)
+{
+	static unsigned char tms[MAX_VECTOR_BYTES], tdi[MAX_VECTOR_BYTES], tdo[MAX_VECTOR_BYTES];
+	struct sockaddr_in addr;
+	struct timeval tv1, tv2;
+	char info[64];
+	int i, k, nbytes = (bits+7) / 8;
+	long errors = 0;
+	double secs;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = inet_addr(address ? address : "127.0.0.1");
+	if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Can't connect to port %d: %s\n", port, strerror(errno));
+		return 1;
+	}
+	set_nodelay(fd);
+
+	memset(info, 0, sizeof(info));
+	if (write_all(fd, "getinfo:", 8) < 0 || read(fd, info, sizeof(info) - 1) <= 0) {
+		fprintf(stderr, "getinfo: failed.\n");
+		return 1;
+	}
+	printf("Server: %s", info);
+
+	/* Test-Logic-Reset, Run-Test/Idle, Select-DR-Scan, Capture-DR, Shift-DR */
+	memset(tms, 0, nbytes);
+	memset(tdi, 0, nbytes);
+	tms[0] = 0x5f;
+	if (xvc_shift(fd, 9, tms, tdi, tdo) < 0) {
+		fprintf(stderr, "shift: failed.\n");
+		return 1;
+	}
+
+	/* stay in Shift-DR with random TDI data */
+	memset(tms, 0, nbytes);
+	srand(1);
+	gettimeofday(&tv1, NULL);
+	for (i = 0; i < num; i++) {
+		for (k = 0; k < nbytes; k++)
+			tdi[k] = rand();
+		if (xvc_shift(fd, bits, tms, tdi, tdo) < 0) {
+			fprintf(stderr, "shift: failed.\n");
+			return 1;
+		}
+		for (k = 0; check && k < bits; k++)
+			errors += ((tdi[k/8] ^ tdo[k/8]) >> (k%8)) & 1;
+	}
+	gettimeofday(&tv2, NULL);
+
+	secs = (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) * 1e-6;
+	printf("%d shifts of %d bits in %.3f s: %.0f shifts/s, %.2f Mbit/s\n",
+			num, bits, secs, num / secs, (double)num * bits / secs * 1e-6);
+	if (check)
+		printf("%ld TDO bits differ from the looped back TDI bits.\n", errors);
+
+	close(fd);
+	return errors ? 1 : 0;
+}
+
+
+/** Main **/
+
+const char *progname;
+
+static void help()
+{
+	fprintf(stderr, "xsvftool-xvcd, part of Lib(X)SVF (http://www.clifford.at/libxsvf/).\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: %s [ -v ... ] [ -i interface ] [ -a address ] [ -p port ]\n", progname);
+	fprintf(stderr, "       %s -b [ -c ] [ -a address ] [ -p port ] [ -n shifts ] [ -l bits ]\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -v, -vv, -vvv\n");
+	fprintf(stderr, "          Verbose, more verbose and even more verbose\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -i interface\n");
+	fprintf(stderr, "          JTAG interface to serve: gpio (the GPIO pins of xsvftool-gpio,\n");
+	fprintf(stderr, "          default) or loopback (TDI looped back to TDO, for -b -c)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -a address\n");
+	fprintf(stderr, "          Address to listen on or connect to\n");
+	fprintf(stderr, "          (default: any / 127.0.0.1)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -p port\n");
+	fprintf(stderr, "          TCP port (default: %d)\n", DEFAULT_PORT);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -b\n");
+	fprintf(stderr, "          Benchmark a running server with shift: requests\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -c\n");
+	fprintf(stderr, "          Check that TDO is TDI looped back (server with -i loopback)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -n shifts, -l bits\n");
+	fprintf(stderr, "          Number and length of the benchmark shifts\n");
+	fprintf(stderr, "          (default: 1000 shifts of 65536 bits)\n");
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *address = NULL;
+	int port = DEFAULT_PORT;
+	int bench = 0, check = 0, num = 1000, bits = 65536;
+	int opt, i;
+
+	progname = argc >= 1 ? argv[0] : "xsvftool-xvcd";
+	while ((opt = getopt(argc, argv, "vi:a:p:bcn:l:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'v':
+			verbose++;
+			break;
+		case 'i':
+			for (i = 0; interfaces[i].name && strcmp(interfaces[i].name, optarg); i++) { }
+			if (interfaces[i].name == NULL)
+				help();
+			io = &interfaces[i];
+			break;
+		case 'a':
+			address = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'b':
+			bench = 1;
+			break;
+		case 'c':
+			check = 1;
+			break;
+		case 'n':
+			num = atoi(optarg);
+			break;
+		case 'l':
+			bits = atoi(optarg);
+			if (bits < 1 || bits > 8 * MAX_VECTOR_BYTES)
+				help();
+			break;
+		default:
+			help();
+			break;
+		}
+	}
+
+	if (optind != argc)
+		help();
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (bench)
+		return benchmark(address, port, num, bits, check);
+	return server(address, port);
+}
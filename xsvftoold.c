@@ -0,0 +1,1008 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/*
+ * xsvftoold keeps JTAG adapters set up and SVF/XSVF files in memory and
+ * plays jobs sent to it over a Unix socket. Each adapter has a job queue
+ * and a worker thread that plays its jobs in a single libxsvf session.
+ *
+ * The adapters are simulated: each one counts clock cycles and drives a
+ * TAP with a single device that only implements IDCODE. The sim_*()
+ * functions are the place to drive real hardware.
+ */
+
+#include "libxsvf.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#define MAX_ADAPTERS 16
+#define MAX_LINE 4096
+#define SOCKET_NAME "xsvftoold.sock"
+#define DEFAULT_CACHE_MB 64
+#define DEFAULT_FREQUENCY 1000000
+
+static int verbose;
+static long cache_limit = DEFAULT_CACHE_MB * 1024L * 1024L;
+static int listen_fd = -1;
+static int quitting;
+static struct timeval start_time;
+
+/* protects the queues, the image cache, the counters and 'quitting' */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long usecs_since(const struct timeval *tv1)
+{
+	struct timeval tv2;
+	gettimeofday(&tv2, NULL);
+	return (tv2.tv_sec - tv1->tv_sec) * 1000000 + (tv2.tv_usec - tv1->tv_usec);
+}
+
+
+/** Clients **/
+
+/* A client stays allocated while it has jobs, even if the connection is
+ * closed: the results of its jobs are then dropped. */
+struct client_s {
+	int fd, refs;
+	pthread_mutex_t write_mutex;
+};
+
+static void client_write(struct client_s *c, const char *buf, int len)
+{
+	int pos, rc;
+
+	pthread_mutex_lock(&c->write_mutex);
+	for (pos = 0; pos < len; pos += rc) {
+		rc = send(c->fd, buf + pos, len - pos, MSG_NOSIGNAL);
+		if (rc < 0 && errno == EINTR)
+			rc = 0;
+		else if (rc <= 0)
+			break;
+	}
+	pthread_mutex_unlock(&c->write_mutex);
+}
+
+static void client_printf(struct client_s *c, const char *fmt, ...)
+{
+	char buf[MAX_LINE];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len >= (int)sizeof(buf)) {
+		len = sizeof(buf) - 1;
+		buf[len-1] = '\n';
+	}
+
+	client_write(c, buf, len);
+}
+
+static void client_put(struct client_s *c)
+{
+	int refs;
+
+	pthread_mutex_lock(&mutex);
+	refs = --c->refs;
+	pthread_mutex_unlock(&mutex);
+
+	if (refs == 0) {
+		close(c->fd);
+		pthread_mutex_destroy(&c->write_mutex);
+		free(c);
+	}
+}
+
+
+/** Image cache **/
+
+/* Files are read once and kept in memory while they don't change. Images
+ * that are not used by a job are dropped (least recently used first) when
+ * the cache grows beyond the limit (-C option). */
+struct image_s {
+	struct image_s *next;
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	char *data;
+	int refs;
+	unsigned long last_use;
+};
+
+static struct image_s *images;
+static unsigned long image_use_counter;
+static long cache_bytes, cache_hits, cache_misses;
+
+static void image_evict(void)
+{
+	struct image_s **pp, **lru;
+
+	while (cache_bytes > cache_limit) {
+		lru = NULL;
+		for (pp = &images; *pp; pp = &(*pp)->next) {
+			if ((*pp)->refs == 0 && (!lru || (*pp)->last_use < (*lru)->last_use))
+				lru = pp;
+		}
+		if (!lru)
+			break;
+
+		struct image_s *img = *lru;
+		*lru = img->next;
+		cache_bytes -= img->size;
+		free(img->path);
+		free(img->data);
+		free(img);
+	}
+}
+
+static struct image_s *image_get(const char *path, char *errbuf, int errsize)
+{
+	struct image_s *img;
+	struct stat st;
+	FILE *f;
+
+	if (stat(path, &st) < 0) {
+		snprintf(errbuf, errsize, "Can't open file `%s': %s", path, strerror(errno));
+		return NULL;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		snprintf(errbuf, errsize, "Can't open file `%s': Not a regular file", path);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&mutex);
+	for (img = images; img; img = img->next) {
+		if (img->dev == st.st_dev && img->ino == st.st_ino && img->size == st.st_size &&
+				img->mtime == st.st_mtime && !strcmp(img->path, path))
+			break;
+	}
+	if (img) {
+		img->refs++;
+		img->last_use = ++image_use_counter;
+		cache_hits++;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (img)
+		return img;
+
+	/* read the file without holding the lock */
+	img = calloc(1, sizeof(*img));
+	img->path = strdup(path);
+	img->dev = st.st_dev;
+	img->ino = st.st_ino;
+	img->size = st.st_size;
+	img->mtime = st.st_mtime;
+	img->data = malloc(st.st_size > 0 ? st.st_size : 1);
+	img->refs = 1;
+
+	f = fopen(path, "rb");
+	if (f == NULL || fread(img->data, 1, st.st_size, f) != (size_t)st.st_size) {
+		snprintf(errbuf, errsize, "Can't read file `%s': %s", path,
+				f ? "Short read" : strerror(errno));
+		if (f)
+			fclose(f);
+		free(img->path);
+		free(img->data);
+		free(img);
+		return NULL;
+	}
+	fclose(f);
+
+	pthread_mutex_lock(&mutex);
+	img->last_use = ++image_use_counter;
+	img->next = images;
+	images = img;
+	cache_bytes += img->size;
+	cache_misses++;
+	image_evict();
+	pthread_mutex_unlock(&mutex);
+
+	return img;
+}
+
+static void image_put(struct image_s *img)
+{
+	pthread_mutex_lock(&mutex);
+	img->refs--;
+	image_evict();
+	pthread_mutex_unlock(&mutex);
+}
+
+
+/** Adapters **/
+
+struct job_s {
+	struct job_s *next;
+	long id;
+	struct client_s *client;
+	enum libxsvf_mode mode;
+	char *path;
+	int frequency;
+};
+
+struct adapter_s {
+	int index;
+	pthread_t thread;
+	pthread_cond_t cond;
+	struct job_s *head, *tail;
+	int queued, busy;
+
+	struct libxsvf_host h;
+	struct libxsvf_arena arena;
+	int session_open;
+	int frequency;
+
+	/* the running job */
+	struct job_s *job;
+	int progress;
+	long job_clocks;
+	int retval_i;
+	int retval[256];
+
+	/* simulated TAP */
+	int state;
+	int ir, ir_shift;
+	int dr_len;
+	unsigned long dr_shift;
+
+	/* throughput counters */
+	long jobs_ok, jobs_failed;
+	long long bytes, clocks, busy_usecs;
+};
+
+static struct adapter_s adapters[MAX_ADAPTERS];
+static int num_adapters = 1;
+static long next_job_id = 1;
+
+#define SIM_IDCODE 0x13631093
+#define SIM_IR_LEN 6
+#define SIM_IR_IDCODE 0x09
+
+static const unsigned char sim_tap_next[17][2] = {
+	[LIBXSVF_TAP_RESET]     = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_RESET     },
+	[LIBXSVF_TAP_IDLE]      = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  },
+	[LIBXSVF_TAP_DRSELECT]  = { LIBXSVF_TAP_DRCAPTURE, LIBXSVF_TAP_IRSELECT  },
+	[LIBXSVF_TAP_DRCAPTURE] = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DREXIT1   },
+	[LIBXSVF_TAP_DRSHIFT]   = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DREXIT1   },
+	[LIBXSVF_TAP_DREXIT1]   = { LIBXSVF_TAP_DRPAUSE,   LIBXSVF_TAP_DRUPDATE  },
+	[LIBXSVF_TAP_DRPAUSE]   = { LIBXSVF_TAP_DRPAUSE,   LIBXSVF_TAP_DREXIT2   },
+	[LIBXSVF_TAP_DREXIT2]   = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DRUPDATE  },
+	[LIBXSVF_TAP_DRUPDATE]  = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  },
+	[LIBXSVF_TAP_IRSELECT]  = { LIBXSVF_TAP_IRCAPTURE, LIBXSVF_TAP_RESET     },
+	[LIBXSVF_TAP_IRCAPTURE] = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IREXIT1   },
+	[LIBXSVF_TAP_IRSHIFT]   = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IREXIT1   },
+	[LIBXSVF_TAP_IREXIT1]   = { LIBXSVF_TAP_IRPAUSE,   LIBXSVF_TAP_IRUPDATE  },
+	[LIBXSVF_TAP_IRPAUSE]   = { LIBXSVF_TAP_IRPAUSE,   LIBXSVF_TAP_IREXIT2   },
+	[LIBXSVF_TAP_IREXIT2]   = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IRUPDATE  },
+	[LIBXSVF_TAP_IRUPDATE]  = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  }
+};
+
+static void sim_setup(struct adapter_s *a)
+{
+	if (verbose)
+		fprintf(stderr, "Adapter %d: setup.\n", a->index);
+	a->state = LIBXSVF_TAP_RESET;
+	a->ir = SIM_IR_IDCODE;
+}
+
+static void sim_shutdown(struct adapter_s *a)
+{
+	if (verbose)
+		fprintf(stderr, "Adapter %d: shutdown.\n", a->index);
+}
+
+/* one clock cycle, returns the TDO line before the rising edge or -1 if
+ * there is none */
+static int sim_clock(struct adapter_s *a, int tms, int tdi)
+{
+	int tdo = 1;
+
+	a->job_clocks++;
+	tdi = tdi < 0 ? 1 : tdi;
+
+	switch (a->state)
+	{
+	case LIBXSVF_TAP_IRCAPTURE:
+		a->ir_shift = 0x01;
+		break;
+	case LIBXSVF_TAP_IRSHIFT:
+		tdo = a->ir_shift & 1;
+		a->ir_shift = a->ir_shift >> 1 | tdi << (SIM_IR_LEN-1);
+		break;
+	case LIBXSVF_TAP_DRCAPTURE:
+		a->dr_len = a->ir == SIM_IR_IDCODE ? 32 : 1;
+		a->dr_shift = a->ir == SIM_IR_IDCODE ? SIM_IDCODE : 0;
+		break;
+	case LIBXSVF_TAP_DRSHIFT:
+		tdo = a->dr_shift & 1;
+		a->dr_shift = a->dr_shift >> 1 | (unsigned long)tdi << (a->dr_len-1);
+		break;
+	}
+
+	a->state = sim_tap_next[a->state][tms];
+	if (a->state == LIBXSVF_TAP_IRUPDATE)
+		a->ir = a->ir_shift;
+	if (a->state == LIBXSVF_TAP_RESET)
+		a->ir = SIM_IR_IDCODE;
+
+	return tdo;
+}
+
+static int h_setup(struct libxsvf_host *h)
+{
+	sim_setup(h->user_data);
+	return 0;
+}
+
+static int h_shutdown(struct libxsvf_host *h)
+{
+	sim_shutdown(h->user_data);
+	return 0;
+}
+
+static void h_udelay(struct libxsvf_host *h, long usecs, int tms, long num_tck)
+{
+	struct adapter_s *a = h->user_data;
+	struct timeval tv1;
+
+	gettimeofday(&tv1, NULL);
+	while (num_tck-- > 0)
+		sim_clock(a, tms, -1);
+	usecs -= usecs_since(&tv1);
+	if (usecs > 0)
+		usleep(usecs);
+}
+
+static int h_getbyte(struct libxsvf_host *h)
+{
+	/* all input is read from the image cache */
+	return -1;
+}
+
+static int h_pulse_tck(struct libxsvf_host *h, int tms, int tdi, int tdo, int rmask, int sync)
+{
+	struct adapter_s *a = h->user_data;
+	int line_tdo = sim_clock(a, tms, tdi);
+
+	/* without a TDO line, read the pull-up */
+	if (line_tdo < 0)
+		return 1;
+
+	if (rmask == 1 && a->retval_i < 256)
+		a->retval[a->retval_i++] = line_tdo;
+
+	if (tdo >= 0 && tdo != line_tdo) {
+		libxsvf_tdo_mismatch(h, &h->srcpos, tdo, line_tdo);
+		return -1;
+	}
+
+	return line_tdo;
+}
+
+static int h_shift_bits(struct libxsvf_host *h, int len, const unsigned char *tdi, unsigned char *tdo, int tms_last)
+{
+	struct adapter_s *a = h->user_data;
+	int k, nbytes = (len+7)/8;
+
+	if (tdo)
+		memset(tdo, 0, nbytes);
+
+	for (k = 0; k < len; k++) {
+		int tms = k == len-1 ? tms_last : 0;
+		if (sim_clock(a, tms, (tdi[nbytes-1-k/8] >> (k%8)) & 1) != 0 && tdo)
+			tdo[nbytes-1-k/8] |= 1 << (k%8);
+	}
+
+	return 0;
+}
+
+static int h_set_frequency(struct libxsvf_host *h, int v)
+{
+	struct adapter_s *a = h->user_data;
+	a->frequency = v;
+	return 0;
+}
+
+static void h_report_device(struct libxsvf_host *h, unsigned long idcode)
+{
+	struct adapter_s *a = h->user_data;
+	client_printf(a->job->client, "idcode %ld 0x%08lx\n", a->job->id, idcode);
+}
+
+/* called for every command: send the progress in steps of 10% */
+static void h_report_status(struct libxsvf_host *h, const char *message)
+{
+	struct adapter_s *a = h->user_data;
+	int progress;
+
+	if (!h->input_data || h->input_size == 0)
+		return;
+
+	progress = (int)(h->input_pos * 10 / h->input_size) * 10;
+	if (progress != a->progress) {
+		a->progress = progress;
+		client_printf(a->job->client, "progress %ld %d\n", a->job->id, progress);
+	}
+}
+
+static void h_report_error(struct libxsvf_host *h, const char *file, int line, const char *message)
+{
+	struct adapter_s *a = h->user_data;
+	if (verbose || !a->job)
+		fprintf(stderr, "Adapter %d: [%s:%d] %s\n", a->index, file, line, message);
+	if (a->job)
+		client_printf(a->job->client, "error %ld %s\n", a->job->id, message);
+}
+
+static void *heap_realloc(void *ptr, int size)
+{
+	return realloc(ptr, size);
+}
+
+/* each adapter has an arena that grows to the largest job */
+static void *h_realloc(struct libxsvf_host *h, void *ptr, int size, enum libxsvf_mem which)
+{
+	struct adapter_s *a = h->user_data;
+	return libxsvf_arena_realloc(&a->arena, ptr, size, which, heap_realloc);
+}
+
+static void update_arena(struct adapter_s *a)
+{
+	long size = libxsvf_arena_size(&a->arena);
+	void *base;
+
+	if (size <= a->arena.size)
+		return;
+
+	free(a->arena.base);
+	base = malloc(size);
+	libxsvf_arena_init(&a->arena, base, base ? size : 0);
+}
+
+static void run_job(struct adapter_s *a, struct job_s *job)
+{
+	struct libxsvf_host *h = &a->h;
+	struct image_s *img = NULL;
+	struct timeval tv1;
+	char errbuf[MAX_LINE / 2];
+	char rmask[256 / 4 + 1];
+	int i, j, rc = -1;
+	long usecs;
+
+	gettimeofday(&tv1, NULL);
+	client_printf(job->client, "start %ld %d\n", job->id, a->index);
+
+	a->job = job;
+	a->progress = -1;
+	a->job_clocks = 0;
+	a->retval_i = 0;
+
+	h->input_data = NULL;
+	h->input_size = 0;
+	if (job->mode != LIBXSVF_MODE_SCAN) {
+		img = image_get(job->path, errbuf, sizeof(errbuf));
+		if (img == NULL) {
+			client_printf(job->client, "error %ld %s\n", job->id, errbuf);
+			goto done;
+		}
+		h->input_data = img->data;
+		h->input_size = img->size;
+	}
+
+	if (!a->session_open) {
+		if (libxsvf_session_open(h) < 0)
+			goto done;
+		a->session_open = 1;
+	}
+
+	h->set_frequency(h, job->frequency > 0 ? job->frequency : DEFAULT_FREQUENCY);
+	rc = libxsvf_session_play(h, job->mode);
+	update_arena(a);
+
+done:
+	usecs = usecs_since(&tv1);
+
+	pthread_mutex_lock(&mutex);
+	if (rc < 0)
+		a->jobs_failed++;
+	else
+		a->jobs_ok++;
+	a->bytes += h->input_size;
+	a->clocks += a->job_clocks;
+	a->busy_usecs += usecs;
+	pthread_mutex_unlock(&mutex);
+
+	/* RMASK bits as a hex value, the last bit is the most significant */
+	for (i = 0, j = 0; i < a->retval_i; i += 4) {
+		int k, val = 0;
+		for (k = i; k < i+4; k++)
+			val = val << 1 | (k < a->retval_i && a->retval[a->retval_i - k - 1] > 0);
+		rmask[j++] = "0123456789abcdef"[val];
+	}
+	rmask[j] = 0;
+
+	client_printf(job->client, "done %ld %s usecs=%ld clocks=%ld%s%s\n", job->id,
+			rc < 0 ? "failed" : "ok", usecs, a->job_clocks,
+			j ? " rmask=0x" : "", rmask);
+
+	h->input_data = NULL;
+	if (img)
+		image_put(img);
+	a->job = NULL;
+}
+
+static void *adapter_main(void *arg)
+{
+	struct adapter_s *a = arg;
+	struct job_s *job;
+
+	while (1)
+	{
+		pthread_mutex_lock(&mutex);
+		while (!a->head && !quitting)
+			pthread_cond_wait(&a->cond, &mutex);
+		job = a->head;
+		if (job) {
+			a->head = job->next;
+			if (!a->head)
+				a->tail = NULL;
+			a->queued--;
+			a->busy = 1;
+		}
+		pthread_mutex_unlock(&mutex);
+
+		/* the queue is drained before quitting */
+		if (!job)
+			break;
+
+		run_job(a, job);
+
+		pthread_mutex_lock(&mutex);
+		a->busy = 0;
+		pthread_mutex_unlock(&mutex);
+
+		client_put(job->client);
+		free(job->path);
+		free(job);
+	}
+
+	if (a->session_open)
+		libxsvf_session_close(&a->h);
+	a->session_open = 0;
+
+	return NULL;
+}
+
+static void adapter_init(struct adapter_s *a, int index)
+{
+	a->index = index;
+	pthread_cond_init(&a->cond, NULL);
+	a->h.setup = h_setup;
+	a->h.shutdown = h_shutdown;
+	a->h.udelay = h_udelay;
+	a->h.getbyte = h_getbyte;
+	a->h.pulse_tck = h_pulse_tck;
+	a->h.shift_bits = h_shift_bits;
+	a->h.set_frequency = h_set_frequency;
+	a->h.report_device = h_report_device;
+	a->h.report_status = h_report_status;
+	a->h.report_error = h_report_error;
+	a->h.realloc = h_realloc;
+	a->h.user_data = a;
+}
+
+
+/** Requests **/
+
+static void request_play(struct client_s *c, enum libxsvf_mode mode, char **args, int nargs)
+{
+	struct adapter_s *a;
+	struct job_s *job;
+	char *endptr;
+	int i, index, frequency = 0, position;
+	int nfile = mode == LIBXSVF_MODE_SCAN ? 0 : 1;
+
+	if (nargs < 1 + nfile) {
+		client_printf(c, "error - Missing arguments.\n");
+		return;
+	}
+
+	index = strtol(args[0], &endptr, 10);
+	if (*endptr || index < 0 || index >= num_adapters) {
+		client_printf(c, "error - Invalid adapter `%s'.\n", args[0]);
+		return;
+	}
+	a = &adapters[index];
+
+	for (i = 1 + nfile; i < nargs; i++) {
+		if (!strncmp(args[i], "freq=", 5)) {
+			frequency = strtol(args[i] + 5, &endptr, 10);
+			if (*endptr == 'k')
+				frequency *= 1000, endptr++;
+			else if (*endptr == 'M')
+				frequency *= 1000000, endptr++;
+			if (*endptr == 0 && frequency > 0)
+				continue;
+		}
+		client_printf(c, "error - Invalid option `%s'.\n", args[i]);
+		return;
+	}
+
+	job = calloc(1, sizeof(*job));
+	job->client = c;
+	job->mode = mode;
+	job->path = nfile ? strdup(args[1]) : NULL;
+	job->frequency = frequency;
+
+	pthread_mutex_lock(&mutex);
+	job->id = next_job_id++;
+	position = a->queued + a->busy;
+	pthread_mutex_unlock(&mutex);
+
+	/* reply before the worker can send the first status of the job */
+	client_printf(c, "queued %ld %d %d\n", job->id, index, position);
+
+	pthread_mutex_lock(&mutex);
+	if (quitting) {
+		pthread_mutex_unlock(&mutex);
+		client_printf(c, "done %ld failed Shutting down.\n", job->id);
+		free(job->path);
+		free(job);
+		return;
+	}
+	c->refs++;
+	if (a->tail)
+		a->tail->next = job;
+	else
+		a->head = job;
+	a->tail = job;
+	a->queued++;
+	pthread_cond_signal(&a->cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+static void request_stats(struct client_s *c)
+{
+	long jobs_ok = 0, jobs_failed = 0, images_num = 0;
+	long uptime = usecs_since(&start_time) / 1000000;
+	char buf[(MAX_ADAPTERS + 2) * 256];
+	struct image_s *img;
+	int i, len = 0;
+
+	/* don't send while holding the lock, the client may be slow */
+	pthread_mutex_lock(&mutex);
+	for (i = 0; i < num_adapters; i++) {
+		struct adapter_s *a = &adapters[i];
+		len += snprintf(buf + len, sizeof(buf) - len, "adapter %d queued=%d busy=%d ok=%ld failed=%ld bytes=%lld clocks=%lld "
+				"busy_usecs=%lld bytes_per_sec=%lld clocks_per_sec=%lld\n",
+				i, a->queued, a->busy, a->jobs_ok, a->jobs_failed, a->bytes, a->clocks, a->busy_usecs,
+				a->busy_usecs ? a->bytes * 1000000 / a->busy_usecs : 0,
+				a->busy_usecs ? a->clocks * 1000000 / a->busy_usecs : 0);
+		jobs_ok += a->jobs_ok;
+		jobs_failed += a->jobs_failed;
+	}
+	for (img = images; img; img = img->next)
+		images_num++;
+	len += snprintf(buf + len, sizeof(buf) - len, "cache images=%ld bytes=%ld limit=%ld hits=%ld misses=%ld\n",
+			images_num, cache_bytes, cache_limit, cache_hits, cache_misses);
+	len += snprintf(buf + len, sizeof(buf) - len, "jobs ok=%ld failed=%ld uptime=%ld jobs_per_hour=%ld\n",
+			jobs_ok, jobs_failed, uptime, uptime ? (jobs_ok + jobs_failed) * 3600 / uptime : 0);
+	pthread_mutex_unlock(&mutex);
+
+	client_write(c, buf, len);
+	client_printf(c, "end\n");
+}
+
+static void request_quit(struct client_s *c)
+{
+	int i;
+
+	pthread_mutex_lock(&mutex);
+	quitting = 1;
+	for (i = 0; i < num_adapters; i++)
+		pthread_cond_signal(&adapters[i].cond);
+	pthread_mutex_unlock(&mutex);
+
+	/* reply first, main() exits when the queues are drained */
+	client_printf(c, "end\n");
+
+	/* wake up the accept() in main() */
+	shutdown(listen_fd, SHUT_RDWR);
+}
+
+static void request(struct client_s *c, char *line)
+{
+	char *args[16], *saveptr;
+	int nargs = 0;
+
+	for (args[0] = strtok_r(line, " \t\r", &saveptr); args[nargs] && nargs < 15; )
+		args[++nargs] = strtok_r(NULL, " \t\r", &saveptr);
+
+	if (nargs == 0)
+		return;
+
+	if (verbose >= 2)
+		fprintf(stderr, "Request: %s\n", args[0]);
+
+	if (!strcmp(args[0], "svf"))
+		request_play(c, LIBXSVF_MODE_SVF, args + 1, nargs - 1);
+	else if (!strcmp(args[0], "xsvf"))
+		request_play(c, LIBXSVF_MODE_XSVF, args + 1, nargs - 1);
+	else if (!strcmp(args[0], "scan"))
+		request_play(c, LIBXSVF_MODE_SCAN, args + 1, nargs - 1);
+	else if (!strcmp(args[0], "stats"))
+		request_stats(c);
+	else if (!strcmp(args[0], "quit"))
+		request_quit(c);
+	else
+		client_printf(c, "error - Unknown request `%s'.\n", args[0]);
+}
+
+static void *client_main(void *arg)
+{
+	struct client_s *c = arg;
+	char buf[MAX_LINE];
+	int len = 0, rc;
+
+	while ((rc = read(c->fd, buf + len, sizeof(buf) - 1 - len)) != 0)
+	{
+		char *line, *nl;
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		len += rc;
+		buf[len] = 0;
+
+		for (line = buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+			*nl = 0;
+			request(c, line);
+		}
+
+		len -= line - buf;
+		memmove(buf, line, len);
+		if (len == sizeof(buf) - 1) {
+			client_printf(c, "error - Request too long.\n");
+			break;
+		}
+	}
+
+	/* stop receiving, the jobs of this client may still send results */
+	shutdown(c->fd, SHUT_RD);
+	client_put(c);
+	return NULL;
+}
+
+
+/** Main **/
+
+const char *progname;
+
+/* The socket accepts file names to read and jobs for the adapters, so it
+ * must only be reachable by this user: $XDG_RUNTIME_DIR/xsvftoold.sock or
+ * a private directory in /tmp. */
+static int default_socket_path(char *buf, int size)
+{
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	char dir[64];
+	struct stat st;
+
+	if (runtime_dir && *runtime_dir) {
+		snprintf(buf, size, "%s/%s", runtime_dir, SOCKET_NAME);
+		return 0;
+	}
+
+	snprintf(dir, sizeof(dir), "/tmp/xsvftoold-%d", (int)getuid());
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Can't create directory `%s': %s\n", dir, strerror(errno));
+		return -1;
+	}
+	if (lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+		fprintf(stderr, "Directory `%s' is not private to this user.\n", dir);
+		return -1;
+	}
+
+	snprintf(buf, size, "%s/%s", dir, SOCKET_NAME);
+	return 0;
+}
+
+/* remove the socket of an earlier run, but nothing else */
+static int remove_old_socket(const char *path)
+{
+	struct stat st;
+
+	if (lstat(path, &st) < 0)
+		return errno == ENOENT ? 0 : -1;
+	if (!S_ISSOCK(st.st_mode) || st.st_uid != getuid()) {
+		fprintf(stderr, "Refusing to remove `%s': Not a socket owned by this user.\n", path);
+		return -1;
+	}
+	return unlink(path);
+}
+
+static void help()
+{
+	fprintf(stderr, "xsvftoold, part of Lib(X)SVF (http://www.clifford.at/libxsvf/).\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Usage: %s [ -v ... ] [ -n adapters ] [ -C cache-mb ] [ -S socket ]\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -v, -vv\n");
+	fprintf(stderr, "          Verbose, more verbose\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -n adapters\n");
+	fprintf(stderr, "          Number of (simulated) adapters (default: 1, max. %d)\n", MAX_ADAPTERS);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -C cache-mb\n");
+	fprintf(stderr, "          Size of the in-memory file cache in MB (default: %d)\n", DEFAULT_CACHE_MB);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   -S socket\n");
+	fprintf(stderr, "          Path of the Unix socket (default: $XDG_RUNTIME_DIR/%s\n", SOCKET_NAME);
+	fprintf(stderr, "          or /tmp/xsvftoold-<uid>/%s)\n", SOCKET_NAME);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Requests (one per line, see README):\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "   svf <adapter> <file> [ freq=<Hz> ]\n");
+	fprintf(stderr, "   xsvf <adapter> <file> [ freq=<Hz> ]\n");
+	fprintf(stderr, "   scan <adapter> [ freq=<Hz> ]\n");
+	fprintf(stderr, "   stats\n");
+	fprintf(stderr, "   quit\n");
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *socket_path = NULL;
+	char default_path[256];
+	struct sockaddr_un addr;
+	mode_t old_umask;
+	int opt, i, rc;
+
+	progname = argc >= 1 ? argv[0] : "xsvftoold";
+	while ((opt = getopt(argc, argv, "vn:C:S:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'v':
+			verbose++;
+			break;
+		case 'n':
+			num_adapters = atoi(optarg);
+			if (num_adapters < 1 || num_adapters > MAX_ADAPTERS)
+				help();
+			break;
+		case 'C':
+			cache_limit = atol(optarg) * 1024L * 1024L;
+			break;
+		case 'S':
+			socket_path = optarg;
+			break;
+		default:
+			help();
+			break;
+		}
+	}
+
+	if (optind != argc)
+		help();
+
+	if (socket_path == NULL) {
+		if (default_socket_path(default_path, sizeof(default_path)) < 0)
+			return 1;
+		socket_path = default_path;
+	}
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+		help();
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		fprintf(stderr, "Can't create socket: %s\n", strerror(errno));
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	if (remove_old_socket(socket_path) < 0)
+		return 1;
+
+	/* no access to the socket for group and others */
+	old_umask = umask(077);
+	rc = bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+	umask(old_umask);
+
+	if (rc < 0 || listen(listen_fd, 16) < 0) {
+		fprintf(stderr, "Can't listen on `%s': %s\n", socket_path, strerror(errno));
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	gettimeofday(&start_time, NULL);
+
+	for (i = 0; i < num_adapters; i++) {
+		adapter_init(&adapters[i], i);
+		pthread_create(&adapters[i].thread, NULL, adapter_main, &adapters[i]);
+	}
+
+	if (verbose)
+		fprintf(stderr, "Listening on `%s' with %d adapter(s).\n", socket_path, num_adapters);
+
+	while (1)
+	{
+		pthread_t thread;
+		struct client_s *c;
+		int fd = accept(listen_fd, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (!quitting)
+				fprintf(stderr, "Accept failed: %s\n", strerror(errno));
+			break;
+		}
+
+		c = calloc(1, sizeof(*c));
+		c->fd = fd;
+		c->refs = 1;
+		pthread_mutex_init(&c->write_mutex, NULL);
+		if (pthread_create(&thread, NULL, client_main, c) != 0) {
+			client_put(c);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	/* a failed accept() shuts down as well */
+	pthread_mutex_lock(&mutex);
+	quitting = 1;
+	for (i = 0; i < num_adapters; i++)
+		pthread_cond_signal(&adapters[i].cond);
+	pthread_mutex_unlock(&mutex);
+
+	for (i = 0; i < num_adapters; i++)
+		pthread_join(adapters[i].thread, NULL);
+
+	close(listen_fd);
+	unlink(socket_path);
+
+	if (verbose)
+		fprintf(stderr, "Shut down.\n");
+
+	return 0;
+}
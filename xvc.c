@@ -0,0 +1,136 @@
+/*
+ *  Lib(X)SVF  -  A library for implementing SVF and XSVF JTAG players
+ *
+ *  Copyright (C) 2009  RIEGL Research ForschungsGmbH
+ *  Copyright (C) 2009  Clifford Wolf <clifford@clifford.at>
+ *  
+ *  Permission to use, copy, modify, and/or distribute this software for any
+ *  purpose with or without fee is hereby granted, provided that the above
+ *  copyright notice and this permission notice appear in all copies.
+ *  
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "libxsvf.h"
+
+/*
+ * Xilinx Virtual Cable (XVC) shifts: 'len' clock cycles with a TMS and a
+ * TDI vector, returning a TDO vector. The vectors use the XVC layout, i.e.
+ * bit 'k' is (vec[k/8] >> (k%8)) & 1. The TAP state is tracked from the
+ * TMS bits: runs of bits in a shift state are passed to shift_bits() in a
+ * single call (if the host has it), the other bits use pulse_tck(). TDO is
+ * undefined outside the shift states, so these bits don't have to wait for
+ * an asynchronous interface.
+ */
+
+#ifndef LIBXSVF_XVC_CHUNK_BITS
+#  define LIBXSVF_XVC_CHUNK_BITS 8192
+#endif
+
+#define XVC_BIT(_v, _k) (((_v)[(_k)/8] >> ((_k)%8)) & 1)
+
+static const unsigned char tap_next[17][2] = {
+	/* INIT is left by 5 TMS=1 bits, see below */
+	[LIBXSVF_TAP_INIT]      = { LIBXSVF_TAP_INIT,      LIBXSVF_TAP_INIT      },
+	[LIBXSVF_TAP_RESET]     = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_RESET     },
+	[LIBXSVF_TAP_IDLE]      = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  },
+	[LIBXSVF_TAP_DRSELECT]  = { LIBXSVF_TAP_DRCAPTURE, LIBXSVF_TAP_IRSELECT  },
+	[LIBXSVF_TAP_DRCAPTURE] = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DREXIT1   },
+	[LIBXSVF_TAP_DRSHIFT]   = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DREXIT1   },
+	[LIBXSVF_TAP_DREXIT1]   = { LIBXSVF_TAP_DRPAUSE,   LIBXSVF_TAP_DRUPDATE  },
+	[LIBXSVF_TAP_DRPAUSE]   = { LIBXSVF_TAP_DRPAUSE,   LIBXSVF_TAP_DREXIT2   },
+	[LIBXSVF_TAP_DREXIT2]   = { LIBXSVF_TAP_DRSHIFT,   LIBXSVF_TAP_DRUPDATE  },
+	[LIBXSVF_TAP_DRUPDATE]  = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  },
+	[LIBXSVF_TAP_IRSELECT]  = { LIBXSVF_TAP_IRCAPTURE, LIBXSVF_TAP_RESET     },
+	[LIBXSVF_TAP_IRCAPTURE] = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IREXIT1   },
+	[LIBXSVF_TAP_IRSHIFT]   = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IREXIT1   },
+	[LIBXSVF_TAP_IREXIT1]   = { LIBXSVF_TAP_IRPAUSE,   LIBXSVF_TAP_IRUPDATE  },
+	[LIBXSVF_TAP_IRPAUSE]   = { LIBXSVF_TAP_IRPAUSE,   LIBXSVF_TAP_IREXIT2   },
+	[LIBXSVF_TAP_IREXIT2]   = { LIBXSVF_TAP_IRSHIFT,   LIBXSVF_TAP_IRUPDATE  },
+	[LIBXSVF_TAP_IRUPDATE]  = { LIBXSVF_TAP_IDLE,      LIBXSVF_TAP_DRSELECT  }
+};
+
+/* shift up to LIBXSVF_XVC_CHUNK_BITS bits starting at bit 'i' in a shift
+ * state, up to and including the first bit with TMS set */
+static int xvc_shift_run(struct libxsvf_host *h, int i, int len, const unsigned char *tms, const unsigned char *tdi, unsigned char *tdo)
+{
+	unsigned char buf_tdi[LIBXSVF_XVC_CHUNK_BITS / 8];
+	unsigned char buf_tdo[LIBXSVF_XVC_CHUNK_BITS / 8];
+	int k, n = 1, nbytes, tms_last;
+
+	while (i + n < len && n < LIBXSVF_XVC_CHUNK_BITS && !XVC_BIT(tms, i + n - 1))
+		n++;
+
+	nbytes = (n+7) / 8;
+	tms_last = XVC_BIT(tms, i + n - 1);
+
+	for (k = 0; k < nbytes; k++)
+		buf_tdi[k] = 0;
+	for (k = 0; k < n; k++)
+		buf_tdi[nbytes-1-k/8] |= XVC_BIT(tdi, i + k) << (k%8);
+
+	if (LIBXSVF_HOST_SHIFT_BITS(n, buf_tdi, buf_tdo, tms_last) < 0)
+		return -1;
+
+	for (k = 0; k < n; k++)
+		tdo[(i+k)/8] |= ((buf_tdo[nbytes-1-k/8] >> (k%8)) & 1) << ((i+k)%8);
+
+	if (tms_last)
+		h->tap_state = tap_next[h->tap_state][1];
+
+	return n;
+}
+
+int libxsvf_xvc_shift(struct libxsvf_host *h, int len, const unsigned char *tms, const unsigned char *tdi, unsigned char *tdo)
+{
+	int i, ones = 0, pending = 0;
+
+	for (i = 0; i < (len+7)/8; i++)
+		tdo[i] = 0;
+
+	for (i = 0; i < len; )
+	{
+		int shift = h->tap_state == LIBXSVF_TAP_DRSHIFT || h->tap_state == LIBXSVF_TAP_IRSHIFT;
+		int rc, t = XVC_BIT(tms, i);
+
+		if (shift && LIBXSVF_HOST_HAS_SHIFT_BITS()) {
+			rc = xvc_shift_run(h, i, len, tms, tdi, tdo);
+			if (rc < 0)
+				return -1;
+			i += rc;
+			pending = 0;
+			continue;
+		}
+
+		/* in the unknown INIT state, any bit could be a shift */
+		rc = LIBXSVF_HOST_PULSE_TCK(t, XVC_BIT(tdi, i), -1, 0, shift || h->tap_state == LIBXSVF_TAP_INIT);
+		if (rc < 0)
+			return -1;
+		tdo[i/8] |= (rc > 0) << (i%8);
+		pending = !(shift || h->tap_state == LIBXSVF_TAP_INIT);
+
+		if (h->tap_state == LIBXSVF_TAP_INIT) {
+			ones = t ? ones + 1 : 0;
+			if (ones == 5)
+				h->tap_state = LIBXSVF_TAP_RESET;
+		} else {
+			h->tap_state = tap_next[h->tap_state][t];
+		}
+		i++;
+	}
+
+	/* the client may wait for the clocks before the next shift */
+	if (pending && LIBXSVF_HOST_SYNC() < 0)
+		return -1;
+
+	LIBXSVF_HOST_REPORT_TAPSTATE();
+	return 0;
+}